@@ -558,6 +558,70 @@ struct IPCZ_ALIGN(8) IpczCreateNodeOptions {
 
   // See IpczMemoryFlags above.
   IpczMemoryFlags memory_flags;
+
+  // If non-zero, the node accepts parcels arriving from other nodes on a pool
+  // of this many ipcz-owned worker threads, rather than on the thread which
+  // delivered them from the driver. Routes are distributed across workers such
+  // that parcels for any given route are still accepted in order. All other
+  // incoming messages, such as introductions or route closure, are handled on
+  // the driver's thread once all previously received parcels have been
+  // accepted.
+  //
+  // This allows a single driver transport carrying traffic for many routes to
+  // make use of multiple cores. It must only be used with drivers which deliver
+  // transport notifications asynchronously, i.e. never from within a call into
+  // the driver's Transmit() function.
+  //
+  // Trap event handlers for portals receiving parcels from other nodes may be
+  // invoked on these worker threads, and they must not block. In particular,
+  // Get() with IPCZ_GET_BLOCKING fails on these threads.
+  size_t num_dispatch_threads;
+
+  // If non-zero, the node allocates a small region of shared memory through its
+  // driver and publishes a snapshot of its statistics there at this interval,
+  // on an ipcz-owned thread. This covers much of what QueryNodeStats() reports,
+  // along with the number of parcels queued on each link. Tools in other
+  // processes which can find and map the driver's shared memory may then
+  // observe the node without any cooperation from the application. For
+  // example, the standalone ipcz_top tool finds such pages in memfd regions
+  // allocated by the Linux multiprocess reference driver.
+  //
+  // Nothing is published if the driver cannot allocate shared memory directly,
+  // e.g. within a sandboxed process. Publishing stops when the node is closed.
+  size_t stats_publish_interval_ms;
+
+  // If non-null, the path of a file to which ipcz streams a capture of the raw
+  // traffic on every driver transport in the calling process, from the time
+  // this node is created until it's closed. Captures can be summarized and
+  // replayed offline by the standalone ipcz_replay tool. Only one capture may
+  // be in progress per process, so this is ignored if another node is already
+  // capturing, or if the file cannot be created.
+  //
+  // Captures include the full contents of every message and must be handled
+  // with the same care as the application's own data.
+  const char* transport_capture_file;
+
+  // If non-zero, limits the size of the file written for
+  // `transport_capture_file`. Once the limit is reached, nothing more is
+  // captured.
+  size_t transport_capture_max_bytes;
+
+  // If non-null, the path of a file to which ipcz writes a trace of the stages
+  // of every parcel handled in the calling process, from the time this node is
+  // created until it's closed. The trace is written in the Chrome JSON trace
+  // event format when the node is closed, and can be loaded by Perfetto or
+  // chrome://tracing. Traces written by separate processes can be merged, with
+  // each parcel's hops between nodes drawn as flows. Only one trace may be in
+  // progress per process, so this is ignored if another node is already
+  // tracing, or if the file cannot be created.
+  //
+  // Traces record only timing and sequence numbers, never parcel contents.
+  const char* parcel_trace_file;
+
+  // If non-zero, limits the number of parcel stages recorded for
+  // `parcel_trace_file`. Stages beyond the limit are only counted. If zero, a
+  // default limit of about a million stages applies.
+  size_t parcel_trace_max_slices;
 };
 
 // See CreateNode() and the IPCZ_CREATE_NODE_* flag descriptions below.
@@ -644,6 +708,29 @@ typedef uint32_t IpczGetFlags;
 // caller indicated they could accept.
 #define IPCZ_GET_PARTIAL IPCZ_FLAG_BIT(0)
 
+// When given to Get() on a portal with no parcel available, this flag causes
+// the calling thread to block until a parcel becomes available, the portal's
+// peer is closed with no more parcels to expect, or the timeout given by
+// IpczGetOptions (if any) elapses. Ignored when Get() is called on a parcel.
+//
+// Blocking is not allowed on a node's dispatch threads (see
+// IpczCreateNodeOptions.num_dispatch_threads), where trap event handlers may
+// run: the parcel being waited for might have to be dispatched by the blocked
+// thread itself. Get() fails there with IPCZ_RESULT_FAILED_PRECONDITION.
+#define IPCZ_GET_BLOCKING IPCZ_FLAG_BIT(1)
+
+// Options given to Get() to modify its default behavior.
+struct IPCZ_ALIGN(8) IpczGetOptions {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to Get().
+  size_t size;
+
+  // The maximum time in microseconds to block within Get() when
+  // IPCZ_GET_BLOCKING is specified. If Get() is called with IPCZ_GET_BLOCKING
+  // and no options, it blocks indefinitely. Ignored without IPCZ_GET_BLOCKING.
+  uint64_t timeout_microseconds;
+};
+
 // See BeginGet() and the IPCZ_BEGIN_GET_* flag descriptions below.
 typedef uint32_t IpczBeginGetFlags;
 
@@ -842,6 +929,28 @@ typedef uint32_t IpczTrapConditionFlags;
 // may be set on any event dispatched to an IpczTrapEventHandler.
 #define IPCZ_TRAP_WITHIN_API_CALL IPCZ_FLAG_BIT(9)
 
+// Flags given to Trap() to control how a trap is installed or removed.
+typedef uint32_t IpczTrapFlags;
+
+// Installs a persistent trap. A persistent trap is not removed when its handler
+// is invoked. Instead it remains installed and fires again on every subsequent
+// edge transition of its conditions, until it is explicitly removed with
+// IPCZ_TRAP_FLAG_REMOVE or its portal is closed. Level-triggered conditions are
+// treated as edge-triggered by persistent traps: they fire only when the
+// condition goes from unsatisfied to satisfied.
+//
+// Events for a persistent trap are coalesced: if the trap fires again while one
+// of its events is already awaiting dispatch or its handler is running, the new
+// condition flags are merged into a single follow-up invocation rather than
+// queued individually. A persistent trap's handler is therefore never invoked
+// concurrently with itself.
+#define IPCZ_TRAP_FLAG_PERSISTENT IPCZ_FLAG_BIT(0)
+
+// Removes any trap installed on the portal with the same `handler` and
+// `context`. Each removed trap observes a final IPCZ_TRAP_REMOVED event. When
+// this flag is given, `conditions` is ignored and may be null.
+#define IPCZ_TRAP_FLAG_REMOVE IPCZ_FLAG_BIT(1)
+
 // A structure describing portal conditions necessary to trigger a trap and
 // invoke its event handler.
 struct IPCZ_ALIGN(8) IpczTrapConditions {
@@ -884,6 +993,136 @@ struct IPCZ_ALIGN(8) IpczTrapEvent {
 // conditions are satisfied on the monitored portal.
 typedef void(IPCZ_API* IpczTrapEventHandler)(const struct IpczTrapEvent* event);
 
+// An application-defined function to be invoked with a batch of trap events.
+// All events collected for traps sharing the same batch handler during a single
+// ipcz operation -- for example, the handling of a single incoming driver
+// transport notification -- are delivered in one invocation. `events` is an
+// array of `num_events` events, and it along with the status referenced by
+// each event is only valid through the extent of the invocation.
+typedef void(IPCZ_API* IpczTrapBatchEventHandler)(
+    const struct IpczTrapEvent* events,
+    size_t num_events);
+
+// Options given to Trap() to modify its default behavior.
+struct IPCZ_ALIGN(8) IpczTrapOptions {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to Trap().
+  size_t size;
+
+  // If non-null, events for the trap are delivered to this batched handler
+  // instead of the individual `handler` given to Trap(), which may then be
+  // null. See IpczTrapBatchEventHandler.
+  IpczTrapBatchEventHandler batch_handler;
+};
+
+// Traffic counters for a single type of internal ipcz message exchanged over a
+// NodeLink. See IpczNodeLinkStats.
+struct IPCZ_ALIGN(8) IpczMessageStats {
+  // The number of messages of this type sent to the remote node, and their
+  // total size in bytes.
+  uint64_t num_sent;
+  uint64_t num_bytes_sent;
+
+  // The number of messages of this type received from the remote node, and
+  // their total size in bytes.
+  uint64_t num_received;
+  uint64_t num_bytes_received;
+};
+
+// Block allocation figures for a single block size within the shared memory of
+// a NodeLink. See IpczNodeLinkStats.
+struct IPCZ_ALIGN(8) IpczBlockStats {
+  // The size in bytes of each block.
+  size_t block_size;
+
+  // The total capacity in bytes of all blocks of this size, whether or not
+  // they're allocated.
+  size_t capacity;
+
+  // The number of blocks of this size allocated and freed by this node. Both
+  // nodes on a link allocate and free blocks from the same shared memory, so
+  // the number of blocks in use is the total allocated by both nodes less the
+  // total freed by both nodes.
+  uint64_t num_allocated;
+  uint64_t num_freed;
+};
+
+// The maximum number of distinct internal message types counted by
+// IpczNodeLinkStats.
+#define IPCZ_MAX_MESSAGE_TYPES 128
+
+// The maximum number of distinct block sizes reported by IpczNodeLinkStats.
+#define IPCZ_MAX_BLOCK_SIZES 16
+
+// Statistics for a single link from a node to another node, as reported by
+// QueryNodeStats().
+struct IPCZ_ALIGN(8) IpczNodeLinkStats {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to QueryNodeStats().
+  size_t size;
+
+  // The name of the remote node on this link.
+  uint64_t remote_node_name_high;
+  uint64_t remote_node_name_low;
+
+  // Totals of all messages sent and received over this link.
+  uint64_t num_messages_sent;
+  uint64_t num_bytes_sent;
+  uint64_t num_messages_received;
+  uint64_t num_bytes_received;
+
+  // The number of messages this node has relayed on behalf of the remote node.
+  // Only brokers relay messages.
+  uint64_t num_messages_relayed;
+
+  // The number of parcels sent over this link with their data inlined within
+  // a message, and the number sent with their data in shared memory.
+  uint64_t num_inlined_parcels_sent;
+  uint64_t num_fragment_parcels_sent;
+
+  // The total size in bytes of all shared memory buffers mapped for this link.
+  size_t shared_memory_size;
+
+  // The number of requests for more shared memory capacity still awaiting
+  // completion.
+  size_t num_pending_capacity_requests;
+
+  // The number of parcels received over this link which are still waiting for
+  // more of their contents to arrive.
+  size_t num_partial_parcels;
+
+  // The number of parcels received over this link which are still waiting for
+  // more of their subparcels to arrive.
+  size_t num_subparcel_trackers;
+
+  // Block allocation figures for each block size in this link's shared memory,
+  // in increasing order of block size. Only the first `num_block_sizes`
+  // entries are meaningful.
+  size_t num_block_sizes;
+  struct IpczBlockStats blocks[IPCZ_MAX_BLOCK_SIZES];
+
+  // Traffic counters for each type of message, indexed by internal message ID.
+  // Message IDs are not a stable part of the ipcz API; these are meant for
+  // diagnostic use only.
+  struct IpczMessageStats messages[IPCZ_MAX_MESSAGE_TYPES];
+};
+
+// Statistics for a node, as reported by QueryNodeStats().
+struct IPCZ_ALIGN(8) IpczNodeStats {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to QueryNodeStats().
+  size_t size;
+
+  // The number of other nodes to which this node has a direct link.
+  size_t num_links;
+
+  // The number of routers on this node bound to any of its links, and how many
+  // of those are proxies forwarding parcels between other routers. Routers
+  // which only link to other routers on the same node are not counted.
+  size_t num_routers;
+  size_t num_proxies;
+};
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -1359,7 +1598,14 @@ struct IPCZ_ALIGN(8) IpczAPI {
   // refer to the underlying parcel in future operations (e.g. Reject() or
   // additional get-transactions).
   //
-  // `options` is ignored and must be null.
+  // If `source` is a portal and IPCZ_GET_BLOCKING is specified in `flags`, the
+  // calling thread blocks until a parcel is available for retrieval or none can
+  // ever be available again. If `options` is non-null, its
+  // `timeout_microseconds` field bounds the time spent blocking. A blocked
+  // Get() is woken directly when the parcel arrives, without any intermediate
+  // trap event.
+  //
+  // `options` may be null.
   //
   // Returns:
   //
@@ -1401,14 +1647,25 @@ struct IPCZ_ALIGN(8) IpczAPI {
   //
   //    IPCZ_RESULT_ALREADY_EXISTS if there is a non-overlapped two-phase
   //        get-transaction in progress on `source`.
-  IpczResult(IPCZ_API* Get)(IpczHandle source,    // in
-                            IpczGetFlags flags,   // in
-                            const void* options,  // in
-                            void* data,           // out
-                            size_t* num_bytes,    // in/out
-                            IpczHandle* handles,  // out
-                            size_t* num_handles,  // in/out
-                            IpczHandle* parcel);  // out
+  //
+  //    IPCZ_RESULT_DEADLINE_EXCEEDED if IPCZ_GET_BLOCKING was specified with a
+  //        timeout in `options`, and no parcel became available on `source`
+  //        before the timeout elapsed.
+  //
+  //    IPCZ_RESULT_CANCELLED if IPCZ_GET_BLOCKING was specified and `source`
+  //        was closed or transferred while blocked.
+  //
+  //    IPCZ_RESULT_FAILED_PRECONDITION if IPCZ_GET_BLOCKING was specified and
+  //        `source` is a portal, but the calling thread is one of a node's
+  //        dispatch threads. See IPCZ_GET_BLOCKING.
+  IpczResult(IPCZ_API* Get)(IpczHandle source,                     // in
+                            IpczGetFlags flags,                    // in
+                            const struct IpczGetOptions* options,  // in
+                            void* data,                            // out
+                            size_t* num_bytes,                     // in/out
+                            IpczHandle* handles,                   // out
+                            size_t* num_handles,                   // in/out
+                            IpczHandle* parcel);                   // out
 
   // BeginGet()
   // ==========
@@ -1562,6 +1819,10 @@ struct IPCZ_ALIGN(8) IpczAPI {
   //
   // Immediately before invoking its handler, the trap is removed from the
   // portal and must be reinstalled in order to observe further state changes.
+  // This does not apply to persistent traps installed with
+  // IPCZ_TRAP_FLAG_PERSISTENT, which remain installed until removed by a
+  // subsequent Trap() call with IPCZ_TRAP_FLAG_REMOVE or until the portal is
+  // closed.
   //
   // When a portal is closed, any traps still installed on it are notified by
   // invoking their handler with IPCZ_TRAP_REMOVED in the event's
@@ -1577,18 +1838,33 @@ struct IPCZ_ALIGN(8) IpczAPI {
   // installed and this call returns IPCZ_RESULT_FAILED_PRECONDITION. See below
   // for details.
   //
-  // `flags` is ignored and must be 0.
+  // `flags` may include IPCZ_TRAP_FLAG_PERSISTENT to install a persistent
+  // trap, or IPCZ_TRAP_FLAG_REMOVE to remove a previously installed trap. See
+  // the descriptions of those flags above.
   //
-  // `options` is ignored and must be null.
+  // `options` may be null. If non-null and its `batch_handler` is set, the
+  // trap's events are delivered to that handler in batches alongside any other
+  // events for the same batch handler, and `handler` is ignored. This allows
+  // applications which observe many portals to handle all of their events from
+  // a single ipcz operation with one invocation. When removing a trap with
+  // IPCZ_TRAP_FLAG_REMOVE, the same `batch_handler` must be given in order to
+  // identify the trap.
   //
   // Returns:
   //
-  //    IPCZ_RESULT_OK if the trap was installed successfully. In this case
-  //        `flags` and `status` arguments are ignored.
+  //    IPCZ_RESULT_OK if the trap was installed successfully, or if
+  //        IPCZ_TRAP_FLAG_REMOVE was given and at least one trap was removed.
+  //        In this case `flags` and `status` arguments are ignored.
   //
   //    IPCZ_RESULT_INVALID_ARGUMENT if `portal` is invalid, `conditions` is
-  //        null or invalid, `handler` is null, or `status` is non-null but its
-  //        `size` field specifies an invalid value.
+  //        null or invalid without IPCZ_TRAP_FLAG_REMOVE, `options` is non-null
+  //        but invalid, both `handler` and the batch handler are null,
+  //        `flags` specifies both IPCZ_TRAP_FLAG_PERSISTENT and
+  //        IPCZ_TRAP_FLAG_REMOVE, or `status` is non-null but its `size` field
+  //        specifies an invalid value.
+  //
+  //    IPCZ_RESULT_NOT_FOUND if IPCZ_TRAP_FLAG_REMOVE was given but no trap
+  //        with a matching `handler` and `context` is installed on `portal`.
   //
   //    IPCZ_RESULT_FAILED_PRECONDITION if the conditions specified are already
   //        met on the portal. If `satisfied_condition_flags` is non-null, then
@@ -1601,8 +1877,8 @@ struct IPCZ_ALIGN(8) IpczAPI {
       const struct IpczTrapConditions* conditions,        // in
       IpczTrapEventHandler handler,                       // in
       uintptr_t context,                                  // in
-      uint32_t flags,                                     // in
-      const void* options,                                // in
+      IpczTrapFlags flags,                                // in
+      const struct IpczTrapOptions* options,              // in
       IpczTrapConditionFlags* satisfied_condition_flags,  // out
       struct IpczPortalStatus* status);                   // out
 
@@ -1690,6 +1966,45 @@ struct IPCZ_ALIGN(8) IpczAPI {
                               IpczUnboxFlags flags,               // in
                               const void* options,                // in
                               struct IpczBoxContents* contents);  // out
+
+  // QueryNodeStats()
+  // ================
+  //
+  // Reports statistics for `node` in `stats`, and for each of its links in
+  // `link_stats`. All counters are maintained cheaply enough to be left on in
+  // production, but they are diagnostic: they may be stale by the time this
+  // call returns, and their exact values may differ between ipcz versions.
+  //
+  // On input, `*num_link_stats` is the capacity of `link_stats`. Every element
+  // of `link_stats` must have its `size` field set to the same value, which
+  // the implementation uses as the stride of the array. If `num_link_stats` is
+  // null, no per-link statistics are reported.
+  //
+  // `flags` is ignored and must be 0.
+  //
+  // `options` is ignored and must be null.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if the query was completed successfully. `stats` is
+  //        populated, and if `num_link_stats` was not null, `*num_link_stats`
+  //        is set to the number of elements populated in `link_stats`.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `node` is invalid, `stats` is null or
+  //        invalid, or `link_stats` is null or invalid but `*num_link_stats`
+  //        is non-zero.
+  //
+  //    IPCZ_RESULT_RESOURCE_EXHAUSTED if `link_stats` is too small to hold an
+  //        element for every link. `stats` is still populated, but
+  //        `link_stats` is not; `*num_link_stats` is set to the number of
+  //        elements required.
+  IpczResult(IPCZ_API* QueryNodeStats)(
+      IpczHandle node,                       // in
+      uint32_t flags,                        // in
+      const void* options,                   // in
+      struct IpczNodeStats* stats,           // out
+      struct IpczNodeLinkStats* link_stats,  // out
+      size_t* num_link_stats);               // in/out
 };
 
 // A function which populates `api` with a table of ipcz API functions. The
@@ -2,9 +2,12 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <memory>
+#include <vector>
 
 #include "api.h"
 #include "ipcz/api_object.h"
@@ -39,7 +42,11 @@ IpczResult CreateNode(const IpczDriver* driver,
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
 
-  if (options && options->size < sizeof(IpczCreateNodeOptions)) {
+  // Older callers may provide options which lack newer trailing fields. These
+  // assume default values.
+  constexpr size_t kMinCreateNodeOptionsSize =
+      offsetof(IpczCreateNodeOptions, memory_flags) + sizeof(IpczMemoryFlags);
+  if (options && options->size < kMinCreateNodeOptionsSize) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
 
@@ -196,14 +203,19 @@ IpczResult EndPut(IpczHandle portal_handle,
 
 IpczResult Get(IpczHandle source,
                IpczGetFlags flags,
-               const void* options,
+               const IpczGetOptions* options,
                void* data,
                size_t* num_bytes,
                IpczHandle* handles,
                size_t* num_handles,
                IpczHandle* parcel) {
+  if (options && options->size < sizeof(IpczGetOptions)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
   if (ipcz::Router* router = ipcz::Router::FromHandle(source)) {
-    return router->Get(flags, data, num_bytes, handles, num_handles, parcel);
+    return router->Get(flags, options, data, num_bytes, handles, num_handles,
+                       parcel);
   }
 
   if (ipcz::ParcelWrapper* wrapper = ipcz::ParcelWrapper::FromHandle(source)) {
@@ -258,13 +270,34 @@ IpczResult Trap(IpczHandle portal_handle,
                 const IpczTrapConditions* conditions,
                 IpczTrapEventHandler handler,
                 uintptr_t context,
-                uint32_t flags,
-                const void* options,
+                IpczTrapFlags flags,
+                const IpczTrapOptions* options,
                 IpczTrapConditionFlags* satisfied_condition_flags,
                 IpczPortalStatus* status) {
+  if (options && options->size < sizeof(IpczTrapOptions)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  const IpczTrapBatchEventHandler batch_handler =
+      options ? options->batch_handler : nullptr;
+  if (batch_handler) {
+    // Batched traps are identified by their batch handler alone.
+    handler = nullptr;
+  }
+
   ipcz::Router* router = ipcz::Router::FromHandle(portal_handle);
-  if (!router || !handler || !conditions ||
-      conditions->size < sizeof(*conditions)) {
+  if (!router || (!handler && !batch_handler)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  if (flags & IPCZ_TRAP_FLAG_REMOVE) {
+    if (flags & IPCZ_TRAP_FLAG_PERSISTENT) {
+      return IPCZ_RESULT_INVALID_ARGUMENT;
+    }
+    return router->RemoveTrap(handler, batch_handler, context);
+  }
+
+  if (!conditions || conditions->size < sizeof(*conditions)) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
 
@@ -272,8 +305,8 @@ IpczResult Trap(IpczHandle portal_handle,
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
 
-  return router->Trap(*conditions, handler, context, satisfied_condition_flags,
-                      status);
+  return router->Trap(*conditions, handler, batch_handler, context, flags,
+                      satisfied_condition_flags, status);
 }
 
 IpczResult Reject(IpczHandle parcel_handle,
@@ -345,6 +378,47 @@ IpczResult Unbox(IpczHandle handle,
   return box->Unbox(*contents);
 }
 
+IpczResult QueryNodeStats(IpczHandle node_handle,
+                          uint32_t flags,
+                          const void* options,
+                          IpczNodeStats* stats,
+                          IpczNodeLinkStats* link_stats,
+                          size_t* num_link_stats) {
+  ipcz::Node* node = ipcz::Node::FromHandle(node_handle);
+  if (!node || !stats || stats->size < sizeof(IpczNodeStats)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  const size_t capacity = num_link_stats ? *num_link_stats : 0;
+  if (capacity > 0 &&
+      (!link_stats || link_stats->size < sizeof(IpczNodeLinkStats))) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  std::vector<IpczNodeLinkStats> all_link_stats;
+  node->QueryStats(*stats, num_link_stats ? &all_link_stats : nullptr);
+  if (!num_link_stats) {
+    return IPCZ_RESULT_OK;
+  }
+
+  *num_link_stats = all_link_stats.size();
+  if (all_link_stats.size() > capacity) {
+    return IPCZ_RESULT_RESOURCE_EXHAUSTED;
+  }
+
+  // Elements may be larger than the IpczNodeLinkStats we know about if the
+  // caller was built against a newer version of ipcz, so the first element's
+  // size determines the array's stride. Each element's `size` is left intact.
+  const size_t stride = all_link_stats.empty() ? 0 : link_stats->size;
+  for (size_t i = 0; i < all_link_stats.size(); ++i) {
+    auto* element = reinterpret_cast<IpczNodeLinkStats*>(
+        reinterpret_cast<uint8_t*>(link_stats) + i * stride);
+    all_link_stats[i].size = element->size;
+    memcpy(element, &all_link_stats[i], sizeof(IpczNodeLinkStats));
+  }
+  return IPCZ_RESULT_OK;
+}
+
 constexpr IpczAPI kCurrentAPI = {
     sizeof(kCurrentAPI),
     Close,
@@ -363,6 +437,7 @@ constexpr IpczAPI kCurrentAPI = {
     Reject,
     Box,
     Unbox,
+    QueryNodeStats,
 };
 
 constexpr size_t kVersion0APISize =
@@ -373,7 +448,11 @@ IPCZ_EXPORT IpczResult IPCZ_API IpczGetAPI(IpczAPI* api) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
 
-  memcpy(api, &kCurrentAPI, kVersion0APISize);
+  // Callers built against an older version of ipcz only get the functions
+  // they know about, and `api->size` tells newer callers which ones they got.
+  const size_t size = std::min(api->size, sizeof(kCurrentAPI));
+  memcpy(api, &kCurrentAPI, size);
+  api->size = size;
   return IPCZ_RESULT_OK;
 }
 
@@ -2,9 +2,14 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <string>
+#include <thread>
 
+#include "api.h"
 #include "ipcz/ipcz.h"
 #include "reference_drivers/single_process_reference_driver_base.h"
 #include "reference_drivers/sync_reference_driver.h"
@@ -325,6 +330,121 @@ TEST_F(APITest, PutGet) {
   CloseAll({a, b, c, node});
 }
 
+TEST_F(APITest, BlockingGet) {
+  const IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+
+  // A parcel which is already available is returned immediately.
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Put(a, "hi", 2, nullptr, 0, IPCZ_NO_FLAGS, nullptr));
+  char data[4];
+  size_t num_bytes = 4;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Get(b, IPCZ_GET_BLOCKING, nullptr, data, &num_bytes,
+                       nullptr, nullptr, nullptr));
+  EXPECT_EQ("hi", std::string(data, num_bytes));
+
+  // Otherwise the caller blocks until a parcel arrives.
+  std::thread sender([a = a, this] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().Put(a, "bye", 3, nullptr, 0, IPCZ_NO_FLAGS, nullptr));
+  });
+  num_bytes = 4;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Get(b, IPCZ_GET_BLOCKING, nullptr, data, &num_bytes,
+                       nullptr, nullptr, nullptr));
+  EXPECT_EQ("bye", std::string(data, num_bytes));
+  sender.join();
+
+  // Peer closure also wakes a blocked caller.
+  std::thread closer([a = a, this] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    Close(a);
+  });
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND,
+            ipcz().Get(b, IPCZ_GET_BLOCKING, nullptr, nullptr, nullptr,
+                       nullptr, nullptr, nullptr));
+  closer.join();
+
+  CloseAll({b, node});
+}
+
+TEST_F(APITest, BlockingGetTimeout) {
+  const IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+
+  // Options with an invalid size.
+  IpczGetOptions options = {.size = sizeof(options) - 1};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Get(b, IPCZ_GET_BLOCKING, &options, nullptr, nullptr,
+                       nullptr, nullptr, nullptr));
+
+  options = {.size = sizeof(options), .timeout_microseconds = 1000};
+  EXPECT_EQ(IPCZ_RESULT_DEADLINE_EXCEEDED,
+            ipcz().Get(b, IPCZ_GET_BLOCKING, &options, nullptr, nullptr,
+                       nullptr, nullptr, nullptr));
+
+  // Without IPCZ_GET_BLOCKING, the timeout is ignored.
+  EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE,
+            ipcz().Get(b, IPCZ_NO_FLAGS, &options, nullptr, nullptr, nullptr,
+                       nullptr, nullptr));
+
+  // Timeouts too large to represent are treated as infinite rather than
+  // expiring immediately.
+  IpczGetOptions huge_options = {.size = sizeof(huge_options),
+                                 .timeout_microseconds = UINT64_MAX};
+  std::thread sender([a = a, this] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().Put(a, nullptr, 0, nullptr, 0, IPCZ_NO_FLAGS, nullptr));
+  });
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Get(b, IPCZ_GET_BLOCKING, &huge_options, nullptr, nullptr,
+                       nullptr, nullptr, nullptr));
+  sender.join();
+
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Put(a, nullptr, 0, nullptr, 0, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Get(b, IPCZ_GET_BLOCKING, &options, nullptr, nullptr,
+                       nullptr, nullptr, nullptr));
+
+  CloseAll({a, b, node});
+}
+
+TEST_F(APITest, ConcurrentBidirectionalTraffic) {
+  // Both ends of a portal pair send and receive at the same time. Each side
+  // must still see the other's parcels exactly once and in order.
+  const IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+
+  constexpr uint32_t kNumParcels = 1000;
+  auto send_and_receive = [this](IpczHandle portal) {
+    std::thread sender([portal, this] {
+      for (uint32_t i = 0; i < kNumParcels; ++i) {
+        EXPECT_EQ(IPCZ_RESULT_OK, ipcz().Put(portal, &i, sizeof(i), nullptr, 0,
+                                             IPCZ_NO_FLAGS, nullptr));
+      }
+    });
+    for (uint32_t i = 0; i < kNumParcels; ++i) {
+      uint32_t value;
+      size_t num_bytes = sizeof(value);
+      EXPECT_EQ(IPCZ_RESULT_OK,
+                ipcz().Get(portal, IPCZ_GET_BLOCKING, nullptr, &value,
+                           &num_bytes, nullptr, nullptr, nullptr));
+      EXPECT_EQ(i, value);
+    }
+    sender.join();
+  };
+
+  std::thread a_thread([&, a = a] { send_and_receive(a); });
+  send_and_receive(b);
+  a_thread.join();
+
+  CloseAll({a, b, node});
+}
+
 TEST_F(APITest, BeginEndPutFailure) {
   const IpczHandle node = CreateNode(kDefaultDriver);
   auto [a, b] = OpenPortals(node);
@@ -572,6 +692,18 @@ TEST_F(APITest, TrapInvalid) {
             ipcz().Trap(b, &conditions, nullptr, 0, IPCZ_NO_FLAGS, nullptr,
                         nullptr, nullptr));
 
+  // Invalid options.
+  IpczTrapOptions options = {.size = sizeof(options) - 1};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Trap(b, &conditions, handler, 0, IPCZ_NO_FLAGS, &options,
+                        nullptr, nullptr));
+
+  // Null handler with null batch handler.
+  options = {.size = sizeof(options), .batch_handler = nullptr};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Trap(b, &conditions, nullptr, 0, IPCZ_NO_FLAGS, &options,
+                        nullptr, nullptr));
+
   // Invalid or non-portal handle.
   EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
             ipcz().Trap(IPCZ_INVALID_HANDLE, &conditions, handler, 0,
@@ -739,5 +871,83 @@ TEST_F(APITest, UnboxInvalid) {
   CloseAll({box, node});
 }
 
+TEST_F(APITest, GetAPIVersion0) {
+  // A caller built against the original API only gets the functions it knows
+  // about, and everything past them is left untouched.
+  IpczAPI api;
+  memset(&api, 0, sizeof(api));
+  api.size = offsetof(IpczAPI, QueryNodeStats);
+  EXPECT_EQ(IPCZ_RESULT_OK, IpczGetAPI(&api));
+  EXPECT_EQ(offsetof(IpczAPI, QueryNodeStats), api.size);
+  EXPECT_NE(nullptr, api.Unbox);
+  EXPECT_EQ(nullptr, api.QueryNodeStats);
+
+  api.size = sizeof(api);
+  EXPECT_EQ(IPCZ_RESULT_OK, IpczGetAPI(&api));
+  EXPECT_EQ(sizeof(api), api.size);
+  EXPECT_NE(nullptr, api.QueryNodeStats);
+}
+
+TEST_F(APITest, QueryNodeStatsInvalid) {
+  IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+
+  // Null node.
+  IpczNodeStats stats = {.size = sizeof(stats)};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().QueryNodeStats(IPCZ_INVALID_HANDLE, IPCZ_NO_FLAGS, nullptr,
+                                  &stats, nullptr, nullptr));
+
+  // Not a node.
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().QueryNodeStats(a, IPCZ_NO_FLAGS, nullptr, &stats, nullptr,
+                                  nullptr));
+
+  // Null output stats.
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().QueryNodeStats(node, IPCZ_NO_FLAGS, nullptr, nullptr,
+                                  nullptr, nullptr));
+
+  // Invalid stats size.
+  stats.size = 0;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().QueryNodeStats(node, IPCZ_NO_FLAGS, nullptr, &stats,
+                                  nullptr, nullptr));
+
+  // Null link stats with non-zero capacity.
+  stats.size = sizeof(stats);
+  size_t num_link_stats = 1;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().QueryNodeStats(node, IPCZ_NO_FLAGS, nullptr, &stats,
+                                  nullptr, &num_link_stats));
+
+  // Invalid link stats size.
+  IpczNodeLinkStats link_stats = {.size = 0};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().QueryNodeStats(node, IPCZ_NO_FLAGS, nullptr, &stats,
+                                  &link_stats, &num_link_stats));
+
+  CloseAll({a, b, node});
+}
+
+TEST_F(APITest, QueryNodeStats) {
+  // A lone node has no links, and local portals are not counted as routers on
+  // any link.
+  IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+
+  IpczNodeStats stats = {.size = sizeof(stats)};
+  size_t num_link_stats = 0;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryNodeStats(node, IPCZ_NO_FLAGS, nullptr, &stats,
+                                  nullptr, &num_link_stats));
+  EXPECT_EQ(0u, stats.num_links);
+  EXPECT_EQ(0u, stats.num_routers);
+  EXPECT_EQ(0u, stats.num_proxies);
+  EXPECT_EQ(0u, num_link_stats);
+
+  CloseAll({a, b, node});
+}
+
 }  // namespace
 }  // namespace ipcz
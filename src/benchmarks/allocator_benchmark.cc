@@ -0,0 +1,365 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "benchmarks/benchmark.h"
+#include "ipcz/block_allocator.h"
+#include "ipcz/buffer_id.h"
+#include "ipcz/buffer_pool.h"
+#include "ipcz/driver_memory.h"
+#include "ipcz/driver_memory_mapping.h"
+#include "ipcz/fragment.h"
+#include "ipcz/node.h"
+#include "reference_drivers/sync_reference_driver.h"
+#include "test_buildflags.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+#include "util/ref_counted.h"
+
+#if BUILDFLAG(ENABLE_IPCZ_MULTIPROCESS_TESTS)
+#include <sched.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "reference_drivers/handle_eintr.h"
+#include "reference_drivers/memfd_memory.h"
+#endif
+
+namespace ipcz::benchmarks {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Every allocator benchmark divides a region of this size into blocks.
+constexpr size_t kRegionSize = 1024 * 1024;
+
+constexpr uint32_t kBlockSizes[] = {64, 512, 4096};
+
+constexpr size_t kThreadCounts[] = {1, 2, 4, 8, 16, 32, 64};
+
+// Each worker allocates this many blocks per iteration, writes to them, and
+// then frees them. This is kept small enough that even the largest block size
+// never runs out of capacity with the maximum number of workers.
+constexpr size_t kBlocksPerIteration = 2;
+constexpr size_t kIterationsPerWorker = 5000;
+constexpr size_t kOpsPerWorker = kIterationsPerWorker * kBlocksPerIteration * 2;
+
+// Measurements taken by a single worker thread or process.
+struct WorkerStats {
+  // Allocation and free operations performed.
+  uint64_t num_ops;
+
+  // Times an operation had to retry its compare-and-swap due to contention.
+  uint64_t num_retries;
+
+  // Allocations which returned null. Capacity is never exhausted by this
+  // workload, so any failures here are due to contention.
+  uint64_t num_failures;
+
+  // Latency of each operation, in order.
+  uint64_t latencies_ns[kOpsPerWorker];
+};
+
+uint64_t GetNanosecondsSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              start)
+      .count();
+}
+
+bool IsNull(void* block) {
+  return !block;
+}
+
+bool IsNull(const Fragment& block) {
+  return block.is_null();
+}
+
+void Fill(void* block, size_t block_size) {
+  memset(block, 0xaa, block_size);
+}
+
+void Fill(const Fragment& block, size_t block_size) {
+  memset(block.address(), 0xaa, block.size());
+}
+
+// Runs the standard allocator workload on the calling thread, recording the
+// results in `stats`. `allocate` must return a new block of `block_size` bytes
+// (or a null block on failure) and `free_block` must free one. Both may add to
+// their `num_retries` argument. Blocks may be raw addresses or Fragments.
+template <typename Block, typename AllocateFn, typename FreeFn>
+void RunWorker(size_t block_size,
+               AllocateFn allocate,
+               FreeFn free_block,
+               WorkerStats& stats) {
+  stats.num_ops = 0;
+  stats.num_retries = 0;
+  stats.num_failures = 0;
+  size_t num_retries = 0;
+  Block blocks[kBlocksPerIteration];
+  for (size_t i = 0; i < kIterationsPerWorker; ++i) {
+    for (Block& block : blocks) {
+      const Clock::time_point start = Clock::now();
+      block = allocate(num_retries);
+      stats.latencies_ns[stats.num_ops++] = GetNanosecondsSince(start);
+      if (IsNull(block)) {
+        ++stats.num_failures;
+        continue;
+      }
+      Fill(block, block_size);
+    }
+    for (const Block& block : blocks) {
+      if (IsNull(block)) {
+        continue;
+      }
+      const Clock::time_point start = Clock::now();
+      free_block(block, num_retries);
+      stats.latencies_ns[stats.num_ops++] = GetNanosecondsSince(start);
+    }
+  }
+  stats.num_retries = num_retries;
+}
+
+// Combines measurements from all workers of a benchmark case into a single
+// reported result.
+void ReportContentionResult(std::string name,
+                            absl::Duration elapsed,
+                            absl::Span<const WorkerStats> workers) {
+  uint64_t num_ops = 0;
+  uint64_t num_retries = 0;
+  uint64_t num_failures = 0;
+  std::vector<uint64_t> latencies;
+  latencies.reserve(workers.size() * kOpsPerWorker);
+  for (const WorkerStats& stats : workers) {
+    num_ops += stats.num_ops;
+    num_retries += stats.num_retries;
+    num_failures += stats.num_failures;
+    latencies.insert(latencies.end(), stats.latencies_ns,
+                     stats.latencies_ns + stats.num_ops);
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  const double seconds = absl::ToDoubleSeconds(elapsed);
+  ReportResult({
+      .name = std::move(name),
+      .iterations = num_ops,
+      .elapsed = elapsed,
+      .metrics =
+          {
+              {"ops_per_second", seconds > 0 ? num_ops / seconds : 0},
+              {"cas_retries", static_cast<double>(num_retries)},
+              {"failures", static_cast<double>(num_failures)},
+              {"p50_ns", GetPercentile(latencies, 0.5)},
+              {"p99_ns", GetPercentile(latencies, 0.99)},
+              {"p999_ns", GetPercentile(latencies, 0.999)},
+              {"max_ns", GetPercentile(latencies, 1)},
+          },
+  });
+}
+
+// Runs `worker` concurrently on `num_threads` threads, releasing them all at
+// once, and reports the combined result as benchmark case `name`.
+template <typename WorkerFn>
+void RunOnThreads(std::string name, size_t num_threads, WorkerFn worker) {
+  std::vector<WorkerStats> stats(num_threads);
+  std::atomic<size_t> num_ready{0};
+  std::atomic<bool> go{false};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&, i] {
+      num_ready.fetch_add(1, std::memory_order_relaxed);
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      worker(stats[i]);
+    });
+  }
+
+  while (num_ready.load(std::memory_order_relaxed) < num_threads) {
+    std::this_thread::yield();
+  }
+  const absl::Time start = absl::Now();
+  go.store(true, std::memory_order_release);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ReportContentionResult(std::move(name), absl::Now() - start, stats);
+}
+
+class AllocatorBenchmark : public testing::Test {
+ protected:
+  DriverMemoryMapping AllocateDriverMemory(size_t size) {
+    return DriverMemory(node_->driver(), size).Map();
+  }
+
+ private:
+  const Ref<Node> node_{
+      MakeRefCounted<Node>(Node::Type::kBroker,
+                           reference_drivers::kSyncReferenceDriver)};
+};
+
+// Runs the workload directly against a BlockAllocator, with every worker
+// thread sharing the same allocator.
+void RunBlockAllocatorWorker(const BlockAllocator& allocator,
+                             WorkerStats& stats) {
+  RunWorker<void*>(
+      allocator.block_size(),
+      [&](size_t& num_retries) { return allocator.Allocate(num_retries); },
+      [&](void* block, size_t& num_retries) {
+        allocator.Free(block, num_retries);
+      },
+      stats);
+}
+
+TEST_F(AllocatorBenchmark, BlockAllocator) {
+  std::vector<uint8_t> region(kRegionSize);
+  for (uint32_t block_size : kBlockSizes) {
+    const BlockAllocator allocator(absl::MakeSpan(region), block_size);
+    allocator.InitializeRegion();
+    for (size_t num_threads : kThreadCounts) {
+      RunOnThreads(
+          absl::StrCat("BlockAllocator/", block_size, "/", num_threads),
+          num_threads, [&](WorkerStats& stats) {
+            RunBlockAllocatorWorker(allocator, stats);
+          });
+    }
+  }
+}
+
+TEST_F(AllocatorBenchmark, BufferPool) {
+  // One buffer per block size, each with a single BlockAllocator.
+  BufferPool pool;
+  for (size_t i = 0; i < std::size(kBlockSizes); ++i) {
+    DriverMemoryMapping mapping = AllocateDriverMemory(kRegionSize);
+    const BlockAllocator allocators[] = {{mapping.bytes(), kBlockSizes[i]}};
+    allocators[0].InitializeRegion();
+    ASSERT_TRUE(
+        pool.AddBlockBuffer(BufferId(i), std::move(mapping), allocators));
+  }
+
+  // BufferPool does not expose retry counts, so `cas_retries` is always zero
+  // for these cases.
+  auto free_block = [&](const Fragment& block, size_t&) {
+    pool.FreeBlock(block);
+  };
+  for (uint32_t block_size : kBlockSizes) {
+    for (size_t num_threads : kThreadCounts) {
+      RunOnThreads(absl::StrCat("BufferPool/AllocateBlock/", block_size, "/",
+                                num_threads),
+                   num_threads, [&](WorkerStats& stats) {
+                     RunWorker<Fragment>(
+                         block_size,
+                         [&](size_t&) {
+                           return pool.AllocateBlock(block_size);
+                         },
+                         free_block, stats);
+                   });
+      RunOnThreads(absl::StrCat("BufferPool/AllocateBlockBestEffort/",
+                                block_size, "/", num_threads),
+                   num_threads, [&](WorkerStats& stats) {
+                     RunWorker<Fragment>(
+                         block_size,
+                         [&](size_t&) {
+                           return pool.AllocateBlockBestEffort(block_size);
+                         },
+                         free_block, stats);
+                   });
+    }
+  }
+}
+
+#if BUILDFLAG(ENABLE_IPCZ_MULTIPROCESS_TESTS)
+constexpr size_t kProcessCounts[] = {2, 4, 8};
+
+// Shared by all processes in the CrossProcess benchmark, alongside the region
+// they allocate from.
+struct CrossProcessControl {
+  std::atomic<uint32_t> num_ready;
+  std::atomic<uint32_t> go;
+
+  // Stats for each process immediately follow this header.
+  WorkerStats* stats() { return reinterpret_cast<WorkerStats*>(this + 1); }
+};
+
+TEST_F(AllocatorBenchmark, BlockAllocatorCrossProcess) {
+  // Each process maps the same memfd-backed region at its own address and
+  // constructs its own BlockAllocator over it, as nodes do when they share a
+  // NodeLinkMemory buffer.
+  for (uint32_t block_size : kBlockSizes) {
+    for (size_t num_processes : kProcessCounts) {
+      reference_drivers::MemfdMemory region(kRegionSize);
+      reference_drivers::MemfdMemory control_memory(
+          sizeof(CrossProcessControl) + sizeof(WorkerStats) * num_processes);
+      reference_drivers::MemfdMemory::Mapping control_mapping =
+          control_memory.Map();
+      auto& control = *control_mapping.As<CrossProcessControl>();
+      {
+        reference_drivers::MemfdMemory::Mapping mapping = region.Map();
+        BlockAllocator(mapping.bytes(), block_size).InitializeRegion();
+      }
+
+      std::vector<pid_t> children;
+      for (size_t i = 0; i < num_processes; ++i) {
+        const pid_t pid = fork();
+        if (pid < 0) {
+          // Release any children already waiting to start, and make sure
+          // they're gone before failing. Otherwise they'd be left behind
+          // busy-looping on `control.go`.
+          control.go.store(1, std::memory_order_release);
+          for (pid_t child : children) {
+            kill(child, SIGKILL);
+            HANDLE_EINTR(waitpid(child, nullptr, 0));
+          }
+          FAIL() << "fork() failed";
+        }
+        if (pid == 0) {
+          // In the child. Avoid anything which might allocate or lock, since
+          // the parent may have other threads.
+          reference_drivers::MemfdMemory::Mapping mapping = region.Map();
+          const BlockAllocator allocator(mapping.bytes(), block_size);
+          control.num_ready.fetch_add(1, std::memory_order_relaxed);
+          while (!control.go.load(std::memory_order_acquire)) {
+            sched_yield();
+          }
+          RunBlockAllocatorWorker(allocator, control.stats()[i]);
+          _exit(0);
+        }
+        children.push_back(pid);
+      }
+
+      while (control.num_ready.load(std::memory_order_relaxed) <
+             num_processes) {
+        std::this_thread::yield();
+      }
+      const absl::Time start = absl::Now();
+      control.go.store(1, std::memory_order_release);
+      for (pid_t pid : children) {
+        int status;
+        ASSERT_EQ(pid, HANDLE_EINTR(waitpid(pid, &status, 0)));
+        EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+      }
+      ReportContentionResult(
+          absl::StrCat("BlockAllocator/CrossProcess/", block_size, "/",
+                       num_processes),
+          absl::Now() - start, absl::MakeSpan(control.stats(), num_processes));
+    }
+  }
+}
+#endif  // BUILDFLAG(ENABLE_IPCZ_MULTIPROCESS_TESTS)
+
+}  // namespace
+}  // namespace ipcz::benchmarks
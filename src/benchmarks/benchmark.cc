@@ -0,0 +1,77 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "benchmarks/benchmark.h"
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+
+namespace ipcz::benchmarks {
+
+double GetPercentile(absl::Span<const uint64_t> sorted_values, double p) {
+  if (sorted_values.empty()) {
+    return 0;
+  }
+  const size_t index = static_cast<size_t>(p * (sorted_values.size() - 1));
+  return static_cast<double>(sorted_values[index]);
+}
+
+std::string FormatResultAsJson(const BenchmarkResult& result) {
+  const double seconds = absl::ToDoubleSeconds(result.elapsed);
+  const double ns_per_iteration =
+      result.iterations
+          ? absl::ToDoubleNanoseconds(result.elapsed) / result.iterations
+          : 0;
+  std::string json = absl::StrCat("{\"benchmark\":\"", result.name, "\"");
+  if (!result.driver.empty()) {
+    absl::StrAppend(&json, ",\"driver\":\"", result.driver, "\"");
+  }
+  absl::StrAppend(&json, ",\"iterations\":", result.iterations,
+                  ",\"elapsed_ns\":", absl::ToInt64Nanoseconds(result.elapsed),
+                  ",\"ns_per_iteration\":", ns_per_iteration);
+  if (result.bytes_per_iteration && seconds > 0) {
+    const double total_bytes =
+        static_cast<double>(result.bytes_per_iteration) * result.iterations;
+    absl::StrAppend(&json,
+                    ",\"bytes_per_iteration\":", result.bytes_per_iteration,
+                    ",\"bytes_per_second\":", total_bytes / seconds);
+  }
+  for (const auto& [key, value] : result.metrics) {
+    absl::StrAppend(&json, ",\"", key, "\":", value);
+  }
+  absl::StrAppend(&json, "}");
+  return json;
+}
+
+void ReportResult(const BenchmarkResult& result) {
+  const std::string json = FormatResultAsJson(result);
+  fprintf(stdout, "%s\n", json.c_str());
+  fflush(stdout);
+
+  // Property keys must be unique within a test, so they're qualified by the
+  // benchmark case name.
+  ::testing::Test::RecordProperty(result.name, json);
+}
+
+void BenchmarkNode::RunTimed(std::string_view name,
+                             size_t iterations,
+                             size_t bytes_per_iteration,
+                             absl::FunctionRef<void()> body) {
+  const absl::Time start = absl::Now();
+  body();
+  ReportResult({
+      .name = std::string(name),
+      .driver = GetTestDriver()->GetName(),
+      .iterations = iterations,
+      .elapsed = absl::Now() - start,
+      .bytes_per_iteration = bytes_per_iteration,
+  });
+}
+
+}  // namespace ipcz::benchmarks
@@ -0,0 +1,70 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_BENCHMARKS_BENCHMARK_H_
+#define IPCZ_SRC_BENCHMARKS_BENCHMARK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "test/multinode_test.h"
+#include "third_party/abseil-cpp/absl/functional/function_ref.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz::benchmarks {
+
+// Timing results from a single benchmark case.
+struct BenchmarkResult {
+  // Names the benchmark case and any parameters, e.g. "Throughput/4096".
+  std::string name;
+
+  // The name of the TestDriver the benchmark ran under, if any.
+  std::string driver;
+
+  // The number of operations measured, and the total time they took.
+  size_t iterations = 0;
+  absl::Duration elapsed;
+
+  // Payload bytes moved by each operation, if meaningful. When non-zero, this
+  // is used to derive a throughput figure.
+  size_t bytes_per_iteration = 0;
+
+  // Any additional named figures measured by the benchmark, such as retry
+  // counts or latency percentiles. These are reported in order.
+  std::vector<std::pair<std::string, double>> metrics;
+};
+
+// Returns the value `p` (from 0 to 1) of the way through `sorted_values`, e.g.
+// the median for 0.5 and the maximum for 1. Returns 0 if there are no values.
+double GetPercentile(absl::Span<const uint64_t> sorted_values, double p);
+
+// Formats `result` as a single line of JSON.
+std::string FormatResultAsJson(const BenchmarkResult& result);
+
+// Reports `result` as a line of JSON on stdout. The result is also recorded as
+// properties of the running GTest test, so it appears in any report written
+// with --gtest_output=json or --gtest_output=xml.
+void ReportResult(const BenchmarkResult& result);
+
+// Base TestNode for benchmarks. Benchmarks are defined with MULTINODE_TEST()
+// and MULTINODE_TEST_NODE() like any other multinode test, so each one runs
+// against every registered TestDriver.
+class BenchmarkNode : public test::TestNode {
+ public:
+  // Runs `body` once and reports its running time as `iterations` operations
+  // of benchmark case `name`, each moving `bytes_per_iteration` bytes.
+  void RunTimed(std::string_view name,
+                size_t iterations,
+                size_t bytes_per_iteration,
+                absl::FunctionRef<void()> body);
+};
+
+}  // namespace ipcz::benchmarks
+
+#endif  // IPCZ_SRC_BENCHMARKS_BENCHMARK_H_
@@ -0,0 +1,133 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "benchmarks/benchmark.h"
+#include "ipcz/ipcz.h"
+#include "ipcz/link_counters.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+
+namespace ipcz::benchmarks {
+namespace {
+
+constexpr size_t kThreadCounts[] = {1, 2, 4, 8, 16, 32};
+
+// Each thread counts this many sent and received messages per case.
+constexpr size_t kMessagesPerThread = 1'000'000;
+
+// Each thread records traffic for a different message type, as dispatch pool
+// workers and sending threads commonly do. Adjacent message IDs are what share
+// cache lines in an unsharded layout.
+uint8_t GetMessageIdForThread(size_t thread_index) {
+  return static_cast<uint8_t>(thread_index % IPCZ_MAX_MESSAGE_TYPES);
+}
+
+// The layout LinkCounters replaced: one set of relaxed atomics per message
+// type, shared by every thread. This is the baseline the sharded counters are
+// measured against.
+class UnshardedCounters {
+ public:
+  void RecordMessageSent(uint8_t message_id, size_t num_bytes) {
+    Counters& counters = messages_[message_id];
+    counters.num_sent.fetch_add(1, std::memory_order_relaxed);
+    counters.num_bytes_sent.fetch_add(num_bytes, std::memory_order_relaxed);
+  }
+
+  void RecordMessageReceived(uint8_t message_id, size_t num_bytes) {
+    Counters& counters = messages_[message_id];
+    counters.num_received.fetch_add(1, std::memory_order_relaxed);
+    counters.num_bytes_received.fetch_add(num_bytes,
+                                          std::memory_order_relaxed);
+  }
+
+ private:
+  struct Counters {
+    std::atomic<uint64_t> num_sent{0};
+    std::atomic<uint64_t> num_bytes_sent{0};
+    std::atomic<uint64_t> num_received{0};
+    std::atomic<uint64_t> num_bytes_received{0};
+  };
+  std::array<Counters, IPCZ_MAX_MESSAGE_TYPES> messages_;
+};
+
+// Runs kMessagesPerThread sends and receives through `counters` on each of
+// `num_threads` threads, releasing them all at once, and reports the result as
+// benchmark case `name`.
+template <typename Counters>
+void RunOnThreads(std::string name, size_t num_threads, Counters& counters) {
+  std::atomic<size_t> num_ready{0};
+  std::atomic<bool> go{false};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&, i] {
+      const uint8_t message_id = GetMessageIdForThread(i);
+      num_ready.fetch_add(1, std::memory_order_relaxed);
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      for (size_t j = 0; j < kMessagesPerThread; ++j) {
+        counters.RecordMessageSent(message_id, 64);
+        counters.RecordMessageReceived(message_id, 64);
+      }
+    });
+  }
+
+  while (num_ready.load(std::memory_order_relaxed) < num_threads) {
+    std::this_thread::yield();
+  }
+  const absl::Time start = absl::Now();
+  go.store(true, std::memory_order_release);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  const absl::Duration elapsed = absl::Now() - start;
+
+  const size_t num_ops = num_threads * kMessagesPerThread * 2;
+  const double seconds = absl::ToDoubleSeconds(elapsed);
+  ReportResult({
+      .name = std::move(name),
+      .iterations = num_ops,
+      .elapsed = elapsed,
+      .metrics = {{"ops_per_second", seconds > 0 ? num_ops / seconds : 0}},
+  });
+}
+
+using LinkCountersBenchmark = testing::Test;
+
+TEST_F(LinkCountersBenchmark, Sharded) {
+  for (size_t num_threads : kThreadCounts) {
+    LinkCounters counters;
+    RunOnThreads(absl::StrCat("LinkCounters/Sharded/", num_threads),
+                 num_threads, counters);
+
+    auto stats = std::make_unique<IpczNodeLinkStats>();
+    stats->size = sizeof(*stats);
+    counters.Query(*stats);
+    EXPECT_EQ(num_threads * kMessagesPerThread, stats->num_messages_sent);
+    EXPECT_EQ(num_threads * kMessagesPerThread, stats->num_messages_received);
+  }
+}
+
+TEST_F(LinkCountersBenchmark, Unsharded) {
+  for (size_t num_threads : kThreadCounts) {
+    auto counters = std::make_unique<UnshardedCounters>();
+    RunOnThreads(absl::StrCat("LinkCounters/Unsharded/", num_threads),
+                 num_threads, *counters);
+  }
+}
+
+}  // namespace
+}  // namespace ipcz::benchmarks
@@ -0,0 +1,215 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "benchmarks/benchmark.h"
+#include "ipcz/ipcz.h"
+#include "ipcz/node.h"
+#include "ipcz/router.h"
+#include "test/allocation_counter.h"
+#include "test/multinode_test.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz::benchmarks {
+namespace {
+
+constexpr size_t kNumPortalPairs = 10000;
+constexpr size_t kPortalsPerParcel = 100;
+constexpr size_t kNumLinks = 100;
+
+// Checked-in ceilings for each figure reported below, in bytes per object.
+// These were measured on a 64-bit Linux standalone build under every driver,
+// with some headroom added. The benchmark fails if any figure exceeds its
+// ceiling, so a change which knowingly grows the footprint must update these
+// too.
+struct FootprintBaseline {
+  std::string_view metric;
+  double max_bytes;
+};
+
+constexpr FootprintBaseline kLocalPortalBaselines[] = {
+    {"heap_bytes_per_portal_pair", 850},
+    {"shared_bytes_per_portal_pair", 0},
+};
+
+constexpr FootprintBaseline kRemotePortalBaselines[] = {
+    {"heap_bytes_per_portal_pair", 1100},
+    {"shared_bytes_per_portal_pair", 72},
+};
+
+constexpr FootprintBaseline kLinkBaselines[] = {
+    {"heap_bytes_per_link", 192 * 1024},
+    {"shared_bytes_per_link", 132 * 1024},
+};
+
+// A snapshot of this process's heap usage since the benchmark began tracking
+// it, and the shared memory mapped by the benchmark's node. Heap usage is only
+// counted where IPCZ_COUNT_ALLOCATIONS is defined.
+struct Footprint {
+  int64_t heap_bytes = 0;
+  size_t shared_bytes = 0;
+};
+
+class MemoryBenchmarkNode : public BenchmarkNode {
+ public:
+  // Begins tracking heap usage by every thread in the process. Only the node
+  // running a benchmark body should call this.
+  void TrackHeapUsage() {
+#if defined(IPCZ_COUNT_ALLOCATIONS)
+    heap_tracker_.emplace();
+#endif
+  }
+
+  Footprint GetFootprint() {
+    Footprint footprint;
+#if defined(IPCZ_COUNT_ALLOCATIONS)
+    if (heap_tracker_) {
+      footprint.heap_bytes = heap_tracker_->GetNetBytes();
+    }
+#endif
+    footprint.shared_bytes =
+        Node::FromHandle(node())->GetTotalSharedMemorySize();
+    return footprint;
+  }
+
+  void WaitForCentralRemoteLink(IpczHandle portal) {
+    while (!Router::FromHandle(portal)->IsOnCentralRemoteLink()) {
+      std::this_thread::yield();
+    }
+  }
+
+  // Reports the growth in footprint since `before` as `num_objects` objects of
+  // benchmark case `name`, and checks each figure against `baselines`.
+  void ReportFootprint(std::string_view name,
+                       std::string_view object_name,
+                       size_t num_objects,
+                       const Footprint& before,
+                       absl::Span<const FootprintBaseline> baselines) {
+    const Footprint after = GetFootprint();
+    BenchmarkResult result = {
+        .name = std::string(name),
+        .driver = GetTestDriver()->GetName(),
+        .iterations = num_objects,
+    };
+#if defined(IPCZ_COUNT_ALLOCATIONS)
+    result.metrics.emplace_back(
+        absl::StrCat("heap_bytes_per_", std::string(object_name)),
+        static_cast<double>(after.heap_bytes - before.heap_bytes) /
+            num_objects);
+#endif
+    result.metrics.emplace_back(
+        absl::StrCat("shared_bytes_per_", std::string(object_name)),
+        (static_cast<double>(after.shared_bytes) - before.shared_bytes) /
+            num_objects);
+    ReportResult(result);
+
+    for (const auto& [metric, value] : result.metrics) {
+      for (const FootprintBaseline& baseline : baselines) {
+        if (metric == baseline.metric) {
+          EXPECT_LE(value, baseline.max_bytes)
+              << name << " " << metric << " regressed past its baseline";
+        }
+      }
+    }
+  }
+
+ private:
+#if defined(IPCZ_COUNT_ALLOCATIONS)
+  std::optional<test::ScopedHeapTracker> heap_tracker_;
+#endif
+};
+
+using MemoryBenchmark = test::MultinodeTest<MemoryBenchmarkNode>;
+
+MULTINODE_TEST_NODE(MemoryBenchmarkNode, PortalHolderClient) {
+  IpczHandle b = ConnectToBroker();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, {}));
+
+  std::vector<IpczHandle> portals(kNumPortalPairs);
+  for (size_t i = 0; i < kNumPortalPairs; i += kPortalsPerParcel) {
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              WaitToGet(b, nullptr, {&portals[i], kPortalsPerParcel}));
+  }
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, {}));
+
+  // Hold onto the portals until the broker has measured them.
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED));
+  CloseAll(portals);
+  Close(b);
+}
+
+MULTINODE_TEST(MemoryBenchmark, IdlePortals) {
+  std::vector<IpczHandle> portals(kNumPortalPairs);
+  std::vector<IpczHandle> remote_portals(kNumPortalPairs);
+  TrackHeapUsage();
+
+  // Both ends of each pair on this node.
+  Footprint before = GetFootprint();
+  for (size_t i = 0; i < kNumPortalPairs; ++i) {
+    std::tie(portals[i], remote_portals[i]) = OpenPortals();
+  }
+  ReportFootprint("LocalPortals", "portal_pair", kNumPortalPairs, before,
+                  kLocalPortalBaselines);
+  CloseAll(portals);
+  CloseAll(remote_portals);
+
+  // One end of each pair on another node, once every route is fully reduced.
+  // Under the multiprocess driver, the other node's heap is not counted.
+  IpczHandle c = SpawnTestNode<PortalHolderClient>();
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(c));
+  before = GetFootprint();
+  for (size_t i = 0; i < kNumPortalPairs; ++i) {
+    std::tie(portals[i], remote_portals[i]) = OpenPortals();
+  }
+  for (size_t i = 0; i < kNumPortalPairs; i += kPortalsPerParcel) {
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              Put(c, {}, {&remote_portals[i], kPortalsPerParcel}));
+  }
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(c));
+  for (IpczHandle portal : portals) {
+    WaitForCentralRemoteLink(portal);
+  }
+  ReportFootprint("RemotePortals", "portal_pair", kNumPortalPairs, before,
+                  kRemotePortalBaselines);
+  CloseAll(portals);
+  Close(c);
+}
+
+MULTINODE_TEST_NODE(MemoryBenchmarkNode, IdleLinkClient) {
+  IpczHandle b = ConnectToBroker();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, {}));
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED));
+  Close(b);
+}
+
+MULTINODE_TEST(MemoryBenchmark, IdleLinks) {
+  // Under the in-process drivers this also counts each client node's heap, as
+  // well as each link's primary buffer, since the reference drivers allocate
+  // in-process shared memory from the heap. It does not count the stacks of
+  // any threads the driver runs for each transport.
+  TrackHeapUsage();
+  const Footprint before = GetFootprint();
+  std::vector<IpczHandle> clients(kNumLinks);
+  for (IpczHandle& client : clients) {
+    client = SpawnTestNode<IdleLinkClient>();
+  }
+  for (IpczHandle client : clients) {
+    EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(client));
+  }
+  ReportFootprint("IdleLinks", "link", kNumLinks, before, kLinkBaselines);
+  CloseAll(clients);
+}
+
+}  // namespace
+}  // namespace ipcz::benchmarks
@@ -0,0 +1,199 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "benchmarks/benchmark.h"
+#include "ipcz/ipcz.h"
+#include "ipcz/node.h"
+#include "ipcz/node_link.h"
+#include "ipcz/node_name.h"
+#include "test/multinode_test.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/strings/numbers.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "third_party/abseil-cpp/absl/synchronization/notification.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+
+namespace ipcz::benchmarks {
+namespace {
+
+// Numbers of non-broker nodes connected to the broker in each benchmark case.
+constexpr size_t kNodeCounts[] = {10, 100, 1000};
+
+class NodeBenchmarkNode : public BenchmarkNode {
+ public:
+  Node& GetNode() { return *Node::FromHandle(node()); }
+};
+
+using NodeBenchmark = test::MultinodeTest<NodeBenchmarkNode>;
+
+uint64_t GetNanosecondsSince(absl::Time start) {
+  return absl::ToInt64Nanoseconds(absl::Now() - start);
+}
+
+MULTINODE_TEST_NODE(NodeBenchmarkNode, IntroductionClient) {
+  // Our first parcel is sent as soon as possible, and it lets the broker know
+  // that we've started and connected.
+  IpczHandle b = ConnectToBroker();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, {}));
+
+  // Once the broker has heard from every node, it asks for our name and then
+  // gives us the name of another node to be introduced to.
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b));
+  const NodeName name = GetNode().GetAssignedName();
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            Put(b, std::string_view(reinterpret_cast<const char*>(&name),
+                                    sizeof(name))));
+
+  std::string message;
+  NodeName peer_name;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, &message));
+  ASSERT_EQ(sizeof(peer_name), message.size());
+  memcpy(&peer_name, message.data(), sizeof(peer_name));
+
+  absl::Notification established;
+  uint64_t latency_ns = 0;
+  const absl::Time start = absl::Now();
+  GetNode().EstablishLink(peer_name, [&](NodeLink* link) {
+    latency_ns = GetNanosecondsSince(start);
+    EXPECT_TRUE(link);
+    established.Notify();
+  });
+  established.WaitForNotification();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, absl::StrCat(latency_ns)));
+
+  // Other nodes may still be establishing links to us, so stay up until the
+  // broker is done with every node.
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED));
+  Close(b);
+}
+
+MULTINODE_TEST(NodeBenchmark, Introductions) {
+  const bool is_multiprocess =
+      std::string_view(GetTestDriver()->GetName()) ==
+      test::internal::kMultiprocessTestDriverName;
+  for (size_t num_nodes : kNodeCounts) {
+    // Spawn every node at once, as a burst of worker startups would. A trap
+    // on each client's portal notes when its first parcel arrives, even while
+    // later clients are still being spawned.
+    std::vector<IpczHandle> clients(num_nodes);
+    std::vector<absl::Time> spawn_times(num_nodes);
+    std::vector<absl::Time> arrival_times(num_nodes);
+    std::atomic<size_t> num_arrived{0};
+    absl::Notification all_arrived;
+    auto record_arrival = [&](size_t i) {
+      arrival_times[i] = absl::Now();
+      if (num_arrived.fetch_add(1, std::memory_order_acq_rel) + 1 ==
+          num_nodes) {
+        all_arrived.Notify();
+      }
+    };
+    const IpczTrapConditions first_parcel = {
+        .size = sizeof(first_parcel),
+        .flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS,
+        .min_local_parcels = 0,
+    };
+    const absl::Time start = absl::Now();
+    for (size_t i = 0; i < num_nodes; ++i) {
+      spawn_times[i] = absl::Now();
+      clients[i] = SpawnTestNode<IntroductionClient>();
+      const IpczResult result =
+          Trap(clients[i], first_parcel,
+               [&record_arrival, i](const IpczTrapEvent& event) {
+                 if (!(event.condition_flags & IPCZ_TRAP_REMOVED)) {
+                   record_arrival(i);
+                 }
+               });
+      if (result != IPCZ_RESULT_OK) {
+        // Normally this means the first parcel beat us to installing the trap.
+        // Anything else is a failure, but it's still counted so the wait below
+        // can't hang.
+        EXPECT_EQ(IPCZ_RESULT_FAILED_PRECONDITION, result);
+        record_arrival(i);
+      }
+    }
+    all_arrived.WaitForNotification();
+
+    std::vector<uint64_t> first_parcel_latencies(num_nodes);
+    for (size_t i = 0; i < num_nodes; ++i) {
+      EXPECT_EQ(IPCZ_RESULT_OK, Get(clients[i]));
+      first_parcel_latencies[i] =
+          absl::ToInt64Nanoseconds(arrival_times[i] - spawn_times[i]);
+    }
+    const absl::Duration connect_elapsed = absl::Now() - start;
+
+    std::vector<std::string> names(num_nodes);
+    for (size_t i = 0; i < num_nodes; ++i) {
+      EXPECT_EQ(IPCZ_RESULT_OK, Put(clients[i], {}));
+    }
+    for (size_t i = 0; i < num_nodes; ++i) {
+      names[i] = WaitToGetString(clients[i]);
+    }
+
+    // Introduce every node to the next one. Each introduction is requested
+    // by a different node, so they all contend for the broker at once.
+    const absl::Time introductions_start = absl::Now();
+    const std::clock_t cpu_start = std::clock();
+    for (size_t i = 0; i < num_nodes; ++i) {
+      EXPECT_EQ(IPCZ_RESULT_OK,
+                Put(clients[i], names[(i + 1) % num_nodes]));
+    }
+    std::vector<uint64_t> introduction_latencies(num_nodes);
+    for (size_t i = 0; i < num_nodes; ++i) {
+      ASSERT_TRUE(absl::SimpleAtoi(WaitToGetString(clients[i]),
+                                   &introduction_latencies[i]));
+    }
+    const double cpu_ns =
+        (std::clock() - cpu_start) * 1e9 / CLOCKS_PER_SEC;
+    const absl::Duration introductions_elapsed =
+        absl::Now() - introductions_start;
+    CloseAll(clients);
+
+    std::sort(first_parcel_latencies.begin(), first_parcel_latencies.end());
+    ReportResult({
+        .name = absl::StrCat("TimeToFirstParcel/", num_nodes),
+        .driver = GetTestDriver()->GetName(),
+        .iterations = num_nodes,
+        .elapsed = connect_elapsed,
+        .metrics =
+            {
+                {"p50_ns", GetPercentile(first_parcel_latencies, 0.5)},
+                {"p99_ns", GetPercentile(first_parcel_latencies, 0.99)},
+                {"max_ns", GetPercentile(first_parcel_latencies, 1)},
+            },
+    });
+
+    // Only with the multiprocess driver does this process's CPU time belong
+    // to the broker alone. Otherwise it includes every other node too.
+    std::sort(introduction_latencies.begin(), introduction_latencies.end());
+    ReportResult({
+        .name = absl::StrCat("Introduction/", num_nodes),
+        .driver = GetTestDriver()->GetName(),
+        .iterations = num_nodes,
+        .elapsed = introductions_elapsed,
+        .metrics =
+            {
+                {"p50_ns", GetPercentile(introduction_latencies, 0.5)},
+                {"p99_ns", GetPercentile(introduction_latencies, 0.99)},
+                {"max_ns", GetPercentile(introduction_latencies, 1)},
+                {is_multiprocess ? "broker_cpu_ns_per_introduction"
+                                 : "process_cpu_ns_per_introduction",
+                 cpu_ns / num_nodes},
+            },
+    });
+  }
+}
+
+}  // namespace
+}  // namespace ipcz::benchmarks
@@ -0,0 +1,179 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "benchmarks/benchmark.h"
+#include "ipcz/ipcz.h"
+#include "test/multinode_test.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz::benchmarks {
+namespace {
+
+using PortalBenchmarkNode = BenchmarkNode;
+using PortalBenchmark = test::MultinodeTest<PortalBenchmarkNode>;
+
+// Round trips made before timing begins, to get past connection setup.
+constexpr size_t kNumWarmupRoundTrips = 10;
+
+constexpr size_t kNumPingPongRoundTrips = 1000;
+
+// Parcel sizes measured by the Throughput benchmark.
+constexpr size_t kThroughputParcelSizes[] = {
+    16, 256, 4096, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024,
+};
+
+// Each Throughput case moves roughly this much data in total, so that every
+// parcel size takes a comparable amount of time to measure.
+constexpr size_t kThroughputBytesPerCase = 128 * 1024 * 1024;
+constexpr size_t kMinThroughputParcelsPerCase = 2;
+constexpr size_t kMaxThroughputParcelsPerCase = 20000;
+
+size_t GetNumThroughputParcels(size_t parcel_size) {
+  return std::clamp(kThroughputBytesPerCase / parcel_size,
+                    kMinThroughputParcelsPerCase, kMaxThroughputParcelsPerCase);
+}
+
+// Numbers of portals carried by each parcel in the HandleParcels benchmark.
+// Portals are sent in connected pairs, so these are all even.
+constexpr size_t kHandlesPerParcel[] = {2, 4, 16};
+constexpr size_t kNumHandleParcels = 500;
+
+constexpr size_t kNumFanOutPortals = 256;
+constexpr size_t kNumFanOutRounds = 20;
+
+MULTINODE_TEST_NODE(PortalBenchmarkNode, PingPongClient) {
+  IpczHandle b = ConnectToBroker();
+  for (size_t i = 0; i < kNumWarmupRoundTrips + kNumPingPongRoundTrips; ++i) {
+    WaitForPingAndReply(b);
+  }
+  Close(b);
+}
+
+MULTINODE_TEST(PortalBenchmark, PingPong) {
+  IpczHandle c = SpawnTestNode<PingPongClient>();
+  for (size_t i = 0; i < kNumWarmupRoundTrips; ++i) {
+    PingPong(c);
+  }
+  RunTimed("PingPong", kNumPingPongRoundTrips, 0, [&] {
+    for (size_t i = 0; i < kNumPingPongRoundTrips; ++i) {
+      PingPong(c);
+    }
+  });
+  Close(c);
+}
+
+MULTINODE_TEST_NODE(PortalBenchmarkNode, ThroughputClient) {
+  IpczHandle b = ConnectToBroker();
+  std::string message;
+  for (size_t size : kThroughputParcelSizes) {
+    const size_t num_parcels = GetNumThroughputParcels(size);
+    for (size_t i = 0; i < num_parcels; ++i) {
+      EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, &message));
+      EXPECT_EQ(size, message.size());
+    }
+    EXPECT_EQ(IPCZ_RESULT_OK, Put(b, {}));
+  }
+  Close(b);
+}
+
+MULTINODE_TEST(PortalBenchmark, Throughput) {
+  IpczHandle c = SpawnTestNode<ThroughputClient>();
+  for (size_t size : kThroughputParcelSizes) {
+    const std::string parcel(size, '!');
+    const size_t num_parcels = GetNumThroughputParcels(size);
+    RunTimed(absl::StrCat("Throughput/", size), num_parcels, size, [&] {
+      for (size_t i = 0; i < num_parcels; ++i) {
+        EXPECT_EQ(IPCZ_RESULT_OK, Put(c, parcel));
+      }
+      EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(c));
+    });
+  }
+  Close(c);
+}
+
+MULTINODE_TEST_NODE(PortalBenchmarkNode, HandleParcelsClient) {
+  IpczHandle b = ConnectToBroker();
+  for (size_t num_handles : kHandlesPerParcel) {
+    std::vector<IpczHandle> handles(num_handles);
+    for (size_t i = 0; i < kNumHandleParcels; ++i) {
+      EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, absl::MakeSpan(handles)));
+      CloseAll(handles);
+    }
+    EXPECT_EQ(IPCZ_RESULT_OK, Put(b, {}));
+  }
+  Close(b);
+}
+
+MULTINODE_TEST(PortalBenchmark, HandleParcels) {
+  IpczHandle c = SpawnTestNode<HandleParcelsClient>();
+  for (size_t num_handles : kHandlesPerParcel) {
+    std::vector<IpczHandle> handles(num_handles);
+    RunTimed(absl::StrCat("HandleParcels/", num_handles), kNumHandleParcels, 0,
+             [&] {
+               for (size_t i = 0; i < kNumHandleParcels; ++i) {
+                 for (size_t j = 0; j < num_handles; j += 2) {
+                   std::tie(handles[j], handles[j + 1]) = OpenPortals();
+                 }
+                 EXPECT_EQ(IPCZ_RESULT_OK,
+                           Put(c, {}, absl::MakeSpan(handles)));
+               }
+               EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(c));
+             });
+  }
+  Close(c);
+}
+
+MULTINODE_TEST_NODE(PortalBenchmarkNode, FanOutClient) {
+  IpczHandle b = ConnectToBroker();
+  std::vector<IpczHandle> portals(kNumFanOutPortals);
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, absl::MakeSpan(portals)));
+
+  // One warmup round, then the timed rounds.
+  std::string message;
+  for (size_t i = 0; i < kNumFanOutRounds + 1; ++i) {
+    for (IpczHandle portal : portals) {
+      EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(portal, &message));
+    }
+    EXPECT_EQ(IPCZ_RESULT_OK, Put(b, {}));
+  }
+  CloseAll(portals);
+  Close(b);
+}
+
+MULTINODE_TEST(PortalBenchmark, FanOut) {
+  IpczHandle c = SpawnTestNode<FanOutClient>();
+  std::vector<IpczHandle> portals(kNumFanOutPortals);
+  std::vector<IpczHandle> remote_portals(kNumFanOutPortals);
+  for (size_t i = 0; i < kNumFanOutPortals; ++i) {
+    std::tie(portals[i], remote_portals[i]) = OpenPortals();
+  }
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, {}, absl::MakeSpan(remote_portals)));
+
+  auto put_to_all_and_wait = [&] {
+    for (IpczHandle portal : portals) {
+      EXPECT_EQ(IPCZ_RESULT_OK, Put(portal, "!"));
+    }
+    EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(c));
+  };
+  put_to_all_and_wait();
+  RunTimed(absl::StrCat("FanOut/", kNumFanOutPortals),
+           kNumFanOutRounds * kNumFanOutPortals, 0, [&] {
+             for (size_t i = 0; i < kNumFanOutRounds; ++i) {
+               put_to_all_and_wait();
+             }
+           });
+  CloseAll(portals);
+  Close(c);
+}
+
+}  // namespace
+}  // namespace ipcz::benchmarks
@@ -0,0 +1,266 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "benchmarks/benchmark.h"
+#include "ipcz/ipcz.h"
+#include "ipcz/node.h"
+#include "ipcz/router.h"
+#include "test/multinode_test.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/strings/numbers.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+
+namespace ipcz::benchmarks {
+namespace {
+
+// Numbers of intermediate nodes a portal is forwarded through before it
+// settles on its final node.
+constexpr size_t kHopCounts[] = {1, 2, 4};
+
+constexpr size_t kNumTransfers = 50;
+
+// Under load, parcels of this size are sent continuously from the moment a
+// portal is transferred until its route is fully reduced, and then this many
+// more are sent once it is.
+constexpr size_t kLoadParcelSize = 256;
+constexpr size_t kNumDirectLoadParcels = 200;
+
+// Sent after the last load parcel of each transfer.
+constexpr std::string_view kEndMarker = "end";
+
+// Sent by the last hop back to the broker after each transfer, describing the
+// load parcels it received before and after its end of the route was reduced.
+struct LastHopStats {
+  uint64_t num_proxied_parcels;
+  uint64_t proxied_ns;
+  uint64_t num_direct_parcels;
+  uint64_t direct_ns;
+};
+
+class RouteBenchmarkNode : public BenchmarkNode {
+ public:
+  bool IsOnCentralRemoteLink(IpczHandle portal) {
+    return Router::FromHandle(portal)->IsOnCentralRemoteLink();
+  }
+
+  void WaitForCentralRemoteLink(IpczHandle portal) {
+    while (!IsOnCentralRemoteLink(portal)) {
+      std::this_thread::yield();
+    }
+  }
+
+  uint64_t GetNumMessagesSent() {
+    return Node::FromHandle(node())->GetNumMessagesSent();
+  }
+};
+
+using RouteBenchmark = test::MultinodeTest<RouteBenchmarkNode>;
+
+// Receives a transferred portal and drains it, measuring how many parcels
+// arrived before and after the portal's route was reduced to a single central
+// link.
+void ReceiveOnLastHop(RouteBenchmarkNode& node, IpczHandle portal) {
+  const absl::Time start = absl::Now();
+  absl::Time stable_time;
+  bool is_stable = false;
+  LastHopStats stats = {};
+  std::string message;
+  for (;;) {
+    if (!is_stable && node.IsOnCentralRemoteLink(portal)) {
+      is_stable = true;
+      stable_time = absl::Now();
+      EXPECT_EQ(IPCZ_RESULT_OK, node.Put(portal, {}));
+    }
+
+    const IpczResult result = node.Get(portal, &message);
+    if (result == IPCZ_RESULT_UNAVAILABLE) {
+      std::this_thread::yield();
+      continue;
+    }
+    ASSERT_EQ(IPCZ_RESULT_OK, result);
+    if (message == kEndMarker) {
+      break;
+    }
+    ++(is_stable ? stats.num_direct_parcels : stats.num_proxied_parcels);
+  }
+
+  // The end marker is only sent once the portal's route is reduced.
+  EXPECT_TRUE(is_stable);
+  stats.proxied_ns = absl::ToInt64Nanoseconds(stable_time - start);
+  stats.direct_ns = absl::ToInt64Nanoseconds(absl::Now() - stable_time);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            node.Put(portal, std::string_view(
+                                 reinterpret_cast<const char*>(&stats),
+                                 sizeof(stats))));
+  node.Close(portal);
+}
+
+MULTINODE_TEST_NODE(RouteBenchmarkNode, RouteHopClient) {
+  IpczHandle b = ConnectToBroker();
+
+  // The broker sends us a portal to receive transferred portals on, and if we
+  // aren't the last hop, a portal to forward them through.
+  IpczHandle hops[2] = {IPCZ_INVALID_HANDLE, IPCZ_INVALID_HANDLE};
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, hops));
+  const IpczHandle in = hops[0];
+  const IpczHandle out = hops[1];
+  WaitForCentralRemoteLink(in);
+  if (out != IPCZ_INVALID_HANDLE) {
+    WaitForCentralRemoteLink(out);
+  }
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, {}));
+
+  // One round of transfers without load, and one with.
+  for (size_t i = 0; i < 2; ++i) {
+    const uint64_t initial_num_messages = GetNumMessagesSent();
+    for (size_t j = 0; j < kNumTransfers; ++j) {
+      IpczHandle portal;
+      EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(in, nullptr, {&portal, 1}));
+      if (out != IPCZ_INVALID_HANDLE) {
+        EXPECT_EQ(IPCZ_RESULT_OK, Put(out, {}, {&portal, 1}));
+      } else {
+        ReceiveOnLastHop(*this, portal);
+      }
+    }
+
+    // Intermediate hops may still be proxying the last transfer, so wait for
+    // the broker to ask for our message count before we report it or exit.
+    EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b));
+    const uint64_t num_messages = GetNumMessagesSent() - initial_num_messages;
+    EXPECT_EQ(IPCZ_RESULT_OK, Put(b, absl::StrCat(num_messages)));
+  }
+
+  Close(in);
+  if (out != IPCZ_INVALID_HANDLE) {
+    Close(out);
+  }
+  Close(b);
+}
+
+MULTINODE_TEST(RouteBenchmark, RouteReduction) {
+  const std::string load_parcel(kLoadParcelSize, '!');
+  for (size_t num_hops : kHopCounts) {
+    // Set up a chain of client nodes, each of which forwards any portal it
+    // receives to the next, until the last one keeps it. The broker keeps the
+    // other end of each transferred portal, so every transfer must ultimately
+    // reduce to a direct link between the broker and the last client.
+    std::vector<IpczHandle> clients(num_hops);
+    IpczHandle first_hop;
+    IpczHandle next_in;
+    std::tie(first_hop, next_in) = OpenPortals();
+    for (size_t i = 0; i < num_hops; ++i) {
+      clients[i] = SpawnTestNode<RouteHopClient>();
+      IpczHandle hops[2] = {next_in, IPCZ_INVALID_HANDLE};
+      size_t num_hop_portals = 1;
+      if (i < num_hops - 1) {
+        std::tie(hops[1], next_in) = OpenPortals();
+        num_hop_portals = 2;
+      }
+      EXPECT_EQ(IPCZ_RESULT_OK,
+                Put(clients[i], {}, {hops, num_hop_portals}));
+    }
+    WaitForCentralRemoteLink(first_hop);
+    for (IpczHandle client : clients) {
+      EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(client));
+    }
+
+    for (bool under_load : {false, true}) {
+      const uint64_t initial_num_messages = GetNumMessagesSent();
+      absl::Duration elapsed;
+      LastHopStats total_stats = {};
+      for (size_t i = 0; i < kNumTransfers; ++i) {
+        auto [a, b] = OpenPortals();
+        const absl::Time start = absl::Now();
+        EXPECT_EQ(IPCZ_RESULT_OK, Put(first_hop, {}, {&b, 1}));
+
+        // The route is stable once both ends have a central link to each
+        // other. The last hop tells us when its end does.
+        bool is_a_stable = false;
+        bool is_b_stable = false;
+        while (!is_a_stable || !is_b_stable) {
+          if (under_load) {
+            ASSERT_EQ(IPCZ_RESULT_OK, Put(a, load_parcel));
+          } else {
+            std::this_thread::yield();
+          }
+          is_a_stable = is_a_stable || IsOnCentralRemoteLink(a);
+          is_b_stable = is_b_stable || Get(a) == IPCZ_RESULT_OK;
+        }
+        elapsed += absl::Now() - start;
+
+        if (under_load) {
+          for (size_t j = 0; j < kNumDirectLoadParcels; ++j) {
+            EXPECT_EQ(IPCZ_RESULT_OK, Put(a, load_parcel));
+          }
+        }
+        EXPECT_EQ(IPCZ_RESULT_OK, Put(a, kEndMarker));
+
+        std::string message;
+        LastHopStats stats;
+        EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(a, &message));
+        ASSERT_EQ(sizeof(stats), message.size());
+        memcpy(&stats, message.data(), sizeof(stats));
+        total_stats.num_proxied_parcels += stats.num_proxied_parcels;
+        total_stats.proxied_ns += stats.proxied_ns;
+        total_stats.num_direct_parcels += stats.num_direct_parcels;
+        total_stats.direct_ns += stats.direct_ns;
+        Close(a);
+      }
+
+      // Message counts include the handful of control parcels this benchmark
+      // sends for each transfer, as well as any load parcels.
+      uint64_t num_messages = GetNumMessagesSent() - initial_num_messages;
+      for (IpczHandle client : clients) {
+        EXPECT_EQ(IPCZ_RESULT_OK, Put(client, {}));
+      }
+      for (IpczHandle client : clients) {
+        uint64_t num_client_messages;
+        ASSERT_TRUE(absl::SimpleAtoi(WaitToGetString(client),
+                                     &num_client_messages));
+        num_messages += num_client_messages;
+      }
+
+      BenchmarkResult result = {
+          .name = absl::StrCat(
+              under_load ? "RouteReductionUnderLoad/" : "RouteReduction/",
+              num_hops),
+          .driver = GetTestDriver()->GetName(),
+          .iterations = kNumTransfers,
+          .elapsed = elapsed,
+          .metrics = {{"messages_per_transfer",
+                       static_cast<double>(num_messages) / kNumTransfers}},
+      };
+      if (under_load) {
+        auto per_second = [](uint64_t count, uint64_t ns) {
+          return ns ? count * 1e9 / ns : 0.0;
+        };
+        result.metrics.emplace_back(
+            "proxied_parcels_per_second",
+            per_second(total_stats.num_proxied_parcels,
+                       total_stats.proxied_ns));
+        result.metrics.emplace_back(
+            "direct_parcels_per_second",
+            per_second(total_stats.num_direct_parcels, total_stats.direct_ns));
+      }
+      ReportResult(result);
+    }
+
+    Close(first_hop);
+    CloseAll(clients);
+  }
+}
+
+}  // namespace
+}  // namespace ipcz::benchmarks
@@ -0,0 +1,105 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "benchmarks/benchmark.h"
+#include "ipcz/sequence_number.h"
+#include "ipcz/sequenced_queue.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/base/macros.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+
+namespace ipcz::benchmarks {
+namespace {
+
+// Each case pushes and pops this many elements. Elements are heap-allocated
+// like the Parcels in a portal's inbound queue, so the cost of moving them in
+// and out of the queue is representative.
+constexpr size_t kNumElements = 10'000'000;
+
+// Queue depths for the in-order case: the number of elements which stay
+// queued ahead of every pop, as in a portal with a steady backlog.
+constexpr size_t kQueueDepths[] = {1, 32, 1024};
+
+using Element = std::unique_ptr<uint64_t>;
+using Queue = SequencedQueue<Element>;
+
+class SequencedQueueBenchmark : public testing::Test {
+ protected:
+  // Runs `body` once and reports its running time as kNumElements pushes and
+  // pops of benchmark case `name`. `body` must return the sum of all popped
+  // values, which is checked so the work can't be optimized away.
+  template <typename Body>
+  void Run(std::string name, Body body) {
+    const absl::Time start = absl::Now();
+    const uint64_t sum = body();
+    const absl::Duration elapsed = absl::Now() - start;
+    EXPECT_EQ(kNumElements * (kNumElements - 1) / 2, sum);
+    ReportResult({
+        .name = std::move(name),
+        .iterations = kNumElements,
+        .elapsed = elapsed,
+    });
+  }
+
+  static void PushOrDie(Queue& queue, uint64_t n) {
+    const bool ok =
+        queue.Push(SequenceNumber(n), std::make_unique<uint64_t>(n));
+    ABSL_ASSERT(ok);
+  }
+
+  static uint64_t PopOrDie(Queue& queue) {
+    Element element;
+    const bool ok = queue.Pop(element);
+    ABSL_ASSERT(ok);
+    return *element;
+  }
+};
+
+TEST_F(SequencedQueueBenchmark, InOrder) {
+  // Elements arrive in sequence order while `depth` of them remain queued.
+  for (size_t depth : kQueueDepths) {
+    Run(absl::StrCat("SequencedQueue/InOrder/", depth), [depth] {
+      Queue queue;
+      uint64_t sum = 0;
+      for (uint64_t n = 0; n < depth; ++n) {
+        PushOrDie(queue, n);
+      }
+      for (uint64_t n = depth; n < kNumElements; ++n) {
+        PushOrDie(queue, n);
+        sum += PopOrDie(queue);
+      }
+      while (queue.HasNextElement()) {
+        sum += PopOrDie(queue);
+      }
+      return sum;
+    });
+  }
+}
+
+TEST_F(SequencedQueueBenchmark, Reordered) {
+  // Each pair of elements arrives swapped, so every other push lands beyond a
+  // one-element gap and the next push fills it.
+  Run("SequencedQueue/Reordered", [] {
+    Queue queue;
+    uint64_t sum = 0;
+    for (uint64_t n = 0; n < kNumElements; n += 2) {
+      PushOrDie(queue, n + 1);
+      PushOrDie(queue, n);
+      sum += PopOrDie(queue);
+      sum += PopOrDie(queue);
+    }
+    return sum;
+  });
+}
+
+}  // namespace
+}  // namespace ipcz::benchmarks
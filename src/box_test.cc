@@ -2,14 +2,19 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <cstddef>
 #include <cstring>
 #include <memory>
+#include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 #include "ipcz/ipcz.h"
 #include "test/multinode_test.h"
 #include "testing/gtest/include/gtest/gtest.h"
 #include "third_party/abseil-cpp/absl/base/macros.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
 #include "third_party/abseil-cpp/absl/types/span.h"
 #include "util/ref_counted.h"
 
@@ -174,8 +179,26 @@ class NamedPortal {
     uint32_t name_length;
   };
 
-  NamedPortal(const IpczAPI& ipcz, std::string_view name, IpczHandle portal)
-      : ipcz_(ipcz), name_(name.begin(), name.end()), portal_(portal) {}
+  // Tracks how ipcz invokes Serialize() on a NamedPortal. This outlives the
+  // object, which is destroyed once serialized.
+  struct SerializerStats {
+    // Calls which only queried the required capacity.
+    size_t num_size_queries = 0;
+
+    // Calls which provided storage to serialize into, and how many of those
+    // failed because the storage was too small.
+    size_t num_serializations = 0;
+    size_t num_exhausted = 0;
+  };
+
+  NamedPortal(const IpczAPI& ipcz,
+              std::string_view name,
+              IpczHandle portal,
+              SerializerStats* stats = nullptr)
+      : ipcz_(ipcz),
+        name_(name.begin(), name.end()),
+        portal_(portal),
+        stats_(stats) {}
   ~NamedPortal() { reset(); }
 
   static uintptr_t Release(std::unique_ptr<NamedPortal> named_portal) {
@@ -185,6 +208,13 @@ class NamedPortal {
   const std::string& name() const { return name_; }
   IpczHandle portal() const { return portal_; }
 
+  // Appends `suffix` to the name once the first size query has been answered,
+  // so that the size reported by the query is too small by the time the
+  // object is actually serialized.
+  void GrowNameAfterSizeQuery(std::string_view suffix) {
+    suffix_after_size_query_ = suffix;
+  }
+
   void reset() {
     if (portal_ != IPCZ_INVALID_HANDLE) {
       ipcz_.Close(std::exchange(portal_, IPCZ_INVALID_HANDLE), IPCZ_NO_FLAGS,
@@ -211,8 +241,22 @@ class NamedPortal {
     if (num_handles) {
       *num_handles = required_handle_capacity;
     }
+    if (!data) {
+      if (portal.stats_) {
+        ++portal.stats_->num_size_queries;
+      }
+      portal.name_ += std::exchange(portal.suffix_after_size_query_, "");
+      return IPCZ_RESULT_RESOURCE_EXHAUSTED;
+    }
+
+    if (portal.stats_) {
+      ++portal.stats_->num_serializations;
+    }
     if (byte_capacity < required_byte_capacity ||
         handle_capacity < required_handle_capacity) {
+      if (portal.stats_) {
+        ++portal.stats_->num_exhausted;
+      }
       return IPCZ_RESULT_RESOURCE_EXHAUSTED;
     }
 
@@ -243,8 +287,10 @@ class NamedPortal {
 
  private:
   const IpczAPI& ipcz_;
-  const std::string name_;
+  std::string name_;
   IpczHandle portal_;
+  SerializerStats* const stats_;
+  std::string suffix_after_size_query_;
 };
 
 constexpr std::string_view kPortalName = "yahoo?";
@@ -296,6 +342,144 @@ MULTINODE_TEST(BoxTest, SerializedApplicationObject) {
   CloseAll({c, q});
 }
 
+// Boxes `portal` as an application object which ipcz can serialize.
+IpczHandle BoxNamedPortal(const IpczAPI& ipcz,
+                          IpczHandle node,
+                          std::unique_ptr<NamedPortal> portal) {
+  const IpczBoxContents contents = {
+      .size = sizeof(contents),
+      .type = IPCZ_BOX_TYPE_APPLICATION_OBJECT,
+      .object = {.application_object = NamedPortal::Release(std::move(portal))},
+      .serializer = &NamedPortal::Serialize,
+      .destructor = &NamedPortal::Destroy,
+  };
+  IpczHandle box;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz.Box(node, &contents, IPCZ_NO_FLAGS, nullptr, &box));
+  return box;
+}
+
+// Receives a single boxed NamedPortal from the broker, along with a message
+// giving its expected name.
+MULTINODE_TEST_NODE(BoxTestNode, NamedApplicationObjectClient) {
+  IpczHandle b = ConnectToBroker();
+  IpczHandle box;
+  std::string name;
+  ASSERT_EQ(IPCZ_RESULT_OK, WaitToGet(b, &name, {&box, 1}));
+
+  IpczBoxContents contents = {.size = sizeof(contents)};
+  ASSERT_EQ(IPCZ_RESULT_OK,
+            ipcz().Unbox(box, IPCZ_NO_FLAGS, nullptr, &contents));
+  ASSERT_EQ(IPCZ_BOX_TYPE_SUBPARCEL, contents.type);
+
+  const IpczHandle subparcel = contents.object.subparcel;
+  std::vector<uint8_t> data(sizeof(NamedPortal::Header) + name.size());
+  size_t num_bytes = data.size();
+  IpczHandle p;
+  size_t num_handles = 1;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Get(subparcel, IPCZ_NO_FLAGS, nullptr, data.data(),
+                       &num_bytes, &p, &num_handles, nullptr));
+  auto portal = NamedPortal::Deserialize(ipcz(), data, {&p, 1});
+  EXPECT_EQ(name, portal->name());
+  VerifyEndToEnd(portal->portal());
+  CloseAll({b, subparcel});
+}
+
+MULTINODE_TEST(BoxTest, SerializedApplicationObjectUsesSizeHint) {
+  // The size reported when ipcz checks that the object is serializable is used
+  // to reserve storage up front, so the object is serialized in place with a
+  // single query and a single serialization.
+  IpczHandle c = SpawnTestNode<NamedApplicationObjectClient>();
+  auto [q, p] = OpenPortals();
+  NamedPortal::SerializerStats stats;
+  IpczHandle box = BoxNamedPortal(
+      ipcz(), node(),
+      std::make_unique<NamedPortal>(ipcz(), kPortalName, p, &stats));
+  Put(c, kPortalName, {&box, 1});
+  VerifyEndToEnd(q);
+  EXPECT_EQ(1u, stats.num_size_queries);
+  EXPECT_EQ(1u, stats.num_serializations);
+  EXPECT_EQ(0u, stats.num_exhausted);
+  CloseAll({c, q});
+}
+
+MULTINODE_TEST(BoxTest, SerializedApplicationObjectOutgrowsSizeHint) {
+  // If the object needs more storage by the time it's serialized than it
+  // reported when queried, the first serialization fails and ipcz retries once
+  // with the size reported by that failure.
+  IpczHandle c = SpawnTestNode<NamedApplicationObjectClient>();
+  auto [q, p] = OpenPortals();
+  NamedPortal::SerializerStats stats;
+  constexpr const char kSuffix[] = " and then some";
+  auto portal = std::make_unique<NamedPortal>(ipcz(), kPortalName, p, &stats);
+  portal->GrowNameAfterSizeQuery(kSuffix);
+  IpczHandle box = BoxNamedPortal(ipcz(), node(), std::move(portal));
+  Put(c, absl::StrCat(std::string(kPortalName), kSuffix), {&box, 1});
+  VerifyEndToEnd(q);
+  EXPECT_EQ(1u, stats.num_size_queries);
+  EXPECT_EQ(2u, stats.num_serializations);
+  EXPECT_EQ(1u, stats.num_exhausted);
+  CloseAll({c, q});
+}
+
+constexpr size_t kNumApplicationObjects = 8;
+
+std::string GetPortalName(size_t i) {
+  return absl::StrCat(std::string(kPortalName), i);
+}
+
+MULTINODE_TEST_NODE(BoxTestNode, MultipleSerializedApplicationObjectsClient) {
+  IpczHandle b = ConnectToBroker();
+  IpczHandle boxes[kNumApplicationObjects];
+  std::string message;
+  ASSERT_EQ(IPCZ_RESULT_OK, WaitToGet(b, &message, absl::MakeSpan(boxes)));
+  EXPECT_EQ("hey", message);
+
+  for (size_t i = 0; i < kNumApplicationObjects; ++i) {
+    IpczBoxContents contents = {.size = sizeof(contents)};
+    ASSERT_EQ(IPCZ_RESULT_OK,
+              ipcz().Unbox(boxes[i], IPCZ_NO_FLAGS, nullptr, &contents));
+    ASSERT_EQ(IPCZ_BOX_TYPE_SUBPARCEL, contents.type);
+
+    const IpczHandle subparcel = contents.object.subparcel;
+    const std::string name = GetPortalName(i);
+    std::vector<uint8_t> data(sizeof(NamedPortal::Header) + name.size());
+    size_t num_bytes = data.size();
+    IpczHandle p;
+    size_t num_handles = 1;
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().Get(subparcel, IPCZ_NO_FLAGS, nullptr, data.data(),
+                         &num_bytes, &p, &num_handles, nullptr));
+    auto portal = NamedPortal::Deserialize(ipcz(), data, {&p, 1});
+    EXPECT_EQ(name, portal->name());
+    VerifyEndToEnd(portal->portal());
+    Close(subparcel);
+  }
+  Close(b);
+}
+
+MULTINODE_TEST(BoxTest, MultipleSerializedApplicationObjects) {
+  // Sends a single parcel with several serialized application objects, each of
+  // which becomes a subparcel carrying its own data and portal.
+  IpczHandle c = SpawnTestNode<MultipleSerializedApplicationObjectsClient>();
+  IpczHandle qs[kNumApplicationObjects];
+  IpczHandle boxes[kNumApplicationObjects];
+  for (size_t i = 0; i < kNumApplicationObjects; ++i) {
+    auto [q, p] = OpenPortals();
+    qs[i] = q;
+    boxes[i] = BoxNamedPortal(
+        ipcz(), node(),
+        std::make_unique<NamedPortal>(ipcz(), GetPortalName(i), p));
+  }
+  Put(c, "hey", absl::MakeSpan(boxes));
+  for (IpczHandle q : qs) {
+    VerifyEndToEnd(q);
+    Close(q);
+  }
+  Close(c);
+}
+
 MULTINODE_TEST(BoxTest, UnserializedApplicationObject) {
   auto [a, b] = OpenPortals();
   auto [q, p] = OpenPortals();
@@ -4,7 +4,11 @@
 
 #include "ipcz/application_object.h"
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "ipcz/ipcz.h"
 #include "ipcz/node_link.h"
@@ -20,7 +24,8 @@ ApplicationObject::ApplicationObject(uintptr_t object,
 ApplicationObject::ApplicationObject(ApplicationObject&& other)
     : object_(*other.object_),
       serializer_(other.serializer_),
-      destructor_(other.destructor_) {
+      destructor_(other.destructor_),
+      size_hint_(other.size_hint_) {
   other.object_.reset();
 }
 
@@ -40,46 +45,58 @@ uintptr_t ApplicationObject::ReleaseObject() {
   return object;
 }
 
-bool ApplicationObject::IsSerializable() const {
+bool ApplicationObject::IsSerializable() {
   if (!serializer_) {
     return false;
   }
 
+  size_t num_bytes = 0;
+  size_t num_handles = 0;
   const IpczResult result = serializer_(object(), IPCZ_NO_FLAGS, nullptr,
-                                        nullptr, nullptr, nullptr, nullptr);
-  return result != IPCZ_RESULT_FAILED_PRECONDITION;
+                                        nullptr, &num_bytes, nullptr,
+                                        &num_handles);
+  if (result == IPCZ_RESULT_FAILED_PRECONDITION) {
+    return false;
+  }
+
+  size_hint_ = SizeHint{num_bytes, num_handles};
+  return true;
 }
 
 Ref<ParcelWrapper> ApplicationObject::Serialize(NodeLink& link) {
-  ABSL_ASSERT(IsSerializable());
-
-  auto parcel = std::make_unique<Parcel>();
-  size_t num_bytes = 0;
-  size_t num_handles = 0;
-  const IpczResult query_result =
-      serializer_(object(), IPCZ_NO_FLAGS, nullptr, nullptr, &num_bytes,
-                  nullptr, &num_handles);
-  if (query_result == IPCZ_RESULT_RESOURCE_EXHAUSTED) {
+  ABSL_ASSERT(serializer_);
+
+  // Reserve capacity for the serialized object and let the serializer fill it
+  // in place, much like a two-phase BeginPut() and EndPut(). Without a size
+  // hint, or if the object's requirements have grown since the hint was taken,
+  // the first attempt fails with the actual requirements and we try once more.
+  size_t num_bytes = size_hint_ ? size_hint_->num_bytes : 0;
+  size_t num_handles = size_hint_ ? size_hint_->num_handles : 0;
+  constexpr size_t kMaxAttempts = 2;
+  for (size_t attempt = 0; attempt < kMaxAttempts; ++attempt) {
+    auto parcel = std::make_unique<Parcel>();
     parcel->AllocateData(num_bytes, /*allow_partial=*/false, &link.memory());
     std::vector<IpczHandle> handles(num_handles);
-    const IpczResult serialize_result = serializer_(
+    const IpczResult result = serializer_(
         object(), IPCZ_NO_FLAGS, nullptr, parcel->data_view().data(),
         &num_bytes, handles.data(), &num_handles);
-    if (serialize_result != IPCZ_RESULT_OK) {
+    if (result == IPCZ_RESULT_RESOURCE_EXHAUSTED) {
+      continue;
+    }
+    if (result != IPCZ_RESULT_OK) {
       return nullptr;
     }
-    parcel->CommitData(num_bytes);
 
+    parcel->CommitData(num_bytes);
     std::vector<Ref<APIObject>> objects(num_handles);
     for (size_t i = 0; i < num_handles; ++i) {
       objects[i] = APIObject::TakeFromHandle(handles[i]);
     }
     parcel->SetObjects(std::move(objects));
-  } else if (query_result != IPCZ_RESULT_OK) {
-    return nullptr;
+    return MakeRefCounted<ParcelWrapper>(std::move(parcel));
   }
 
-  return MakeRefCounted<ParcelWrapper>(std::move(parcel));
+  return nullptr;
 }
 
 }  // namespace ipcz
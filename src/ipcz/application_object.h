@@ -51,22 +51,35 @@ class ApplicationObject {
   // destructor.
   uintptr_t ReleaseObject();
 
-  // Indicates whether this object can be serialized by ipcz.
-  bool IsSerializable() const;
+  // Indicates whether this object can be serialized by ipcz. This queries the
+  // object's serializer, and the capacity requirements it reports are retained
+  // as a hint for a subsequent Serialize() call.
+  bool IsSerializable();
 
   // Serializes this object into a new Parcel to be transmitted across `link`.
   // Returns the wrapped new parcel, or null on failure. Note that this does
   // *not* invoke the object's destructor, which is still slated for invocation
   // when the ApplicationObject is reset or destroyed.
   //
+  // Parcel data is allocated from `link`'s memory where possible, and the
+  // serializer writes directly into it. If IsSerializable() was called first,
+  // its size hint usually allows the serializer to be invoked only once here.
+  //
   // Must only be called on objects which are known to be serializable.
   Ref<ParcelWrapper> Serialize(NodeLink& link);
 
  private:
+  // Capacity requirements last reported by this object's serializer.
+  struct SizeHint {
+    size_t num_bytes;
+    size_t num_handles;
+  };
+
   // Null iff this ApplicationObject has been moved-from.
   std::optional<uintptr_t> object_;
   const IpczApplicationObjectSerializer serializer_;
   const IpczApplicationObjectDestructor destructor_;
+  std::optional<SizeHint> size_hint_;
 };
 
 }  // namespace ipcz
@@ -89,6 +89,22 @@ void BlockAllocator::InitializeRegion() const {
 }
 
 void* BlockAllocator::Allocate() const {
+  return AllocateImpl(nullptr);
+}
+
+bool BlockAllocator::Free(void* ptr) const {
+  return FreeImpl(ptr, nullptr);
+}
+
+void* BlockAllocator::Allocate(size_t& num_retries) const {
+  return AllocateImpl(&num_retries);
+}
+
+bool BlockAllocator::Free(void* ptr, size_t& num_retries) const {
+  return FreeImpl(ptr, &num_retries);
+}
+
+void* BlockAllocator::AllocateImpl(size_t* num_retries) const {
   BlockHeader front =
       block_header_at(kFrontBlockIndex).load(std::memory_order_relaxed);
   for (;;) {
@@ -141,10 +157,13 @@ void* BlockAllocator::Allocate() const {
     // Another thread must have modified the front block header since we fetched
     // it above. `front` now has a newly updated copy, so we loop around again
     // to retry allocation.
+    if (num_retries) {
+      ++*num_retries;
+    }
   }
 }
 
-bool BlockAllocator::Free(void* ptr) const {
+bool BlockAllocator::FreeImpl(void* ptr, size_t* num_retries) const {
   // Derive a block index from the given address, relative to the start of this
   // allocator's managed region.
   const int16_t new_free_index =
@@ -158,7 +177,7 @@ bool BlockAllocator::Free(void* ptr) const {
   FreeBlock free_block = free_block_at(new_free_index);
   BlockHeader front =
       block_header_at(kFrontBlockIndex).load(std::memory_order_relaxed);
-  do {
+  for (;;) {
     const int16_t first_free_index =
         ForBaseIndex(kFrontBlockIndex).GetAbsoluteFromRelativeIndex(front.next);
     if (!is_index_valid(first_free_index)) {
@@ -177,9 +196,14 @@ bool BlockAllocator::Free(void* ptr) const {
     // effectively freed. Upon failure, `front` will have an updated copy of
     // the front block header, so we can loop around and try to insert the freed
     // block again.
-  } while (!TryUpdateFrontHeader(front, new_free_index));
+    if (TryUpdateFrontHeader(front, new_free_index)) {
+      return true;
+    }
 
-  return true;
+    if (num_retries) {
+      ++*num_retries;
+    }
+  }
 }
 
 bool BlockAllocator::TryUpdateFrontHeader(BlockHeader& last_known_header,
@@ -67,6 +67,13 @@ class BlockAllocator {
   // Failure implies that `ptr` was not a valid block to free.
   bool Free(void* ptr) const;
 
+  // Same as Allocate() and Free() above, but each also increments
+  // `num_retries` once for every time the operation lost a race with another
+  // allocator to update the free-list and had to start over. Used to measure
+  // contention on a shared region.
+  void* Allocate(size_t& num_retries) const;
+  bool Free(void* ptr, size_t& num_retries) const;
+
  private:
   // For a region of N bytes with a block size B, BlockAllocator divides the
   // region into `N/B` contiguous blocks with this BlockHeader structure at the
@@ -143,6 +150,11 @@ class BlockAllocator {
   bool TryUpdateFrontHeader(BlockHeader& last_known_header,
                             int16_t first_free_block) const;
 
+  // Implementations of Allocate() and Free(). If `num_retries` is non-null, it
+  // is incremented each time the operation must be retried.
+  void* AllocateImpl(size_t* num_retries) const;
+  bool FreeImpl(void* ptr, size_t* num_retries) const;
+
   int16_t last_block_index() const { return num_blocks_ - 1; }
 
   bool is_index_valid(int16_t index) const {
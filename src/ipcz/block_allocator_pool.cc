@@ -83,6 +83,7 @@ Fragment BlockAllocatorPool::Allocate() {
                                             std::memory_order_relaxed);
       }
 
+      num_blocks_allocated_.fetch_add(1, std::memory_order_relaxed);
       FragmentDescriptor descriptor(
           entry->buffer_id, checked_cast<uint32_t>(offset),
           checked_cast<uint32_t>(allocator.block_size()));
@@ -110,7 +111,12 @@ bool BlockAllocatorPool::Free(const Fragment& fragment) {
     entry = it->second;
   }
 
-  return entry->allocator.Free(fragment.address());
+  if (!entry->allocator.Free(fragment.address())) {
+    return false;
+  }
+
+  num_blocks_freed_.fetch_add(1, std::memory_order_relaxed);
+  return true;
 }
 
 BlockAllocatorPool::Entry::Entry(BufferId buffer_id,
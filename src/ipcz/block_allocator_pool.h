@@ -36,6 +36,15 @@ class BlockAllocatorPool {
   // this counts all blocks, including ones which are currently allocated.
   size_t GetCapacity();
 
+  // The number of blocks allocated and freed through this pool so far. These
+  // are diagnostic counters, so they're loaded without synchronization.
+  uint64_t num_blocks_allocated() const {
+    return num_blocks_allocated_.load(std::memory_order_relaxed);
+  }
+  uint64_t num_blocks_freed() const {
+    return num_blocks_freed_.load(std::memory_order_relaxed);
+  }
+
   // Registers a new allocator. `buffer_memory` is the entire mapped region
   // associated with `buffer_id`, not just the subspan managed by `allocator`.
   //
@@ -86,6 +95,10 @@ class BlockAllocatorPool {
   // An atomic cache of the most recently used Entry, for fast unsynchronized
   // access in the common case.
   std::atomic<Entry*> active_entry_{nullptr};
+
+  // See num_blocks_allocated() and num_blocks_freed().
+  std::atomic<uint64_t> num_blocks_allocated_{0};
+  std::atomic<uint64_t> num_blocks_freed_{0};
 };
 
 }  // namespace ipcz
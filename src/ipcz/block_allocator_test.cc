@@ -59,6 +59,28 @@ TEST_F(BlockAllocatorTest, Basic) {
   }
 }
 
+TEST_F(BlockAllocatorTest, RetryCounting) {
+  // The retry-counting overloads of Allocate() and Free() must otherwise behave
+  // exactly like their plain counterparts. Note that without contention there
+  // should be no retries, but a weak compare/exchange is allowed to fail
+  // spuriously, so the count itself is not verified here.
+  size_t num_retries = 0;
+  std::set<void*> blocks;
+  for (size_t i = 0; i < allocator().capacity(); ++i) {
+    void* block = allocator().Allocate(num_retries);
+    ASSERT_TRUE(block);
+    auto [it, inserted] = blocks.insert(block);
+    EXPECT_TRUE(inserted);
+  }
+  EXPECT_FALSE(allocator().Allocate(num_retries));
+
+  for (void* block : blocks) {
+    EXPECT_TRUE(allocator().Free(block, num_retries));
+  }
+  EXPECT_FALSE(allocator().Free(allocator().region().data(), num_retries));
+  EXPECT_TRUE(allocator().Allocate());
+}
+
 TEST_F(BlockAllocatorTest, AllocUseFreeRace) {
   // Spins up a worker thread to allocate new blocks and write to them
   // non-atomically, along with a separate worker thread to free them. This
@@ -100,6 +100,32 @@ bool BufferPool::AddBlockBuffer(
   return true;
 }
 
+size_t BufferPool::GetTotalBufferSize() {
+  absl::MutexLock lock(&mutex_);
+  size_t total_size = 0;
+  for (const auto& [id, mapping] : mappings_) {
+    total_size += mapping.bytes().size();
+  }
+  return total_size;
+}
+
+size_t BufferPool::QueryBlockStats(absl::Span<IpczBlockStats> stats) {
+  absl::MutexLock lock(&mutex_);
+  size_t num_block_sizes = 0;
+  for (const auto& [block_size, pool] : block_allocator_pools_) {
+    if (num_block_sizes == stats.size()) {
+      break;
+    }
+    stats[num_block_sizes++] = {
+        .block_size = block_size,
+        .capacity = pool->GetCapacity(),
+        .num_allocated = pool->num_blocks_allocated(),
+        .num_freed = pool->num_blocks_freed(),
+    };
+  }
+  return num_block_sizes;
+}
+
 size_t BufferPool::GetTotalBlockCapacity(size_t block_size) {
   BlockAllocatorPool* pool;
   {
@@ -135,6 +161,31 @@ Fragment BufferPool::AllocateBlock(size_t block_size) {
   return pool->Allocate();
 }
 
+size_t BufferPool::AllocateBlocks(size_t block_size,
+                                  absl::Span<Fragment> fragments) {
+  ABSL_ASSERT(absl::has_single_bit(block_size));
+
+  BlockAllocatorPool* pool;
+  {
+    absl::MutexLock lock(&mutex_);
+    auto it = block_allocator_pools_.lower_bound(block_size);
+    if (it == block_allocator_pools_.end()) {
+      return 0;
+    }
+    pool = it->second.get();
+  }
+
+  size_t num_allocated = 0;
+  for (Fragment& fragment : fragments) {
+    fragment = pool->Allocate();
+    if (fragment.is_null()) {
+      break;
+    }
+    ++num_allocated;
+  }
+  return num_allocated;
+}
+
 Fragment BufferPool::AllocateBlockBestEffort(size_t preferred_block_size) {
   ABSL_ASSERT(absl::has_single_bit(preferred_block_size));
 
@@ -14,6 +14,7 @@
 #include "ipcz/driver_memory_mapping.h"
 #include "ipcz/fragment.h"
 #include "ipcz/fragment_descriptor.h"
+#include "ipcz/ipcz.h"
 #include "third_party/abseil-cpp/absl/container/flat_hash_map.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
 #include "third_party/abseil-cpp/absl/types/span.h"
@@ -62,6 +63,14 @@ class BufferPool {
                       DriverMemoryMapping mapping,
                       absl::Span<const BlockAllocator> block_allocators);
 
+  // Returns the total size in bytes of all buffers registered with this pool.
+  size_t GetTotalBufferSize();
+
+  // Fills `stats` with figures for each block size supported by this pool, in
+  // increasing order of block size, up to the size of `stats`. Returns the
+  // number of elements populated.
+  size_t QueryBlockStats(absl::Span<IpczBlockStats> stats);
+
   // Returns the total size in bytes of capacity available across all registered
   // BlockAllocators for the given `block_size`.
   size_t GetTotalBlockCapacity(size_t block_size);
@@ -72,6 +81,11 @@ class BufferPool {
   // allocation request, this returns a null Fragment.
   Fragment AllocateBlock(size_t block_size);
 
+  // Like AllocateBlock(), but fills `fragments` with up to `fragments.size()`
+  // blocks in one pass, resolving the allocator pool only once. Returns the
+  // number of blocks allocated, which are stored at the front of `fragments`.
+  size_t AllocateBlocks(size_t block_size, absl::Span<Fragment> fragments);
+
   // Similar to AllocateFragment(), but this may allocate less space than
   // requested if that's all that's available. May still return a null Fragment
   // if the BufferPool has trouble finding available memory.
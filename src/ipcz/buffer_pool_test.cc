@@ -107,6 +107,26 @@ TEST_F(BufferPoolTest, AddBlockBufferRequireBlockSizePowerOfTwo) {
   EXPECT_TRUE(fragment.is_pending());
 }
 
+TEST_F(BufferPoolTest, GetTotalBufferSize) {
+  constexpr size_t kBufferSize1 = 4096;
+  constexpr size_t kBufferSize2 = 2048;
+  constexpr size_t kBlockSize = 64;
+  BufferPool pool;
+  EXPECT_EQ(0u, pool.GetTotalBufferSize());
+
+  DriverMemoryMapping mapping1 = AllocateDriverMemory(kBufferSize1);
+  const BlockAllocator allocators1[] = {{mapping1.bytes(), kBlockSize}};
+  EXPECT_TRUE(
+      pool.AddBlockBuffer(BufferId(0), std::move(mapping1), allocators1));
+  EXPECT_EQ(kBufferSize1, pool.GetTotalBufferSize());
+
+  DriverMemoryMapping mapping2 = AllocateDriverMemory(kBufferSize2);
+  const BlockAllocator allocators2[] = {{mapping2.bytes(), kBlockSize}};
+  EXPECT_TRUE(
+      pool.AddBlockBuffer(BufferId(1), std::move(mapping2), allocators2));
+  EXPECT_EQ(kBufferSize1 + kBufferSize2, pool.GetTotalBufferSize());
+}
+
 TEST_F(BufferPoolTest, GetFragment) {
   constexpr size_t kBufferSize1 = 4096;
   constexpr size_t kBufferSize2 = 2048;
@@ -215,6 +235,80 @@ TEST_F(BufferPoolTest, BasicBlockAllocation) {
   }
 }
 
+TEST_F(BufferPoolTest, QueryBlockStats) {
+  constexpr size_t kBufferSize = 4096;
+  constexpr size_t kSmallBlockSize = 64;
+  constexpr size_t kLargeBlockSize = 512;
+
+  auto mapping = AllocateDriverMemory(kBufferSize);
+  auto bytes = mapping.bytes();
+  const size_t half_size = bytes.size() / 2;
+  BlockAllocator allocators[] = {
+      {bytes.first(half_size), kLargeBlockSize},
+      {bytes.subspan(half_size), kSmallBlockSize},
+  };
+  for (const BlockAllocator& allocator : allocators) {
+    allocator.InitializeRegion();
+  }
+
+  BufferPool pool;
+  EXPECT_TRUE(pool.AddBlockBuffer(BufferId(0), std::move(mapping), allocators));
+
+  const Fragment first = pool.AllocateBlock(kSmallBlockSize);
+  const Fragment second = pool.AllocateBlock(kSmallBlockSize);
+  ASSERT_FALSE(first.is_null());
+  ASSERT_FALSE(second.is_null());
+  EXPECT_TRUE(pool.FreeBlock(first));
+
+  // Stats are ordered by block size, and only as many as requested are
+  // populated.
+  IpczBlockStats stats[3] = {};
+  ASSERT_EQ(2u, pool.QueryBlockStats(stats));
+  EXPECT_EQ(kSmallBlockSize, stats[0].block_size);
+  EXPECT_EQ(kSmallBlockSize * allocators[1].capacity(), stats[0].capacity);
+  EXPECT_EQ(2u, stats[0].num_allocated);
+  EXPECT_EQ(1u, stats[0].num_freed);
+  EXPECT_EQ(kLargeBlockSize, stats[1].block_size);
+  EXPECT_EQ(kLargeBlockSize * allocators[0].capacity(), stats[1].capacity);
+  EXPECT_EQ(0u, stats[1].num_allocated);
+  EXPECT_EQ(0u, stats[1].num_freed);
+
+  ASSERT_EQ(1u, pool.QueryBlockStats(absl::MakeSpan(stats, 1)));
+  EXPECT_EQ(kSmallBlockSize, stats[0].block_size);
+}
+
+TEST_F(BufferPoolTest, BatchBlockAllocation) {
+  constexpr size_t kBufferSize = 4096;
+  constexpr size_t kBlockSize = 64;
+
+  auto mapping = AllocateDriverMemory(kBufferSize);
+  BlockAllocator allocator(mapping.bytes(), kBlockSize);
+  allocator.InitializeRegion();
+
+  BufferPool pool;
+  EXPECT_TRUE(
+      pool.AddBlockBuffer(BufferId(0), std::move(mapping), {&allocator, 1}));
+
+  // No allocator can satisfy blocks this large.
+  std::vector<Fragment> fragments(4);
+  EXPECT_EQ(0u,
+            pool.AllocateBlocks(kBufferSize * 2, absl::MakeSpan(fragments)));
+
+  // A batch larger than the available capacity is partially filled.
+  fragments.resize(allocator.capacity() + 4);
+  EXPECT_EQ(allocator.capacity(),
+            pool.AllocateBlocks(kBlockSize, absl::MakeSpan(fragments)));
+  for (size_t i = 0; i < allocator.capacity(); ++i) {
+    EXPECT_FALSE(fragments[i].is_null());
+    EXPECT_EQ(kBlockSize, fragments[i].size());
+  }
+  EXPECT_TRUE(fragments[allocator.capacity()].is_null());
+
+  for (size_t i = 0; i < allocator.capacity(); ++i) {
+    EXPECT_TRUE(pool.FreeBlock(fragments[i]));
+  }
+}
+
 TEST_F(BufferPoolTest, BlockAllocationSizing) {
   constexpr size_t kBufferSize = 4096;
   DriverMemoryMapping mapping1 = AllocateDriverMemory(kBufferSize);
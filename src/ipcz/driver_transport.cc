@@ -4,6 +4,7 @@
 
 #include "ipcz/driver_transport.h"
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
@@ -11,6 +12,7 @@
 #include "ipcz/ipcz.h"
 #include "ipcz/message.h"
 #include "ipcz/node.h"
+#include "ipcz/transport_capture.h"
 #include "third_party/abseil-cpp/absl/base/macros.h"
 #include "third_party/abseil-cpp/absl/types/span.h"
 #include "util/ref_counted.h"
@@ -51,10 +53,15 @@ IpczResult IPCZ_API NotifyTransport(IpczHandle listener,
   return IPCZ_RESULT_OK;
 }
 
+uint64_t GenerateTransportId() {
+  static std::atomic<uint64_t> next_id{1};
+  return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
 }  // namespace
 
 DriverTransport::DriverTransport(DriverObject transport)
-    : transport_(std::move(transport)) {}
+    : id_(GenerateTransportId()), transport_(std::move(transport)) {}
 
 DriverTransport::~DriverTransport() = default;
 
@@ -116,6 +123,8 @@ IpczResult DriverTransport::Transmit(Message& message) {
   const absl::Span<const uint8_t> data = message.data_view();
   const absl::Span<const IpczDriverHandle> handles =
       message.transmissible_driver_handles();
+  TransportCapture::RecordMessage(TransportCaptureRecord::Type::kTransmit,
+                                  *this, data, handles.size());
   return transport_.driver()->Transmit(transport_.handle(), data.data(),
                                        data.size(), handles.data(),
                                        handles.size(), IPCZ_NO_FLAGS, nullptr);
@@ -123,6 +132,9 @@ IpczResult DriverTransport::Transmit(Message& message) {
 
 bool DriverTransport::Notify(const RawMessage& message) {
   ABSL_ASSERT(listener_);
+  TransportCapture::RecordMessage(TransportCaptureRecord::Type::kReceive,
+                                  *this, message.data, message.handles.size());
+
   // Listener methods may set a new Listener on this DriverTransport, and that
   // may drop their own last reference. Keep a reference here to ensure this
   // Listener remains alive through the extent of its notification.
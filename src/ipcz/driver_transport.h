@@ -76,6 +76,10 @@ class DriverTransport
   // are mutually exclusive).
   void set_listener(Ref<Listener> listener) { listener_ = std::move(listener); }
 
+  // A process-unique identifier for this transport, used to tell transports
+  // apart in diagnostics such as TransportCapture.
+  uint64_t id() const { return id_; }
+
   // Exposes the underlying driver handle for this transport.
   const DriverObject& driver_object() const { return transport_; }
 
@@ -123,6 +127,7 @@ class DriverTransport
  private:
   ~DriverTransport() override;
 
+  const uint64_t id_;
   DriverObject transport_;
 
   Ref<Listener> listener_;
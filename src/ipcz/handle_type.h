@@ -27,9 +27,10 @@ enum class HandleType : uint32_t {
   kRelayedBoxedDriverObject = 2,
 
   // A placeholder for a box handle in a parcel with one or more associated
-  // subparcels. Subparcels are transmitted separately from the main parcel,
-  // and the main parcel is not available to the application until it all
-  // subparcels are collected internally.
+  // subparcels. Subparcels are either coalesced with the main parcel into a
+  // single AcceptCoalescedParcel message or transmitted separately from it. In
+  // the latter case the main parcel is not available to the application until
+  // all subparcels are collected internally.
   kBoxedSubparcel = 3,
 };
 
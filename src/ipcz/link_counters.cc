@@ -0,0 +1,130 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/link_counters.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace ipcz {
+
+namespace {
+
+// Hands out shard indices to threads round-robin, the first time each thread
+// records anything on any LinkCounters.
+std::atomic<size_t> next_thread_shard_index{0};
+
+size_t GetCurrentThreadShardIndex() {
+  thread_local const size_t index =
+      next_thread_shard_index.fetch_add(1, std::memory_order_relaxed) %
+      LinkCounters::kNumShards;
+  return index;
+}
+
+}  // namespace
+
+LinkCounters::LinkCounters() = default;
+
+LinkCounters::~LinkCounters() {
+  for (std::atomic<Shard*>& shard : shards_) {
+    delete shard.load(std::memory_order_relaxed);
+  }
+}
+
+void LinkCounters::RecordMessageSent(uint8_t message_id, size_t num_bytes) {
+  if (message_id >= IPCZ_MAX_MESSAGE_TYPES) {
+    return;
+  }
+  MessageCounters& counters = GetShardForCurrentThread().messages[message_id];
+  counters.num_sent.fetch_add(1, std::memory_order_relaxed);
+  counters.num_bytes_sent.fetch_add(num_bytes, std::memory_order_relaxed);
+}
+
+void LinkCounters::RecordMessageReceived(uint8_t message_id, size_t num_bytes) {
+  if (message_id >= IPCZ_MAX_MESSAGE_TYPES) {
+    return;
+  }
+  MessageCounters& counters = GetShardForCurrentThread().messages[message_id];
+  counters.num_received.fetch_add(1, std::memory_order_relaxed);
+  counters.num_bytes_received.fetch_add(num_bytes, std::memory_order_relaxed);
+}
+
+void LinkCounters::RecordMessageRelayed() {
+  GetShardForCurrentThread().num_messages_relayed.fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+void LinkCounters::RecordParcelSent(bool is_inlined) {
+  Shard& shard = GetShardForCurrentThread();
+  (is_inlined ? shard.num_inlined_parcels_sent
+              : shard.num_fragment_parcels_sent)
+      .fetch_add(1, std::memory_order_relaxed);
+}
+
+void LinkCounters::Query(IpczNodeLinkStats& stats) const {
+  stats.num_messages_sent = 0;
+  stats.num_bytes_sent = 0;
+  stats.num_messages_received = 0;
+  stats.num_bytes_received = 0;
+  stats.num_messages_relayed = 0;
+  stats.num_inlined_parcels_sent = 0;
+  stats.num_fragment_parcels_sent = 0;
+  for (IpczMessageStats& message_stats : stats.messages) {
+    message_stats = {};
+  }
+
+  for (const std::atomic<Shard*>& slot : shards_) {
+    const Shard* shard = slot.load(std::memory_order_acquire);
+    if (!shard) {
+      continue;
+    }
+    for (size_t i = 0; i < shard->messages.size(); ++i) {
+      const MessageCounters& counters = shard->messages[i];
+      IpczMessageStats& message_stats = stats.messages[i];
+      message_stats.num_sent +=
+          counters.num_sent.load(std::memory_order_relaxed);
+      message_stats.num_bytes_sent +=
+          counters.num_bytes_sent.load(std::memory_order_relaxed);
+      message_stats.num_received +=
+          counters.num_received.load(std::memory_order_relaxed);
+      message_stats.num_bytes_received +=
+          counters.num_bytes_received.load(std::memory_order_relaxed);
+    }
+    stats.num_messages_relayed +=
+        shard->num_messages_relayed.load(std::memory_order_relaxed);
+    stats.num_inlined_parcels_sent +=
+        shard->num_inlined_parcels_sent.load(std::memory_order_relaxed);
+    stats.num_fragment_parcels_sent +=
+        shard->num_fragment_parcels_sent.load(std::memory_order_relaxed);
+  }
+
+  for (const IpczMessageStats& message_stats : stats.messages) {
+    stats.num_messages_sent += message_stats.num_sent;
+    stats.num_bytes_sent += message_stats.num_bytes_sent;
+    stats.num_messages_received += message_stats.num_received;
+    stats.num_bytes_received += message_stats.num_bytes_received;
+  }
+}
+
+LinkCounters::Shard& LinkCounters::GetShardForCurrentThread() {
+  std::atomic<Shard*>& slot = shards_[GetCurrentThreadShardIndex()];
+  Shard* shard = slot.load(std::memory_order_acquire);
+  if (shard) {
+    return *shard;
+  }
+
+  // Another thread sharing this slot may race to allocate it. Only one
+  // allocation wins and the others are discarded.
+  auto new_shard = std::make_unique<Shard>();
+  if (slot.compare_exchange_strong(shard, new_shard.get(),
+                                   std::memory_order_acq_rel,
+                                   std::memory_order_acquire)) {
+    return *new_shard.release();
+  }
+  return *shard;
+}
+
+}  // namespace ipcz
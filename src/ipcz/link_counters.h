@@ -0,0 +1,76 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_LINK_COUNTERS_H_
+#define IPCZ_SRC_IPCZ_LINK_COUNTERS_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "ipcz/ipcz.h"
+
+namespace ipcz {
+
+// LinkCounters tracks the traffic counters a NodeLink reports through
+// QueryStats(). Every message sent or received on a link is counted, possibly
+// from many threads at once, so the counters are sharded: each thread updates
+// only its own cache-line-aligned shard with relaxed atomics, and Query() sums
+// across all shards. Totals are therefore only approximately consistent with
+// each other while traffic is in flight.
+//
+// Shards are allocated on first use, so a link which never carries traffic
+// costs no more than a small array of null pointers.
+class LinkCounters {
+ public:
+  // The maximum number of shards per instance. Threads beyond this many share
+  // shards round-robin.
+  static constexpr size_t kNumShards = 16;
+
+  LinkCounters();
+  LinkCounters(const LinkCounters&) = delete;
+  LinkCounters& operator=(const LinkCounters&) = delete;
+  ~LinkCounters();
+
+  // Counts a message of type `message_id` and `num_bytes` bytes as sent or
+  // received. Message IDs at or beyond IPCZ_MAX_MESSAGE_TYPES are ignored.
+  void RecordMessageSent(uint8_t message_id, size_t num_bytes);
+  void RecordMessageReceived(uint8_t message_id, size_t num_bytes);
+
+  // Counts a message relayed on behalf of the remote node.
+  void RecordMessageRelayed();
+
+  // Counts a parcel sent with its data either inlined or in a fragment.
+  void RecordParcelSent(bool is_inlined);
+
+  // Fills in the traffic counter fields of `stats` with the sum over all
+  // shards: the per-message counters and their totals, num_messages_relayed,
+  // num_inlined_parcels_sent and num_fragment_parcels_sent.
+  void Query(IpczNodeLinkStats& stats) const;
+
+ private:
+  struct MessageCounters {
+    std::atomic<uint64_t> num_sent{0};
+    std::atomic<uint64_t> num_bytes_sent{0};
+    std::atomic<uint64_t> num_received{0};
+    std::atomic<uint64_t> num_bytes_received{0};
+  };
+
+  struct alignas(64) Shard {
+    std::array<MessageCounters, IPCZ_MAX_MESSAGE_TYPES> messages;
+    std::atomic<uint64_t> num_messages_relayed{0};
+    std::atomic<uint64_t> num_inlined_parcels_sent{0};
+    std::atomic<uint64_t> num_fragment_parcels_sent{0};
+  };
+
+  // Returns the calling thread's shard, allocating it if necessary.
+  Shard& GetShardForCurrentThread();
+
+  std::array<std::atomic<Shard*>, kNumShards> shards_{};
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_LINK_COUNTERS_H_
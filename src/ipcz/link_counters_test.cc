@@ -0,0 +1,95 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/link_counters.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ipcz/ipcz.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace ipcz {
+namespace {
+
+using LinkCountersTest = testing::Test;
+
+std::unique_ptr<IpczNodeLinkStats> Query(const LinkCounters& counters) {
+  auto stats = std::make_unique<IpczNodeLinkStats>();
+  stats->size = sizeof(*stats);
+  counters.Query(*stats);
+  return stats;
+}
+
+TEST_F(LinkCountersTest, Empty) {
+  LinkCounters counters;
+  std::unique_ptr<IpczNodeLinkStats> stats = Query(counters);
+  EXPECT_EQ(0u, stats->num_messages_sent);
+  EXPECT_EQ(0u, stats->num_messages_received);
+  EXPECT_EQ(0u, stats->num_messages_relayed);
+  EXPECT_EQ(0u, stats->messages[3].num_sent);
+}
+
+TEST_F(LinkCountersTest, Record) {
+  LinkCounters counters;
+  counters.RecordMessageSent(3, 10);
+  counters.RecordMessageSent(3, 20);
+  counters.RecordMessageSent(5, 7);
+  counters.RecordMessageReceived(5, 8);
+  counters.RecordMessageRelayed();
+  counters.RecordParcelSent(/*is_inlined=*/true);
+  counters.RecordParcelSent(/*is_inlined=*/false);
+  counters.RecordParcelSent(/*is_inlined=*/false);
+
+  // Out-of-range message IDs are ignored.
+  counters.RecordMessageSent(IPCZ_MAX_MESSAGE_TYPES, 100);
+
+  std::unique_ptr<IpczNodeLinkStats> stats = Query(counters);
+  EXPECT_EQ(2u, stats->messages[3].num_sent);
+  EXPECT_EQ(30u, stats->messages[3].num_bytes_sent);
+  EXPECT_EQ(1u, stats->messages[5].num_sent);
+  EXPECT_EQ(1u, stats->messages[5].num_received);
+  EXPECT_EQ(8u, stats->messages[5].num_bytes_received);
+  EXPECT_EQ(3u, stats->num_messages_sent);
+  EXPECT_EQ(37u, stats->num_bytes_sent);
+  EXPECT_EQ(1u, stats->num_messages_received);
+  EXPECT_EQ(8u, stats->num_bytes_received);
+  EXPECT_EQ(1u, stats->num_messages_relayed);
+  EXPECT_EQ(1u, stats->num_inlined_parcels_sent);
+  EXPECT_EQ(2u, stats->num_fragment_parcels_sent);
+}
+
+TEST_F(LinkCountersTest, SumsAcrossThreads) {
+  // More threads than shards, so some threads share a shard.
+  constexpr size_t kNumThreads = LinkCounters::kNumShards * 2;
+  constexpr size_t kNumMessagesPerThread = 1000;
+  LinkCounters counters;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&] {
+      for (size_t j = 0; j < kNumMessagesPerThread; ++j) {
+        counters.RecordMessageSent(1, 4);
+        counters.RecordMessageReceived(2, 8);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  std::unique_ptr<IpczNodeLinkStats> stats = Query(counters);
+  constexpr uint64_t kTotal = kNumThreads * kNumMessagesPerThread;
+  EXPECT_EQ(kTotal, stats->messages[1].num_sent);
+  EXPECT_EQ(kTotal * 4, stats->messages[1].num_bytes_sent);
+  EXPECT_EQ(kTotal, stats->messages[2].num_received);
+  EXPECT_EQ(kTotal * 8, stats->messages[2].num_bytes_received);
+  EXPECT_EQ(kTotal, stats->num_messages_sent);
+  EXPECT_EQ(kTotal, stats->num_messages_received);
+}
+
+}  // namespace
+}  // namespace ipcz
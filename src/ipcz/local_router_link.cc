@@ -4,6 +4,7 @@
 
 #include "ipcz/local_router_link.h"
 
+#include <optional>
 #include <sstream>
 #include <utility>
 
@@ -168,6 +169,22 @@ void LocalRouterLink::Unlock() {
   state_->link_state().Unlock(side_);
 }
 
+bool LocalRouterLink::TryPublishRouteClosure(SequenceNumber sequence_length) {
+  // Closure is propagated synchronously between local peers, so there's never
+  // any benefit to deferring it.
+  return false;
+}
+
+bool LocalRouterLink::TryMarkSideIdle() {
+  return false;
+}
+
+void LocalRouterLink::MarkSideActive() {}
+
+std::optional<SequenceNumber> LocalRouterLink::GetPublishedRouteClosure() {
+  return std::nullopt;
+}
+
 bool LocalRouterLink::FlushOtherSideIfWaiting(const OperationContext& context) {
   const LinkSide other_side = side_.opposite();
   if (state_->link_state().ResetWaitingBit(other_side)) {
@@ -50,6 +50,10 @@ class LocalRouterLink : public RouterLink {
   bool TryLockForBypass(const NodeName& bypass_request_source) override;
   bool TryLockForClosure() override;
   void Unlock() override;
+  bool TryPublishRouteClosure(SequenceNumber sequence_length) override;
+  bool TryMarkSideIdle() override;
+  void MarkSideActive() override;
+  std::optional<SequenceNumber> GetPublishedRouteClosure() override;
   bool FlushOtherSideIfWaiting(const OperationContext& context) override;
   bool CanNodeRequestBypass(const NodeName& bypass_request_source) override;
   void BypassPeer(const OperationContext& context,
@@ -0,0 +1,112 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/message_dispatch_pool.h"
+
+#include <utility>
+
+#include "third_party/abseil-cpp/absl/base/macros.h"
+
+namespace ipcz {
+
+namespace {
+
+// The pool whose worker is running on the current thread, if any.
+thread_local const MessageDispatchPool* current_thread_pool = nullptr;
+
+}  // namespace
+
+MessageDispatchPool::MessageDispatchPool(size_t num_threads)
+    : workers_(num_threads) {
+  for (std::unique_ptr<Worker>& worker : workers_) {
+    worker = std::make_unique<Worker>();
+  }
+}
+
+MessageDispatchPool::~MessageDispatchPool() = default;
+
+// static
+Ref<MessageDispatchPool> MessageDispatchPool::Create(size_t num_threads) {
+  ABSL_ASSERT(num_threads > 0);
+  Ref<MessageDispatchPool> pool(kAdoptExistingRef,
+                                new MessageDispatchPool(num_threads));
+  for (std::unique_ptr<Worker>& worker : pool->workers_) {
+    worker->thread =
+        std::make_unique<std::thread>(&RunWorker, pool, worker.get());
+  }
+  return pool;
+}
+
+bool MessageDispatchPool::Post(uint64_t shard_key, Task&& task) {
+  Worker& worker = *workers_[shard_key % workers_.size()];
+  absl::MutexLock lock(&worker.mutex);
+  if (worker.is_shutting_down) {
+    return false;
+  }
+  worker.tasks.push_back(std::move(task));
+  return true;
+}
+
+bool MessageDispatchPool::IsCurrentThreadWorker() const {
+  return current_thread_pool == this;
+}
+
+// static
+bool MessageDispatchPool::IsCurrentThreadAnyWorker() {
+  return current_thread_pool != nullptr;
+}
+
+void MessageDispatchPool::ShutDown() {
+  {
+    absl::MutexLock lock(&shutdown_mutex_);
+    if (is_shut_down_) {
+      return;
+    }
+    is_shut_down_ = true;
+  }
+
+  for (std::unique_ptr<Worker>& worker : workers_) {
+    absl::MutexLock lock(&worker->mutex);
+    worker->is_shutting_down = true;
+  }
+
+  // Join each worker thread unless we're on it, in which case it's detached.
+  // Detachment is safe: each worker thread owns a reference to the pool as
+  // long as it's running, and it will terminate soon after this call returns.
+  for (std::unique_ptr<Worker>& worker : workers_) {
+    std::unique_ptr<std::thread> thread = std::move(worker->thread);
+    if (thread->get_id() == std::this_thread::get_id()) {
+      thread->detach();
+    } else {
+      thread->join();
+    }
+  }
+}
+
+// static
+void MessageDispatchPool::RunWorker(Ref<MessageDispatchPool> pool,
+                                    Worker* worker) {
+  current_thread_pool = pool.get();
+  for (;;) {
+    Task task;
+    {
+      absl::MutexLock lock(&worker->mutex);
+      worker->mutex.Await(absl::Condition(
+          +[](Worker* worker) ABSL_EXCLUSIVE_LOCKS_REQUIRED(worker->mutex) {
+            return !worker->tasks.empty() || worker->is_shutting_down;
+          },
+          worker));
+      if (worker->tasks.empty()) {
+        // Only reachable once shutting down and all tasks have been run.
+        break;
+      }
+      task = std::move(worker->tasks.front());
+      worker->tasks.pop_front();
+    }
+    std::move(task)();
+  }
+  current_thread_pool = nullptr;
+}
+
+}  // namespace ipcz
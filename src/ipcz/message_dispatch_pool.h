@@ -0,0 +1,78 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_MESSAGE_DISPATCH_POOL_H_
+#define IPCZ_SRC_IPCZ_MESSAGE_DISPATCH_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "third_party/abseil-cpp/absl/base/thread_annotations.h"
+#include "third_party/abseil-cpp/absl/functional/any_invocable.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "util/ref_counted.h"
+
+namespace ipcz {
+
+// A fixed pool of worker threads used by a Node to dispatch incoming messages
+// in parallel when configured to do so via IpczCreateNodeOptions. Each task is
+// posted with a shard key, and all tasks with the same key run in order on the
+// same worker thread.
+class MessageDispatchPool : public RefCounted<MessageDispatchPool> {
+ public:
+  using Task = absl::AnyInvocable<void() &&>;
+
+  // Creates a new pool with `num_threads` worker threads, which are started
+  // immediately. `num_threads` must be non-zero.
+  static Ref<MessageDispatchPool> Create(size_t num_threads);
+
+  // Schedules `task` to run on the worker thread which owns `shard_key`.
+  // Returns false if the pool has been shut down, in which case `task` is left
+  // untouched so the caller can still run it some other way.
+  bool Post(uint64_t shard_key, Task&& task);
+
+  // Indicates whether the calling thread is one of this pool's workers.
+  bool IsCurrentThreadWorker() const;
+
+  // Indicates whether the calling thread is a worker of any pool. Tasks must
+  // not block on anything which may need a later task to make progress, since
+  // that task may be queued on the same worker.
+  static bool IsCurrentThreadAnyWorker();
+
+  // Stops accepting new tasks and waits for all worker threads to finish their
+  // remaining tasks and terminate. If called from a worker thread, that thread
+  // is detached rather than joined and terminates soon after returning to its
+  // task loop.
+  void ShutDown();
+
+ private:
+  friend class RefCounted<MessageDispatchPool>;
+
+  struct Worker {
+    absl::Mutex mutex;
+    std::deque<Task> tasks ABSL_GUARDED_BY(mutex);
+    bool is_shutting_down ABSL_GUARDED_BY(mutex) = false;
+
+    // Only accessed by the thread which creates or shuts down the pool.
+    std::unique_ptr<std::thread> thread;
+  };
+
+  explicit MessageDispatchPool(size_t num_threads);
+  ~MessageDispatchPool();
+
+  static void RunWorker(Ref<MessageDispatchPool> pool, Worker* worker);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  absl::Mutex shutdown_mutex_;
+  bool is_shut_down_ ABSL_GUARDED_BY(shutdown_mutex_) = false;
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_MESSAGE_DISPATCH_POOL_H_
@@ -0,0 +1,103 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/message_dispatch_pool.h"
+
+#include <atomic>
+#include <vector>
+
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/synchronization/notification.h"
+#include "util/ref_counted.h"
+
+namespace ipcz {
+namespace {
+
+using MessageDispatchPoolTest = testing::Test;
+
+TEST_F(MessageDispatchPoolTest, TasksWithSameKeyRunInOrder) {
+  constexpr size_t kNumKeys = 8;
+  constexpr size_t kNumTasksPerKey = 100;
+  Ref<MessageDispatchPool> pool = MessageDispatchPool::Create(3);
+
+  absl::Mutex mutex;
+  std::vector<std::vector<size_t>> results(kNumKeys);
+  for (size_t i = 0; i < kNumTasksPerKey; ++i) {
+    for (size_t key = 0; key < kNumKeys; ++key) {
+      EXPECT_TRUE(pool->Post(key, [&, key, i] {
+        absl::MutexLock lock(&mutex);
+        results[key].push_back(i);
+      }));
+    }
+  }
+
+  pool->ShutDown();
+  absl::MutexLock lock(&mutex);
+  for (const std::vector<size_t>& key_results : results) {
+    ASSERT_EQ(kNumTasksPerKey, key_results.size());
+    for (size_t i = 0; i < kNumTasksPerKey; ++i) {
+      EXPECT_EQ(i, key_results[i]);
+    }
+  }
+}
+
+TEST_F(MessageDispatchPoolTest, TasksRunOnWorkerThreads) {
+  Ref<MessageDispatchPool> pool = MessageDispatchPool::Create(2);
+  EXPECT_FALSE(pool->IsCurrentThreadWorker());
+  EXPECT_FALSE(MessageDispatchPool::IsCurrentThreadAnyWorker());
+
+  std::atomic<bool> ran_on_worker{false};
+  EXPECT_TRUE(pool->Post(0, [&] {
+    ran_on_worker = pool->IsCurrentThreadWorker() &&
+                    MessageDispatchPool::IsCurrentThreadAnyWorker();
+  }));
+  pool->ShutDown();
+  EXPECT_TRUE(ran_on_worker);
+}
+
+TEST_F(MessageDispatchPoolTest, ShutDownRunsPendingTasks) {
+  Ref<MessageDispatchPool> pool = MessageDispatchPool::Create(1);
+  absl::Notification unblock;
+  std::atomic<size_t> num_tasks_run{0};
+  EXPECT_TRUE(pool->Post(0, [&] {
+    unblock.WaitForNotification();
+    ++num_tasks_run;
+  }));
+  EXPECT_TRUE(pool->Post(0, [&] { ++num_tasks_run; }));
+  unblock.Notify();
+  pool->ShutDown();
+  EXPECT_EQ(2u, num_tasks_run);
+
+  // No more tasks are accepted once shut down.
+  EXPECT_FALSE(pool->Post(0, [&] { ++num_tasks_run; }));
+}
+
+TEST_F(MessageDispatchPoolTest, ShutDownFromWorker) {
+  Ref<MessageDispatchPool> pool = MessageDispatchPool::Create(2);
+  absl::Notification done;
+  EXPECT_TRUE(pool->Post(1, [&] {
+    pool->ShutDown();
+    done.Notify();
+  }));
+  done.WaitForNotification();
+  EXPECT_FALSE(pool->Post(0, [] {}));
+}
+
+TEST_F(MessageDispatchPoolTest, RejectedTaskIsNotDiscarded) {
+  Ref<MessageDispatchPool> pool = MessageDispatchPool::Create(1);
+  pool->ShutDown();
+
+  // A task rejected by a shut-down pool remains intact and can still be run by
+  // the caller.
+  bool ran = false;
+  MessageDispatchPool::Task task = [&] { ran = true; };
+  EXPECT_FALSE(pool->Post(0, std::move(task)));
+  ASSERT_TRUE(task);
+  std::move(task)();
+  EXPECT_TRUE(ran);
+}
+
+}  // namespace
+}  // namespace ipcz
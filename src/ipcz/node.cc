@@ -4,6 +4,7 @@
 
 #include "ipcz/node.h"
 
+#include <iterator>
 #include <optional>
 #include <utility>
 #include <vector>
@@ -14,10 +15,13 @@
 #include "ipcz/node_connector.h"
 #include "ipcz/node_link.h"
 #include "ipcz/node_link_memory.h"
+#include "ipcz/parcel_trace.h"
 #include "ipcz/router.h"
+#include "ipcz/transport_capture.h"
 #include "third_party/abseil-cpp/absl/base/macros.h"
 #include "third_party/abseil-cpp/absl/container/inlined_vector.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
 #include "third_party/abseil-cpp/absl/types/span.h"
 #include "util/log.h"
 #include "util/ref_counted.h"
@@ -92,7 +96,13 @@ class Node::PendingIntroduction {
 Node::Node(Type type,
            const IpczDriver& driver,
            const IpczCreateNodeOptions* options)
-    : type_(type), driver_(driver), options_(CopyOrUseDefaultOptions(options)) {
+    : type_(type),
+      driver_(driver),
+      options_(CopyOrUseDefaultOptions(options)),
+      dispatch_pool_(options_.num_dispatch_threads > 0
+                         ? MessageDispatchPool::Create(
+                               options_.num_dispatch_threads)
+                         : nullptr) {
   if (type_ == Type::kBroker) {
     // Only brokers assign their own names.
     assigned_name_ = GenerateRandomName();
@@ -100,12 +110,44 @@ Node::Node(Type type,
   } else {
     DVLOG(4) << "Created new non-broker node " << this;
   }
+
+  if (options_.transport_capture_file) {
+    is_capturing_transports_ = TransportCapture::StartToFile(
+        options_.transport_capture_file, options_.transport_capture_max_bytes);
+  }
+
+  if (options_.parcel_trace_file) {
+    is_tracing_parcels_ = ParcelTracer::StartToFile(
+        options_.parcel_trace_file, options_.parcel_trace_max_slices);
+  }
+
+  if (options_.stats_publish_interval_ms > 0) {
+    stats_publisher_ = NodeStatsPublisher::Create(
+        *this, absl::Milliseconds(options_.stats_publish_interval_ms));
+  }
 }
 
 Node::~Node() = default;
 
 IpczResult Node::Close() {
+  // Stop publishing first, so the publisher doesn't hold onto any links while
+  // they're being deactivated.
+  stats_publisher_.reset();
+
   ShutDown();
+
+  // All links are now deactivated, so no new messages will be posted to the
+  // pool. Let it finish dispatching anything already received.
+  if (dispatch_pool_) {
+    dispatch_pool_->ShutDown();
+  }
+
+  if (is_capturing_transports_.exchange(false)) {
+    TransportCapture::Stop();
+  }
+  if (is_tracing_parcels_.exchange(false)) {
+    ParcelTracer::Stop();
+  }
   return IPCZ_RESULT_OK;
 }
 
@@ -220,6 +262,70 @@ Ref<NodeLink> Node::GetLink(const NodeName& name) {
   return it->second.link;
 }
 
+std::vector<Ref<NodeLink>> Node::GetLinks() {
+  absl::MutexLock lock(&mutex_);
+  std::vector<Ref<NodeLink>> links;
+  links.reserve(connections_.size());
+  for (const auto& [name, connection] : connections_) {
+    links.push_back(connection.link);
+  }
+  return links;
+}
+
+uint64_t Node::GetNumMessagesSent() {
+  absl::MutexLock lock(&mutex_);
+  uint64_t num_messages = num_messages_sent_by_dropped_links_;
+  for (const auto& [name, connection] : connections_) {
+    num_messages += connection.link->GetNumMessagesSent();
+  }
+  return num_messages;
+}
+
+size_t Node::GetTotalSharedMemorySize() {
+  absl::MutexLock lock(&mutex_);
+  size_t total_size = 0;
+  for (const auto& [name, connection] : connections_) {
+    total_size += connection.link->memory().GetTotalBufferSize();
+  }
+  return total_size;
+}
+
+void Node::QueryStats(IpczNodeStats& stats,
+                      std::vector<IpczNodeLinkStats>* link_stats) {
+  const std::vector<Ref<NodeLink>> links = GetLinks();
+
+  // A Router may be bound to sublinks on more than one link at once, e.g. while
+  // proxying, so only count each one once. The routers are all held until
+  // counting is done so that none of their addresses can be reused meanwhile.
+  std::vector<Ref<Router>> routers;
+  for (const Ref<NodeLink>& link : links) {
+    std::vector<Ref<Router>> link_routers = link->GetBoundRouters();
+    routers.insert(routers.end(), std::make_move_iterator(link_routers.begin()),
+                   std::make_move_iterator(link_routers.end()));
+  }
+  absl::flat_hash_set<Router*> unique_routers;
+  stats.num_links = links.size();
+  stats.num_routers = 0;
+  stats.num_proxies = 0;
+  for (const Ref<Router>& router : routers) {
+    if (!unique_routers.insert(router.get()).second) {
+      continue;
+    }
+    ++stats.num_routers;
+    if (router->IsProxy()) {
+      ++stats.num_proxies;
+    }
+  }
+
+  if (link_stats) {
+    link_stats->resize(links.size());
+    for (size_t i = 0; i < links.size(); ++i) {
+      (*link_stats)[i].size = sizeof(IpczNodeLinkStats);
+      links[i]->QueryStats((*link_stats)[i]);
+    }
+  }
+}
+
 NodeName Node::GenerateRandomName() const {
   NodeName name;
   IpczResult result =
@@ -483,6 +589,7 @@ void Node::DropConnection(const OperationContext& context,
     }
     link = std::move(it->second.link);
     connections_.erase(it);
+    num_messages_sent_by_dropped_links_ += link->GetNumMessagesSent();
 
     const NodeName& local_name = link->local_node_name();
     DVLOG(4) << "Node " << local_name.ToString() << " dropping "
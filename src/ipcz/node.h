@@ -5,6 +5,8 @@
 #ifndef IPCZ_SRC_IPCZ_NODE_H_
 #define IPCZ_SRC_IPCZ_NODE_H_
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <optional>
@@ -15,8 +17,10 @@
 #include "ipcz/driver_memory.h"
 #include "ipcz/ipcz.h"
 #include "ipcz/link_side.h"
+#include "ipcz/message_dispatch_pool.h"
 #include "ipcz/node_messages.h"
 #include "ipcz/node_name.h"
+#include "ipcz/node_stats_publisher.h"
 #include "ipcz/node_type.h"
 #include "ipcz/operation_context.h"
 #include "third_party/abseil-cpp/absl/container/flat_hash_map.h"
@@ -60,6 +64,16 @@ class Node : public APIObjectImpl<Node, APIObject::kNode> {
   const IpczDriver& driver() const { return driver_; }
   const IpczCreateNodeOptions& options() const { return options_; }
 
+  // The pool of threads used to dispatch incoming messages from this node's
+  // NodeLinks, or null if messages are dispatched inline on whatever thread
+  // the driver uses to notify ipcz of their arrival. See
+  // IpczCreateNodeOptions.num_dispatch_threads.
+  MessageDispatchPool* dispatch_pool() const { return dispatch_pool_.get(); }
+
+  // The publisher of this node's stats page, or null if the node doesn't
+  // publish one. See IpczCreateNodeOptions.stats_publish_interval_ms.
+  NodeStatsPublisher* stats_publisher() const { return stats_publisher_.get(); }
+
   // APIObject:
   IpczResult Close() override;
 
@@ -90,6 +104,24 @@ class Node : public APIObjectImpl<Node, APIObject::kNode> {
   // case where the caller only wants the underlying NodeLink.
   Ref<NodeLink> GetLink(const NodeName& name);
 
+  // Returns references to all of this node's NodeLinks.
+  std::vector<Ref<NodeLink>> GetLinks();
+
+  // Returns the total number of messages transmitted so far by all of this
+  // node's NodeLinks. This is a diagnostic figure meant for tests and
+  // benchmarks, and it is not cheap to compute.
+  uint64_t GetNumMessagesSent();
+
+  // Returns the total size in bytes of all shared memory currently mapped by
+  // this node's NodeLinks. Like GetNumMessagesSent(), this is diagnostic.
+  size_t GetTotalSharedMemorySize();
+
+  // Fills in `stats` with a snapshot of this node's statistics. If `link_stats`
+  // is non-null, it's also filled with one entry for each of the node's links.
+  // See QueryNodeStats() in the ipcz API.
+  void QueryStats(IpczNodeStats& stats,
+                  std::vector<IpczNodeLinkStats>* link_stats);
+
   // Generates a new random NodeName using this node's driver as a source of
   // randomness.
   NodeName GenerateRandomName() const;
@@ -189,6 +221,7 @@ class Node : public APIObjectImpl<Node, APIObject::kNode> {
   const Type type_;
   const IpczDriver& driver_;
   const IpczCreateNodeOptions options_;
+  const Ref<MessageDispatchPool> dispatch_pool_;
 
   absl::Mutex mutex_;
 
@@ -216,6 +249,10 @@ class Node : public APIObjectImpl<Node, APIObject::kNode> {
   using ConnectionMap = absl::flat_hash_map<NodeName, Connection>;
   ConnectionMap connections_ ABSL_GUARDED_BY(mutex_);
 
+  // Messages sent over NodeLinks which have since been dropped from
+  // `connections_`. See GetNumMessagesSent().
+  uint64_t num_messages_sent_by_dropped_links_ ABSL_GUARDED_BY(mutex_) = 0;
+
   // A map of other nodes to which this node is waiting for an introduction,
   // either from its own broker or (if we are a broker) all the other known
   // brokers we're connected to.
@@ -263,6 +300,22 @@ class Node : public APIObjectImpl<Node, APIObject::kNode> {
   // network. This map can only be non-empty on broker nodes.
   absl::flat_hash_map<NodeName, Ref<NodeLink>> other_brokers_
       ABSL_GUARDED_BY(mutex_);
+
+  // Whether this node started the process-wide transport capture, as requested
+  // by IpczCreateNodeOptions.transport_capture_file. If so, the capture is
+  // stopped when this node is closed.
+  std::atomic<bool> is_capturing_transports_{false};
+
+  // Whether this node started the process-wide parcel trace, as requested by
+  // IpczCreateNodeOptions.parcel_trace_file. If so, the trace is stopped and
+  // written out when this node is closed.
+  std::atomic<bool> is_tracing_parcels_{false};
+
+  // Publishes this node's statistics to shared memory, if enabled by
+  // IpczCreateNodeOptions.stats_publish_interval_ms. Its thread reads the rest
+  // of this Node's state, so this must be declared last in order to be
+  // destroyed first. It's only reset on closure or destruction of the Node.
+  std::unique_ptr<NodeStatsPublisher> stats_publisher_;
 };
 
 }  // namespace ipcz
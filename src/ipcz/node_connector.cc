@@ -18,6 +18,7 @@
 #include "ipcz/remote_router_link.h"
 #include "ipcz/router.h"
 #include "ipcz/sublink_id.h"
+#include "ipcz/trap_event_dispatcher.h"
 #include "third_party/abseil-cpp/absl/base/macros.h"
 #include "util/log.h"
 #include "util/ref_counted.h"
@@ -628,7 +629,9 @@ bool NodeConnector::ActivateTransport() {
 void NodeConnector::EstablishWaitingRouters(Ref<NodeLink> to_link,
                                             size_t max_valid_portals) {
   // All paths to this function come from a transport notification.
-  const OperationContext context{OperationContext::kTransportNotification};
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kTransportNotification,
+                                 dispatcher};
 
   ABSL_ASSERT(to_link != nullptr || max_valid_portals == 0);
   const size_t num_valid_portals =
@@ -12,25 +12,34 @@
 #include <limits>
 #include <optional>
 #include <utility>
+#include <vector>
 
 #include "ipcz/box.h"
+#include "ipcz/fragment.h"
 #include "ipcz/fragment_ref.h"
 #include "ipcz/ipcz.h"
 #include "ipcz/link_side.h"
 #include "ipcz/link_type.h"
 #include "ipcz/message.h"
+#include "ipcz/message_dispatch_pool.h"
 #include "ipcz/node.h"
 #include "ipcz/node_connector.h"
 #include "ipcz/node_link_memory.h"
 #include "ipcz/node_messages.h"
 #include "ipcz/operation_context.h"
 #include "ipcz/parcel.h"
+#include "ipcz/parcel_trace.h"
+#include "ipcz/parcel_wrapper.h"
 #include "ipcz/remote_router_link.h"
 #include "ipcz/router.h"
 #include "ipcz/router_link.h"
 #include "ipcz/router_link_state.h"
 #include "ipcz/sublink_id.h"
+#include "ipcz/subparcel_descriptor.h"
+#include "ipcz/trap_event_dispatcher.h"
 #include "third_party/abseil-cpp/absl/base/macros.h"
+#include "third_party/abseil-cpp/absl/container/inlined_vector.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
 #include "util/log.h"
 #include "util/ref_counted.h"
 #include "util/safe_math.h"
@@ -50,6 +59,55 @@ FragmentRef<T> MaybeAdoptFragmentRef(NodeLinkMemory& memory,
   return memory.AdoptFragmentRef<T>(memory.GetFragment(descriptor));
 }
 
+// If `message` only delivers parcel contents to a single route along its
+// NodeLink and may therefore be dispatched concurrently with messages for other
+// routes, this returns the SublinkId of that route. Otherwise returns null.
+//
+// Note that messages which alter route topology or lifetime (e.g. RouteClosed
+// or any of the proxy bypass messages) are never eligible: their handling may
+// depend on the state of other routes as established by messages previously
+// received on the same NodeLink, even when targeting a different sublink.
+std::optional<SublinkId> GetParallelDispatchSublink(Message& message) {
+  switch (message.header().message_id) {
+    case msg::AcceptParcel::kId: {
+      auto& accept = static_cast<msg::AcceptParcel&>(message);
+      // Any routers attached to the parcel will be bound to new sublinks when
+      // the parcel is accepted, and messages targeting those sublinks may
+      // follow immediately. So we can only defer dispatch if there are none.
+      if (!accept.GetArrayView<RouterDescriptor>(accept.params().new_routers)
+               .empty()) {
+        return std::nullopt;
+      }
+      return accept.params().sublink;
+    }
+    case msg::AcceptCoalescedParcel::kId: {
+      auto& accept = static_cast<msg::AcceptCoalescedParcel&>(message);
+      if (!accept.GetArrayView<RouterDescriptor>(accept.params().new_routers)
+               .empty()) {
+        return std::nullopt;
+      }
+      return accept.params().sublink;
+    }
+    case msg::AcceptParcelDriverObjects::kId:
+      return static_cast<msg::AcceptParcelDriverObjects&>(message)
+          .params()
+          .sublink;
+    default:
+      return std::nullopt;
+  }
+}
+
+// Reconstructs a message of type T from its serialized `data` and `objects`,
+// and dispatches it to `handler` on `link`.
+template <typename T>
+bool DeserializeAndDispatch(absl::Span<const uint8_t> data,
+                            absl::Span<DriverObject> objects,
+                            NodeLink& link,
+                            bool (NodeLink::*handler)(T&)) {
+  T message;
+  return message.DeserializeRelayed(data, objects) && (link.*handler)(message);
+}
+
 }  // namespace
 
 // static
@@ -141,37 +199,84 @@ Ref<RemoteRouterLink> NodeLink::AddRemoteRouterLink(
     return nullptr;
   }
 
-  auto [it, added] = sublinks_.try_emplace(
-      sublink, Sublink(std::move(link), std::move(router)));
-  if (!added) {
+  if (!sublinks_.Add(sublink, Sublink(link, std::move(router)))) {
     // The SublinkId provided here may have been received from another node and
     // may already be in use if the node is misbehaving.
     return nullptr;
   }
-  return it->second.router_link;
+  return link;
 }
 
 void NodeLink::RemoveRemoteRouterLink(SublinkId sublink) {
-  absl::MutexLock lock(&mutex_);
-  sublinks_.erase(sublink);
+  sublinks_.Remove(sublink);
+  StopForwardingSublink(sublink);
 }
 
 std::optional<NodeLink::Sublink> NodeLink::GetSublink(SublinkId sublink) {
+  return sublinks_.Get(sublink);
+}
+
+void NodeLink::QueryStats(IpczNodeLinkStats& stats) {
+  stats.remote_node_name_high = remote_node_name_.high();
+  stats.remote_node_name_low = remote_node_name_.low();
+  counters_.Query(stats);
+
+  stats.shared_memory_size = memory_->GetTotalBufferSize();
+  stats.num_pending_capacity_requests =
+      memory_->GetNumPendingCapacityRequests();
+  stats.num_block_sizes = memory_->QueryBlockStats(stats.blocks);
+
   absl::MutexLock lock(&mutex_);
-  auto it = sublinks_.find(sublink);
-  if (it == sublinks_.end()) {
-    return std::nullopt;
+  stats.num_partial_parcels = partial_parcels_.size();
+  stats.num_subparcel_trackers = subparcel_trackers_.size();
+}
+
+void NodeLink::RecordParcelSent(bool is_inlined) {
+  counters_.RecordParcelSent(is_inlined);
+}
+
+std::vector<Ref<Router>> NodeLink::GetBoundRouters() {
+  std::vector<Ref<Router>> routers;
+  for (Sublink& sublink : sublinks_.GetAll()) {
+    routers.push_back(std::move(sublink.receiver));
   }
-  return it->second;
+  return routers;
 }
 
 Ref<Router> NodeLink::GetRouter(SublinkId sublink) {
-  absl::MutexLock lock(&mutex_);
-  auto it = sublinks_.find(sublink);
-  if (it == sublinks_.end()) {
+  std::optional<Sublink> entry = sublinks_.Get(sublink);
+  if (!entry) {
     return nullptr;
   }
-  return it->second.receiver;
+  return std::move(entry->receiver);
+}
+
+void NodeLink::StartForwardingSublink(SublinkId sublink,
+                                      Ref<RemoteRouterLink> target) {
+  {
+    // Any replaced entry is released only after the lock, since it may hold
+    // the last reference to its link.
+    Ref<RemoteRouterLink> replaced_target;
+    absl::MutexLock lock(&forwarding_mutex_);
+    replaced_target =
+        std::exchange(forwarded_sublinks_[sublink], std::move(target));
+    has_forwarded_sublinks_.store(true, std::memory_order_relaxed);
+  }
+
+  // RemoveRemoteRouterLink() removes `sublink` before it stops forwarding, so
+  // if `sublink` is still bound here, the entry will be removed with it.
+  // Otherwise we must not leave it behind.
+  if (!sublinks_.Get(sublink)) {
+    StopForwardingSublink(sublink);
+  }
+}
+
+void NodeLink::StopForwardingSublink(SublinkId sublink) {
+  ForwardedSublinkMap::node_type removed_entry;
+  absl::MutexLock lock(&forwarding_mutex_);
+  removed_entry = forwarded_sublinks_.extract(sublink);
+  has_forwarded_sublinks_.store(!forwarded_sublinks_.empty(),
+                                std::memory_order_relaxed);
 }
 
 void NodeLink::AddBlockBuffer(BufferId id,
@@ -355,7 +460,9 @@ void NodeLink::Transmit(Message& message) {
   }
 
   message.header().sequence_number = GenerateOutgoingSequenceNumber();
+  const uint8_t message_id = message.header().message_id;
   transport_->Transmit(message);
+  counters_.RecordMessageSent(message_id, message.data_view().size());
 }
 
 SequenceNumber NodeLink::GenerateOutgoingSequenceNumber() {
@@ -363,6 +470,115 @@ SequenceNumber NodeLink::GenerateOutgoingSequenceNumber() {
       1, std::memory_order_relaxed));
 }
 
+bool NodeLink::DispatchDeferredMessage(uint8_t message_id,
+                                       absl::Span<const uint8_t> data,
+                                       absl::Span<DriverObject> objects) {
+  switch (message_id) {
+    case msg::AcceptParcel::kId:
+      return DeserializeAndDispatch(data, objects, *this,
+                                    &NodeLink::OnAcceptParcel);
+    case msg::AcceptParcelDriverObjects::kId:
+      return DeserializeAndDispatch(data, objects, *this,
+                                    &NodeLink::OnAcceptParcelDriverObjects);
+    case msg::AcceptCoalescedParcel::kId:
+      return DeserializeAndDispatch(data, objects, *this,
+                                    &NodeLink::OnAcceptCoalescedParcel);
+    default:
+      // Only the message types above are ever deferred.
+      ABSL_ASSERT(false);
+      return false;
+  }
+}
+
+bool NodeLink::OnMessage(Message& message) {
+  const uint8_t message_id = message.header().message_id;
+  counters_.RecordMessageReceived(message_id, message.data_view().size());
+
+  MessageDispatchPool* const pool = node_->dispatch_pool();
+  if (!pool || pool->IsCurrentThreadWorker()) {
+    return DispatchMessage(message);
+  }
+
+  const std::optional<SublinkId> sublink = GetParallelDispatchSublink(message);
+  if (!sublink) {
+    // This message may affect the state of multiple routes, or of the link
+    // itself. Wait for all deferred messages received so far on this link to
+    // be dispatched before dispatching it inline, so it's ordered against
+    // everything else the remote node has sent us.
+    WaitForDeferredMessages();
+    return DispatchMessage(message);
+  }
+
+  // Otherwise the message is dispatched on the pool thread which owns its
+  // sublink, preserving order among all messages for the same route. Since
+  // `message` lives on the caller's stack, its serialized data and driver
+  // objects are moved into the task, which reconstructs the message prior to
+  // dispatch. The message has already been validated at this point, so any
+  // failure from here on is treated like a transport error.
+  absl::InlinedVector<DriverObject, 2> objects;
+  for (DriverObject& object : message.driver_objects()) {
+    objects.push_back(std::move(object));
+  }
+  Message::ReceivedDataBuffer data = std::move(message).TakeReceivedData();
+  MessageDispatchPool::Task task =
+      [link = WrapRefCounted(this), message_id, data = std::move(data),
+       objects = std::move(objects)]() mutable {
+        if (!link->DispatchDeferredMessage(message_id, data.bytes(),
+                                           absl::MakeSpan(objects))) {
+          link->OnTransportError();
+        }
+        link->OnDeferredMessageDispatched();
+      };
+  {
+    absl::MutexLock lock(&deferred_messages_mutex_);
+    ++num_deferred_messages_;
+  }
+  if (!pool->Post(sublink->value(), std::move(task))) {
+    // The pool is shutting down with the node, so there's no worker left to
+    // own this sublink. Rather than drop the message, dispatch it here once
+    // any other messages deferred by this link have finished. The task is
+    // still counted, and it accounts for itself when run.
+    {
+      absl::MutexLock lock(&deferred_messages_mutex_);
+      deferred_messages_mutex_.Await(absl::Condition(
+          +[](size_t* num_deferred_messages) {
+            return *num_deferred_messages == 1;
+          },
+          &num_deferred_messages_));
+    }
+    std::move(task)();
+  }
+  return true;
+}
+
+void NodeLink::OnDeferredMessageDispatched() {
+  {
+    absl::MutexLock lock(&deferred_messages_mutex_);
+    ABSL_ASSERT(num_deferred_messages_ > 0);
+    --num_deferred_messages_;
+    if (num_deferred_messages_ > 0 || !has_deferred_transport_error_) {
+      return;
+    }
+    has_deferred_transport_error_ = false;
+  }
+
+  // This was the last message received before the link failed, so the failure
+  // can now be handled. See HandleTransportError().
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kTransportNotification,
+                                 dispatcher};
+  DisconnectAllSublinks(context);
+}
+
+void NodeLink::WaitForDeferredMessages() {
+  absl::MutexLock lock(&deferred_messages_mutex_);
+  deferred_messages_mutex_.Await(absl::Condition(
+      +[](size_t* num_deferred_messages) {
+        return *num_deferred_messages == 0;
+      },
+      &num_deferred_messages_));
+}
+
 bool NodeLink::OnReferNonBroker(msg::ReferNonBroker& refer) {
   if (remote_node_type_ != Node::Type::kNormal ||
       node()->type() != Node::Type::kBroker) {
@@ -517,6 +733,19 @@ bool NodeLink::OnAddBlockBuffer(msg::AddBlockBuffer& add) {
 }
 
 bool NodeLink::OnAcceptParcel(msg::AcceptParcel& accept) {
+  ScopedParcelTraceSlice trace_slice(ParcelTraceStage::kReceive, this,
+                                     accept.params().sequence_number);
+  if (trace_slice.is_recording() && accept.params().subparcel_index == 0) {
+    trace_slice.set_flow_id(ParcelTracer::GetFlowId(
+        remote_node_name_, local_node_name_, accept.params().sublink,
+        accept.params().sequence_number));
+  }
+
+  if (has_forwarded_sublinks_.load(std::memory_order_relaxed) &&
+      TryForwardParcel(accept)) {
+    return true;
+  }
+
   absl::Span<uint8_t> parcel_data =
       accept.GetArrayView<uint8_t>(accept.params().parcel_data);
   absl::Span<const HandleType> handle_types =
@@ -641,6 +870,182 @@ bool NodeLink::OnAcceptParcelDriverObjects(
   return AcceptParcelDriverObjects(accept.params().sublink, std::move(parcel));
 }
 
+bool NodeLink::OnAcceptCoalescedParcel(msg::AcceptCoalescedParcel& accept) {
+  ScopedParcelTraceSlice trace_slice(ParcelTraceStage::kReceive, this,
+                                     accept.params().sequence_number);
+  if (trace_slice.is_recording()) {
+    trace_slice.set_flow_id(ParcelTracer::GetFlowId(
+        remote_node_name_, local_node_name_, accept.params().sublink,
+        accept.params().sequence_number));
+  }
+
+  absl::Span<const SubparcelDescriptor> subparcels =
+      accept.GetArrayView<SubparcelDescriptor>(accept.params().subparcels);
+  absl::Span<uint8_t> parcel_data =
+      accept.GetArrayView<uint8_t>(accept.params().parcel_data);
+  absl::Span<const HandleType> handle_types =
+      accept.GetArrayView<HandleType>(accept.params().handle_types);
+  absl::Span<const RouterDescriptor> new_routers =
+      accept.GetArrayView<RouterDescriptor>(accept.params().new_routers);
+  auto driver_objects = accept.driver_objects();
+  if (subparcels.empty() ||
+      subparcels.size() > Parcel::kMaxSubparcelsPerParcel) {
+    return false;
+  }
+
+  // Deserialize every parcel in the message. As in OnAcceptParcel(), any
+  // deserialized objects are stored in a Parcel before validation failures are
+  // reported, so they're properly cleaned up.
+  const SublinkId for_sublink = accept.params().sublink;
+  const SequenceNumber sequence_number = accept.params().sequence_number;
+  std::vector<std::unique_ptr<Parcel>> parcels(subparcels.size());
+  absl::InlinedVector<FragmentDescriptor, 4> pending_fragments(
+      subparcels.size());
+  bool has_pending_fragments = false;
+  size_t num_subparcel_placeholders = 0;
+  for (size_t i = 0; i < subparcels.size(); ++i) {
+    const SubparcelDescriptor& descriptor = subparcels[i];
+    if (descriptor.num_handles > handle_types.size()) {
+      return false;
+    }
+
+    bool parcel_valid = true;
+    std::vector<Ref<APIObject>> objects(descriptor.num_handles);
+    for (size_t j = 0; j < objects.size(); ++j) {
+      switch (handle_types[j]) {
+        case HandleType::kPortal: {
+          if (new_routers.empty()) {
+            parcel_valid = false;
+            continue;
+          }
+
+          Ref<Router> new_router = Router::Deserialize(new_routers[0], *this);
+          if (!new_router) {
+            parcel_valid = false;
+            continue;
+          }
+
+          objects[j] = std::move(new_router);
+          new_routers.remove_prefix(1);
+          break;
+        }
+
+        case HandleType::kBoxedDriverObject: {
+          if (driver_objects.empty()) {
+            parcel_valid = false;
+            continue;
+          }
+
+          objects[j] = MakeRefCounted<Box>(std::move(driver_objects[0]));
+          driver_objects.remove_prefix(1);
+          break;
+        }
+
+        case HandleType::kBoxedSubparcel:
+          // Only the main parcel may have subparcels. Placeholders are filled
+          // in below once every parcel has been deserialized.
+          if (i > 0) {
+            parcel_valid = false;
+            continue;
+          }
+          objects[j] =
+              MakeRefCounted<Box>(MakeRefCounted<ParcelWrapper>(nullptr));
+          ++num_subparcel_placeholders;
+          break;
+
+        default:
+          parcel_valid = false;
+          break;
+      }
+    }
+    handle_types.remove_prefix(descriptor.num_handles);
+
+    auto& parcel = parcels[i];
+    parcel = std::make_unique<Parcel>(sequence_number);
+    parcel->SetObjects(std::move(objects));
+    if (!parcel_valid) {
+      return false;
+    }
+
+    if (!descriptor.data_fragment.is_null()) {
+      const Fragment fragment = memory().GetFragment(descriptor.data_fragment);
+      if (fragment.is_pending()) {
+        pending_fragments[i] = descriptor.data_fragment;
+        has_pending_fragments = true;
+      } else if (!parcel->AdoptDataFragment(WrapRefCounted(&memory()),
+                                            fragment)) {
+        return false;
+      }
+    } else if (i > 0) {
+      // Main parcel data is adopted from the message below. Subparcel data is
+      // copied out, since only one Parcel can own the message's storage.
+      const uint64_t end = uint64_t{descriptor.data_offset} +
+                           uint64_t{descriptor.data_size};
+      if (end > parcel_data.size()) {
+        return false;
+      }
+      parcel->AllocateData(descriptor.data_size, /*allow_partial=*/false,
+                           nullptr);
+      if (descriptor.data_size > 0) {
+        memcpy(parcel->data_view().data(),
+               parcel_data.data() + descriptor.data_offset,
+               descriptor.data_size);
+      }
+    }
+  }
+
+  if (!handle_types.empty() || !new_routers.empty() ||
+      !driver_objects.empty() ||
+      num_subparcel_placeholders != parcels.size() - 1) {
+    // Every handle, router and driver object must be claimed by some parcel,
+    // and the main parcel must claim every subparcel.
+    return false;
+  }
+
+  const SubparcelDescriptor& main_descriptor = subparcels[0];
+  if (main_descriptor.data_fragment.is_null()) {
+    const uint64_t end = uint64_t{main_descriptor.data_offset} +
+                         uint64_t{main_descriptor.data_size};
+    if (end > parcel_data.size()) {
+      return false;
+    }
+    parcels[0]->SetDataFromMessage(
+        std::move(accept).TakeReceivedData(),
+        parcel_data.subspan(main_descriptor.data_offset,
+                            main_descriptor.data_size));
+  }
+
+  if (has_pending_fragments) {
+    // Some parcel data lives in a buffer we don't have yet. In this rare case
+    // we fall back on collecting the parcels individually as if they were
+    // transmitted separately.
+    for (size_t i = 0; i < parcels.size(); ++i) {
+      parcels[i]->set_num_subparcels(parcels.size());
+      parcels[i]->set_subparcel_index(i);
+    }
+    for (size_t i = 0; i < parcels.size(); ++i) {
+      if (!pending_fragments[i].is_null()) {
+        WaitForParcelFragmentToResolve(for_sublink, std::move(parcels[i]),
+                                       pending_fragments[i],
+                                       /*is_split_parcel=*/false);
+      } else if (!AcceptCompleteParcel(for_sublink, std::move(parcels[i]))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Otherwise all parcels are complete and can be joined immediately.
+  size_t next_subparcel = 1;
+  for (auto& object : parcels[0]->objects_view()) {
+    Box* box = Box::FromObject(object.get());
+    if (box && box->type() == Box::Type::kSubparcel) {
+      box->subparcel()->SetParcel(std::move(parcels[next_subparcel++]));
+    }
+  }
+  return AcceptCompleteParcel(for_sublink, std::move(parcels[0]));
+}
+
 bool NodeLink::OnRouteClosed(msg::RouteClosed& route_closed) {
   std::optional<Sublink> sublink = GetSublink(route_closed.params().sublink);
   if (!sublink) {
@@ -650,7 +1055,9 @@ bool NodeLink::OnRouteClosed(msg::RouteClosed& route_closed) {
     return true;
   }
 
-  const OperationContext context{OperationContext::kTransportNotification};
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kTransportNotification,
+                                 dispatcher};
   return sublink->receiver->AcceptRouteClosureFrom(
       context, sublink->router_link->GetType(),
       route_closed.params().sequence_length);
@@ -665,7 +1072,9 @@ bool NodeLink::OnRouteDisconnected(msg::RouteDisconnected& route_closed) {
   DVLOG(4) << "Accepting RouteDisconnected at "
            << sublink->router_link->Describe();
 
-  const OperationContext context{OperationContext::kTransportNotification};
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kTransportNotification,
+                                 dispatcher};
   return sublink->receiver->AcceptRouteDisconnectedFrom(
       context, sublink->router_link->GetType());
 }
@@ -678,7 +1087,9 @@ bool NodeLink::OnBypassPeer(msg::BypassPeer& bypass) {
 
   // NOTE: This request is authenticated by the receiving Router, within
   // BypassPeer().
-  const OperationContext context{OperationContext::kTransportNotification};
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kTransportNotification,
+                                 dispatcher};
   return sublink->receiver->BypassPeer(context, *sublink->router_link,
                                        bypass.params().bypass_target_node,
                                        bypass.params().bypass_target_sublink);
@@ -712,7 +1123,9 @@ bool NodeLink::OnAcceptBypassLink(msg::AcceptBypassLink& accept) {
     return false;
   }
 
-  const OperationContext context{OperationContext::kTransportNotification};
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kTransportNotification,
+                                 dispatcher};
   return receiver->AcceptBypassLink(
       context, *this, accept.params().new_sublink, std::move(link_state),
       accept.params().inbound_sequence_length_from_bypassed_link);
@@ -724,7 +1137,9 @@ bool NodeLink::OnStopProxying(msg::StopProxying& stop) {
     return true;
   }
 
-  const OperationContext context{OperationContext::kTransportNotification};
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kTransportNotification,
+                                 dispatcher};
   return router->StopProxying(context, stop.params().inbound_sequence_length,
                               stop.params().outbound_sequence_length);
 }
@@ -735,7 +1150,9 @@ bool NodeLink::OnProxyWillStop(msg::ProxyWillStop& will_stop) {
     return true;
   }
 
-  const OperationContext context{OperationContext::kTransportNotification};
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kTransportNotification,
+                                 dispatcher};
   return router->NotifyProxyWillStop(
       context, will_stop.params().inbound_sequence_length);
 }
@@ -752,7 +1169,9 @@ bool NodeLink::OnBypassPeerWithLink(msg::BypassPeerWithLink& bypass) {
     return false;
   }
 
-  const OperationContext context{OperationContext::kTransportNotification};
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kTransportNotification,
+                                 dispatcher};
   return router->AcceptBypassLink(context, *this, bypass.params().new_sublink,
                                   std::move(link_state),
                                   bypass.params().inbound_sequence_length);
@@ -764,14 +1183,18 @@ bool NodeLink::OnStopProxyingToLocalPeer(msg::StopProxyingToLocalPeer& stop) {
     return true;
   }
 
-  const OperationContext context{OperationContext::kTransportNotification};
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kTransportNotification,
+                                 dispatcher};
   return router->StopProxyingToLocalPeer(
       context, stop.params().outbound_sequence_length);
 }
 
 bool NodeLink::OnFlushRouter(msg::FlushRouter& flush) {
   if (Ref<Router> router = GetRouter(flush.params().sublink)) {
-    const OperationContext context{OperationContext::kTransportNotification};
+    TrapEventDispatcher dispatcher;
+    const OperationContext context{OperationContext::kTransportNotification,
+                                   dispatcher};
     router->Flush(context, Router::kForceProxyBypassAttempt);
   }
   return true;
@@ -815,6 +1238,7 @@ bool NodeLink::OnRelayMessage(msg::RelayMessage& relay) {
     return false;
   }
 
+  counters_.RecordMessageRelayed();
   return node_->RelayMessage(remote_node_name_, relay);
 }
 
@@ -827,15 +1251,43 @@ bool NodeLink::OnAcceptRelayedMessage(msg::AcceptRelayedMessage& accept) {
 }
 
 void NodeLink::OnTransportError() {
-  const OperationContext context{OperationContext::kTransportNotification};
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kTransportNotification,
+                                 dispatcher};
   HandleTransportError(context);
 }
 
 void NodeLink::HandleTransportError(const OperationContext& context) {
-  SublinkMap sublinks;
+  // Parcels received before the failure must still be accepted before their
+  // routes are disconnected, including any deferred to the dispatch pool. A
+  // pool worker can't wait for them, since they may be queued behind it, so
+  // then the last of them to be dispatched handles the failure instead.
+  if (MessageDispatchPool::IsCurrentThreadAnyWorker()) {
+    absl::MutexLock lock(&deferred_messages_mutex_);
+    if (num_deferred_messages_ > 0) {
+      has_deferred_transport_error_ = true;
+      return;
+    }
+  } else {
+    WaitForDeferredMessages();
+  }
+
+  DisconnectAllSublinks(context);
+}
+
+void NodeLink::DisconnectAllSublinks(const OperationContext& context) {
+  std::vector<std::pair<SublinkId, Sublink>> sublinks;
   {
     absl::MutexLock lock(&mutex_);
-    sublinks.swap(sublinks_);
+    sublinks = sublinks_.TakeAll();
+  }
+
+  // None of our sublinks will receive any more parcels to forward.
+  ForwardedSublinkMap forwarded_sublinks;
+  {
+    absl::MutexLock lock(&forwarding_mutex_);
+    forwarded_sublinks.swap(forwarded_sublinks_);
+    has_forwarded_sublinks_.store(false, std::memory_order_relaxed);
   }
 
   for (auto& [id, sublink] : sublinks) {
@@ -849,11 +1301,74 @@ void NodeLink::HandleTransportError(const OperationContext& context) {
   node_->DropConnection(context, *this);
 }
 
+bool NodeLink::TryForwardParcel(msg::AcceptParcel& accept) {
+  // Parcels with attached objects or subparcels are left to the proxy, which
+  // must deserialize and reserialize them anyway.
+  if (accept.params().num_subparcels != 1 ||
+      accept.params().subparcel_index != 0 ||
+      !accept.GetArrayView<HandleType>(accept.params().handle_types).empty() ||
+      !accept.GetArrayView<RouterDescriptor>(accept.params().new_routers)
+           .empty() ||
+      !accept.driver_objects().empty()) {
+    return false;
+  }
+
+  const SublinkId for_sublink = accept.params().sublink;
+  Ref<RemoteRouterLink> target;
+  {
+    absl::MutexLock lock(&forwarding_mutex_);
+    auto it = forwarded_sublinks_.find(for_sublink);
+    if (it == forwarded_sublinks_.end()) {
+      return false;
+    }
+    target = it->second;
+  }
+
+  const std::optional<Sublink> sublink = GetSublink(for_sublink);
+  if (!sublink) {
+    return false;
+  }
+
+  // Anything unusual about the parcel's data, including a fragment in a buffer
+  // we don't have yet, is also left to the normal path.
+  Fragment fragment;
+  absl::Span<const uint8_t> data;
+  const FragmentDescriptor descriptor = accept.params().parcel_fragment;
+  if (!descriptor.is_null()) {
+    fragment = memory().GetFragment(descriptor);
+    const std::optional<absl::Span<uint8_t>> view =
+        Parcel::GetDataFragmentView(fragment);
+    if (!view) {
+      return false;
+    }
+    data = *view;
+  } else {
+    data = accept.GetArrayView<uint8_t>(accept.params().parcel_data);
+  }
+
+  // The proxy must account for every parcel in its sequences, so it has to
+  // agree to let this one pass before we can forward it.
+  const SequenceNumber sequence_number = accept.params().sequence_number;
+  const bool is_inbound = sublink->router_link->GetType().is_outward();
+  if (!sublink->receiver->ClaimParcelForForwarding(is_inbound, *target,
+                                                   sequence_number)) {
+    return false;
+  }
+
+  DVLOG(4) << "Forwarding parcel " << sequence_number << " from sublink "
+           << for_sublink << " at " << local_node_name_.ToString() << " to "
+           << target->Describe();
+  target->ForwardParcel(sequence_number, memory(), fragment, data);
+  num_parcels_forwarded_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
 void NodeLink::WaitForParcelFragmentToResolve(
     SublinkId for_sublink,
     std::unique_ptr<Parcel> parcel,
     const FragmentDescriptor& descriptor,
     bool is_split_parcel) {
+  ParcelTracer::BeginStage(*parcel);
   auto wrapper = MakeRefCounted<ParcelWrapper>(std::move(parcel));
   memory().WaitForBufferAsync(
       descriptor.buffer_id(), [this_link = WrapRefCounted(this), for_sublink,
@@ -861,6 +1376,8 @@ void NodeLink::WaitForParcelFragmentToResolve(
         Ref<NodeLinkMemory> memory = WrapRefCounted(&this_link->memory());
         const Fragment fragment = memory->GetFragment(descriptor);
         std::unique_ptr<Parcel> parcel = wrapper->TakeParcel();
+        ParcelTracer::EndStage(ParcelTraceStage::kWaitForFragment,
+                               this_link.get(), *parcel);
         if (!fragment.is_addressable() ||
             !parcel->AdoptDataFragment(std::move(memory), fragment)) {
           // The fragment is out of bounds or had an invalid header. Either way
@@ -1028,7 +1545,9 @@ bool NodeLink::AcceptCompleteParcel(SublinkId for_sublink,
 
   // At this point we've collected all expected subparcels and can pass the full
   // parcel along to its receiver.
-  const OperationContext context{OperationContext::kTransportNotification};
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kTransportNotification,
+                                 dispatcher};
   parcel->set_remote_source(WrapRefCounted(this));
   const LinkType link_type = sublink->router_link->GetType();
   if (link_type.is_outward()) {
@@ -10,10 +10,13 @@
 #include <cstdint>
 #include <optional>
 #include <type_traits>
+#include <vector>
 
 #include "ipcz/driver_memory.h"
 #include "ipcz/driver_transport.h"
 #include "ipcz/fragment_ref.h"
+#include "ipcz/ipcz.h"
+#include "ipcz/link_counters.h"
 #include "ipcz/link_side.h"
 #include "ipcz/link_type.h"
 #include "ipcz/node.h"
@@ -22,6 +25,7 @@
 #include "ipcz/node_name.h"
 #include "ipcz/sequence_number.h"
 #include "ipcz/sublink_id.h"
+#include "ipcz/sublink_table.h"
 #include "third_party/abseil-cpp/absl/container/flat_hash_map.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
 #include "third_party/abseil-cpp/absl/types/span.h"
@@ -91,6 +95,25 @@ class NodeLink : public msg::NodeMessageListener {
   NodeLinkMemory& memory() { return *memory_; }
   const NodeLinkMemory& memory() const { return *memory_; }
 
+  // Returns the number of messages transmitted over this link so far. Messages
+  // relayed through a broker are not counted here, but by the broker's link.
+  uint64_t GetNumMessagesSent() const {
+    return next_outgoing_sequence_number_generator_.load(
+        std::memory_order_relaxed);
+  }
+
+  // Fills in `stats` with a snapshot of this link's traffic counters and
+  // resource usage. See IpczNodeLinkStats.
+  void QueryStats(IpczNodeLinkStats& stats);
+
+  // Counts a parcel sent over this link by one of its RemoteRouterLinks.
+  // `is_inlined` indicates whether the parcel's data was copied into the
+  // message itself rather than passed by reference to a shared memory fragment.
+  void RecordParcelSent(bool is_inlined);
+
+  // Returns every Router currently bound to a sublink on this NodeLink.
+  std::vector<Ref<Router>> GetBoundRouters();
+
   // Activates this NodeLink. The NodeLink must have been created with
   // CreateInactive() and must not have already been activated.
   void Activate();
@@ -116,12 +139,32 @@ class NodeLink : public msg::NodeMessageListener {
   void RemoveRemoteRouterLink(SublinkId sublink);
 
   // Retrieves the Router and RemoteRouterLink currently bound to `sublink`
-  // on this NodeLink.
+  // on this NodeLink. This never blocks on other sublink lookups or updates.
   std::optional<Sublink> GetSublink(SublinkId sublink);
 
   // Retrieves only the Router currently bound to `sublink` on this NodeLink.
   Ref<Router> GetRouter(SublinkId sublink);
 
+  // Starts forwarding parcels received on `sublink` directly over `target`,
+  // without handing them to the proxying Router bound to `sublink`. `target`
+  // must be the link on which that Router would otherwise forward them.
+  //
+  // Only parcels without attached objects are forwarded this way, and each
+  // one must still be claimed from the Router in sequence, so the Router can
+  // fall back on forwarding them itself at any time. Forwarding stops when
+  // `sublink` is removed, when this NodeLink is deactivated, or when
+  // StopForwardingSublink() is called.
+  void StartForwardingSublink(SublinkId sublink, Ref<RemoteRouterLink> target);
+
+  // Stops forwarding parcels received on `sublink`, if they were forwarded.
+  void StopForwardingSublink(SublinkId sublink);
+
+  // Returns the number of parcels received on this link and forwarded directly
+  // to another sublink on behalf of a proxy. Used by tests.
+  uint64_t GetNumParcelsForwarded() const {
+    return num_parcels_forwarded_.load(std::memory_order_relaxed);
+  }
+
   // Sends a new driver memory object to the remote endpoint to be associated
   // with BufferId within the peer NodeLink's associated NodeLinkMemory, and to
   // be used to dynamically allocate blocks of `block_size` bytes. The BufferId
@@ -231,7 +274,23 @@ class NodeLink : public msg::NodeMessageListener {
 
   SequenceNumber GenerateOutgoingSequenceNumber();
 
+  // Dispatches a message previously deferred by OnMessage() to the Node's
+  // MessageDispatchPool. `data` and `objects` are the message's original
+  // serialized contents and deserialized driver objects.
+  bool DispatchDeferredMessage(uint8_t message_id,
+                               absl::Span<const uint8_t> data,
+                               absl::Span<DriverObject> objects);
+
+  // Called once a message deferred by OnMessage() has been dispatched.
+  void OnDeferredMessageDispatched();
+
+  // Blocks until every message this link has deferred to the Node's
+  // MessageDispatchPool has been dispatched. Messages deferred by other links
+  // are not waited on.
+  void WaitForDeferredMessages();
+
   // NodeMessageListener overrides:
+  bool OnMessage(Message& message) override;
   bool OnReferNonBroker(msg::ReferNonBroker& refer) override;
   bool OnNonBrokerReferralAccepted(
       msg::NonBrokerReferralAccepted& accepted) override;
@@ -246,6 +305,7 @@ class NodeLink : public msg::NodeMessageListener {
   bool OnAcceptParcel(msg::AcceptParcel& accept) override;
   bool OnAcceptParcelDriverObjects(
       msg::AcceptParcelDriverObjects& accept) override;
+  bool OnAcceptCoalescedParcel(msg::AcceptCoalescedParcel& accept) override;
   bool OnRouteClosed(msg::RouteClosed& route_closed) override;
   bool OnRouteDisconnected(msg::RouteDisconnected& route_disconnected) override;
   bool OnBypassPeer(msg::BypassPeer& bypass) override;
@@ -261,8 +321,14 @@ class NodeLink : public msg::NodeMessageListener {
   bool OnAcceptRelayedMessage(msg::AcceptRelayedMessage& accept) override;
   void OnTransportError() override;
 
+  // Disconnects every route bound to this link, once any parcels received
+  // before the failure have been dispatched.
   void HandleTransportError(const OperationContext& context);
 
+  // Disconnects every route bound to this link and drops the link from the
+  // Node. Called by HandleTransportError().
+  void DisconnectAllSublinks(const OperationContext& context);
+
   // Invoked when we receive a Parcel whose data fragment resides in a buffer
   // not yet known to the local node. This schedules the parcel for acceptance
   // as soon as that buffer is available.
@@ -281,6 +347,11 @@ class NodeLink : public msg::NodeMessageListener {
   bool AcceptCompleteParcel(SublinkId for_sublink,
                             std::unique_ptr<Parcel> parcel);
 
+  // Attempts to forward the parcel in `accept` over the link installed for its
+  // sublink by StartForwardingSublink(). Returns true if the parcel was
+  // forwarded, or false if it must be accepted normally instead.
+  bool TryForwardParcel(msg::AcceptParcel& accept);
+
   const Ref<Node> node_;
   const LinkSide link_side_;
   const NodeName local_node_name_;
@@ -300,8 +371,42 @@ class NodeLink : public msg::NodeMessageListener {
   // reordered on the receiving end.
   std::atomic<uint64_t> next_outgoing_sequence_number_generator_{0};
 
-  using SublinkMap = absl::flat_hash_map<SublinkId, Sublink>;
-  SublinkMap sublinks_ ABSL_GUARDED_BY(mutex_);
+  // Traffic counters reported by QueryStats().
+  LinkCounters counters_;
+
+  // Every sublink bound on this NodeLink. Sublink lookups are performed for
+  // nearly every incoming message, so this table supports lock-free lookup.
+  // Insertions are still serialized by `mutex_` against deactivation.
+  SublinkTable<Sublink> sublinks_;
+
+  // The link over which parcels received on each forwarded sublink are sent.
+  // See StartForwardingSublink().
+  using ForwardedSublinkMap =
+      absl::flat_hash_map<SublinkId, Ref<RemoteRouterLink>>;
+
+  // Guards `forwarded_sublinks_`. This is only ever held briefly to look up or
+  // update an entry, and no other lock is acquired while it's held.
+  absl::Mutex forwarding_mutex_;
+  ForwardedSublinkMap forwarded_sublinks_ ABSL_GUARDED_BY(forwarding_mutex_);
+
+  // Mirrors whether `forwarded_sublinks_` is non-empty, so that incoming
+  // parcels can skip the lookup on links which forward nothing.
+  std::atomic<bool> has_forwarded_sublinks_{false};
+
+  // Counts parcels forwarded by TryForwardParcel(). See
+  // GetNumParcelsForwarded().
+  std::atomic<uint64_t> num_parcels_forwarded_{0};
+
+  // The number of messages deferred by OnMessage() to the Node's
+  // MessageDispatchPool which have yet to be dispatched. Incremented only by
+  // OnMessage(), so while it waits on this, nothing else can add to it.
+  absl::Mutex deferred_messages_mutex_;
+  size_t num_deferred_messages_ ABSL_GUARDED_BY(deferred_messages_mutex_) = 0;
+
+  // Whether HandleTransportError() was called on a pool worker while messages
+  // were still deferred, leaving the last of them to disconnect our sublinks.
+  bool has_deferred_transport_error_ ABSL_GUARDED_BY(deferred_messages_mutex_) =
+      false;
 
   // Pending memory allocation request callbacks. Keyed by request size, when
   // an incoming ProvideMemory message is received, the front of the list for
@@ -8,6 +8,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <utility>
+#include <vector>
 
 #include "ipcz/buffer_id.h"
 #include "ipcz/driver_memory.h"
@@ -276,6 +277,11 @@ bool NodeLinkMemory::AddBlockBuffer(BufferId id,
   return buffer_pool_.AddBlockBuffer(id, std::move(mapping), {&allocator, 1});
 }
 
+size_t NodeLinkMemory::GetNumPendingCapacityRequests() {
+  absl::MutexLock lock(&mutex_);
+  return capacity_callbacks_.size();
+}
+
 Fragment NodeLinkMemory::AllocateFragment(size_t size) {
   if (size == 0 || size > kMaxFragmentSizeForBlockAllocation) {
     // TODO: Support an alternative allocation scheme for large requests.
@@ -339,6 +345,21 @@ FragmentRef<RouterLinkState> NodeLinkMemory::TryAllocateRouterLinkState() {
   return {};
 }
 
+size_t NodeLinkMemory::TryAllocateRouterLinkStates(
+    absl::Span<FragmentRef<RouterLinkState>> states) {
+  std::vector<Fragment> fragments(states.size());
+  const size_t num_allocated = buffer_pool_.AllocateBlocks(
+      sizeof(RouterLinkState), absl::MakeSpan(fragments));
+  for (size_t i = 0; i < num_allocated; ++i) {
+    states[i] = InitializeRouterLinkStateFragment(fragments[i]);
+  }
+
+  if (num_allocated < states.size()) {
+    RequestBlockCapacity(sizeof(RouterLinkState), [](bool ok) {});
+  }
+  return num_allocated;
+}
+
 void NodeLinkMemory::AllocateRouterLinkState(RouterLinkStateCallback callback) {
   Fragment fragment = buffer_pool_.AllocateBlock(sizeof(RouterLinkState));
   if (!fragment.is_null()) {
@@ -94,6 +94,19 @@ class NodeLinkMemory : public RefCounted<NodeLinkMemory> {
     return FragmentRef<T>(kAdoptExistingRef, WrapRefCounted(this), fragment);
   }
 
+  // Returns the total size in bytes of all shared buffers mapped by this
+  // NodeLinkMemory, including the primary buffer.
+  size_t GetTotalBufferSize() { return buffer_pool_.GetTotalBufferSize(); }
+
+  // See BufferPool::QueryBlockStats().
+  size_t QueryBlockStats(absl::Span<IpczBlockStats> stats) {
+    return buffer_pool_.QueryBlockStats(stats);
+  }
+
+  // Returns the number of requests for more block capacity which are still
+  // awaiting a response. At most one is in flight per block size.
+  size_t GetNumPendingCapacityRequests();
+
   // Adds a new buffer to the underlying BufferPool to use as additional
   // allocation capacity for blocks of size `block_size`. Note that the
   // contents of the mapped region must already be initialized as a
@@ -121,6 +134,13 @@ class NodeLinkMemory : public RefCounted<NodeLinkMemory> {
   // allocate an appropriate fragment, this may return null.
   FragmentRef<RouterLinkState> TryAllocateRouterLinkState();
 
+  // Batched form of TryAllocateRouterLinkState(), which fills `states` with as
+  // many new RouterLinkStates as can be allocated in one pass and returns the
+  // number allocated. If that falls short of `states.size()`, additional
+  // capacity is requested only once for the whole batch.
+  size_t TryAllocateRouterLinkStates(
+      absl::Span<FragmentRef<RouterLinkState>> states);
+
   // Allocates a fragment to store a new RouterLinkState and initializes a new
   // RouterLinkState instance there. Calls `callback` with a reference to the
   // new fragment once allocated. Unlike TryAllocateRouterLinkState(), this
@@ -4,19 +4,36 @@
 
 #include "ipcz/node_link.h"
 
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
 #include <utility>
 
+#include "ipcz/block_allocator.h"
+#include "ipcz/box.h"
+#include "ipcz/buffer_id.h"
 #include "ipcz/driver_memory.h"
+#include "ipcz/fragment_descriptor.h"
+#include "ipcz/handle_type.h"
 #include "ipcz/link_side.h"
 #include "ipcz/link_type.h"
 #include "ipcz/node_link_memory.h"
+#include "ipcz/node_messages.h"
 #include "ipcz/operation_context.h"
+#include "ipcz/parcel.h"
+#include "ipcz/parcel_wrapper.h"
 #include "ipcz/remote_router_link.h"
 #include "ipcz/router.h"
+#include "ipcz/sequence_number.h"
+#include "ipcz/subparcel_descriptor.h"
 #include "ipcz/sublink_id.h"
 #include "reference_drivers/sync_reference_driver.h"
+#include "test/test_node_links.h"
 #include "testing/gtest/include/gtest/gtest.h"
-#include "third_party/abseil-cpp/absl/base/macros.h"
+#include "third_party/abseil-cpp/absl/synchronization/notification.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
 #include "util/ref_counted.h"
 
 namespace ipcz {
@@ -24,34 +41,74 @@ namespace {
 
 const IpczDriver& kDriver = reference_drivers::kSyncReferenceDriver;
 
-std::pair<Ref<NodeLink>, Ref<NodeLink>> LinkNodes(Ref<Node> broker,
-                                                  Ref<Node> non_broker) {
-  IpczDriverHandle handle0, handle1;
-  EXPECT_EQ(IPCZ_RESULT_OK,
-            kDriver.CreateTransports(IPCZ_INVALID_DRIVER_HANDLE,
-                                     IPCZ_INVALID_DRIVER_HANDLE, IPCZ_NO_FLAGS,
-                                     nullptr, &handle0, &handle1));
-
-  auto transport0 =
-      MakeRefCounted<DriverTransport>(DriverObject(kDriver, handle0));
-  auto transport1 =
-      MakeRefCounted<DriverTransport>(DriverObject(kDriver, handle1));
-
-  DriverMemoryWithMapping buffer = NodeLinkMemory::AllocateMemory(kDriver);
-  ABSL_ASSERT(buffer.mapping.is_valid());
-
-  const NodeName non_broker_name = broker->GenerateRandomName();
-  auto link0 = NodeLink::CreateInactive(
-      broker, LinkSide::kA, broker->GetAssignedName(), non_broker_name,
-      Node::Type::kNormal, 0, transport0,
-      NodeLinkMemory::Create(broker, std::move(buffer.mapping)));
-  auto link1 = NodeLink::CreateInactive(
-      non_broker, LinkSide::kB, non_broker_name, broker->GetAssignedName(),
-      Node::Type::kNormal, 0, transport1,
-      NodeLinkMemory::Create(non_broker, buffer.memory.Map()));
-  link0->Activate();
-  link1->Activate();
-  return {link0, link1};
+// Links a new router on each end of a NodeLink over `sublink`, which must be
+// one of the link's initial portal sublinks.
+std::pair<Ref<Router>, Ref<Router>> LinkRouters(const OperationContext& context,
+                                                NodeLink& link0,
+                                                NodeLink& link1,
+                                                SublinkId sublink = SublinkId(0)) {
+  auto router0 = MakeRefCounted<Router>();
+  auto router1 = MakeRefCounted<Router>();
+  FragmentRef<RouterLinkState> link_state =
+      link0.memory().GetInitialRouterLinkState(sublink.value());
+  router0->SetOutwardLink(
+      context,
+      link0.AddRemoteRouterLink(context, sublink, link_state,
+                                LinkType::kCentral, LinkSide::kA, router0));
+  router1->SetOutwardLink(
+      context,
+      link1.AddRemoteRouterLink(context, sublink, link_state,
+                                LinkType::kCentral, LinkSide::kB, router1));
+  link_state->status = RouterLinkState::kStable;
+  return {router0, router1};
+}
+
+absl::Span<const uint8_t> AsBytes(const std::string& data) {
+  return absl::MakeSpan(reinterpret_cast<const uint8_t*>(data.data()),
+                        data.size());
+}
+
+std::string AsString(absl::Span<const uint8_t> bytes) {
+  return std::string(bytes.begin(), bytes.end());
+}
+
+// Returns a new handle to a box containing a subparcel with `data`.
+IpczHandle BoxSubparcel(const std::string& data) {
+  auto parcel = std::make_unique<Parcel>();
+  parcel->AllocateData(data.size(), /*allow_partial=*/false, nullptr);
+  memcpy(parcel->data_view().data(), data.data(), data.size());
+  return APIObject::ReleaseAsHandle(
+      MakeRefCounted<Box>(MakeRefCounted<ParcelWrapper>(std::move(parcel))));
+}
+
+// Retrieves the next parcel from `router`, which must carry only a boxed
+// subparcel. Returns the data of the parcel and of its subparcel.
+std::pair<std::string, std::string> GetParcelWithSubparcel(Router& router) {
+  char data[64];
+  size_t num_bytes = sizeof(data);
+  IpczHandle handle = IPCZ_INVALID_HANDLE;
+  size_t num_handles = 1;
+  const IpczResult result = router.Get(IPCZ_NO_FLAGS, nullptr, data, &num_bytes,
+                                       &handle, &num_handles, nullptr);
+  if (result != IPCZ_RESULT_OK || num_handles != 1) {
+    ADD_FAILURE() << "Get() failed with " << result;
+    return {};
+  }
+
+  Ref<Box> box = Box::TakeFromHandle(handle);
+  if (!box || box->type() != Box::Type::kSubparcel) {
+    ADD_FAILURE() << "Attachment is not a subparcel";
+    return {};
+  }
+  return {std::string(data, num_bytes),
+          AsString(box->subparcel()->parcel().data_view())};
+}
+
+uint64_t GetNumMessagesSent(NodeLink& link, uint8_t message_id) {
+  auto stats = std::make_unique<IpczNodeLinkStats>();
+  stats->size = sizeof(*stats);
+  link.QueryStats(*stats);
+  return stats->messages[message_id].num_sent;
 }
 
 using NodeLinkTest = testing::Test;
@@ -62,7 +119,7 @@ TEST_F(NodeLinkTest, BasicTransmission) {
 
   // The choice of OperationContext is arbitrary and irrelevant for this test.
   const OperationContext context{OperationContext::kTransportNotification};
-  auto [link0, link1] = LinkNodes(node0, node1);
+  auto [link0, link1] = test::LinkNodes(node0, node1);
   auto router0 = MakeRefCounted<Router>();
   auto router1 = MakeRefCounted<Router>();
   FragmentRef<RouterLinkState> link_state =
@@ -86,5 +143,257 @@ TEST_F(NodeLinkTest, BasicTransmission) {
   link1->Deactivate(context);
 }
 
+TEST_F(NodeLinkTest, CoalescedSubparcels) {
+  Ref<Node> node0 = MakeRefCounted<Node>(Node::Type::kBroker, kDriver);
+  Ref<Node> node1 = MakeRefCounted<Node>(Node::Type::kNormal, kDriver);
+  const OperationContext context{OperationContext::kTransportNotification};
+  auto [link0, link1] = test::LinkNodes(node0, node1);
+  auto [router0, router1] = LinkRouters(context, *link0, *link1);
+
+  // A parcel and its subparcel travel together in one message.
+  IpczHandle box = BoxSubparcel("sub");
+  EXPECT_EQ(IPCZ_RESULT_OK, router0->Put(AsBytes("main"), {&box, 1}));
+  EXPECT_EQ(1u, GetNumMessagesSent(*link0, msg::AcceptCoalescedParcel::kId));
+  EXPECT_EQ(0u, GetNumMessagesSent(*link0, msg::AcceptParcel::kId));
+  EXPECT_EQ(std::make_pair(std::string("main"), std::string("sub")),
+            GetParcelWithSubparcel(*router1));
+
+  router0->CloseRoute();
+  router1->CloseRoute();
+  link0->Deactivate(context);
+  link1->Deactivate(context);
+}
+
+TEST_F(NodeLinkTest, SplitSubparcelsForLegacyPeer) {
+  Ref<Node> node0 = MakeRefCounted<Node>(Node::Type::kBroker, kDriver);
+  Ref<Node> node1 = MakeRefCounted<Node>(Node::Type::kNormal, kDriver);
+  const OperationContext context{OperationContext::kTransportNotification};
+
+  // A node on protocol version 0 doesn't understand AcceptCoalescedParcel, so
+  // the subparcel must be sent in its own AcceptParcel message.
+  auto [link0, link1] = test::LinkNodes(node0, node1, /*protocol_version=*/0);
+  auto [router0, router1] = LinkRouters(context, *link0, *link1);
+
+  IpczHandle box = BoxSubparcel("sub");
+  EXPECT_EQ(IPCZ_RESULT_OK, router0->Put(AsBytes("main"), {&box, 1}));
+  EXPECT_EQ(0u, GetNumMessagesSent(*link0, msg::AcceptCoalescedParcel::kId));
+  EXPECT_EQ(2u, GetNumMessagesSent(*link0, msg::AcceptParcel::kId));
+  EXPECT_EQ(std::make_pair(std::string("main"), std::string("sub")),
+            GetParcelWithSubparcel(*router1));
+
+  router0->CloseRoute();
+  router1->CloseRoute();
+  link0->Deactivate(context);
+  link1->Deactivate(context);
+}
+
+TEST_F(NodeLinkTest, CoalescedSubparcelWithPendingFragment) {
+  Ref<Node> node0 = MakeRefCounted<Node>(Node::Type::kBroker, kDriver);
+  Ref<Node> node1 = MakeRefCounted<Node>(Node::Type::kNormal, kDriver);
+  const OperationContext context{OperationContext::kTransportNotification};
+  auto [link0, link1] = test::LinkNodes(node0, node1);
+  auto [router0, router1] = LinkRouters(context, *link0, *link1);
+
+  // Stage subparcel data in a new buffer which the receiver doesn't have yet.
+  constexpr size_t kBlockSize = 64;
+  constexpr size_t kNumBlocks = 4;
+  const std::string kSubparcelData = "sub";
+  DriverMemory buffer(kDriver, kBlockSize * kNumBlocks);
+  DriverMemoryMapping mapping = buffer.Map();
+  BlockAllocator allocator(mapping.bytes(), kBlockSize);
+  allocator.InitializeRegion();
+  auto* block = static_cast<uint8_t*>(allocator.Allocate());
+  ASSERT_TRUE(block);
+
+  // Parcel data fragments begin with an 8-byte header holding the data size.
+  const uint32_t data_size = static_cast<uint32_t>(kSubparcelData.size());
+  memcpy(block, &data_size, sizeof(data_size));
+  memcpy(block + 8, kSubparcelData.data(), kSubparcelData.size());
+  const BufferId buffer_id = link0->memory().AllocateNewBufferId();
+  const uint32_t offset =
+      static_cast<uint32_t>(block - mapping.bytes().data());
+
+  // Send a coalesced parcel whose subparcel lives in that buffer.
+  const std::string kMainData = "main";
+  msg::AcceptCoalescedParcel accept;
+  accept.params().sublink = SublinkId(0);
+  accept.params().sequence_number = SequenceNumber(0);
+  accept.params().subparcels = accept.AllocateArray<SubparcelDescriptor>(2);
+  accept.params().parcel_data =
+      accept.AllocateArray<uint8_t>(kMainData.size());
+  accept.params().handle_types = accept.AllocateArray<HandleType>(1);
+  accept.params().new_routers = accept.AllocateArray<RouterDescriptor>(0);
+  absl::Span<SubparcelDescriptor> subparcels =
+      accept.GetArrayView<SubparcelDescriptor>(accept.params().subparcels);
+  subparcels[0] = {.data_offset = 0,
+                   .data_size = static_cast<uint32_t>(kMainData.size()),
+                   .num_handles = 1};
+  subparcels[1] = {
+      .data_fragment = FragmentDescriptor(buffer_id, offset, kBlockSize)};
+  memcpy(accept.GetArrayView<uint8_t>(accept.params().parcel_data).data(),
+         kMainData.data(), kMainData.size());
+  accept.GetArrayView<HandleType>(accept.params().handle_types)[0] =
+      HandleType::kBoxedSubparcel;
+  link0->Transmit(accept);
+
+  // Nothing can be delivered until the buffer arrives, at which point the
+  // parcels are joined as if they'd been transmitted separately.
+  EXPECT_EQ(0u, router1->GetNumQueuedParcels());
+  EXPECT_TRUE(link1->memory().AddBlockBuffer(buffer_id, kBlockSize,
+                                             buffer.Map()));
+  EXPECT_EQ(std::make_pair(kMainData, kSubparcelData),
+            GetParcelWithSubparcel(*router1));
+
+  router0->CloseRoute();
+  router1->CloseRoute();
+  link0->Deactivate(context);
+  link1->Deactivate(context);
+}
+
+// Blocks in a trap event handler, as if it were slow to handle an event, until
+// notified or a long timeout elapses.
+struct BlockingTrapHandler {
+  static void IPCZ_API OnEvent(const IpczTrapEvent* event) {
+    auto& handler = *reinterpret_cast<BlockingTrapHandler*>(event->context);
+    handler.entered.Notify();
+    handler.was_unblocked =
+        handler.unblock.WaitForNotificationWithTimeout(absl::Seconds(10));
+  }
+
+  absl::Notification entered;
+  absl::Notification unblock;
+  bool was_unblocked = false;
+};
+
+TEST_F(NodeLinkTest, InlineDispatchWaitsOnlyForOwnDeferredMessages) {
+  const IpczCreateNodeOptions options = {
+      .size = sizeof(options),
+      .num_dispatch_threads = 2,
+  };
+  Ref<Node> node0 = MakeRefCounted<Node>(Node::Type::kBroker, kDriver, &options);
+  Ref<Node> node1 = MakeRefCounted<Node>(Node::Type::kNormal, kDriver);
+  Ref<Node> node2 = MakeRefCounted<Node>(Node::Type::kNormal, kDriver);
+  const OperationContext context{OperationContext::kTransportNotification};
+  auto [link01, link10] = test::LinkNodes(node0, node1);
+  auto [link02, link20] = test::LinkNodes(node0, node2);
+  auto [router01, router10] = LinkRouters(context, *link01, *link10);
+  auto [router02, router20] = LinkRouters(context, *link02, *link20);
+
+  // Stall the dispatch pool on a parcel deferred by `link02`.
+  BlockingTrapHandler handler;
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS,
+      .min_local_parcels = 0,
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            router02->Trap(conditions, &BlockingTrapHandler::OnEvent, nullptr,
+                           reinterpret_cast<uintptr_t>(&handler), IPCZ_NO_FLAGS,
+                           nullptr, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_OK, router20->Put(AsBytes("stall"), {}));
+  handler.entered.WaitForNotification();
+
+  // Route closure isn't deferred, so `link01` dispatches it inline once its
+  // own deferred messages are done. It must not wait on `link02`'s.
+  router10->CloseRoute();
+  EXPECT_TRUE(router01->IsPeerClosed());
+  handler.unblock.Notify();
+
+  router01->CloseRoute();
+  router02->CloseRoute();
+  router20->CloseRoute();
+  for (const Ref<NodeLink>& link : {link01, link10, link02, link20}) {
+    link->Deactivate(context);
+  }
+  node0->Close();
+  node1->Close();
+  node2->Close();
+  EXPECT_TRUE(handler.was_unblocked);
+}
+
+TEST_F(NodeLinkTest, DeactivateAcceptsDeferredParcelsFirst) {
+  const IpczCreateNodeOptions options = {
+      .size = sizeof(options),
+      .num_dispatch_threads = 2,
+  };
+  Ref<Node> node0 = MakeRefCounted<Node>(Node::Type::kBroker, kDriver, &options);
+  Ref<Node> node1 = MakeRefCounted<Node>(Node::Type::kNormal, kDriver);
+  const OperationContext context{OperationContext::kTransportNotification};
+  auto [link0, link1] = test::LinkNodes(node0, node1);
+  auto [router0, router1] = LinkRouters(context, *link0, *link1);
+
+  // Parcels deferred to the dispatch pool just before the link goes away must
+  // still reach `router0` before it learns of the disconnection.
+  constexpr size_t kNumParcels = 100;
+  for (size_t i = 0; i < kNumParcels; ++i) {
+    EXPECT_EQ(IPCZ_RESULT_OK, router1->Put(AsBytes("!"), {}));
+  }
+  link0->Deactivate(context);
+  EXPECT_EQ(kNumParcels, router0->GetNumQueuedParcels());
+
+  router0->CloseRoute();
+  router1->CloseRoute();
+  link1->Deactivate(context);
+  node0->Close();
+  node1->Close();
+}
+
+// Deactivates a NodeLink from within a trap event handler once notified.
+struct DeactivatingTrapHandler {
+  static void IPCZ_API OnEvent(const IpczTrapEvent* event) {
+    auto& handler = *reinterpret_cast<DeactivatingTrapHandler*>(event->context);
+    handler.deactivate.WaitForNotification();
+    handler.link->Deactivate(OperationContext{OperationContext::kAPICall});
+  }
+
+  Ref<NodeLink> link;
+  absl::Notification deactivate;
+};
+
+TEST_F(NodeLinkTest, DeactivateOnWorkerAcceptsDeferredParcelsFirst) {
+  const IpczCreateNodeOptions options = {
+      .size = sizeof(options),
+      .num_dispatch_threads = 1,
+  };
+  Ref<Node> node0 = MakeRefCounted<Node>(Node::Type::kBroker, kDriver, &options);
+  Ref<Node> node1 = MakeRefCounted<Node>(Node::Type::kNormal, kDriver);
+  const OperationContext context{OperationContext::kTransportNotification};
+  auto [link0, link1] = test::LinkNodes(node0, node1);
+  auto [router0, router1] = LinkRouters(context, *link0, *link1, SublinkId(0));
+  auto [other_router0, other_router1] =
+      LinkRouters(context, *link0, *link1, SublinkId(1));
+
+  // The only pool worker deactivates `link0` while handling the first parcel,
+  // with more parcels for another route queued behind it.
+  DeactivatingTrapHandler handler{.link = link0};
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS,
+      .min_local_parcels = 0,
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            router0->Trap(conditions, &DeactivatingTrapHandler::OnEvent,
+                          nullptr, reinterpret_cast<uintptr_t>(&handler),
+                          IPCZ_NO_FLAGS, nullptr, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_OK, router1->Put(AsBytes("!"), {}));
+  constexpr size_t kNumParcels = 100;
+  for (size_t i = 0; i < kNumParcels; ++i) {
+    EXPECT_EQ(IPCZ_RESULT_OK, other_router1->Put(AsBytes("!"), {}));
+  }
+  handler.deactivate.Notify();
+
+  // Closing the node waits for the worker to finish everything queued.
+  node0->Close();
+  EXPECT_EQ(kNumParcels, other_router0->GetNumQueuedParcels());
+  EXPECT_TRUE(other_router0->IsPeerClosed());
+
+  for (const Ref<Router>& router :
+       {router0, router1, other_router0, other_router1}) {
+    router->CloseRoute();
+  }
+  link1->Deactivate(context);
+  node1->Close();
+}
+
 }  // namespace
 }  // namespace ipcz
@@ -18,12 +18,16 @@
 #include "ipcz/router_descriptor.h"
 #include "ipcz/sequence_number.h"
 #include "ipcz/sublink_id.h"
+#include "ipcz/subparcel_descriptor.h"
 
 namespace ipcz::msg {
 
 // Bump this version number up by 1 when adding new protocol features so that
 // they can be detected during NodeLink establishment.
-constexpr uint32_t kProtocolVersion = 0;
+constexpr uint32_t kProtocolVersion = 1;
+
+// The first protocol version which supports AcceptCoalescedParcel messages.
+constexpr uint32_t kMinVersionForCoalescedParcels = 1;
 
 #pragma pack(push, 1)
 
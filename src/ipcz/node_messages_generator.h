@@ -364,6 +364,42 @@ IPCZ_MSG_BEGIN(AcceptParcelDriverObjects, IPCZ_MSG_ID(21), IPCZ_MSG_VERSION(0))
   IPCZ_MSG_PARAM_DRIVER_OBJECT_ARRAY(driver_objects)
 IPCZ_MSG_END()
 
+// Conveys the contents of a parcel along with all of its subparcels in a single
+// message, as an alternative to transmitting each subparcel in its own
+// AcceptParcel message. Only sent to nodes whose protocol version is at least
+// kMinVersionForCoalescedParcels, and never for parcels whose driver objects
+// must be relayed.
+IPCZ_MSG_BEGIN(AcceptCoalescedParcel, IPCZ_MSG_ID(24), IPCZ_MSG_VERSION(0))
+  // The SublinkId linking the source and destination Routers along the
+  // transmitting NodeLink.
+  IPCZ_MSG_PARAM(SublinkId, sublink)
+
+  // The SequenceNumber of the main parcel within the transmitting portal's
+  // outbound parcel sequence (and the receiving portal's inbound parcel
+  // sequence.)
+  IPCZ_MSG_PARAM(SequenceNumber, sequence_number)
+
+  // One entry for each parcel carried by this message, beginning with the main
+  // parcel and followed by its subparcels in order. Each entry identifies the
+  // parcel's data and its share of the arrays below.
+  IPCZ_MSG_PARAM_ARRAY(SubparcelDescriptor, subparcels)
+
+  // Inlined data for all parcels which don't have a shared memory fragment,
+  // concatenated.
+  IPCZ_MSG_PARAM_ARRAY(uint8_t, parcel_data)
+
+  // Handle types for every parcel's attachments, concatenated in parcel order.
+  IPCZ_MSG_PARAM_ARRAY(HandleType, handle_types)
+
+  // A RouterDescriptor for every portal attached to any of the parcels, in
+  // the order the portals appear in `handle_types`.
+  IPCZ_MSG_PARAM_ARRAY(RouterDescriptor, new_routers)
+
+  // Every DriverObject boxed and attached to any of the parcels, in the order
+  // the boxes appear in `handle_types`.
+  IPCZ_MSG_PARAM_DRIVER_OBJECT_ARRAY(driver_objects)
+IPCZ_MSG_END()
+
 // Notifies a node that the route has been closed on one side. This message
 // always pertains to the side of the route opposite of the router receiving it,
 // guaranteed by the fact that the closed side of the route only transmits this
@@ -0,0 +1,136 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/node_stats_page.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+#include "third_party/abseil-cpp/absl/base/macros.h"
+
+namespace ipcz {
+
+namespace {
+
+// How many times Read() tries to get a consistent snapshot before giving up.
+constexpr size_t kMaxReadAttempts = 1000;
+
+template <typename T>
+constexpr size_t GetNumWords() {
+  static_assert(std::is_trivially_copyable_v<T>);
+  static_assert(sizeof(T) % sizeof(uint64_t) == 0);
+  return sizeof(T) / sizeof(uint64_t);
+}
+
+constexpr size_t kNumNodeEntryWords = GetNumWords<NodeStatsPage::NodeEntry>();
+constexpr size_t kNumLinkEntryWords = GetNumWords<NodeStatsPage::LinkEntry>();
+
+}  // namespace
+
+NodeStatsPage::NodeStatsPage()
+    : magic_(kMagic),
+      version_(kVersion),
+      max_link_entries_(kMaxLinkEntries) {
+  static_assert(sizeof(NodeStatsPage) == kSize);
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "Page contents must be lock-free to be shared across "
+                "processes");
+}
+
+// static
+NodeStatsPage& NodeStatsPage::Initialize(absl::Span<uint8_t> memory) {
+  ABSL_ASSERT(memory.size() == kSize);
+  ABSL_ASSERT(reinterpret_cast<uintptr_t>(memory.data()) % 8 == 0);
+  NodeStatsPage& page = *new (memory.data()) NodeStatsPage();
+  page.Publish({}, {});
+  return page;
+}
+
+// static
+const NodeStatsPage* NodeStatsPage::FromMemory(
+    absl::Span<const uint8_t> memory) {
+  if (memory.size() != kSize ||
+      reinterpret_cast<uintptr_t>(memory.data()) % 8 != 0) {
+    return nullptr;
+  }
+
+  const auto* page = reinterpret_cast<const NodeStatsPage*>(memory.data());
+  if (page->magic_ != kMagic || page->version_ != kVersion ||
+      page->max_link_entries_ != kMaxLinkEntries) {
+    return nullptr;
+  }
+  return page;
+}
+
+void NodeStatsPage::Publish(const NodeEntry& node,
+                            absl::Span<const LinkEntry> links) {
+  NodeEntry published_node = node;
+  published_node.num_link_entries =
+      std::min<uint64_t>(links.size(), kMaxLinkEntries);
+
+  const uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+  sequence_.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  uint64_t words[std::max(kNumNodeEntryWords, kNumLinkEntryWords)];
+  memcpy(words, &published_node, sizeof(published_node));
+  WriteWords(0, words, kNumNodeEntryWords);
+  for (size_t i = 0; i < published_node.num_link_entries; ++i) {
+    memcpy(words, &links[i], sizeof(links[i]));
+    WriteWords(kNumNodeEntryWords + i * kNumLinkEntryWords, words,
+               kNumLinkEntryWords);
+  }
+
+  sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+bool NodeStatsPage::Read(NodeEntry& node, std::vector<LinkEntry>& links) const {
+  uint64_t words[std::max(kNumNodeEntryWords, kNumLinkEntryWords)];
+  for (size_t attempt = 0; attempt < kMaxReadAttempts; ++attempt) {
+    const uint32_t sequence = sequence_.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      continue;
+    }
+
+    ReadWords(0, words, kNumNodeEntryWords);
+    memcpy(&node, words, sizeof(node));
+
+    // This may be torn if we raced with the writer, so clamp it before use.
+    // The snapshot is discarded below in that case anyway.
+    const size_t num_links =
+        std::min<uint64_t>(node.num_link_entries, kMaxLinkEntries);
+    links.resize(num_links);
+    for (size_t i = 0; i < num_links; ++i) {
+      ReadWords(kNumNodeEntryWords + i * kNumLinkEntryWords, words,
+                kNumLinkEntryWords);
+      memcpy(&links[i], words, sizeof(links[i]));
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence_.load(std::memory_order_relaxed) == sequence) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void NodeStatsPage::WriteWords(size_t offset,
+                               const uint64_t* words,
+                               size_t num_words) {
+  for (size_t i = 0; i < num_words; ++i) {
+    data_[offset + i].store(words[i], std::memory_order_relaxed);
+  }
+}
+
+void NodeStatsPage::ReadWords(size_t offset,
+                              uint64_t* words,
+                              size_t num_words) const {
+  for (size_t i = 0; i < num_words; ++i) {
+    words[i] = data_[offset + i].load(std::memory_order_relaxed);
+  }
+}
+
+}  // namespace ipcz
@@ -0,0 +1,138 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_NODE_STATS_PAGE_H_
+#define IPCZ_SRC_IPCZ_NODE_STATS_PAGE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz {
+
+// A NodeStatsPage is a small fixed-size region of shared memory into which a
+// node periodically publishes a snapshot of its statistics, so that tools in
+// other processes (see tools/ipcz_top.cc) can observe it without any
+// cooperation from the application. See
+// IpczCreateNodeOptions.stats_publish_interval_ms.
+//
+// The page is written by a single thread in the publishing node and may be
+// read concurrently by any number of other processes, which may only have a
+// read-only mapping. Snapshots are published through a seqlock: readers never
+// block the writer, and they retry if they race with an update.
+//
+// Everything in the page is fixed-width, and its layout is versioned, so that
+// a reader need not be built from the same revision as the writer.
+class NodeStatsPage {
+ public:
+  // Identifies a NodeStatsPage in shared memory. This is "ipczstat" in ASCII.
+  static constexpr uint64_t kMagic = 0x746174737a637069;
+
+  // Bumped any time the layout of the page changes.
+  static constexpr uint32_t kVersion = 1;
+
+  // The exact size in bytes of the shared memory region holding a page.
+  static constexpr size_t kSize = 64 * 1024;
+
+  // The size in bytes of the fields which precede the published data.
+  static constexpr size_t kHeaderSize = 24;
+
+  // Figures for the publishing node as a whole.
+  struct NodeEntry {
+    uint64_t node_name_high;
+    uint64_t node_name_low;
+
+    // The wall clock time in nanoseconds since the Unix epoch at which this
+    // snapshot was taken, and the interval at which the node publishes.
+    uint64_t publish_time;
+    uint64_t publish_interval_ms;
+
+    // The node's total number of links, which may exceed the number of link
+    // entries in the page. See IpczNodeStats for the others.
+    uint64_t num_links;
+    uint64_t num_routers;
+    uint64_t num_proxies;
+
+    // The number of LinkEntry structures which follow in the page.
+    uint64_t num_link_entries;
+  };
+
+  // Figures for a single NodeLink. See IpczNodeLinkStats for most of these.
+  struct LinkEntry {
+    uint64_t remote_node_name_high;
+    uint64_t remote_node_name_low;
+    uint64_t num_messages_sent;
+    uint64_t num_bytes_sent;
+    uint64_t num_messages_received;
+    uint64_t num_bytes_received;
+    uint64_t num_messages_relayed;
+    uint64_t shared_memory_size;
+    uint64_t num_pending_capacity_requests;
+    uint64_t num_partial_parcels;
+    uint64_t num_subparcel_trackers;
+
+    // The total capacity in bytes of all block allocators in the link's
+    // shared memory, and the total size of blocks allocated and freed there by
+    // the publishing node. Both ends of the link allocate from the same blocks,
+    // so the occupancy of the link's shared memory can only be derived by
+    // combining these figures from both ends.
+    uint64_t block_capacity;
+    uint64_t num_block_bytes_allocated;
+    uint64_t num_block_bytes_freed;
+
+    // The number of parcels queued by all Routers bound to this link, in either
+    // direction.
+    uint64_t num_queued_parcels;
+  };
+
+  // The maximum number of LinkEntry structures which fit in a page.
+  static constexpr size_t kMaxLinkEntries =
+      ((kSize - kHeaderSize) - sizeof(NodeEntry)) / sizeof(LinkEntry);
+
+  // Initializes a new page within `memory`, which must be exactly kSize bytes,
+  // 8-byte aligned, and writable. The page starts out empty.
+  static NodeStatsPage& Initialize(absl::Span<uint8_t> memory);
+
+  // Returns the page within `memory` if it looks like a NodeStatsPage of a
+  // version understood by this reader, or null otherwise. `memory` need only
+  // be readable.
+  static const NodeStatsPage* FromMemory(absl::Span<const uint8_t> memory);
+
+  // Publishes a new snapshot. Link entries beyond kMaxLinkEntries are dropped.
+  // There must only be one writer at a time.
+  void Publish(const NodeEntry& node, absl::Span<const LinkEntry> links);
+
+  // Reads a consistent copy of the most recently published snapshot. Returns
+  // false if no consistent snapshot could be read after a bounded number of
+  // attempts, as may happen if the writer's process died mid-update.
+  bool Read(NodeEntry& node, std::vector<LinkEntry>& links) const;
+
+ private:
+  static constexpr size_t kNumDataWords =
+      (kSize - kHeaderSize) / sizeof(uint64_t);
+
+  NodeStatsPage();
+
+  void WriteWords(size_t offset, const uint64_t* words, size_t num_words);
+  void ReadWords(size_t offset, uint64_t* words, size_t num_words) const;
+
+  const uint64_t magic_;
+  const uint32_t version_;
+  const uint32_t max_link_entries_;
+
+  // Odd while an update is in progress, and even otherwise.
+  std::atomic<uint32_t> sequence_{0};
+  uint32_t padding_ = 0;
+
+  // A NodeEntry followed by up to kMaxLinkEntries LinkEntry structures, stored
+  // as atomic words so that concurrent reads are well-defined.
+  std::atomic<uint64_t> data_[kNumDataWords];
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_NODE_STATS_PAGE_H_
@@ -0,0 +1,176 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/node_stats_page.h"
+
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ipcz/link_side.h"
+#include "ipcz/link_type.h"
+#include "ipcz/node.h"
+#include "ipcz/node_link.h"
+#include "ipcz/node_link_memory.h"
+#include "ipcz/node_name.h"
+#include "ipcz/node_stats_publisher.h"
+#include "ipcz/operation_context.h"
+#include "ipcz/remote_router_link.h"
+#include "ipcz/router.h"
+#include "ipcz/sublink_id.h"
+#include "reference_drivers/sync_reference_driver.h"
+#include "test/test_node_links.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+#include "util/ref_counted.h"
+
+namespace ipcz {
+namespace {
+
+const IpczDriver& kDriver = reference_drivers::kSyncReferenceDriver;
+
+constexpr std::string_view kMessage = "hello";
+
+// Backing memory for a page, suitably aligned.
+class PageMemory {
+ public:
+  absl::Span<uint8_t> bytes() {
+    return {reinterpret_cast<uint8_t*>(words_.data()), NodeStatsPage::kSize};
+  }
+
+ private:
+  std::vector<uint64_t> words_ =
+      std::vector<uint64_t>(NodeStatsPage::kSize / sizeof(uint64_t));
+};
+
+NodeStatsPage::LinkEntry MakeLinkEntry(uint64_t n) {
+  NodeStatsPage::LinkEntry entry = {};
+  entry.remote_node_name_high = n;
+  entry.remote_node_name_low = n + 1;
+  entry.num_messages_sent = n + 2;
+  entry.num_queued_parcels = n + 3;
+  return entry;
+}
+
+using NodeStatsPageTest = testing::Test;
+
+TEST_F(NodeStatsPageTest, PublishAndRead) {
+  PageMemory memory;
+  EXPECT_EQ(nullptr, NodeStatsPage::FromMemory(memory.bytes()));
+
+  NodeStatsPage& page = NodeStatsPage::Initialize(memory.bytes());
+  EXPECT_EQ(&page, NodeStatsPage::FromMemory(memory.bytes()));
+  EXPECT_EQ(nullptr, NodeStatsPage::FromMemory(memory.bytes().subspan(8)));
+
+  NodeStatsPage::NodeEntry node;
+  std::vector<NodeStatsPage::LinkEntry> links(1);
+  EXPECT_TRUE(page.Read(node, links));
+  EXPECT_EQ(0u, node.publish_time);
+  EXPECT_TRUE(links.empty());
+
+  const NodeStatsPage::LinkEntry published_links[] = {MakeLinkEntry(10),
+                                                      MakeLinkEntry(20)};
+  page.Publish({.node_name_high = 1, .node_name_low = 2, .num_links = 2},
+               published_links);
+  EXPECT_TRUE(page.Read(node, links));
+  EXPECT_EQ(1u, node.node_name_high);
+  EXPECT_EQ(2u, node.node_name_low);
+  EXPECT_EQ(2u, node.num_links);
+  EXPECT_EQ(2u, node.num_link_entries);
+  ASSERT_EQ(2u, links.size());
+  EXPECT_EQ(10u, links[0].remote_node_name_high);
+  EXPECT_EQ(13u, links[0].num_queued_parcels);
+  EXPECT_EQ(20u, links[1].remote_node_name_high);
+  EXPECT_EQ(23u, links[1].num_queued_parcels);
+}
+
+TEST_F(NodeStatsPageTest, TooManyLinks) {
+  PageMemory memory;
+  NodeStatsPage& page = NodeStatsPage::Initialize(memory.bytes());
+
+  std::vector<NodeStatsPage::LinkEntry> published_links;
+  for (size_t i = 0; i < NodeStatsPage::kMaxLinkEntries + 5; ++i) {
+    published_links.push_back(MakeLinkEntry(i));
+  }
+  page.Publish({.num_links = published_links.size()}, published_links);
+
+  // The total number of links is still reported, but only as many entries as
+  // fit in the page are published.
+  NodeStatsPage::NodeEntry node;
+  std::vector<NodeStatsPage::LinkEntry> links;
+  EXPECT_TRUE(page.Read(node, links));
+  EXPECT_EQ(published_links.size(), node.num_links);
+  ASSERT_EQ(NodeStatsPage::kMaxLinkEntries, links.size());
+  EXPECT_EQ(NodeStatsPage::kMaxLinkEntries - 1,
+            links.back().remote_node_name_high);
+}
+
+TEST_F(NodeStatsPageTest, Publisher) {
+  const IpczCreateNodeOptions options = {
+      .size = sizeof(options),
+      .stats_publish_interval_ms = 1000 * 1000,
+  };
+  Ref<Node> node0 = MakeRefCounted<Node>(Node::Type::kBroker, kDriver);
+  Ref<Node> node1 =
+      MakeRefCounted<Node>(Node::Type::kNormal, kDriver, &options);
+  EXPECT_EQ(nullptr, node0->stats_publisher());
+  ASSERT_NE(nullptr, node1->stats_publisher());
+
+  const OperationContext context{OperationContext::kTransportNotification};
+  auto [link0, link1] =
+      test::LinkNodes(node0, node1, /*protocol_version=*/0,
+                      /*add_connections=*/true);
+  auto router0 = MakeRefCounted<Router>();
+  auto router1 = MakeRefCounted<Router>();
+  FragmentRef<RouterLinkState> link_state =
+      link0->memory().GetInitialRouterLinkState(0);
+  router0->SetOutwardLink(
+      context,
+      link0->AddRemoteRouterLink(context, SublinkId(0), link_state,
+                                 LinkType::kCentral, LinkSide::kA, router0));
+  router1->SetOutwardLink(
+      context,
+      link1->AddRemoteRouterLink(context, SublinkId(0), link_state,
+                                 LinkType::kCentral, LinkSide::kB, router1));
+  link_state->status = RouterLinkState::kStable;
+
+  // Leave a parcel queued on node1 for it to report.
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            router0->Put(absl::MakeSpan(
+                             reinterpret_cast<const uint8_t*>(kMessage.data()),
+                             kMessage.size()),
+                         {}));
+
+  NodeStatsPublisher& publisher = *node1->stats_publisher();
+  publisher.Publish();
+
+  NodeStatsPage::NodeEntry node;
+  std::vector<NodeStatsPage::LinkEntry> links;
+  EXPECT_TRUE(publisher.page().Read(node, links));
+  EXPECT_EQ(node1->GetAssignedName(),
+            NodeName(node.node_name_high, node.node_name_low));
+  EXPECT_EQ(1000u * 1000u, node.publish_interval_ms);
+  EXPECT_LT(0u, node.publish_time);
+  EXPECT_EQ(1u, node.num_links);
+  EXPECT_EQ(1u, node.num_routers);
+  EXPECT_EQ(0u, node.num_proxies);
+  ASSERT_EQ(1u, links.size());
+  EXPECT_EQ(link1->remote_node_name(),
+            NodeName(links[0].remote_node_name_high,
+                     links[0].remote_node_name_low));
+  EXPECT_LE(1u, links[0].num_messages_received);
+  EXPECT_LT(0u, links[0].shared_memory_size);
+  EXPECT_LT(0u, links[0].block_capacity);
+  EXPECT_EQ(1u, links[0].num_queued_parcels);
+
+  router0->CloseRoute();
+  router1->CloseRoute();
+  node0->Close();
+  node1->Close();
+  EXPECT_EQ(nullptr, node1->stats_publisher());
+}
+
+}  // namespace
+}  // namespace ipcz
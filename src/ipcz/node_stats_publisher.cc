@@ -0,0 +1,109 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/node_stats_publisher.h"
+
+#include <utility>
+#include <vector>
+
+#include "ipcz/ipcz.h"
+#include "ipcz/node.h"
+#include "ipcz/node_link.h"
+#include "ipcz/router.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "util/ref_counted.h"
+
+namespace ipcz {
+
+// static
+std::unique_ptr<NodeStatsPublisher> NodeStatsPublisher::Create(
+    Node& node,
+    absl::Duration interval) {
+  DriverMemory memory(node.driver(), NodeStatsPage::kSize);
+  if (!memory.is_valid()) {
+    return nullptr;
+  }
+
+  DriverMemoryMapping mapping = memory.Map();
+  if (!mapping.is_valid()) {
+    return nullptr;
+  }
+
+  return std::unique_ptr<NodeStatsPublisher>(new NodeStatsPublisher(
+      node, interval, std::move(memory), std::move(mapping)));
+}
+
+NodeStatsPublisher::NodeStatsPublisher(Node& node,
+                                       absl::Duration interval,
+                                       DriverMemory memory,
+                                       DriverMemoryMapping mapping)
+    : node_(node),
+      interval_(interval),
+      memory_(std::move(memory)),
+      mapping_(std::move(mapping)),
+      page_(NodeStatsPage::Initialize(mapping_.bytes())),
+      thread_([this] { Run(); }) {}
+
+NodeStatsPublisher::~NodeStatsPublisher() {
+  stop_.Notify();
+  thread_.join();
+}
+
+void NodeStatsPublisher::Publish() {
+  IpczNodeStats stats = {.size = sizeof(stats)};
+  node_.QueryStats(stats, nullptr);
+
+  const std::vector<Ref<NodeLink>> links = node_.GetLinks();
+  std::vector<NodeStatsPage::LinkEntry> link_entries(links.size());
+  IpczNodeLinkStats link_stats = {.size = sizeof(link_stats)};
+  for (size_t i = 0; i < links.size(); ++i) {
+    links[i]->QueryStats(link_stats);
+    NodeStatsPage::LinkEntry& entry = link_entries[i];
+    entry.remote_node_name_high = link_stats.remote_node_name_high;
+    entry.remote_node_name_low = link_stats.remote_node_name_low;
+    entry.num_messages_sent = link_stats.num_messages_sent;
+    entry.num_bytes_sent = link_stats.num_bytes_sent;
+    entry.num_messages_received = link_stats.num_messages_received;
+    entry.num_bytes_received = link_stats.num_bytes_received;
+    entry.num_messages_relayed = link_stats.num_messages_relayed;
+    entry.shared_memory_size = link_stats.shared_memory_size;
+    entry.num_pending_capacity_requests =
+        link_stats.num_pending_capacity_requests;
+    entry.num_partial_parcels = link_stats.num_partial_parcels;
+    entry.num_subparcel_trackers = link_stats.num_subparcel_trackers;
+    for (size_t j = 0; j < link_stats.num_block_sizes; ++j) {
+      const IpczBlockStats& blocks = link_stats.blocks[j];
+      entry.block_capacity += blocks.capacity;
+      entry.num_block_bytes_allocated +=
+          blocks.block_size * blocks.num_allocated;
+      entry.num_block_bytes_freed += blocks.block_size * blocks.num_freed;
+    }
+    for (const Ref<Router>& router : links[i]->GetBoundRouters()) {
+      entry.num_queued_parcels += router->GetNumQueuedParcels();
+    }
+  }
+
+  const NodeName name = node_.GetAssignedName();
+  const NodeStatsPage::NodeEntry node_entry = {
+      .node_name_high = name.high(),
+      .node_name_low = name.low(),
+      .publish_time = static_cast<uint64_t>(absl::GetCurrentTimeNanos()),
+      .publish_interval_ms =
+          static_cast<uint64_t>(absl::ToInt64Milliseconds(interval_)),
+      .num_links = links.size(),
+      .num_routers = stats.num_routers,
+      .num_proxies = stats.num_proxies,
+  };
+
+  absl::MutexLock lock(&mutex_);
+  page_.Publish(node_entry, link_entries);
+}
+
+void NodeStatsPublisher::Run() {
+  do {
+    Publish();
+  } while (!stop_.WaitForNotificationWithTimeout(interval_));
+}
+
+}  // namespace ipcz
@@ -0,0 +1,73 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_NODE_STATS_PUBLISHER_H_
+#define IPCZ_SRC_IPCZ_NODE_STATS_PUBLISHER_H_
+
+#include <memory>
+#include <thread>
+
+#include "ipcz/driver_memory.h"
+#include "ipcz/driver_memory_mapping.h"
+#include "ipcz/node_stats_page.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/synchronization/notification.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+
+namespace ipcz {
+
+class Node;
+
+// Owns a NodeStatsPage in driver-allocated shared memory, along with a thread
+// which periodically publishes a snapshot of a Node's statistics into it. See
+// IpczCreateNodeOptions.stats_publish_interval_ms.
+class NodeStatsPublisher {
+ public:
+  // Allocates a new page through `node`'s driver and starts a thread which
+  // publishes to it every `interval`. Returns null if the driver can't
+  // allocate or map the page, e.g. within a sandboxed process. `node` must
+  // outlive the returned object.
+  static std::unique_ptr<NodeStatsPublisher> Create(Node& node,
+                                                    absl::Duration interval);
+
+  NodeStatsPublisher(const NodeStatsPublisher&) = delete;
+  NodeStatsPublisher& operator=(const NodeStatsPublisher&) = delete;
+
+  // Stops and joins the publishing thread.
+  ~NodeStatsPublisher();
+
+  // The shared memory object holding the page.
+  const DriverMemory& memory() const { return memory_; }
+
+  // The page itself, as mapped by this process.
+  const NodeStatsPage& page() const { return page_; }
+
+  // Publishes a fresh snapshot immediately, rather than waiting for the next
+  // interval. This is safe to call from any thread.
+  void Publish();
+
+ private:
+  NodeStatsPublisher(Node& node,
+                     absl::Duration interval,
+                     DriverMemory memory,
+                     DriverMemoryMapping mapping);
+
+  void Run();
+
+  Node& node_;
+  const absl::Duration interval_;
+  const DriverMemory memory_;
+  const DriverMemoryMapping mapping_;
+  NodeStatsPage& page_;
+
+  // Serializes writers to `page_`.
+  absl::Mutex mutex_;
+
+  absl::Notification stop_;
+  std::thread thread_;
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_NODE_STATS_PUBLISHER_H_
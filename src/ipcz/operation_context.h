@@ -7,6 +7,8 @@
 
 namespace ipcz {
 
+class TrapEventDispatcher;
+
 // Structure to capture any relevant context regarding an ongoing ipcz
 // operation. This is plumbed throughout methods on Router and other related
 // objects as needed to provide context for any events emitted by ipcz.
@@ -32,13 +34,36 @@ struct OperationContext {
 
   explicit OperationContext(EntryPoint entry_point)
       : entry_point_(entry_point) {}
-  OperationContext(const OperationContext&) = default;
-  OperationContext& operator=(const OperationContext&) = default;
+
+  // Constructs an OperationContext whose trap events are all accumulated into
+  // `dispatcher` for dispatch at the end of the operation, rather than being
+  // dispatched by each individual object which raises them. `dispatcher` must
+  // outlive this object.
+  OperationContext(EntryPoint entry_point, TrapEventDispatcher& dispatcher)
+      : entry_point_(entry_point), trap_event_dispatcher_(&dispatcher) {}
+
+  // NOTE: Copies do not inherit their source's TrapEventDispatcher, because
+  // copies may be retained beyond the extent of the operation, e.g. when
+  // captured by asynchronous callbacks.
+  OperationContext(const OperationContext& other)
+      : entry_point_(other.entry_point_) {}
+  OperationContext& operator=(const OperationContext& other) {
+    entry_point_ = other.entry_point_;
+    trap_event_dispatcher_ = nullptr;
+    return *this;
+  }
 
   bool is_api_call() const { return entry_point_ == kAPICall; }
 
+  // The TrapEventDispatcher which accumulates all trap events raised within
+  // this operation, if any.
+  TrapEventDispatcher* trap_event_dispatcher() const {
+    return trap_event_dispatcher_;
+  }
+
  private:
   EntryPoint entry_point_;
+  TrapEventDispatcher* trap_event_dispatcher_ = nullptr;
 };
 
 }  // namespace ipcz
@@ -7,6 +7,7 @@
 #include <cctype>
 #include <cstddef>
 #include <cstdint>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -56,6 +57,12 @@ void Parcel::AllocateData(size_t num_bytes,
     }
   }
 
+  if (fragment.is_null() && num_bytes <= kMaxInlineDataSize) {
+    InlineData& bytes = data_.storage.emplace<InlineData>();
+    data_.view = absl::MakeSpan(bytes).first(num_bytes);
+    return;
+  }
+
   if (fragment.is_null()) {
     std::vector<uint8_t> bytes(num_bytes);
     data_.view = absl::MakeSpan(bytes);
@@ -78,9 +85,23 @@ void Parcel::AllocateData(size_t num_bytes,
 
 bool Parcel::AdoptDataFragment(Ref<NodeLinkMemory> memory,
                                const Fragment& fragment) {
+  const std::optional<absl::Span<uint8_t>> view =
+      GetDataFragmentView(fragment);
+  if (!view) {
+    return false;
+  }
+
+  data_.storage.emplace<DataFragment>(std::move(memory), fragment);
+  data_.view = *view;
+  return true;
+}
+
+// static
+std::optional<absl::Span<uint8_t>> Parcel::GetDataFragmentView(
+    const Fragment& fragment) {
   if (!fragment.is_addressable() || fragment.size() <= sizeof(FragmentHeader) ||
       fragment.offset() % 8 != 0) {
-    return false;
+    return std::nullopt;
   }
 
   // This load-acquire is balanced by a store-release in CommitData() by the
@@ -90,17 +111,17 @@ bool Parcel::AdoptDataFragment(Ref<NodeLinkMemory> memory,
   const uint32_t data_size = header.size.load(std::memory_order_acquire);
   const size_t max_data_size = fragment.size() - sizeof(FragmentHeader);
   if (data_size > max_data_size) {
-    return false;
+    return std::nullopt;
   }
 
-  data_.storage.emplace<DataFragment>(std::move(memory), fragment);
-  data_.view =
-      fragment.mutable_bytes().subspan(sizeof(FragmentHeader), data_size);
-  return true;
+  return fragment.mutable_bytes().subspan(sizeof(FragmentHeader), data_size);
 }
 
 void Parcel::SetObjects(std::vector<Ref<APIObject>> objects) {
   ABSL_ASSERT(!objects_);
+  if (objects.empty()) {
+    return;
+  }
   objects_ = std::make_unique<ObjectStorageWithView>();
   objects_->storage = std::move(objects);
   objects_->view = absl::MakeSpan(objects_->storage);
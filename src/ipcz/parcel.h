@@ -5,10 +5,12 @@
 #ifndef IPCZ_SRC_IPCZ_PARCEL_H_
 #define IPCZ_SRC_IPCZ_PARCEL_H_
 
+#include <array>
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -24,6 +26,7 @@
 #include "third_party/abseil-cpp/absl/types/span.h"
 #include "third_party/abseil-cpp/absl/types/variant.h"
 #include "util/ref_counted.h"
+#include "util/thread_local_free_list.h"
 
 namespace ipcz {
 
@@ -38,12 +41,25 @@ class Parcel {
   // a parcel, to mitigate the potential for abuse.
   static constexpr size_t kMaxSubparcelsPerParcel = 1024;
 
+  // Parcels allocated with heap-backed data of this size or less store their
+  // data inline within the Parcel object itself.
+  static constexpr size_t kMaxInlineDataSize = 64;
+
   Parcel();
   explicit Parcel(SequenceNumber sequence_number);
   Parcel(const Parcel& other) = delete;
   Parcel& operator=(const Parcel& other) = delete;
   ~Parcel();
 
+  // Parcels are allocated and freed at a high rate, so their storage is
+  // recycled through a per-thread free list.
+  static void* operator new(size_t size) {
+    return ThreadLocalFreeList<Parcel>::Allocate(size);
+  }
+  static void operator delete(void* ptr, size_t size) {
+    ThreadLocalFreeList<Parcel>::Free(ptr, size);
+  }
+
   void set_sequence_number(SequenceNumber n) { sequence_number_ = n; }
   SequenceNumber sequence_number() const { return sequence_number_; }
 
@@ -55,6 +71,13 @@ class Parcel {
   void set_subparcel_index(size_t index) { subparcel_index_ = index; }
   size_t subparcel_index() const { return subparcel_index_; }
 
+  // When parcel tracing is enabled, the time at which this parcel's current
+  // traced stage began. See ParcelTracer.
+  void set_trace_stage_start_time(int64_t time) {
+    trace_stage_start_time_ = time;
+  }
+  int64_t trace_stage_start_time() const { return trace_stage_start_time_; }
+
   // Indicates whether this Parcel is empty, meaning its data and objects have
   // been fully consumed.
   bool empty() const { return data_view().empty() && objects_view().empty(); }
@@ -69,9 +92,9 @@ class Parcel {
 
   // Allocates `num_bytes` of storage for this Parcel's data. If `memory` is
   // non-null then its fragment pool is the preferred allocation source.
-  // Otherwise memory is allocated and zero-initialized on the heap, and the
-  // data placed therein will be inlined within any message that transmits this
-  // parcel.
+  // Otherwise memory is zero-initialized within the Parcel itself if small
+  // enough, or allocated on the heap. In either case the data placed therein
+  // will be inlined within any message that transmits this parcel.
   //
   // If `memory` is non-null and `allow_partial` is true, this may allocate less
   // memory than requested if some reasonable amount of space is still available
@@ -92,6 +115,12 @@ class Parcel {
   // this returns false.
   bool AdoptDataFragment(Ref<NodeLinkMemory> memory, const Fragment& fragment);
 
+  // Validates `fragment` as a parcel data fragment in the same way as
+  // AdoptDataFragment(), but without adopting it. Returns a view of the parcel
+  // data within the fragment, or null if the fragment is invalid.
+  static std::optional<absl::Span<uint8_t>> GetDataFragmentView(
+      const Fragment& fragment);
+
   void set_remote_source(Ref<NodeLink> source) {
     remote_source_ = std::move(source);
   }
@@ -191,11 +220,15 @@ class Parcel {
     Fragment fragment_;
   };
 
+  // Storage for small parcel data held directly within a Parcel.
+  using InlineData = std::array<uint8_t, kMaxInlineDataSize>;
+
   // A variant backing type for the parcel's data. Data may be in shared memory,
-  // heap-allocated and initialized from within the Parcel, or heap-allocated by
-  // a received Message and moved into the Parcel from there.
+  // stored inline or heap-allocated and initialized from within the Parcel, or
+  // heap-allocated by a received Message and moved into the Parcel from there.
   using DataStorage = absl::variant<absl::monostate,
                                     DataFragment,
+                                    InlineData,
                                     std::vector<uint8_t>,
                                     Message::ReceivedDataBuffer>;
 
@@ -237,8 +270,8 @@ class Parcel {
   DataStorageWithView data_;
 
   // The set of APIObjects attached to this parcel, and a view of the objects
-  // not yet consumed from it. Heap-allocated to keep Parcels small in the
-  // common case of no object attachments.
+  // not yet consumed from it. Heap-allocated to keep Parcels small, and null in
+  // the common case of no object attachments.
   std::unique_ptr<ObjectStorageWithView> objects_;
 
   // By default, all parcels have a single subparcel (theirself) at index 0. On
@@ -246,6 +279,9 @@ class Parcel {
   // updated by the containing Parcel as needed.
   size_t num_subparcels_ = 1;
   size_t subparcel_index_ = 0;
+
+  // See ParcelTracer. Zero unless tracing was enabled when the stage began.
+  int64_t trace_stage_start_time_ = 0;
 };
 
 }  // namespace ipcz
@@ -0,0 +1,289 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/parcel_trace.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "ipcz/node_name.h"
+#include "ipcz/parcel.h"
+#include "third_party/abseil-cpp/absl/container/flat_hash_set.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "util/log.h"
+
+namespace ipcz {
+
+namespace {
+
+struct TraceSlice {
+  ParcelTraceStage stage;
+  uintptr_t track;
+  SequenceNumber sequence_number;
+  int64_t start_time;
+  int64_t end_time;
+  uint64_t flow_id;
+};
+
+class TraceLog {
+ public:
+  // Discards anything recorded so far. If `file` is non-null, the trace is
+  // written there by TakeTrace(), which also closes it.
+  void Reset(int64_t start_time, size_t max_slices, std::FILE* file) {
+    absl::MutexLock lock(&mutex_);
+    file_ = file;
+    slices_.clear();
+    max_slices_ = max_slices;
+    num_dropped_slices_ = 0;
+
+    // Each process which exports a trace needs its own pid in the trace so
+    // that merged traces keep them apart. The start time and the address of
+    // this object are distinct enough between processes for that.
+    process_id_ = static_cast<uint32_t>(
+                      Mix(static_cast<uint64_t>(start_time) ^
+                          reinterpret_cast<uintptr_t>(this))) &
+                  0x7fffffff;
+  }
+
+  void Add(const TraceSlice& slice) {
+    absl::MutexLock lock(&mutex_);
+    if (slices_.size() >= max_slices_) {
+      ++num_dropped_slices_;
+      return;
+    }
+    slices_.push_back(slice);
+  }
+
+  // Ends the trace. Returns it if it was kept in memory, or an empty string if
+  // it was written to a file.
+  std::string TakeTrace() {
+    absl::MutexLock lock(&mutex_);
+    std::string json = ExportJson();
+    if (!file_) {
+      return json;
+    }
+
+    if (std::fwrite(json.data(), 1, json.size(), file_) < json.size()) {
+      DLOG(ERROR) << "Parcel trace failed to write " << json.size()
+                  << " bytes";
+    }
+    if (std::fclose(file_) != 0) {
+      DLOG(ERROR) << "Parcel trace failed to close its file";
+    }
+    file_ = nullptr;
+    return {};
+  }
+
+  static uint64_t Mix(uint64_t value) {
+    // The finalizer from SplitMix64. This must be stable across processes, so
+    // it can't be absl::Hash.
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+    return value ^ (value >> 31);
+  }
+
+ private:
+  std::string ExportJson() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    std::string json = "{\"traceEvents\":[";
+    absl::StrAppend(&json, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":",
+                    process_id_, ",\"args\":{\"name\":\"ipcz\"}}");
+
+    absl::flat_hash_set<uintptr_t> named_tracks;
+    for (const TraceSlice& slice : slices_) {
+      const uint32_t tid = GetThreadId(slice.track);
+      if (named_tracks.insert(slice.track).second) {
+        absl::StrAppend(&json,
+                        ",{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":",
+                        process_id_, ",\"tid\":", tid,
+                        ",\"args\":{\"name\":\"", GetTrackName(slice.stage),
+                        " 0x", absl::Hex(slice.track), "\"}}");
+      }
+
+      const char* name = GetStageName(slice.stage);
+      absl::StrAppend(&json, ",{\"ph\":\"X\",\"cat\":\"ipcz\",\"name\":\"",
+                      name, "\",\"pid\":", process_id_, ",\"tid\":", tid,
+                      ",\"ts\":", FormatMicroseconds(slice.start_time),
+                      ",\"dur\":",
+                      FormatMicroseconds(slice.end_time - slice.start_time),
+                      ",\"args\":{\"seq\":", slice.sequence_number.value(),
+                      "}}");
+      if (slice.flow_id) {
+        const bool starts_flow = slice.stage == ParcelTraceStage::kTransmit;
+        absl::StrAppend(&json, ",{\"ph\":\"", starts_flow ? "s" : "f",
+                        starts_flow ? "" : "\",\"bp\":\"e",
+                        "\",\"cat\":\"ipcz\",\"name\":\"Parcel\",\"id\":\"0x",
+                        absl::Hex(slice.flow_id), "\",\"pid\":", process_id_,
+                        ",\"tid\":", tid,
+                        ",\"ts\":", FormatMicroseconds(slice.start_time), "}");
+      }
+    }
+    absl::StrAppend(&json,
+                    "],\"displayTimeUnit\":\"ns\",\"otherData\":{"
+                    "\"dropped_slices\":\"",
+                    num_dropped_slices_, "\"}}");
+    slices_.clear();
+    num_dropped_slices_ = 0;
+    return json;
+  }
+
+  static uint32_t GetThreadId(uintptr_t track) {
+    return static_cast<uint32_t>(Mix(track)) & 0x7fffffff;
+  }
+
+  static const char* GetTrackName(ParcelTraceStage stage) {
+    switch (stage) {
+      case ParcelTraceStage::kTransmit:
+      case ParcelTraceStage::kReceive:
+      case ParcelTraceStage::kWaitForFragment:
+        return "NodeLink";
+      default:
+        return "Router";
+    }
+  }
+
+  static const char* GetStageName(ParcelTraceStage stage) {
+    switch (stage) {
+      case ParcelTraceStage::kAllocate:
+        return "Allocate";
+      case ParcelTraceStage::kQueueOutbound:
+        return "QueueOutbound";
+      case ParcelTraceStage::kProxy:
+        return "Proxy";
+      case ParcelTraceStage::kTransmit:
+        return "Transmit";
+      case ParcelTraceStage::kReceive:
+        return "Receive";
+      case ParcelTraceStage::kWaitForFragment:
+        return "WaitForFragment";
+      case ParcelTraceStage::kQueueInbound:
+        return "QueueInbound";
+    }
+    return "Unknown";
+  }
+
+  // Chrome JSON timestamps are in microseconds, but fractions are allowed.
+  static std::string FormatMicroseconds(int64_t nanoseconds) {
+    return absl::StrCat(nanoseconds / 1000, ".",
+                        absl::Dec(nanoseconds % 1000, absl::kZeroPad3));
+  }
+
+  absl::Mutex mutex_;
+  std::FILE* file_ ABSL_GUARDED_BY(mutex_) = nullptr;
+  uint32_t process_id_ ABSL_GUARDED_BY(mutex_) = 0;
+  size_t max_slices_ ABSL_GUARDED_BY(mutex_) = 0;
+  std::vector<TraceSlice> slices_ ABSL_GUARDED_BY(mutex_);
+
+  // The number of slices not recorded because `slices_` was already full.
+  uint64_t num_dropped_slices_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+TraceLog& GetTraceLog() {
+  static auto* log = new TraceLog();
+  return *log;
+}
+
+}  // namespace
+
+std::atomic<bool> ParcelTracer::enabled_{false};
+
+// static
+bool ParcelTracer::Start(size_t max_slices) {
+  bool was_enabled = false;
+  if (!enabled_.compare_exchange_strong(was_enabled, true,
+                                        std::memory_order_relaxed)) {
+    return false;
+  }
+
+  // Anything recorded since `enabled_` was set is discarded here.
+  GetTraceLog().Reset(GetCurrentTime(), max_slices, nullptr);
+  return true;
+}
+
+// static
+bool ParcelTracer::StartToFile(const char* path, size_t max_slices) {
+  bool was_enabled = false;
+  if (!enabled_.compare_exchange_strong(was_enabled, true,
+                                        std::memory_order_relaxed)) {
+    return false;
+  }
+
+  std::FILE* file = std::fopen(path, "w");
+  if (!file) {
+    enabled_.store(false, std::memory_order_relaxed);
+    return false;
+  }
+
+  GetTraceLog().Reset(GetCurrentTime(),
+                      max_slices ? max_slices : kDefaultMaxSlices, file);
+  return true;
+}
+
+// static
+std::string ParcelTracer::Stop() {
+  enabled_.store(false, std::memory_order_relaxed);
+  return GetTraceLog().TakeTrace();
+}
+
+// static
+uint64_t ParcelTracer::GetFlowId(const NodeName& from,
+                                 const NodeName& to,
+                                 SublinkId sublink,
+                                 SequenceNumber n) {
+  uint64_t id = TraceLog::Mix(from.high());
+  id = TraceLog::Mix(id ^ from.low());
+  id = TraceLog::Mix(id ^ to.high());
+  id = TraceLog::Mix(id ^ to.low());
+  id = TraceLog::Mix(id ^ sublink.value());
+  id = TraceLog::Mix(id ^ n.value());
+
+  // Zero means "no flow" to AddSlice().
+  return id ? id : 1;
+}
+
+// static
+void ParcelTracer::AddSlice(ParcelTraceStage stage,
+                            const void* track,
+                            SequenceNumber n,
+                            int64_t start_time,
+                            uint64_t flow_id) {
+  if (!start_time || !IsEnabled()) {
+    return;
+  }
+
+  GetTraceLog().Add({
+      .stage = stage,
+      .track = reinterpret_cast<uintptr_t>(track),
+      .sequence_number = n,
+      .start_time = start_time,
+      .end_time = GetCurrentTime(),
+      .flow_id = flow_id,
+  });
+}
+
+// static
+int64_t ParcelTracer::GetCurrentTime() {
+  // Wall clock time, so that traces from different processes on the same
+  // machine line up.
+  return absl::GetCurrentTimeNanos();
+}
+
+// static
+void ParcelTracer::BeginStageImpl(Parcel& parcel) {
+  parcel.set_trace_stage_start_time(GetCurrentTime());
+}
+
+// static
+void ParcelTracer::EndStageImpl(ParcelTraceStage stage,
+                                const void* track,
+                                const Parcel& parcel) {
+  AddSlice(stage, track, parcel.sequence_number(),
+           parcel.trace_stage_start_time());
+}
+
+}  // namespace ipcz
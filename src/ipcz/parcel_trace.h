@@ -0,0 +1,175 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_PARCEL_TRACE_H_
+#define IPCZ_SRC_IPCZ_PARCEL_TRACE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "ipcz/sequence_number.h"
+#include "ipcz/sublink_id.h"
+
+namespace ipcz {
+
+class NodeName;
+class Parcel;
+
+// Stages of a parcel's life which can be traced. Each stage is recorded as a
+// slice on a track belonging to the Router or NodeLink which handled it.
+enum class ParcelTraceStage {
+  // From allocation of an outgoing parcel's data until it's submitted to its
+  // Router and assigned a SequenceNumber. This includes any time the
+  // application spends filling in the parcel.
+  kAllocate,
+
+  // Queued by a terminal Router until it has an outward link to send on.
+  kQueueOutbound,
+
+  // Queued by a proxying Router until it's forwarded along the route.
+  kProxy,
+
+  // Serialized and handed to the driver by a RemoteRouterLink.
+  kTransmit,
+
+  // Deserialized and handed to a Router by a NodeLink.
+  kReceive,
+
+  // Waiting for the NodeLink to learn about the shared memory buffer which
+  // holds the parcel's data.
+  kWaitForFragment,
+
+  // Queued by a terminal Router until the application retrieves it.
+  kQueueInbound,
+};
+
+// Records traced parcel stages process-wide, for export in the Chrome JSON
+// trace event format understood by Perfetto and chrome://tracing. Tracing is
+// off by default. While it's off, GetStartTime() returns 0 without reading the
+// clock, so a ScopedParcelTraceSlice records nothing and never computes a flow
+// ID, and BeginStage() doesn't touch the parcel.
+//
+// Every slice is tagged with its parcel's SequenceNumber. Each hop from one
+// node to another is also drawn as a flow from the kTransmit slice on the
+// sending node to the kReceive slice on the receiving node. Flow IDs depend
+// only on the two node names, the sublink and the SequenceNumber, so traces
+// exported by separate processes can be merged and still line up.
+//
+// A trace is bounded: once it holds its maximum number of slices, further
+// slices are dropped and only counted. The count is exported with the trace.
+class ParcelTracer {
+ public:
+  // The default maximum number of slices recorded by a trace.
+  static constexpr size_t kDefaultMaxSlices = 1024 * 1024;
+
+  static bool IsEnabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  // Discards anything previously recorded and begins recording, up to
+  // `max_slices` slices. Returns false, without starting, if tracing is already
+  // in progress.
+  static bool Start(size_t max_slices = kDefaultMaxSlices);
+
+  // Like Start(), but the trace is written to a new file at `path` when tracing
+  // stops, replacing any existing file. If `max_slices` is zero, the default
+  // limit applies. Returns false, without starting, if tracing is already in
+  // progress or the file can't be created.
+  static bool StartToFile(const char* path, size_t max_slices);
+
+  // Stops recording and returns everything recorded since Start() as a Chrome
+  // JSON trace. The number of slices dropped for exceeding the limit given to
+  // Start() is reported as "dropped_slices" in the trace's "otherData". If
+  // tracing was started by StartToFile(), the trace is written to the file
+  // instead and an empty string is returned.
+  static std::string Stop();
+
+  // Returns the current time in nanoseconds, for use as the start time of a
+  // slice passed to AddSlice(). Returns 0 if tracing is disabled.
+  static int64_t GetStartTime() {
+    return IsEnabled() ? GetCurrentTime() : 0;
+  }
+
+  // Returns an ID identifying the flow of the parcel with SequenceNumber `n`
+  // over `sublink`, from node `from` to node `to`.
+  static uint64_t GetFlowId(const NodeName& from,
+                            const NodeName& to,
+                            SublinkId sublink,
+                            SequenceNumber n);
+
+  // Records a slice for `stage` of the parcel with SequenceNumber `n`,
+  // beginning at `start_time` (as returned by GetStartTime()) and ending now.
+  // `track` identifies the object which handled the stage. If `flow_id` is
+  // non-zero, a kTransmit slice starts that flow and a kReceive slice ends it.
+  // Does nothing if `start_time` is 0.
+  static void AddSlice(ParcelTraceStage stage,
+                       const void* track,
+                       SequenceNumber n,
+                       int64_t start_time,
+                       uint64_t flow_id = 0);
+
+  // Marks the beginning of a new stage for `parcel`.
+  static void BeginStage(Parcel& parcel) {
+    if (IsEnabled()) {
+      BeginStageImpl(parcel);
+    }
+  }
+
+  // Records `stage` for `parcel` as a slice on `track`, beginning at the last
+  // call to BeginStage() for `parcel`.
+  static void EndStage(ParcelTraceStage stage,
+                       const void* track,
+                       const Parcel& parcel) {
+    if (IsEnabled()) {
+      EndStageImpl(stage, track, parcel);
+    }
+  }
+
+ private:
+  static int64_t GetCurrentTime();
+  static void BeginStageImpl(Parcel& parcel);
+  static void EndStageImpl(ParcelTraceStage stage,
+                           const void* track,
+                           const Parcel& parcel);
+
+  static std::atomic<bool> enabled_;
+};
+
+// Records a slice for `stage` spanning the lifetime of this object, if tracing
+// was enabled when it was constructed.
+class ScopedParcelTraceSlice {
+ public:
+  ScopedParcelTraceSlice(ParcelTraceStage stage,
+                         const void* track,
+                         SequenceNumber n)
+      : stage_(stage),
+        track_(track),
+        sequence_number_(n),
+        start_time_(ParcelTracer::GetStartTime()) {}
+  ScopedParcelTraceSlice(const ScopedParcelTraceSlice&) = delete;
+  ScopedParcelTraceSlice& operator=(const ScopedParcelTraceSlice&) = delete;
+
+  ~ScopedParcelTraceSlice() {
+    if (start_time_) {
+      ParcelTracer::AddSlice(stage_, track_, sequence_number_, start_time_,
+                             flow_id_);
+    }
+  }
+
+  bool is_recording() const { return start_time_ != 0; }
+
+  // See ParcelTracer::AddSlice().
+  void set_flow_id(uint64_t flow_id) { flow_id_ = flow_id; }
+
+ private:
+  const ParcelTraceStage stage_;
+  const void* const track_;
+  const SequenceNumber sequence_number_;
+  const int64_t start_time_;
+  uint64_t flow_id_ = 0;
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_PARCEL_TRACE_H_
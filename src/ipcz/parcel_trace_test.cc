@@ -0,0 +1,240 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/parcel_trace.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "ipcz/link_side.h"
+#include "ipcz/link_type.h"
+#include "ipcz/node.h"
+#include "ipcz/node_link.h"
+#include "ipcz/node_link_memory.h"
+#include "ipcz/operation_context.h"
+#include "ipcz/remote_router_link.h"
+#include "ipcz/router.h"
+#include "ipcz/sublink_id.h"
+#include "reference_drivers/sync_reference_driver.h"
+#include "test/test_node_links.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "util/ref_counted.h"
+
+namespace ipcz {
+namespace {
+
+const IpczDriver& kDriver = reference_drivers::kSyncReferenceDriver;
+
+constexpr std::string_view kMessage = "hello";
+
+bool HasSlice(std::string_view trace, std::string_view name) {
+  return trace.find(absl::StrCat("\"ph\":\"X\",\"cat\":\"ipcz\",\"name\":\"",
+                                 std::string(name), "\"")) !=
+         std::string_view::npos;
+}
+
+IpczResult GetMessage(Router& router, std::string& message) {
+  char data[kMessage.size()];
+  size_t num_bytes = sizeof(data);
+  const IpczResult result = router.Get(IPCZ_NO_FLAGS, nullptr, data,
+                                       &num_bytes, nullptr, nullptr, nullptr);
+  message = std::string(data, num_bytes);
+  return result;
+}
+
+class ParcelTraceTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    // Only one trace may be in progress per process, and the test runner may
+    // already be tracing to a file.
+    if (ParcelTracer::IsEnabled()) {
+      GTEST_SKIP() << "Parcel tracing is already in progress";
+    }
+  }
+};
+
+TEST_F(ParcelTraceTest, DisabledByDefault) {
+  EXPECT_FALSE(ParcelTracer::IsEnabled());
+
+  auto [a, b] = Router::CreatePair();
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            a->Put(absl::MakeSpan(
+                       reinterpret_cast<const uint8_t*>(kMessage.data()),
+                       kMessage.size()),
+                   {}));
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, GetMessage(*b, message));
+
+  // Nothing recorded before tracing started is exported.
+  ParcelTracer::Start();
+  const std::string trace = ParcelTracer::Stop();
+  EXPECT_FALSE(HasSlice(trace, "Allocate"));
+  EXPECT_FALSE(HasSlice(trace, "QueueInbound"));
+
+  a->CloseRoute();
+  b->CloseRoute();
+}
+
+TEST_F(ParcelTraceTest, LocalParcel) {
+  auto [a, b] = Router::CreatePair();
+
+  ParcelTracer::Start();
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            a->Put(absl::MakeSpan(
+                       reinterpret_cast<const uint8_t*>(kMessage.data()),
+                       kMessage.size()),
+                   {}));
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, GetMessage(*b, message));
+  EXPECT_EQ(kMessage, message);
+  const std::string trace = ParcelTracer::Stop();
+
+  EXPECT_TRUE(HasSlice(trace, "Allocate"));
+  EXPECT_TRUE(HasSlice(trace, "QueueInbound"));
+  EXPECT_FALSE(HasSlice(trace, "Transmit"));
+  EXPECT_FALSE(HasSlice(trace, "Receive"));
+
+  a->CloseRoute();
+  b->CloseRoute();
+}
+
+TEST_F(ParcelTraceTest, RemoteParcel) {
+  Ref<Node> node0 = MakeRefCounted<Node>(Node::Type::kBroker, kDriver);
+  Ref<Node> node1 = MakeRefCounted<Node>(Node::Type::kNormal, kDriver);
+
+  const OperationContext context{OperationContext::kTransportNotification};
+  auto [link0, link1] = test::LinkNodes(node0, node1, /*protocol_version=*/0);
+  auto router0 = MakeRefCounted<Router>();
+  auto router1 = MakeRefCounted<Router>();
+  FragmentRef<RouterLinkState> link_state =
+      link0->memory().GetInitialRouterLinkState(0);
+  router0->SetOutwardLink(
+      context,
+      link0->AddRemoteRouterLink(context, SublinkId(0), link_state,
+                                 LinkType::kCentral, LinkSide::kA, router0));
+  router1->SetOutwardLink(
+      context,
+      link1->AddRemoteRouterLink(context, SublinkId(0), link_state,
+                                 LinkType::kCentral, LinkSide::kB, router1));
+  link_state->status = RouterLinkState::kStable;
+
+  ParcelTracer::Start();
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            router0->Put(absl::MakeSpan(
+                             reinterpret_cast<const uint8_t*>(kMessage.data()),
+                             kMessage.size()),
+                         {}));
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, GetMessage(*router1, message));
+  EXPECT_EQ(kMessage, message);
+  const std::string trace = ParcelTracer::Stop();
+
+  EXPECT_TRUE(HasSlice(trace, "Allocate"));
+  EXPECT_TRUE(HasSlice(trace, "Transmit"));
+  EXPECT_TRUE(HasSlice(trace, "Receive"));
+  EXPECT_TRUE(HasSlice(trace, "QueueInbound"));
+
+  // The hop is drawn as a flow from the sending node to the receiving node,
+  // with an ID either side can derive independently.
+  const uint64_t flow_id = ParcelTracer::GetFlowId(
+      link0->local_node_name(), link0->remote_node_name(), SublinkId(0),
+      SequenceNumber(0));
+  EXPECT_EQ(flow_id, ParcelTracer::GetFlowId(link1->remote_node_name(),
+                                             link1->local_node_name(),
+                                             SublinkId(0), SequenceNumber(0)));
+  const std::string flow_id_field =
+      absl::StrCat("\"id\":\"0x", absl::Hex(flow_id), "\"");
+  EXPECT_NE(std::string::npos,
+            trace.find(absl::StrCat("{\"ph\":\"s\",\"cat\":\"ipcz\",\"name\":"
+                                    "\"Parcel\",",
+                                    flow_id_field)));
+  EXPECT_NE(std::string::npos,
+            trace.find(absl::StrCat("{\"ph\":\"f\",\"bp\":\"e\",\"cat\":"
+                                    "\"ipcz\",\"name\":\"Parcel\",",
+                                    flow_id_field)));
+
+  router0->CloseRoute();
+  router1->CloseRoute();
+  link0->Deactivate(context);
+  link1->Deactivate(context);
+}
+
+TEST_F(ParcelTraceTest, MaxSlices) {
+  // Once a trace is full, later slices are dropped and counted instead.
+  constexpr size_t kMaxSlices = 2;
+  ParcelTracer::Start(kMaxSlices);
+  for (uint64_t i = 0; i < 5; ++i) {
+    ParcelTracer::AddSlice(ParcelTraceStage::kQueueInbound, this,
+                           SequenceNumber(i), ParcelTracer::GetStartTime());
+  }
+  std::string trace = ParcelTracer::Stop();
+
+  size_t num_slices = 0;
+  for (size_t i = trace.find("\"ph\":\"X\""); i != std::string::npos;
+       i = trace.find("\"ph\":\"X\"", i + 1)) {
+    ++num_slices;
+  }
+  EXPECT_EQ(kMaxSlices, num_slices);
+  EXPECT_NE(std::string::npos, trace.find("\"seq\":1}"));
+  EXPECT_EQ(std::string::npos, trace.find("\"seq\":2}"));
+  EXPECT_NE(std::string::npos, trace.find("\"dropped_slices\":\"3\""));
+
+  // The next trace starts empty, with nothing dropped.
+  ParcelTracer::Start(kMaxSlices);
+  trace = ParcelTracer::Stop();
+  EXPECT_FALSE(HasSlice(trace, "QueueInbound"));
+  EXPECT_NE(std::string::npos, trace.find("\"dropped_slices\":\"0\""));
+}
+
+TEST_F(ParcelTraceTest, TraceToFileFromNodeOptions) {
+  const std::string path = testing::TempDir() + "ipcz_parcel_trace.json";
+  const IpczCreateNodeOptions options = {
+      .size = sizeof(options),
+      .parcel_trace_file = path.c_str(),
+  };
+
+  // The first node starts tracing and the second, finding a trace already in
+  // progress, leaves it alone. Closing the first node stops the trace.
+  Ref<Node> node0 =
+      MakeRefCounted<Node>(Node::Type::kBroker, kDriver, &options);
+  Ref<Node> node1 =
+      MakeRefCounted<Node>(Node::Type::kNormal, kDriver, &options);
+  EXPECT_TRUE(ParcelTracer::IsEnabled());
+
+  auto [a, b] = Router::CreatePair();
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            a->Put(absl::MakeSpan(
+                       reinterpret_cast<const uint8_t*>(kMessage.data()),
+                       kMessage.size()),
+                   {}));
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, GetMessage(*b, message));
+  EXPECT_EQ(kMessage, message);
+
+  node1->Close();
+  EXPECT_TRUE(ParcelTracer::IsEnabled());
+  node0->Close();
+  EXPECT_FALSE(ParcelTracer::IsEnabled());
+
+  std::ifstream file(path);
+  const std::string trace((std::istreambuf_iterator<char>(file)),
+                          std::istreambuf_iterator<char>());
+  std::remove(path.c_str());
+  EXPECT_TRUE(HasSlice(trace, "Allocate"));
+  EXPECT_TRUE(HasSlice(trace, "QueueInbound"));
+  EXPECT_NE(std::string::npos, trace.find("\"dropped_slices\":\"0\""));
+
+  a->CloseRoute();
+  b->CloseRoute();
+}
+
+}  // namespace
+}  // namespace ipcz
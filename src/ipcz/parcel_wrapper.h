@@ -12,6 +12,7 @@
 #include "ipcz/parcel.h"
 #include "third_party/abseil-cpp/absl/base/macros.h"
 #include "util/ref_counted.h"
+#include "util/thread_local_free_list.h"
 
 namespace ipcz {
 
@@ -25,6 +26,14 @@ class ParcelWrapper : public APIObjectImpl<ParcelWrapper, APIObject::kParcel> {
  public:
   explicit ParcelWrapper(std::unique_ptr<Parcel> parcel);
 
+  // Like Parcels, these are recycled through a per-thread free list.
+  static void* operator new(size_t size) {
+    return ThreadLocalFreeList<ParcelWrapper>::Allocate(size);
+  }
+  static void operator delete(void* ptr, size_t size) {
+    ThreadLocalFreeList<ParcelWrapper>::Free(ptr, size);
+  }
+
   Parcel& parcel() {
     ABSL_ASSERT(parcel_);
     return *parcel_;
@@ -0,0 +1,57 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/portal_status_snapshot.h"
+
+namespace ipcz {
+
+PortalStatusSnapshot::PortalStatusSnapshot() = default;
+
+PortalStatusSnapshot::~PortalStatusSnapshot() = default;
+
+void PortalStatusSnapshot::Publish(IpczPortalStatusFlags flags,
+                                   size_t num_local_parcels,
+                                   size_t num_local_bytes) {
+  // The writer is the only thread which modifies these fields, so it can read
+  // them back without synchronization.
+  if (flags == flags_.load(std::memory_order_relaxed) &&
+      num_local_parcels ==
+          num_local_parcels_.load(std::memory_order_relaxed) &&
+      num_local_bytes == num_local_bytes_.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  const uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+  sequence_.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  flags_.store(flags, std::memory_order_release);
+  num_local_parcels_.store(num_local_parcels, std::memory_order_relaxed);
+  num_local_bytes_.store(num_local_bytes, std::memory_order_relaxed);
+  sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+void PortalStatusSnapshot::Read(IpczPortalStatus& status) const {
+  for (;;) {
+    const uint32_t sequence = sequence_.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      continue;
+    }
+
+    const IpczPortalStatusFlags flags =
+        flags_.load(std::memory_order_relaxed);
+    const size_t num_local_parcels =
+        num_local_parcels_.load(std::memory_order_relaxed);
+    const size_t num_local_bytes =
+        num_local_bytes_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence_.load(std::memory_order_relaxed) == sequence) {
+      status.flags = flags;
+      status.num_local_parcels = num_local_parcels;
+      status.num_local_bytes = num_local_bytes;
+      return;
+    }
+  }
+}
+
+}  // namespace ipcz
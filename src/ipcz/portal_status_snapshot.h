@@ -0,0 +1,57 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_PORTAL_STATUS_SNAPSHOT_H_
+#define IPCZ_SRC_IPCZ_PORTAL_STATUS_SNAPSHOT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "ipcz/ipcz.h"
+
+namespace ipcz {
+
+// PortalStatusSnapshot publishes a copy of a Router's portal status so that it
+// can be read without acquiring the Router's lock. The status is published
+// through a seqlock: readers never block the writer, and they retry if they
+// race with an update so that every read observes a consistent snapshot.
+//
+// There must only be one writer at a time. Router publishes only while holding
+// its own mutex, which serializes all calls to Publish().
+class PortalStatusSnapshot {
+ public:
+  PortalStatusSnapshot();
+  PortalStatusSnapshot(const PortalStatusSnapshot&) = delete;
+  PortalStatusSnapshot& operator=(const PortalStatusSnapshot&) = delete;
+  ~PortalStatusSnapshot();
+
+  // Publishes a new status. This is cheap if nothing has changed since the
+  // last call.
+  void Publish(IpczPortalStatusFlags flags,
+               size_t num_local_parcels,
+               size_t num_local_bytes);
+
+  // Returns the most recently published status flags. A single flags word is
+  // always consistent by itself, so this never has to retry.
+  IpczPortalStatusFlags flags() const {
+    return flags_.load(std::memory_order_acquire);
+  }
+
+  // Fills in the flags, num_local_parcels and num_local_bytes fields of
+  // `status` with a consistent copy of the most recently published status.
+  void Read(IpczPortalStatus& status) const;
+
+ private:
+  // Odd while an update is in progress, and even otherwise.
+  std::atomic<uint32_t> sequence_{0};
+
+  std::atomic<IpczPortalStatusFlags> flags_{IPCZ_NO_FLAGS};
+  std::atomic<size_t> num_local_parcels_{0};
+  std::atomic<size_t> num_local_bytes_{0};
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_PORTAL_STATUS_SNAPSHOT_H_
@@ -0,0 +1,64 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/portal_status_snapshot.h"
+
+#include <atomic>
+#include <thread>
+
+#include "ipcz/ipcz.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace ipcz {
+namespace {
+
+using PortalStatusSnapshotTest = testing::Test;
+
+TEST_F(PortalStatusSnapshotTest, PublishAndRead) {
+  PortalStatusSnapshot snapshot;
+  IpczPortalStatus status = {.size = sizeof(status)};
+  snapshot.Read(status);
+  EXPECT_EQ(IPCZ_NO_FLAGS, status.flags);
+  EXPECT_EQ(0u, status.num_local_parcels);
+  EXPECT_EQ(0u, status.num_local_bytes);
+
+  snapshot.Publish(IPCZ_NO_FLAGS, 2, 42);
+  snapshot.Read(status);
+  EXPECT_EQ(IPCZ_NO_FLAGS, status.flags);
+  EXPECT_EQ(2u, status.num_local_parcels);
+  EXPECT_EQ(42u, status.num_local_bytes);
+
+  snapshot.Publish(IPCZ_PORTAL_STATUS_PEER_CLOSED, 1, 7);
+  EXPECT_EQ(IPCZ_PORTAL_STATUS_PEER_CLOSED, snapshot.flags());
+  snapshot.Read(status);
+  EXPECT_EQ(IPCZ_PORTAL_STATUS_PEER_CLOSED, status.flags);
+  EXPECT_EQ(1u, status.num_local_parcels);
+  EXPECT_EQ(7u, status.num_local_bytes);
+}
+
+TEST_F(PortalStatusSnapshotTest, ConsistentReads) {
+  // The writer always publishes a byte count which is exactly 10 times the
+  // parcel count. Concurrent readers must never observe anything else.
+  PortalStatusSnapshot snapshot;
+  std::atomic<bool> done{false};
+  std::thread writer([&] {
+    for (size_t i = 1; i <= 100000; ++i) {
+      snapshot.Publish(IPCZ_NO_FLAGS, i, i * 10);
+    }
+    done = true;
+  });
+
+  size_t last_num_parcels = 0;
+  while (!done) {
+    IpczPortalStatus status = {.size = sizeof(status)};
+    snapshot.Read(status);
+    ASSERT_EQ(status.num_local_parcels * 10, status.num_local_bytes);
+    ASSERT_GE(status.num_local_parcels, last_num_parcels);
+    last_num_parcels = status.num_local_parcels;
+  }
+  writer.join();
+}
+
+}  // namespace
+}  // namespace ipcz
@@ -5,6 +5,9 @@
 #include "ipcz/remote_router_link.h"
 
 #include <algorithm>
+#include <cstring>
+#include <memory>
+#include <optional>
 #include <sstream>
 #include <utility>
 #include <vector>
@@ -15,7 +18,12 @@
 #include "ipcz/node_link_memory.h"
 #include "ipcz/node_messages.h"
 #include "ipcz/parcel.h"
+#include "ipcz/parcel_trace.h"
+#include "ipcz/parcel_wrapper.h"
 #include "ipcz/router.h"
+#include "ipcz/subparcel_descriptor.h"
+#include "ipcz/transport_capture.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
 #include "util/log.h"
 #include "util/safe_math.h"
 
@@ -140,6 +148,17 @@ void RemoteRouterLink::AllocateParcelData(size_t num_bytes,
 
 void RemoteRouterLink::AcceptParcel(const OperationContext& context,
                                     std::unique_ptr<Parcel> parcel) {
+  // Subparcels sent separately share their main parcel's SequenceNumber, so
+  // only the main parcel is given a flow.
+  ScopedParcelTraceSlice trace_slice(ParcelTraceStage::kTransmit,
+                                     node_link().get(),
+                                     parcel->sequence_number());
+  if (trace_slice.is_recording() && parcel->subparcel_index() == 0) {
+    trace_slice.set_flow_id(ParcelTracer::GetFlowId(
+        node_link()->local_node_name(), node_link()->remote_node_name(),
+        sublink_, parcel->sequence_number()));
+  }
+
   const absl::Span<Ref<APIObject>> objects = parcel->objects_view();
 
   msg::AcceptParcel accept;
@@ -205,6 +224,13 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
   // of subparcels.
   ABSL_ASSERT(subparcels.size() < Parcel::kMaxSubparcelsPerParcel);
 
+  if (!subparcels.empty() && !must_relay_driver_objects &&
+      CanCoalesceSubparcels(subparcels)) {
+    AcceptCoalescedParcel(context, std::move(parcel),
+                          absl::MakeSpan(driver_objects), subparcels);
+    return;
+  }
+
   uint32_t num_subparcels;
   if (parcel->subparcel_index() == 0) {
     // The total subparcel count includes this (the main) parcel.
@@ -254,12 +280,16 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
     // switched links since the Parcel's data was allocated.
     accept.params().parcel_data =
         accept.AllocateArray<uint8_t>(parcel->data_size());
+    node_link()->RecordParcelSent(/*is_inlined=*/true);
   } else {
     // The data for this parcel already exists in this link's memory, so we only
     // stash a reference to it in the message. This relinquishes ownership of
     // the fragment, effectively passing it to the recipient.
     accept.params().parcel_fragment = parcel->data_fragment().descriptor();
+    TransportCapture::RecordFragment(*node_link()->transport(),
+                                     parcel->data_fragment());
     parcel->ReleaseDataFragment();
+    node_link()->RecordParcelSent(/*is_inlined=*/false);
   }
   accept.params().handle_types =
       accept.AllocateArray<HandleType>(objects.size());
@@ -282,11 +312,11 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
   // portals, because we need to reference them again after transmission, with
   // a 1:1 correspondence to the serialized RouterDescriptors.
   absl::InlinedVector<Ref<Router>, 4> routers_to_proxy(num_portals);
-  absl::InlinedVector<RouterDescriptor, 4> descriptors(num_portals);
 
-  // Explicitly zero the descriptor memory since there may be padding bits
-  // within and we'll be copying the full contents into message data below.
-  memset(descriptors.data(), 0, descriptors.size() * sizeof(descriptors[0]));
+  // The descriptors are value-initialized, which zeroes them along with any
+  // padding bits within, since we'll be copying their full contents into
+  // message data below.
+  absl::InlinedVector<RouterDescriptor, 4> descriptors(num_portals);
 
   size_t portal_index = 0;
   for (size_t i = 0; i < objects.size(); ++i) {
@@ -296,11 +326,9 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
       case APIObject::kPortal: {
         handle_types[i] = HandleType::kPortal;
 
-        Ref<Router> router = WrapRefCounted(Router::FromObject(&object));
         ABSL_ASSERT(portal_index < num_portals);
-        router->SerializeNewRouter(context, *node_link(),
-                                   descriptors[portal_index]);
-        routers_to_proxy[portal_index] = std::move(router);
+        routers_to_proxy[portal_index] =
+            WrapRefCounted(Router::FromObject(&object));
         ++portal_index;
         break;
       }
@@ -330,6 +358,15 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
     }
   }
 
+  // Serialize all attached portals as one batch, so that sublink IDs and
+  // RouterLinkState fragments are allocated once for the whole parcel rather
+  // than once per portal.
+  if (!routers_to_proxy.empty()) {
+    Router::SerializeNewRouters(context, *node_link(),
+                                absl::MakeConstSpan(routers_to_proxy),
+                                absl::MakeSpan(descriptors));
+  }
+
   // Copy all the serialized router descriptors into the message. Our local
   // copy will supply inputs for BeginProxyingToNewRouter() calls below.
   if (!descriptors.empty()) {
@@ -372,6 +409,219 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
   }
 }
 
+void RemoteRouterLink::ForwardParcel(SequenceNumber sequence_number,
+                                     NodeLinkMemory& source_memory,
+                                     const Fragment& fragment,
+                                     absl::Span<const uint8_t> data) {
+  ScopedParcelTraceSlice trace_slice(ParcelTraceStage::kTransmit,
+                                     node_link().get(), sequence_number);
+  if (trace_slice.is_recording()) {
+    trace_slice.set_flow_id(ParcelTracer::GetFlowId(
+        node_link()->local_node_name(), node_link()->remote_node_name(),
+        sublink_, sequence_number));
+  }
+
+  msg::AcceptParcel accept;
+  accept.params().sublink = sublink_;
+  accept.params().sequence_number = sequence_number;
+  accept.params().padding = 0;
+  accept.params().num_subparcels = 1;
+  accept.params().subparcel_index = 0;
+
+  const bool is_fragment_shared =
+      !fragment.is_null() && &source_memory == &node_link()->memory();
+  if (is_fragment_shared) {
+    // The recipient can already see the fragment, so ownership of it passes
+    // along with the message just as if we'd allocated it ourselves.
+    accept.params().parcel_fragment = fragment.descriptor();
+    TransportCapture::RecordFragment(*node_link()->transport(), fragment);
+    node_link()->RecordParcelSent(/*is_inlined=*/false);
+  } else {
+    accept.params().parcel_data = accept.AllocateArray<uint8_t>(data.size());
+    node_link()->RecordParcelSent(/*is_inlined=*/true);
+  }
+  accept.params().handle_types = accept.AllocateArray<HandleType>(0);
+  accept.params().new_routers = accept.AllocateArray<RouterDescriptor>(0);
+
+  if (!is_fragment_shared) {
+    const absl::Span<uint8_t> inline_parcel_data =
+        accept.GetArrayView<uint8_t>(accept.params().parcel_data);
+    if (!inline_parcel_data.empty()) {
+      memcpy(inline_parcel_data.data(), data.data(), data.size());
+    }
+    if (!fragment.is_null()) {
+      source_memory.FreeFragment(fragment);
+    }
+  }
+
+  node_link()->Transmit(accept);
+}
+
+bool RemoteRouterLink::CanCoalesceSubparcels(
+    absl::Span<const Ref<ParcelWrapper>> subparcels) {
+  if (node_link()->remote_protocol_version() <
+      msg::kMinVersionForCoalescedParcels) {
+    return false;
+  }
+
+  for (const Ref<ParcelWrapper>& subparcel : subparcels) {
+    for (const Ref<APIObject>& object : subparcel->parcel().objects_view()) {
+      if (object->object_type() != APIObject::kBox) {
+        continue;
+      }
+
+      // Subparcels may only carry driver objects in boxes, and those objects
+      // must not require relaying.
+      Box* box = Box::FromObject(object.get());
+      if (box->type() != Box::Type::kDriverObject ||
+          !box->driver_object().CanTransmitOn(*node_link()->transport())) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void RemoteRouterLink::AcceptCoalescedParcel(
+    const OperationContext& context,
+    std::unique_ptr<Parcel> parcel,
+    absl::Span<DriverObject> driver_objects,
+    absl::Span<const Ref<ParcelWrapper>> subparcels) {
+  absl::InlinedVector<std::unique_ptr<Parcel>, 4> parcels;
+  parcels.reserve(subparcels.size() + 1);
+  parcels.push_back(std::move(parcel));
+  for (const Ref<ParcelWrapper>& subparcel : subparcels) {
+    parcels.push_back(subparcel->TakeParcel());
+  }
+
+  // Parcel data already in this link's memory is passed by reference. Anything
+  // else is inlined within the message.
+  auto has_usable_fragment = [this](const Parcel& parcel) {
+    return parcel.has_data_fragment() &&
+           parcel.data_fragment_memory() == &node_link()->memory();
+  };
+
+  // Tally the space needed by every parcel, and collect all attached portals
+  // and driver objects in the order they'll be serialized. The main parcel's
+  // driver objects have already been extracted by AcceptParcel().
+  size_t num_inlined_bytes = 0;
+  size_t num_handles = 0;
+  absl::InlinedVector<Ref<Router>, 4> routers_to_proxy;
+  absl::InlinedVector<DriverObject, 2> all_driver_objects;
+  for (DriverObject& object : driver_objects) {
+    all_driver_objects.push_back(std::move(object));
+  }
+  for (size_t i = 0; i < parcels.size(); ++i) {
+    const Parcel& p = *parcels[i];
+    const bool is_inlined = !has_usable_fragment(p);
+    if (is_inlined) {
+      num_inlined_bytes += p.data_size();
+    }
+    node_link()->RecordParcelSent(is_inlined);
+    num_handles += p.num_objects();
+    for (const Ref<APIObject>& object : p.objects_view()) {
+      if (object->object_type() == APIObject::kPortal) {
+        routers_to_proxy.push_back(
+            WrapRefCounted(Router::FromObject(object.get())));
+      } else if (i > 0) {
+        all_driver_objects.push_back(
+            std::move(Box::FromObject(object.get())->driver_object()));
+      }
+    }
+  }
+
+  msg::AcceptCoalescedParcel accept;
+  accept.params().sublink = sublink_;
+  accept.params().sequence_number = parcels[0]->sequence_number();
+  accept.params().subparcels =
+      accept.AllocateArray<SubparcelDescriptor>(parcels.size());
+  accept.params().parcel_data =
+      accept.AllocateArray<uint8_t>(num_inlined_bytes);
+  accept.params().handle_types = accept.AllocateArray<HandleType>(num_handles);
+  accept.params().new_routers =
+      accept.AllocateArray<RouterDescriptor>(routers_to_proxy.size());
+
+  const absl::Span<SubparcelDescriptor> subparcel_descriptors =
+      accept.GetArrayView<SubparcelDescriptor>(accept.params().subparcels);
+  const absl::Span<uint8_t> inline_parcel_data =
+      accept.GetArrayView<uint8_t>(accept.params().parcel_data);
+  const absl::Span<HandleType> handle_types =
+      accept.GetArrayView<HandleType>(accept.params().handle_types);
+  const absl::Span<RouterDescriptor> new_routers =
+      accept.GetArrayView<RouterDescriptor>(accept.params().new_routers);
+
+  size_t data_offset = 0;
+  size_t handle_index = 0;
+  for (size_t i = 0; i < parcels.size(); ++i) {
+    Parcel& p = *parcels[i];
+    SubparcelDescriptor& descriptor = subparcel_descriptors[i];
+    if (has_usable_fragment(p)) {
+      // As in AcceptParcel(), this relinquishes ownership of the fragment to
+      // the recipient.
+      descriptor.data_fragment = p.data_fragment().descriptor();
+      TransportCapture::RecordFragment(*node_link()->transport(),
+                                       p.data_fragment());
+      p.ReleaseDataFragment();
+    } else {
+      descriptor.data_fragment = FragmentDescriptor();
+      descriptor.data_offset = checked_cast<uint32_t>(data_offset);
+      descriptor.data_size = checked_cast<uint32_t>(p.data_size());
+      if (p.data_size() > 0) {
+        memcpy(&inline_parcel_data[data_offset], p.data_view().data(),
+               p.data_size());
+      }
+      data_offset += p.data_size();
+    }
+
+    descriptor.num_handles = checked_cast<uint32_t>(p.num_objects());
+    for (const Ref<APIObject>& object : p.objects_view()) {
+      HandleType& type = handle_types[handle_index++];
+      if (object->object_type() == APIObject::kPortal) {
+        type = HandleType::kPortal;
+      } else if (Box::FromObject(object.get())->type() ==
+                 Box::Type::kDriverObject) {
+        type = HandleType::kBoxedDriverObject;
+      } else {
+        // Application objects and subparcels attached to the main parcel.
+        type = HandleType::kBoxedSubparcel;
+      }
+    }
+  }
+
+  // Portals attached to the main parcel and to any subparcel are serialized
+  // together as one batch. As above, the descriptors are value-initialized so
+  // no uninitialized padding is copied into the message.
+  absl::InlinedVector<RouterDescriptor, 4> descriptors(routers_to_proxy.size());
+  if (!routers_to_proxy.empty()) {
+    Router::SerializeNewRouters(context, *node_link(),
+                                absl::MakeConstSpan(routers_to_proxy),
+                                absl::MakeSpan(descriptors));
+    memcpy(new_routers.data(), descriptors.data(),
+           new_routers.size() * sizeof(new_routers[0]));
+  }
+
+  accept.params().driver_objects =
+      accept.AppendDriverObjects(absl::MakeSpan(all_driver_objects));
+
+  DVLOG(4) << "Transmitting " << parcels[0]->Describe() << " with "
+           << subparcels.size() << " coalesced subparcels over " << Describe();
+
+  node_link()->Transmit(accept);
+
+  for (size_t i = 0; i < routers_to_proxy.size(); ++i) {
+    routers_to_proxy[i]->BeginProxyingToNewRouter(context, *node_link(),
+                                                  descriptors[i]);
+  }
+
+  // As in AcceptParcel(), prevent the transmitted parcels from closing their
+  // attached objects on destruction.
+  for (std::unique_ptr<Parcel>& p : parcels) {
+    for (Ref<APIObject>& object : p->objects_view()) {
+      Ref<APIObject> released_object = std::move(object);
+    }
+  }
+}
+
 void RemoteRouterLink::AcceptRouteClosure(const OperationContext& context,
                                           SequenceNumber sequence_length) {
   msg::RouteClosed route_closed;
@@ -415,6 +665,34 @@ void RemoteRouterLink::Unlock() {
   }
 }
 
+bool RemoteRouterLink::TryPublishRouteClosure(SequenceNumber sequence_length) {
+  RouterLinkState* state = GetLinkState();
+  return state && state->PublishClosure(side_, sequence_length);
+}
+
+bool RemoteRouterLink::TryMarkSideIdle() {
+  RouterLinkState* state = GetLinkState();
+  if (!state) {
+    return false;
+  }
+  state->SetSideIdle(side_, true);
+  return true;
+}
+
+void RemoteRouterLink::MarkSideActive() {
+  if (RouterLinkState* state = GetLinkState()) {
+    state->SetSideIdle(side_, false);
+  }
+}
+
+std::optional<SequenceNumber> RemoteRouterLink::GetPublishedRouteClosure() {
+  RouterLinkState* state = GetLinkState();
+  if (!state) {
+    return std::nullopt;
+  }
+  return state->GetFinalSequenceLengthFrom(side_.opposite());
+}
+
 bool RemoteRouterLink::FlushOtherSideIfWaiting(
     const OperationContext& context) {
   RouterLinkState* state = GetLinkState();
@@ -6,21 +6,29 @@
 #define IPCZ_SRC_IPCZ_REMOTE_ROUTER_LINK_H_
 
 #include <atomic>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <vector>
 
+#include "ipcz/fragment.h"
 #include "ipcz/fragment_ref.h"
 #include "ipcz/link_side.h"
 #include "ipcz/link_type.h"
 #include "ipcz/router_link.h"
 #include "ipcz/router_link_state.h"
+#include "ipcz/sequence_number.h"
 #include "ipcz/sublink_id.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
 #include "util/ref_counted.h"
 
 namespace ipcz {
 
+class DriverObject;
 class NodeLink;
+class NodeLinkMemory;
+class ParcelWrapper;
 
 // One side of a link between two Routers living on different nodes. A
 // RemoteRouterLink uses a NodeLink plus a SublinkId as its transport between
@@ -70,6 +78,10 @@ class RemoteRouterLink : public RouterLink {
   bool TryLockForBypass(const NodeName& bypass_request_source) override;
   bool TryLockForClosure() override;
   void Unlock() override;
+  bool TryPublishRouteClosure(SequenceNumber sequence_length) override;
+  bool TryMarkSideIdle() override;
+  void MarkSideActive() override;
+  std::optional<SequenceNumber> GetPublishedRouteClosure() override;
   bool FlushOtherSideIfWaiting(const OperationContext& context) override;
   bool CanNodeRequestBypass(const NodeName& bypass_request_source) override;
   void BypassPeer(const OperationContext& context,
@@ -90,6 +102,17 @@ class RemoteRouterLink : public RouterLink {
   void Deactivate() override;
   std::string Describe() const override;
 
+  // Transmits a parcel forwarded by `source_memory`'s NodeLink on behalf of a
+  // proxy, without the parcel ever being deserialized. The parcel carries no
+  // objects and `data` is its data. If `fragment` is non-null, `data` resides
+  // within it: the fragment is passed along as-is if it's in this link's own
+  // memory, and otherwise `data` is copied into the message and `fragment` is
+  // freed.
+  void ForwardParcel(SequenceNumber sequence_number,
+                     NodeLinkMemory& source_memory,
+                     const Fragment& fragment,
+                     absl::Span<const uint8_t> data);
+
  private:
   RemoteRouterLink(const OperationContext& context,
                    Ref<NodeLink> node_link,
@@ -105,6 +128,20 @@ class RemoteRouterLink : public RouterLink {
   void SetLinkState(const OperationContext& context,
                     FragmentRef<RouterLinkState> state);
 
+  // Indicates whether `subparcels` can be transmitted along with their main
+  // parcel in a single AcceptCoalescedParcel message. This requires the remote
+  // node to support that message and every attached driver object to be
+  // transmissible without relaying.
+  bool CanCoalesceSubparcels(absl::Span<const Ref<ParcelWrapper>> subparcels);
+
+  // Transmits `parcel` along with all of its `subparcels` in a single
+  // AcceptCoalescedParcel message. `driver_objects` contains any driver objects
+  // already extracted from `parcel`'s own attachments.
+  void AcceptCoalescedParcel(const OperationContext& context,
+                             std::unique_ptr<Parcel> parcel,
+                             absl::Span<DriverObject> driver_objects,
+                             absl::Span<const Ref<ParcelWrapper>> subparcels);
+
   const Ref<NodeLink> node_link_;
   const SublinkId sublink_;
   const LinkType type_;
@@ -6,14 +6,18 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <limits>
 #include <optional>
 #include <utility>
 
 #include "ipcz/ipcz.h"
 #include "ipcz/local_router_link.h"
+#include "ipcz/message_dispatch_pool.h"
 #include "ipcz/node_link.h"
 #include "ipcz/operation_context.h"
+#include "ipcz/parcel_trace.h"
 #include "ipcz/parcel_wrapper.h"
 #include "ipcz/remote_router_link.h"
 #include "ipcz/sequence_number.h"
@@ -44,10 +48,13 @@ using ParcelsToFlush = absl::InlinedVector<ParcelToFlush, 8>;
 // Helper which attempts to pop elements from `queue` for transmission along
 // `edge`. This terminates either when `queue` is exhausted, or the next parcel
 // in `queue` is to be transmitted over a link that is not yet known to `edge`.
-// Any successfully popped elements are accumulated at the end of `parcels`.
+// Any successfully popped elements are accumulated at the end of `parcels`, and
+// the time each spent in `queue` is traced as `trace_stage` of `trace_track`.
 void CollectParcelsToFlush(ParcelQueue& queue,
                            const RouteEdge& edge,
-                           ParcelsToFlush& parcels) {
+                           ParcelsToFlush& parcels,
+                           ParcelTraceStage trace_stage,
+                           const Router* trace_track) {
   RouterLink* decaying_link = edge.decaying_link();
   RouterLink* primary_link = edge.primary_link().get();
   while (queue.HasNextElement()) {
@@ -64,6 +71,21 @@ void CollectParcelsToFlush(ParcelQueue& queue,
     ParcelToFlush& parcel = parcels.emplace_back(ParcelToFlush{.link = link});
     const bool popped = queue.Pop(parcel.parcel);
     ABSL_ASSERT(popped);
+    ParcelTracer::EndStage(trace_stage, trace_track, *parcel.parcel);
+  }
+}
+
+// Like above, but for an edge known to be stable, whose primary link is `link`.
+void CollectParcelsToFlush(ParcelQueue& queue,
+                           RouterLink& link,
+                           ParcelsToFlush& parcels,
+                           ParcelTraceStage trace_stage,
+                           const Router* trace_track) {
+  while (queue.HasNextElement()) {
+    ParcelToFlush& parcel = parcels.emplace_back(ParcelToFlush{.link = &link});
+    const bool popped = queue.Pop(parcel.parcel);
+    ABSL_ASSERT(popped);
+    ParcelTracer::EndStage(trace_stage, trace_track, *parcel.parcel);
   }
 }
 
@@ -117,13 +139,13 @@ bool Router::CanSendFrom(Router& sender) {
 }
 
 bool Router::IsPeerClosed() {
-  absl::MutexLock lock(&mutex_);
-  return (status_flags_ & IPCZ_PORTAL_STATUS_PEER_CLOSED) != 0;
+  AcceptIdleRouteClosure();
+  return (status_snapshot_.flags() & IPCZ_PORTAL_STATUS_PEER_CLOSED) != 0;
 }
 
 bool Router::IsRouteDead() {
-  absl::MutexLock lock(&mutex_);
-  return (status_flags_ & IPCZ_PORTAL_STATUS_DEAD) != 0;
+  AcceptIdleRouteClosure();
+  return (status_snapshot_.flags() & IPCZ_PORTAL_STATUS_DEAD) != 0;
 }
 
 bool Router::IsOnCentralRemoteLink() {
@@ -135,12 +157,36 @@ bool Router::IsOnCentralRemoteLink() {
          !outward_edge_.primary_link()->GetLocalPeer();
 }
 
-void Router::QueryStatus(IpczPortalStatus& status) {
+bool Router::IsProxy() {
   absl::MutexLock lock(&mutex_);
+  return inward_edge_ != nullptr;
+}
+
+bool Router::CanCutThroughInboundParcels() {
+  absl::MutexLock lock(&mutex_);
+  absl::MutexLock outbound_lock(&outbound_mutex_);
+  return CanCutThroughParcels();
+}
+
+bool Router::CanCutThroughOutboundParcels() {
+  absl::MutexLock lock(&outbound_mutex_);
+  return can_cut_through_outbound_;
+}
+
+size_t Router::GetNumQueuedParcels() {
+  size_t num_parcels;
+  {
+    absl::MutexLock lock(&mutex_);
+    num_parcels = inbound_parcels_.GetNumAvailableElements();
+  }
+  absl::MutexLock lock(&outbound_mutex_);
+  return num_parcels + outbound_parcels_.GetNumAvailableElements();
+}
+
+void Router::QueryStatus(IpczPortalStatus& status) {
+  AcceptIdleRouteClosure();
   status.size = std::min(status.size, sizeof(IpczPortalStatus));
-  status.flags = status_flags_;
-  status.num_local_parcels = inbound_parcels_.GetNumAvailableElements();
-  status.num_local_bytes = inbound_parcels_.GetTotalAvailableElementSize();
+  status_snapshot_.Read(status);
 }
 
 bool Router::HasLocalPeer(Router& router) {
@@ -152,11 +198,12 @@ std::unique_ptr<Parcel> Router::AllocateOutboundParcel(size_t num_bytes,
                                                        bool allow_partial) {
   Ref<RouterLink> outward_link;
   {
-    absl::MutexLock lock(&mutex_);
-    outward_link = outward_edge_.primary_link();
+    absl::MutexLock lock(&outbound_mutex_);
+    outward_link = outbound_link_;
   }
 
   auto parcel = std::make_unique<Parcel>();
+  ParcelTracer::BeginStage(*parcel);
   if (outward_link) {
     outward_link->AllocateParcelData(num_bytes, allow_partial, *parcel);
   } else {
@@ -168,8 +215,17 @@ std::unique_ptr<Parcel> Router::AllocateOutboundParcel(size_t num_bytes,
 IpczResult Router::SendOutboundParcel(std::unique_ptr<Parcel> parcel) {
   Ref<RouterLink> link;
   {
-    absl::MutexLock lock(&mutex_);
-    if (inbound_parcels_.final_sequence_length()) {
+    // Only the outbound lock is needed here, so sending never contends with
+    // inbound parcel delivery or retrieval on this router.
+    absl::ReleasableMutexLock lock(&outbound_mutex_);
+    if (HasIdleRouteClosure()) {
+      // The other side closed while this router was idle. Picking that up
+      // requires `mutex_`, which can't be acquired while holding this lock.
+      lock.Release();
+      AcceptPublishedRouteClosure();
+      return IPCZ_RESULT_NOT_FOUND;
+    }
+    if (is_inbound_sequence_final_) {
       // If the inbound sequence is finalized, the peer portal must be gone.
       return IPCZ_RESULT_NOT_FOUND;
     }
@@ -177,9 +233,9 @@ IpczResult Router::SendOutboundParcel(std::unique_ptr<Parcel> parcel) {
     const SequenceNumber sequence_number =
         outbound_parcels_.GetCurrentSequenceLength();
     parcel->set_sequence_number(sequence_number);
-    if (outward_edge_.primary_link() &&
-        outbound_parcels_.SkipElement(sequence_number)) {
-      link = outward_edge_.primary_link();
+    ParcelTracer::EndStage(ParcelTraceStage::kAllocate, this, *parcel);
+    if (outbound_link_ && outbound_parcels_.SkipElement(sequence_number)) {
+      link = outbound_link_;
     } else {
       // If there are no unsent parcels ahead of this one in the outbound
       // sequence, and we have an active outward link, we can immediately
@@ -187,13 +243,16 @@ IpczResult Router::SendOutboundParcel(std::unique_ptr<Parcel> parcel) {
       // most common case, but otherwise we have to queue the parcel here and it
       // will be flushed out ASAP.
       DVLOG(4) << "Queuing outbound " << parcel->Describe();
+      ParcelTracer::BeginStage(*parcel);
       const bool push_ok =
           outbound_parcels_.Push(sequence_number, std::move(parcel));
       ABSL_ASSERT(push_ok);
+      is_flush_no_op_.store(false, std::memory_order_release);
     }
   }
 
-  const OperationContext context{OperationContext::kAPICall};
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kAPICall, dispatcher};
   if (link) {
     // NOTE: This cannot be a use-after-move because `link` is always null in
     // the case where `parcel` is moved above.
@@ -205,14 +264,21 @@ IpczResult Router::SendOutboundParcel(std::unique_ptr<Parcel> parcel) {
 }
 
 void Router::CloseRoute() {
-  const OperationContext context{OperationContext::kAPICall};
   TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kAPICall, dispatcher};
   Ref<RouterLink> link;
   {
     absl::MutexLock lock(&mutex_);
-    outbound_parcels_.SetFinalSequenceLength(
-        outbound_parcels_.GetCurrentSequenceLength());
+    {
+      absl::MutexLock outbound_lock(&outbound_mutex_);
+      outbound_parcels_.SetFinalSequenceLength(
+          outbound_parcels_.GetCurrentSequenceLength());
+      UpdateOutboundState();
+    }
     traps_.RemoveAll(context, dispatcher);
+    is_portal_invalidated_ = true;
+    WakeBlockedGets(/*all=*/true);
+    WakeFromIdle(context, dispatcher);
   }
   Flush(context);
 }
@@ -232,7 +298,9 @@ void Router::SetOutwardLink(const OperationContext& context,
     }
 
     if (!is_disconnected_) {
+      absl::MutexLock outbound_lock(&outbound_mutex_);
       outward_edge_.SetPrimaryLink(std::move(link));
+      UpdateOutboundState();
     }
   }
 
@@ -248,10 +316,14 @@ void Router::SetOutwardLink(const OperationContext& context,
 
 bool Router::AcceptInboundParcel(const OperationContext& context,
                                  std::unique_ptr<Parcel> parcel) {
-  TrapEventDispatcher dispatcher;
+  TrapEventDispatcher dispatcher(context);
+  Ref<RouterLink> cut_through_link;
+  ParcelsToFlush parcels_to_forward;
+  bool needs_flush;
   {
     absl::MutexLock lock(&mutex_);
     const SequenceNumber sequence_number = parcel->sequence_number();
+    ParcelTracer::BeginStage(*parcel);
     if (!inbound_parcels_.Push(sequence_number, std::move(parcel))) {
       // Unexpected route disconnection can cut off inbound sequences, so don't
       // treat an out-of-bounds parcel as a validation failure.
@@ -266,18 +338,44 @@ bool Router::AcceptInboundParcel(const OperationContext& context,
         // to be received.
         traps_.NotifyNewLocalParcel(context, status_flags_, inbound_parcels_,
                                     dispatcher);
+        WakeBlockedGets(/*all=*/false);
+      }
+    } else {
+      // A stable proxy can forward whatever is now ready without a full
+      // Flush(), since nothing else about its state could have changed.
+      absl::MutexLock outbound_lock(&outbound_mutex_);
+      if (CanCutThroughParcels()) {
+        cut_through_link = inward_edge_->primary_link();
+        CollectParcelsToFlush(inbound_parcels_, *inward_edge_,
+                              parcels_to_forward, ParcelTraceStage::kProxy,
+                              this);
       }
     }
+    PublishStatus();
+
+    // This is the hottest path into Flush(), and in steady state it's
+    // unnecessary. Skip it entirely.
+    needs_flush = !IsInSteadyState() && !cut_through_link;
   }
 
-  Flush(context);
+  for (ParcelToFlush& parcel : parcels_to_forward) {
+    parcel.link->AcceptParcel(context, std::move(parcel.parcel));
+  }
+
+  if (needs_flush) {
+    Flush(context);
+  }
   return true;
 }
 
 bool Router::AcceptOutboundParcel(const OperationContext& context,
                                   std::unique_ptr<Parcel> parcel) {
+  Ref<RouterLink> cut_through_link;
+  ParcelsToFlush parcels_to_forward;
   {
-    absl::MutexLock lock(&mutex_);
+    // Only the outbound lock is needed unless this router has other work to
+    // flush, so forwarding never contends with inbound parcel delivery.
+    absl::MutexLock lock(&outbound_mutex_);
 
     // Proxied outbound parcels are always queued in a ParcelQueue even if they
     // will be forwarded immediately. This allows us to track the full sequence
@@ -289,52 +387,100 @@ bool Router::AcceptOutboundParcel(const OperationContext& context,
     // queue for forwarding, but we'd still need some lighter-weight abstraction
     // that tracks complete sequences from potentially fragmented contributions.
     const SequenceNumber sequence_number = parcel->sequence_number();
+    ParcelTracer::BeginStage(*parcel);
     if (!outbound_parcels_.Push(sequence_number, std::move(parcel))) {
       // Unexpected route disconnection can cut off outbound sequences, so don't
       // treat an out-of-bounds parcel as a validation failure.
       return true;
     }
+    is_flush_no_op_.store(false, std::memory_order_release);
+
+    if (can_cut_through_outbound_) {
+      cut_through_link = outbound_link_;
+      CollectParcelsToFlush(outbound_parcels_, *cut_through_link,
+                            parcels_to_forward, ParcelTraceStage::kProxy, this);
+    }
   }
 
-  Flush(context);
+  for (ParcelToFlush& parcel : parcels_to_forward) {
+    parcel.link->AcceptParcel(context, std::move(parcel.parcel));
+  }
+
+  if (!cut_through_link) {
+    Flush(context);
+  }
+  return true;
+}
+
+bool Router::ClaimParcelForForwarding(bool is_inbound,
+                                      RouterLink& link,
+                                      SequenceNumber sequence_number) {
+  // Skipping the claimed parcel may make others queued behind it available,
+  // in which case we forward those ourselves just as AcceptInboundParcel() or
+  // AcceptOutboundParcel() would have.
+  ParcelsToFlush parcels_to_forward;
+  if (is_inbound) {
+    absl::MutexLock lock(&mutex_);
+    absl::MutexLock outbound_lock(&outbound_mutex_);
+    if (!CanCutThroughParcels() || inward_edge_->primary_link() != &link ||
+        !inbound_parcels_.SkipElement(sequence_number)) {
+      return false;
+    }
+    CollectParcelsToFlush(inbound_parcels_, link, parcels_to_forward,
+                          ParcelTraceStage::kProxy, this);
+    PublishStatus();
+  } else {
+    absl::MutexLock lock(&outbound_mutex_);
+    if (!can_cut_through_outbound_ || outbound_link_ != &link ||
+        !outbound_parcels_.SkipElement(sequence_number)) {
+      return false;
+    }
+    CollectParcelsToFlush(outbound_parcels_, link, parcels_to_forward,
+                          ParcelTraceStage::kProxy, this);
+  }
+
+  if (!parcels_to_forward.empty()) {
+    TrapEventDispatcher dispatcher;
+    const OperationContext context{OperationContext::kTransportNotification,
+                                   dispatcher};
+    for (ParcelToFlush& parcel : parcels_to_forward) {
+      parcel.link->AcceptParcel(context, std::move(parcel.parcel));
+    }
+  }
   return true;
 }
 
 bool Router::AcceptRouteClosureFrom(const OperationContext& context,
                                     LinkType link_type,
                                     SequenceNumber sequence_length) {
-  TrapEventDispatcher dispatcher;
+  TrapEventDispatcher dispatcher(context);
   {
     absl::MutexLock lock(&mutex_);
     if (link_type.is_outward()) {
-      if (!inbound_parcels_.SetFinalSequenceLength(sequence_length)) {
+      if (!FinalizeInboundSequence(context, sequence_length, dispatcher)) {
         // Ignore if and only if the sequence was terminated early.
         DVLOG(4) << "Discarding inbound route closure notification";
         return inbound_parcels_.final_sequence_length().has_value() &&
                *inbound_parcels_.final_sequence_length() <= sequence_length;
       }
-
-      if (!inward_edge_ && !bridge_) {
-        is_peer_closed_ = true;
-        if (inbound_parcels_.IsSequenceFullyConsumed()) {
-          status_flags_ |=
-              IPCZ_PORTAL_STATUS_PEER_CLOSED | IPCZ_PORTAL_STATUS_DEAD;
-        }
-        traps_.NotifyPeerClosed(context, status_flags_, inbound_parcels_,
-                                dispatcher);
-      }
     } else if (link_type.is_peripheral_inward()) {
+      absl::MutexLock outbound_lock(&outbound_mutex_);
       if (!outbound_parcels_.SetFinalSequenceLength(sequence_length)) {
         // Ignore if and only if the sequence was terminated early.
         DVLOG(4) << "Discarding outbound route closure notification";
         return outbound_parcels_.final_sequence_length().has_value() &&
                *outbound_parcels_.final_sequence_length() <= sequence_length;
       }
+      UpdateOutboundState();
     } else if (link_type.is_bridge()) {
-      if (!outbound_parcels_.SetFinalSequenceLength(sequence_length)) {
-        return false;
+      {
+        absl::MutexLock outbound_lock(&outbound_mutex_);
+        if (!outbound_parcels_.SetFinalSequenceLength(sequence_length)) {
+          return false;
+        }
+        bridge_.reset();
+        UpdateOutboundState();
       }
-      bridge_.reset();
     }
   }
 
@@ -344,7 +490,7 @@ bool Router::AcceptRouteClosureFrom(const OperationContext& context,
 
 bool Router::AcceptRouteDisconnectedFrom(const OperationContext& context,
                                          LinkType link_type) {
-  TrapEventDispatcher dispatcher;
+  TrapEventDispatcher dispatcher(context);
   absl::InlinedVector<Ref<RouterLink>, 4> forwarding_links;
   {
     absl::MutexLock lock(&mutex_);
@@ -353,15 +499,21 @@ bool Router::AcceptRouteDisconnectedFrom(const OperationContext& context,
              << link_type.ToString() << "link";
 
     is_disconnected_ = true;
-    if (link_type.is_peripheral_inward()) {
-      outbound_parcels_.ForceTerminateSequence();
-    } else {
-      inbound_parcels_.ForceTerminateSequence();
-    }
+    {
+      absl::MutexLock outbound_lock(&outbound_mutex_);
+      if (link_type.is_peripheral_inward()) {
+        outbound_parcels_.ForceTerminateSequence();
+      } else {
+        inbound_parcels_.ForceTerminateSequence();
+        is_inbound_sequence_final_ = true;
+      }
 
-    // Wipe out all remaining links and propagate the disconnection over them.
-    forwarding_links.push_back(outward_edge_.ReleasePrimaryLink());
-    forwarding_links.push_back(outward_edge_.ReleaseDecayingLink());
+      // Wipe out all remaining links and propagate the disconnection over
+      // them.
+      forwarding_links.push_back(outward_edge_.ReleasePrimaryLink());
+      forwarding_links.push_back(outward_edge_.ReleaseDecayingLink());
+      UpdateOutboundState();
+    }
     if (inward_edge_) {
       forwarding_links.push_back(inward_edge_->ReleasePrimaryLink());
       forwarding_links.push_back(inward_edge_->ReleaseDecayingLink());
@@ -377,7 +529,9 @@ bool Router::AcceptRouteDisconnectedFrom(const OperationContext& context,
       }
       traps_.NotifyPeerClosed(context, status_flags_, inbound_parcels_,
                               dispatcher);
+      WakeBlockedGets(/*all=*/true);
     }
+    PublishStatus();
   }
 
   for (const Ref<RouterLink>& link : forwarding_links) {
@@ -492,20 +646,68 @@ IpczResult Router::EndPut(IpczTransaction transaction,
 }
 
 IpczResult Router::Get(IpczGetFlags flags,
+                       const IpczGetOptions* options,
                        void* data,
                        size_t* num_bytes,
                        IpczHandle* handles,
                        size_t* num_handles,
                        IpczHandle* parcel) {
-  const OperationContext context{OperationContext::kAPICall};
+  if ((flags & IPCZ_GET_BLOCKING) &&
+      MessageDispatchPool::IsCurrentThreadAnyWorker()) {
+    // The parcel we'd wait for may have to be dispatched by this very thread,
+    // e.g. if we're in a trap event handler for a parcel on the same route.
+    return IPCZ_RESULT_FAILED_PRECONDITION;
+  }
+
   TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kAPICall, dispatcher};
   std::unique_ptr<Parcel> consumed_parcel;
+
+  // A blocking Get() may race with closure of the portal, which would otherwise
+  // drop the last reference to this Router while we're waiting on it.
+  Ref<Router> self;
+  absl::Time deadline = absl::InfiniteFuture();
+  if (flags & IPCZ_GET_BLOCKING) {
+    self = WrapRefCounted(this);
+    if (options && options->timeout_microseconds <=
+                       static_cast<uint64_t>(
+                           std::numeric_limits<int64_t>::max())) {
+      // Larger timeouts don't fit in an absl::Duration and are treated as
+      // infinite.
+      deadline = absl::Now() + absl::Microseconds(static_cast<int64_t>(
+                                   options->timeout_microseconds));
+    }
+
+    // A blocked Get() relies on being woken by closure of the other side, so
+    // this router can't stay idle. Closure may have been published while it
+    // was, in which case it's accepted on waking and must be flushed before we
+    // wait. Counting this call as a blocked Get() from here on keeps the router
+    // from going idle again in the meantime.
+    bool needs_flush;
+    {
+      absl::MutexLock lock(&mutex_);
+      ++num_blocked_gets_;
+      needs_flush = WakeFromIdle(context, dispatcher);
+    }
+    if (needs_flush) {
+      Flush(context);
+    }
+  } else {
+    AcceptIdleRouteClosure();
+  }
   {
     absl::MutexLock lock(&mutex_);
+    if (flags & IPCZ_GET_BLOCKING) {
+      const IpczResult result = WaitForInboundParcel(deadline);
+      if (result != IPCZ_RESULT_OK) {
+        return result;
+      }
+    }
     if (inbound_parcels_.IsSequenceFullyConsumed()) {
       return IPCZ_RESULT_NOT_FOUND;
     }
     if (!inbound_parcels_.HasNextElement()) {
+      EnterIdleState();
       return IPCZ_RESULT_UNAVAILABLE;
     }
 
@@ -546,11 +748,14 @@ IpczResult Router::Get(IpczGetFlags flags,
 
     const bool ok = inbound_parcels_.Pop(consumed_parcel);
     ABSL_ASSERT(ok);
+    ParcelTracer::EndStage(ParcelTraceStage::kQueueInbound, this,
+                           *consumed_parcel);
     consumed_parcel->ConsumeHandles(absl::MakeSpan(handles, handles_size));
 
     if (inbound_parcels_.IsSequenceFullyConsumed()) {
       status_flags_ |= IPCZ_PORTAL_STATUS_PEER_CLOSED | IPCZ_PORTAL_STATUS_DEAD;
     }
+    PublishStatus();
     traps_.NotifyLocalParcelConsumed(context, status_flags_, inbound_parcels_,
                                      dispatcher);
   }
@@ -569,8 +774,10 @@ IpczResult Router::BeginGet(IpczBeginGetFlags flags,
                             IpczHandle* handles,
                             size_t* num_handles,
                             IpczTransaction* transaction) {
-  const OperationContext context{OperationContext::kAPICall};
+  AcceptIdleRouteClosure();
+
   TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kAPICall, dispatcher};
   absl::MutexLock lock(&mutex_);
   if (!transaction || inward_edge_) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
@@ -633,8 +840,8 @@ IpczResult Router::BeginGet(IpczBeginGetFlags flags,
 IpczResult Router::EndGet(IpczTransaction transaction,
                           IpczEndGetFlags flags,
                           IpczHandle* parcel_handle) {
-  const OperationContext context{OperationContext::kAPICall};
   TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kAPICall, dispatcher};
   absl::MutexLock lock(&mutex_);
   if (!pending_gets_) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
@@ -665,14 +872,87 @@ IpczResult Router::EndGet(IpczTransaction transaction,
   return IPCZ_RESULT_OK;
 }
 
+IpczResult Router::WaitForInboundParcel(absl::Time deadline) {
+  bool timed_out = false;
+  while (!inbound_parcels_.HasNextElement() &&
+         !inbound_parcels_.IsSequenceFullyConsumed() &&
+         !is_portal_invalidated_ && !timed_out) {
+    timed_out = inbound_parcel_available_.WaitWithDeadline(&mutex_, deadline);
+  }
+  --num_blocked_gets_;
+
+  if (is_portal_invalidated_) {
+    return IPCZ_RESULT_CANCELLED;
+  }
+  if (inbound_parcels_.HasNextElement() ||
+      inbound_parcels_.IsSequenceFullyConsumed()) {
+    // A single signal may have made several parcels available at once (e.g.
+    // when a gap in the sequence is filled), or may have been absorbed by a
+    // waiter which timed out. Pass the wakeup on, so that every remaining
+    // waiter gets a chance at whatever this caller leaves behind; any woken
+    // waiter which then finds nothing simply goes back to sleep.
+    WakeBlockedGets(/*all=*/false);
+    return IPCZ_RESULT_OK;
+  }
+  return IPCZ_RESULT_DEADLINE_EXCEEDED;
+}
+
+void Router::WakeBlockedGets(bool all) {
+  if (!num_blocked_gets_) {
+    return;
+  }
+  if (all) {
+    inbound_parcel_available_.SignalAll();
+  } else {
+    inbound_parcel_available_.Signal();
+  }
+}
+
 IpczResult Router::Trap(const IpczTrapConditions& conditions,
                         IpczTrapEventHandler handler,
+                        IpczTrapBatchEventHandler batch_handler,
                         uint64_t context,
+                        IpczTrapFlags flags,
                         IpczTrapConditionFlags* satisfied_condition_flags,
                         IpczPortalStatus* status) {
+  TrapEventDispatcher dispatcher;
+  const OperationContext operation_context{OperationContext::kAPICall,
+                                           dispatcher};
+  IpczResult result;
+  bool needs_flush;
+  {
+    absl::MutexLock lock(&mutex_);
+
+    // Traps watching for closure of the other side of the route must be
+    // notified of it, so this router can't stay idle once it has any. Waking
+    // here also ensures the new trap observes any closure published while we
+    // were idle. Traps watching only for parcels don't care.
+    needs_flush =
+        (conditions.flags & (IPCZ_TRAP_PEER_CLOSED | IPCZ_TRAP_DEAD)) &&
+        WakeFromIdle(operation_context, dispatcher);
+    result = traps_.Add(conditions, handler, batch_handler, context, flags,
+                        status_flags_, inbound_parcels_,
+                        satisfied_condition_flags, status);
+  }
+
+  if (needs_flush) {
+    Flush(operation_context);
+  }
+  return result;
+}
+
+IpczResult Router::RemoveTrap(IpczTrapEventHandler handler,
+                              IpczTrapBatchEventHandler batch_handler,
+                              uint64_t context) {
+  const OperationContext operation_context{OperationContext::kAPICall};
+  TrapEventDispatcher dispatcher;
   absl::MutexLock lock(&mutex_);
-  return traps_.Add(conditions, handler, context, status_flags_,
-                    inbound_parcels_, satisfied_condition_flags, status);
+  if (!traps_.Remove(operation_context, handler, batch_handler, context,
+                     dispatcher)) {
+    return IPCZ_RESULT_NOT_FOUND;
+  }
+  EnterIdleState();
+  return IPCZ_RESULT_OK;
 }
 
 IpczResult Router::MergeRoute(const Ref<Router>& other) {
@@ -680,6 +960,9 @@ IpczResult Router::MergeRoute(const Ref<Router>& other) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
 
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kAPICall, dispatcher};
+  bool other_needs_flush = false;
   {
     MultiMutexLock lock(&mutex_, &other->mutex_);
     if (inward_edge_ || other->inward_edge_ || bridge_ || other->bridge_) {
@@ -687,6 +970,13 @@ IpczResult Router::MergeRoute(const Ref<Router>& other) {
       return IPCZ_RESULT_INVALID_ARGUMENT;
     }
 
+    // Neither router can stay idle once bridged, since closure must propagate
+    // across the bridge.
+    WakeFromIdle(context, dispatcher);
+    other_needs_flush = other->WakeFromIdle(context, dispatcher);
+
+    MultiMutexLock outbound_lock(&outbound_mutex_, &other->outbound_mutex_);
+
     if (inbound_parcels_.current_sequence_number() > SequenceNumber(0) ||
         outbound_parcels_.GetCurrentSequenceLength() > SequenceNumber(0) ||
         other->inbound_parcels_.current_sequence_number() > SequenceNumber(0) ||
@@ -704,10 +994,14 @@ IpczResult Router::MergeRoute(const Ref<Router>& other) {
         LinkType::kBridge, Router::Pair(WrapRefCounted(this), other));
     bridge_->SetPrimaryLink(std::move(links.first));
     other->bridge_->SetPrimaryLink(std::move(links.second));
+    UpdateOutboundState();
+    other->UpdateOutboundState();
   }
 
-  const OperationContext context{OperationContext::kAPICall};
   Flush(context);
+  if (other_needs_flush) {
+    other->Flush(context);
+  }
   return IPCZ_RESULT_OK;
 }
 
@@ -723,6 +1017,7 @@ Ref<Router> Router::Deserialize(const RouterDescriptor& descriptor,
   Ref<RemoteRouterLink> new_outward_link;
   {
     absl::MutexLock lock(&router->mutex_);
+    absl::MutexLock outbound_lock(&router->outbound_mutex_);
     router->outbound_parcels_.ResetSequence(
         descriptor.next_outgoing_sequence_number);
     router->inbound_parcels_.ResetSequence(
@@ -733,6 +1028,7 @@ Ref<Router> Router::Deserialize(const RouterDescriptor& descriptor,
               descriptor.closed_peer_sequence_length)) {
         return nullptr;
       }
+      router->is_inbound_sequence_final_ = true;
       if (router->inbound_parcels_.IsSequenceFullyConsumed()) {
         router->status_flags_ |=
             IPCZ_PORTAL_STATUS_PEER_CLOSED | IPCZ_PORTAL_STATUS_DEAD;
@@ -805,6 +1101,8 @@ Ref<Router> Router::Deserialize(const RouterDescriptor& descriptor,
         disconnected = true;
       }
     }
+    router->UpdateOutboundState();
+    router->PublishStatus();
   }
 
   if (disconnected) {
@@ -823,48 +1121,105 @@ Ref<Router> Router::Deserialize(const RouterDescriptor& descriptor,
   return router;
 }
 
-void Router::SerializeNewRouter(const OperationContext& context,
-                                NodeLink& to_node_link,
-                                RouterDescriptor& descriptor) {
-  TrapEventDispatcher dispatcher;
-  Ref<Router> local_peer;
-  bool initiate_proxy_bypass = false;
-  {
-    absl::MutexLock lock(&mutex_);
-    traps_.RemoveAll(context, dispatcher);
-    local_peer = outward_edge_.GetLocalPeer();
-    initiate_proxy_bypass = outward_edge_.primary_link() &&
-                            outward_edge_.primary_link()->TryLockForBypass(
-                                to_node_link.remote_node_name());
-  }
+// static
+void Router::SerializeNewRouters(const OperationContext& context,
+                                 NodeLink& to_node_link,
+                                 absl::Span<const Ref<Router>> routers,
+                                 absl::Span<RouterDescriptor> descriptors) {
+  ABSL_ASSERT(routers.size() == descriptors.size());
+  TrapEventDispatcher dispatcher(context);
+
+  // Detach each Router from its portal and find out which ones may be able to
+  // take the optimized local-peer path. Each of those needs a new
+  // RouterLinkState and two sublinks, while every other Router needs only one
+  // sublink.
+  absl::InlinedVector<Ref<Router>, 4> local_peers(routers.size());
+  absl::InlinedVector<bool, 4> initiate_proxy_bypass(routers.size());
+  size_t num_link_states_needed = 0;
+  for (size_t i = 0; i < routers.size(); ++i) {
+    bool bypass = false;
+    local_peers[i] = routers[i]->PrepareToSerializeNewRouter(
+        context, dispatcher, to_node_link, bypass);
+    initiate_proxy_bypass[i] = bypass;
+    if (local_peers[i]) {
+      ++num_link_states_needed;
+    }
+  }
+
+  // Allocate all new RouterLinkStates in one pass. If we fall short, the
+  // remaining local-peer Routers fall back onto the proxying path below, and
+  // only one request for more capacity is issued on behalf of the whole batch.
+  absl::InlinedVector<FragmentRef<RouterLinkState>, 4> link_states(
+      num_link_states_needed);
+  const size_t num_link_states =
+      num_link_states_needed
+          ? to_node_link.memory().TryAllocateRouterLinkStates(
+                absl::MakeSpan(link_states))
+          : 0;
+
+  // Reserve every sublink ID the batch will use with a single allocation.
+  const size_t num_sublinks = routers.size() + num_link_states;
+  SublinkId next_sublink =
+      to_node_link.memory().AllocateSublinkIds(num_sublinks);
+
+  size_t link_state_index = 0;
+  for (size_t i = 0; i < routers.size(); ++i) {
+    Router& router = *routers[i];
+    const SublinkId new_sublink = next_sublink;
+    if (local_peers[i] && link_state_index < num_link_states) {
+      next_sublink = SublinkId(next_sublink.value() + 2);
+      if (router.SerializeNewRouterWithLocalPeer(
+              context, to_node_link, descriptors[i], local_peers[i],
+              std::move(link_states[link_state_index++]), new_sublink)) {
+        continue;
+      }
+    } else {
+      next_sublink = SublinkId(next_sublink.value() + 1);
+    }
 
-  if (local_peer && initiate_proxy_bypass &&
-      SerializeNewRouterWithLocalPeer(context, to_node_link, descriptor,
-                                      local_peer)) {
-    return;
+    router.SerializeNewRouterAndConfigureProxy(context, to_node_link,
+                                               descriptors[i],
+                                               initiate_proxy_bypass[i],
+                                               new_sublink);
   }
+}
 
-  SerializeNewRouterAndConfigureProxy(context, to_node_link, descriptor,
-                                      initiate_proxy_bypass);
+Ref<Router> Router::PrepareToSerializeNewRouter(
+    const OperationContext& context,
+    TrapEventDispatcher& dispatcher,
+    NodeLink& to_node_link,
+    bool& initiate_proxy_bypass) {
+  absl::MutexLock lock(&mutex_);
+  traps_.RemoveAll(context, dispatcher);
+  is_portal_invalidated_ = true;
+  WakeBlockedGets(/*all=*/true);
+
+  // Any closure picked up here is reflected in serialization, and the
+  // remaining work is flushed once this router begins proxying.
+  WakeFromIdle(context, dispatcher);
+  initiate_proxy_bypass = outward_edge_.primary_link() &&
+                          outward_edge_.primary_link()->TryLockForBypass(
+                              to_node_link.remote_node_name());
+  if (!initiate_proxy_bypass) {
+    return nullptr;
+  }
+  return outward_edge_.GetLocalPeer();
 }
 
-bool Router::SerializeNewRouterWithLocalPeer(const OperationContext& context,
-                                             NodeLink& to_node_link,
-                                             RouterDescriptor& descriptor,
-                                             Ref<Router> local_peer) {
+bool Router::SerializeNewRouterWithLocalPeer(
+    const OperationContext& context,
+    NodeLink& to_node_link,
+    RouterDescriptor& descriptor,
+    Ref<Router> local_peer,
+    FragmentRef<RouterLinkState> new_link_state,
+    SublinkId new_sublink) {
   MultiMutexLock lock(&mutex_, &local_peer->mutex_);
   if (local_peer->outward_edge_.GetLocalPeer() != this) {
     // If the peer was closed, its link to us may already be invalidated.
     return false;
   }
 
-  FragmentRef<RouterLinkState> new_link_state =
-      to_node_link.memory().TryAllocateRouterLinkState();
-  if (!new_link_state.is_addressable()) {
-    // If we couldn't allocate a RouterLinkState for a new central link, then
-    // we can't replace the central link yet. Fall back to the proxying case.
-    return false;
-  }
+  MultiMutexLock outbound_lock(&outbound_mutex_, &local_peer->outbound_mutex_);
 
   const SequenceNumber proxy_inbound_sequence_length =
       local_peer->outbound_parcels_.current_sequence_number();
@@ -873,14 +1228,14 @@ bool Router::SerializeNewRouterWithLocalPeer(const OperationContext& context,
   // outward link in BeginProxyingToNewRouter() after this descriptor is
   // transmitted.
   local_peer->outward_edge_.ReleasePrimaryLink();
+  local_peer->UpdateOutboundState();
 
   // The primary new sublink to the destination node will act as the route's
   // new central link between our local peer and the new remote router.
   //
-  // An additional sublink is allocated to act as a decaying inward link from
+  // An additional sublink is reserved to act as a decaying inward link from
   // this router to the new one, so we can forward any inbound parcels that have
   // already been queued here.
-  const SublinkId new_sublink = to_node_link.memory().AllocateSublinkIds(2);
   const SublinkId decaying_sublink = SublinkId(new_sublink.value() + 1);
 
   // Register the new routes on the NodeLink. Note that we don't provide them to
@@ -923,6 +1278,7 @@ bool Router::SerializeNewRouterWithLocalPeer(const OperationContext& context,
   inward_edge_->set_length_to_decaying_link(proxy_inbound_sequence_length);
   inward_edge_->set_length_from_decaying_link(
       outbound_parcels_.GetCurrentSequenceLength());
+  UpdateOutboundState();
   return true;
 }
 
@@ -930,10 +1286,10 @@ void Router::SerializeNewRouterAndConfigureProxy(
     const OperationContext& context,
     NodeLink& to_node_link,
     RouterDescriptor& descriptor,
-    bool initiate_proxy_bypass) {
-  const SublinkId new_sublink = to_node_link.memory().AllocateSublinkIds(1);
-
+    bool initiate_proxy_bypass,
+    SublinkId new_sublink) {
   absl::MutexLock lock(&mutex_);
+  absl::MutexLock outbound_lock(&outbound_mutex_);
   descriptor.new_sublink = new_sublink;
   descriptor.new_link_state_fragment = FragmentDescriptor();
   descriptor.proxy_already_bypassed = false;
@@ -979,6 +1335,7 @@ void Router::SerializeNewRouterAndConfigureProxy(
       outward_edge_.primary_link()->Unlock();
     }
   }
+  UpdateOutboundState();
 
   // Once `descriptor` is transmitted to the destination node and the new
   // Router is created there, it may immediately begin transmitting messages
@@ -1004,7 +1361,7 @@ void Router::BeginProxyingToNewRouter(const OperationContext& context,
   Ref<Router> local_peer;
 
   // Acquire references to RemoteRouterLink(s) created by an earlier call to
-  // SerializeNewRouter(). If the NodeLink has already been disconnected, these
+  // SerializeNewRouters(). If the NodeLink has already been disconnected, these
   // may be null.
   auto new_sublink = to_node_link.GetSublink(descriptor.new_sublink);
   auto new_decaying_sublink =
@@ -1018,6 +1375,7 @@ void Router::BeginProxyingToNewRouter(const OperationContext& context,
   Ref<RemoteRouterLink> new_decaying_link;
   {
     absl::MutexLock lock(&mutex_);
+    absl::MutexLock outbound_lock(&outbound_mutex_);
     ABSL_ASSERT(inward_edge_);
 
     if (descriptor.proxy_already_bypassed) {
@@ -1044,6 +1402,7 @@ void Router::BeginProxyingToNewRouter(const OperationContext& context,
         outward_link->MarkSideStable();
       }
     }
+    UpdateOutboundState();
   }
 
   if (local_peer && new_primary_link && !new_decaying_link) {
@@ -1171,11 +1530,13 @@ bool Router::AcceptBypassLink(
       return false;
     }
 
+    absl::MutexLock outbound_lock(&outbound_mutex_);
     length_to_proxy_from_us = outbound_parcels_.current_sequence_number();
     if (!outward_edge_.BeginPrimaryLinkDecay()) {
       DLOG(ERROR) << "Rejecting BypassProxy on failure to decay link";
       return false;
     }
+    UpdateOutboundState();
 
     // By convention the initiator of a bypass assumes side A of the bypass
     // link, so we assume side B.
@@ -1194,6 +1555,7 @@ bool Router::AcceptBypassLink(
       outward_edge_.set_length_from_decaying_link(
           inbound_sequence_length_from_bypassed_link);
       outward_edge_.SetPrimaryLink(new_link);
+      UpdateOutboundState();
     }
   }
 
@@ -1395,13 +1757,17 @@ void Router::NotifyLinkDisconnected(const OperationContext& context,
     absl::MutexLock lock(&mutex_);
     if (outward_edge_.primary_link() == &link) {
       DVLOG(4) << "Primary " << link.Describe() << " disconnected";
+      absl::MutexLock outbound_lock(&outbound_mutex_);
       outward_edge_.ReleasePrimaryLink();
+      UpdateOutboundState();
     } else if (outward_edge_.decaying_link() == &link) {
       DVLOG(4) << "Decaying " << link.Describe() << " disconnected";
       outward_edge_.ReleaseDecayingLink();
     } else if (inward_edge_ && inward_edge_->primary_link() == &link) {
       DVLOG(4) << "Primary " << link.Describe() << " disconnected";
+      absl::MutexLock outbound_lock(&outbound_mutex_);
       inward_edge_->ReleasePrimaryLink();
+      UpdateOutboundState();
     } else if (inward_edge_ && inward_edge_->decaying_link() == &link) {
       DVLOG(4) << "Decaying " << link.Describe() << " disconnected";
       inward_edge_->ReleaseDecayingLink();
@@ -1431,9 +1797,22 @@ void Router::Flush(const OperationContext& context, FlushBehavior behavior) {
   bool outward_link_decayed = false;
   bool dropped_last_decaying_link = false;
   ParcelsToFlush parcels_to_flush;
-  TrapEventDispatcher dispatcher;
+  if (behavior == kDefault &&
+      is_flush_no_op_.load(std::memory_order_acquire)) {
+    // Many operations flush unconditionally, so a router in steady state
+    // finds out it has nothing to do without taking either lock.
+    return;
+  }
+
+  TrapEventDispatcher dispatcher(context);
   {
     absl::MutexLock lock(&mutex_);
+    UpdateIdleState(context, dispatcher);
+
+    absl::MutexLock outbound_lock(&outbound_mutex_);
+    if (behavior == kDefault && IsFlushNoOp()) {
+      return;
+    }
 
     // Acquire stack references to all links we might want to use, so it's safe
     // to acquire additional (unmanaged) references per ParcelToFlush.
@@ -1458,7 +1837,10 @@ void Router::Flush(const OperationContext& context, FlushBehavior behavior) {
     // and then perform any transmissions or link deactivations after the mutex
     // is released further below.
 
-    CollectParcelsToFlush(outbound_parcels_, outward_edge_, parcels_to_flush);
+    CollectParcelsToFlush(outbound_parcels_, outward_edge_, parcels_to_flush,
+                          inward_edge_ ? ParcelTraceStage::kProxy
+                                       : ParcelTraceStage::kQueueOutbound,
+                          this);
     const SequenceNumber outbound_sequence_length_sent =
         outbound_parcels_.current_sequence_number();
     const SequenceNumber inbound_sequence_length_received =
@@ -1473,7 +1855,8 @@ void Router::Flush(const OperationContext& context, FlushBehavior behavior) {
     }
 
     if (inward_edge_) {
-      CollectParcelsToFlush(inbound_parcels_, *inward_edge_, parcels_to_flush);
+      CollectParcelsToFlush(inbound_parcels_, *inward_edge_, parcels_to_flush,
+                            ParcelTraceStage::kProxy, this);
       const SequenceNumber inbound_sequence_length_sent =
           inbound_parcels_.current_sequence_number();
       const SequenceNumber outbound_sequence_length_received =
@@ -1487,7 +1870,8 @@ void Router::Flush(const OperationContext& context, FlushBehavior behavior) {
         inward_link_decayed = true;
       }
     } else if (bridge_link) {
-      CollectParcelsToFlush(inbound_parcels_, *bridge_, parcels_to_flush);
+      CollectParcelsToFlush(inbound_parcels_, *bridge_, parcels_to_flush,
+                            ParcelTraceStage::kProxy, this);
     }
 
     if (bridge_ && bridge_->MaybeFinishDecay(
@@ -1530,6 +1914,13 @@ void Router::Flush(const OperationContext& context, FlushBehavior behavior) {
       final_outward_sequence_length =
           *outbound_parcels_.final_sequence_length();
 
+      // If the other side is idle, it finds our closure in the link's shared
+      // state whenever it's next used, so there's no need to wake it now.
+      if (outward_link->TryPublishRouteClosure(
+              *final_outward_sequence_length)) {
+        final_outward_sequence_length.reset();
+      }
+
       // We also have no more use for either outward or inward links: trivially
       // there are no more outbound parcels to send outward, and there no longer
       // exists an ultimate destination for any forwarded inbound parcels. So we
@@ -1553,6 +1944,12 @@ void Router::Flush(const OperationContext& context, FlushBehavior behavior) {
         bridge_.reset();
       }
     }
+
+    // Any stale idle state was cleared on entry above, so this only catches
+    // routers made eligible by this flush (e.g. once their link is stable).
+    EnterIdleState();
+    UpdateOutboundState();
+    PublishStatus();
   }
 
   for (ParcelToFlush& parcel : parcels_to_flush) {
@@ -1672,8 +2069,10 @@ bool Router::MaybeStartSelfBypass(const OperationContext& context) {
         return false;
       }
 
+      absl::MutexLock outbound_lock(&outbound_mutex_);
       outward_edge_.BeginPrimaryLinkDecay();
       inward_edge_->BeginPrimaryLinkDecay();
+      UpdateOutboundState();
     }
 
     DVLOG(4) << "Proxy sending bypass request to inward peer over "
@@ -1743,6 +2142,8 @@ bool Router::StartSelfBypassToLocalPeer(
     ABSL_ASSERT(peer_outward_link->GetLocalPeer() == this);
 
     // Decay both of our existing links, as well as the local peer's link to us.
+    MultiMutexLock outbound_lock(&outbound_mutex_,
+                                 &local_outward_peer.outbound_mutex_);
     length_from_outward_peer =
         local_outward_peer.outbound_parcels_.current_sequence_number();
     local_outward_peer.outward_edge_.BeginPrimaryLinkDecay();
@@ -1752,6 +2153,8 @@ bool Router::StartSelfBypassToLocalPeer(
     outward_edge_.set_length_from_decaying_link(length_from_outward_peer);
     inward_edge_->BeginPrimaryLinkDecay();
     inward_edge_->set_length_to_decaying_link(length_from_outward_peer);
+    UpdateOutboundState();
+    local_outward_peer.UpdateOutboundState();
 
     new_link = inward_link.node_link()->AddRemoteRouterLink(
         context, new_sublink, new_link_state, LinkType::kCentral, LinkSide::kA,
@@ -1847,10 +2250,14 @@ void Router::MaybeStartBridgeBypass(const OperationContext& context) {
         // immediately.
         return;
       }
+      MultiMutexLock outbound_lock(&outbound_mutex_,
+                                   &second_bridge->outbound_mutex_);
       outward_edge_.BeginPrimaryLinkDecay();
       second_bridge->outward_edge_.BeginPrimaryLinkDecay();
       bridge_->BeginPrimaryLinkDecay();
       second_bridge->bridge_->BeginPrimaryLinkDecay();
+      UpdateOutboundState();
+      second_bridge->UpdateOutboundState();
     }
     second_remote_link->BypassPeer(
         context, first_remote_link->node_link()->remote_node_name(),
@@ -1886,6 +2293,10 @@ void Router::MaybeStartBridgeBypass(const OperationContext& context) {
       return;
     }
 
+    MultiMutexLock outbound_lock(
+        &outbound_mutex_, &second_bridge->outbound_mutex_,
+        &first_local_peer->outbound_mutex_,
+        &second_local_peer->outbound_mutex_);
     const SequenceNumber length_from_first_peer =
         first_local_peer->outbound_parcels_.current_sequence_number();
     const SequenceNumber length_from_second_peer =
@@ -1925,6 +2336,11 @@ void Router::MaybeStartBridgeBypass(const OperationContext& context) {
         LinkType::kCentral, Router::Pair(first_local_peer, second_local_peer));
     first_local_peer->outward_edge_.SetPrimaryLink(std::move(links.first));
     second_local_peer->outward_edge_.SetPrimaryLink(std::move(links.second));
+
+    UpdateOutboundState();
+    second_bridge->UpdateOutboundState();
+    first_local_peer->UpdateOutboundState();
+    second_local_peer->UpdateOutboundState();
   }
 
   first_bridge->Flush(context);
@@ -1997,6 +2413,9 @@ void Router::StartBridgeBypassFromLocalPeer(
       return;
     }
 
+    MultiMutexLock outbound_lock(&outbound_mutex_,
+                                 &other_bridge->outbound_mutex_,
+                                 &local_peer->outbound_mutex_);
     length_from_local_peer =
         local_peer->outbound_parcels_.current_sequence_number();
 
@@ -2017,6 +2436,10 @@ void Router::StartBridgeBypassFromLocalPeer(
     RouteEdge& other_bridge_edge = *other_bridge->bridge_;
     other_bridge_edge.BeginPrimaryLinkDecay();
     other_bridge_edge.set_length_from_decaying_link(length_from_local_peer);
+
+    UpdateOutboundState();
+    other_bridge->UpdateOutboundState();
+    local_peer->UpdateOutboundState();
   }
 
   remote_link->BypassPeerWithLink(
@@ -2064,10 +2487,12 @@ bool Router::BypassPeerWithNewRemoteLink(
       return true;
     }
 
+    absl::MutexLock outbound_lock(&outbound_mutex_);
     if (!outward_edge_.BeginPrimaryLinkDecay()) {
       DLOG(ERROR) << "Rejecting BypassPeer on failure to decay link";
       return false;
     }
+    UpdateOutboundState();
 
     length_to_decaying_link = outbound_parcels_.current_sequence_number();
     outward_edge_.set_length_to_decaying_link(length_to_decaying_link);
@@ -2122,6 +2547,8 @@ bool Router::BypassPeerWithNewLocalLink(const OperationContext& context,
   SequenceNumber length_from_proxy_to_us;
   {
     MultiMutexLock lock(&mutex_, &new_local_peer->mutex_);
+    MultiMutexLock outbound_lock(&outbound_mutex_,
+                                 &new_local_peer->outbound_mutex_);
     length_from_proxy_to_us =
         new_local_peer->outbound_parcels_.current_sequence_number();
     length_to_proxy_from_us = outbound_parcels_.current_sequence_number();
@@ -2141,8 +2568,11 @@ bool Router::BypassPeerWithNewLocalLink(const OperationContext& context,
     }
 
     // Otherwise immediately begin decay of both links to the proxy.
-    if (!outward_edge_.BeginPrimaryLinkDecay() ||
-        !new_local_peer->outward_edge_.BeginPrimaryLinkDecay()) {
+    const bool decayed = outward_edge_.BeginPrimaryLinkDecay() &&
+                         new_local_peer->outward_edge_.BeginPrimaryLinkDecay();
+    UpdateOutboundState();
+    new_local_peer->UpdateOutboundState();
+    if (!decayed) {
       DLOG(ERROR) << "Rejecting BypassPeer on failure to decay link";
       return false;
     }
@@ -2159,6 +2589,8 @@ bool Router::BypassPeerWithNewLocalLink(const OperationContext& context,
         LinkType::kCentral, Router::Pair(WrapRefCounted(this), new_local_peer));
     outward_edge_.SetPrimaryLink(std::move(links.first));
     new_local_peer->outward_edge_.SetPrimaryLink(std::move(links.second));
+    UpdateOutboundState();
+    new_local_peer->UpdateOutboundState();
   }
 
   link_from_new_local_peer_to_proxy->StopProxying(
@@ -2169,14 +2601,198 @@ bool Router::BypassPeerWithNewLocalLink(const OperationContext& context,
   return true;
 }
 
+bool Router::IsInSteadyState() const {
+  return !inward_edge_ && !bridge_ && outward_edge_.is_stable() &&
+         !inbound_parcels_.final_sequence_length();
+}
+
+bool Router::CanCutThroughParcels() const {
+  return inward_edge_ && !bridge_ && inward_edge_->is_stable() &&
+         outward_edge_.is_stable() && inward_edge_->primary_link() &&
+         outward_edge_.primary_link() &&
+         !inbound_parcels_.final_sequence_length() &&
+         !outbound_parcels_.final_sequence_length();
+}
+
+bool Router::FinalizeInboundSequence(const OperationContext& context,
+                                     SequenceNumber sequence_length,
+                                     TrapEventDispatcher& dispatcher) {
+  if (!inbound_parcels_.SetFinalSequenceLength(sequence_length)) {
+    return false;
+  }
+  {
+    absl::MutexLock outbound_lock(&outbound_mutex_);
+    is_inbound_sequence_final_ = true;
+    UpdateOutboundState();
+  }
+
+  if (!inward_edge_ && !bridge_) {
+    is_peer_closed_ = true;
+    if (inbound_parcels_.IsSequenceFullyConsumed()) {
+      status_flags_ |= IPCZ_PORTAL_STATUS_PEER_CLOSED | IPCZ_PORTAL_STATUS_DEAD;
+    }
+    PublishStatus();
+    traps_.NotifyPeerClosed(context, status_flags_, inbound_parcels_,
+                            dispatcher);
+    WakeBlockedGets(/*all=*/true);
+  }
+  return true;
+}
+
+bool Router::CanBeIdle() const {
+  // Only remote links have shared state in which to publish closure; local
+  // peers notify each other synchronously anyway.
+  const Ref<RouterLink>& link = outward_edge_.primary_link();
+  return !traps_.IsWatchingPeerClosure() && !num_blocked_gets_ &&
+         !inward_edge_ && !bridge_ && !is_portal_invalidated_ &&
+         outward_edge_.is_stable() && link && link->GetType().is_central() &&
+         link->AsRemoteRouterLink() &&
+         !inbound_parcels_.final_sequence_length();
+}
+
+void Router::UpdateIdleState(const OperationContext& context,
+                             TrapEventDispatcher& dispatcher) {
+  if (idle_link_ &&
+      (!CanBeIdle() || idle_link_ != outward_edge_.primary_link())) {
+    // Note that any closure picked up here makes CanBeIdle() false.
+    WakeFromIdle(context, dispatcher);
+  }
+}
+
+void Router::EnterIdleState() {
+  if (!idle_link_ && CanBeIdle() &&
+      outward_edge_.primary_link()->TryMarkSideIdle()) {
+    idle_link_ = outward_edge_.primary_link();
+    is_idle_.store(true, std::memory_order_relaxed);
+  }
+}
+
+bool Router::WakeFromIdle(const OperationContext& context,
+                          TrapEventDispatcher& dispatcher) {
+  if (!idle_link_) {
+    return false;
+  }
+
+  // Once the idle bit is cleared, the other side will notify us of any closure
+  // it publishes later; so only closure published before now must be picked up
+  // here.
+  Ref<RouterLink> link = std::move(idle_link_);
+  is_idle_.store(false, std::memory_order_relaxed);
+  link->MarkSideActive();
+  const std::optional<SequenceNumber> sequence_length =
+      link->GetPublishedRouteClosure();
+  return sequence_length &&
+         FinalizeInboundSequence(context, *sequence_length, dispatcher);
+}
+
+void Router::AcceptIdleRouteClosure() {
+  if (!is_idle_.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  {
+    absl::MutexLock lock(&outbound_mutex_);
+    if (!HasIdleRouteClosure()) {
+      return;
+    }
+  }
+  AcceptPublishedRouteClosure();
+}
+
+bool Router::HasIdleRouteClosure() {
+  // `outbound_link_` is the idle link whenever this router is idle, or it's
+  // about to be woken anyway because that link is changing.
+  return is_idle_.load(std::memory_order_relaxed) && outbound_link_ &&
+         outbound_link_->GetPublishedRouteClosure().has_value();
+}
+
+void Router::AcceptPublishedRouteClosure() {
+  TrapEventDispatcher dispatcher;
+  const OperationContext context{OperationContext::kAPICall, dispatcher};
+  {
+    absl::MutexLock lock(&mutex_);
+    if (!idle_link_) {
+      return;
+    }
+    const std::optional<SequenceNumber> sequence_length =
+        idle_link_->GetPublishedRouteClosure();
+    if (!sequence_length ||
+        !FinalizeInboundSequence(context, *sequence_length, dispatcher)) {
+      return;
+    }
+  }
+
+  // Among other things, this wakes the router from idle now that it has a
+  // final inbound sequence length.
+  Flush(context);
+}
+
+bool Router::IsFlushNoOp() const {
+  return IsInSteadyState() && !outbound_parcels_.HasNextElement() &&
+         !outbound_parcels_.final_sequence_length();
+}
+
+void Router::PublishStatus() {
+  status_snapshot_.Publish(status_flags_,
+                           inbound_parcels_.GetNumAvailableElements(),
+                           inbound_parcels_.GetTotalAvailableElementSize());
+}
+
+void Router::UpdateOutboundState() {
+  outbound_link_ = outward_edge_.primary_link();
+  can_cut_through_outbound_ = CanCutThroughParcels();
+  is_flush_no_op_.store(IsFlushNoOp(), std::memory_order_release);
+  UpdateNodeLinkForwarding();
+}
+
+void Router::UpdateNodeLinkForwarding() {
+  RemoteRouterLink* outward_link = nullptr;
+  RemoteRouterLink* inward_link = nullptr;
+  if (can_cut_through_outbound_) {
+    outward_link = outward_edge_.primary_link()->AsRemoteRouterLink();
+    inward_link = inward_edge_->primary_link()->AsRemoteRouterLink();
+    if (!outward_link || !inward_link) {
+      outward_link = inward_link = nullptr;
+    }
+  }
+
+  if (outward_link == forwarding_outward_link_.get() &&
+      inward_link == forwarding_inward_link_.get()) {
+    return;
+  }
+
+  // Teardown happens under the same locks as the state change which requires
+  // it, so no parcel can be forwarded for this router once it's unable to cut
+  // through. Each NodeLink also confirms every parcel it forwards with
+  // ClaimParcelForForwarding(), which covers parcels already in flight.
+  if (forwarding_outward_link_) {
+    forwarding_outward_link_->node_link()->StopForwardingSublink(
+        forwarding_outward_link_->sublink());
+    forwarding_inward_link_->node_link()->StopForwardingSublink(
+        forwarding_inward_link_->sublink());
+  }
+
+  forwarding_outward_link_ = WrapRefCounted(outward_link);
+  forwarding_inward_link_ = WrapRefCounted(inward_link);
+  if (forwarding_outward_link_) {
+    forwarding_outward_link_->node_link()->StartForwardingSublink(
+        forwarding_outward_link_->sublink(), forwarding_inward_link_);
+    forwarding_inward_link_->node_link()->StartForwardingSublink(
+        forwarding_inward_link_->sublink(), forwarding_outward_link_);
+  }
+}
+
 std::unique_ptr<Parcel> Router::TakeNextInboundParcel(
     const OperationContext& context,
     TrapEventDispatcher& dispatcher) {
   std::unique_ptr<Parcel> parcel;
-  inbound_parcels_.Pop(parcel);
+  if (inbound_parcels_.Pop(parcel)) {
+    ParcelTracer::EndStage(ParcelTraceStage::kQueueInbound, this, *parcel);
+  }
   if (inbound_parcels_.IsSequenceFullyConsumed()) {
     status_flags_ |= IPCZ_PORTAL_STATUS_PEER_CLOSED | IPCZ_PORTAL_STATUS_DEAD;
   }
+  PublishStatus();
   traps_.NotifyLocalParcelConsumed(context, status_flags_, inbound_parcels_,
                                    dispatcher);
   return parcel;
@@ -5,6 +5,7 @@
 #ifndef IPCZ_SRC_IPCZ_ROUTER_H_
 #define IPCZ_SRC_IPCZ_ROUTER_H_
 
+#include <atomic>
 #include <cstdint>
 #include <utility>
 
@@ -13,6 +14,7 @@
 #include "ipcz/operation_context.h"
 #include "ipcz/parcel_queue.h"
 #include "ipcz/pending_transaction_set.h"
+#include "ipcz/portal_status_snapshot.h"
 #include "ipcz/route_edge.h"
 #include "ipcz/router_descriptor.h"
 #include "ipcz/router_link.h"
@@ -21,6 +23,8 @@
 #include "ipcz/trap_set.h"
 #include "third_party/abseil-cpp/absl/base/thread_annotations.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
 #include "util/ref_counted.h"
 
 namespace ipcz {
@@ -76,6 +80,7 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
                     absl::Span<const IpczHandle> handles,
                     IpczEndPutFlags flags);
   IpczResult Get(IpczGetFlags flags,
+                 const IpczGetOptions* options,
                  void* data,
                  size_t* num_data_bytes,
                  IpczHandle* handles,
@@ -105,6 +110,23 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   // reduction behavior, and may only be called on terminal Routers.
   bool IsOnCentralRemoteLink();
 
+  // Indicates whether this Router is a proxy, forwarding parcels between other
+  // Routers rather than being controlled by a portal.
+  bool IsProxy();
+
+  // Indicate whether this Router is a proxy which currently forwards inbound or
+  // outbound parcels as they arrive, without a full Flush(). The inbound answer
+  // is CanCutThroughParcels() itself, and the outbound answer is the mirror of
+  // it which AcceptOutboundParcel() consults. Used by tests to verify that the
+  // two agree.
+  bool CanCutThroughInboundParcels();
+  bool CanCutThroughOutboundParcels();
+
+  // Returns the number of parcels currently queued by this Router in either
+  // direction, whether they're awaiting retrieval by the application or
+  // awaiting transmission along the route. This is a diagnostic figure.
+  size_t GetNumQueuedParcels();
+
   // Fills in an IpczPortalStatus corresponding to the current state of this
   // Router.
   void QueryStatus(IpczPortalStatus& status);
@@ -141,6 +163,18 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   bool AcceptOutboundParcel(const OperationContext& context,
                             std::unique_ptr<Parcel> parcel);
 
+  // Called by a NodeLink which forwards parcels on this proxy's behalf (see
+  // NodeLink::StartForwardingSublink()) to claim the parcel numbered
+  // `sequence_number` before forwarding it over `link`. The parcel is inbound
+  // to this router if `is_inbound` is true, and outbound otherwise. Returns
+  // true if the parcel was accounted for as forwarded, in which case any
+  // parcels queued behind it are also forwarded by this call. Returns false if
+  // this router can no longer cut through parcels to `link`, or if the parcel
+  // isn't next in sequence; in that case the NodeLink must accept it normally.
+  bool ClaimParcelForForwarding(bool is_inbound,
+                                RouterLink& link,
+                                SequenceNumber sequence_number);
+
   // Accepts notification that the other end of the route has been closed and
   // that the closed end transmitted a total of `sequence_length` parcels before
   // closing. `source` indicates whether the portal's peer was closed locally,
@@ -164,10 +198,19 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   // implements the ipcz Trap() API. See its description in ipcz.h for details.
   IpczResult Trap(const IpczTrapConditions& conditions,
                   IpczTrapEventHandler handler,
+                  IpczTrapBatchEventHandler batch_handler,
                   uint64_t context,
+                  IpczTrapFlags flags,
                   IpczTrapConditionFlags* satisfied_condition_flags,
                   IpczPortalStatus* status);
 
+  // Removes any trap installed on this Router with the given `handler`,
+  // `batch_handler`, and `context`. This implements the ipcz Trap() API when
+  // given IPCZ_TRAP_FLAG_REMOVE.
+  IpczResult RemoveTrap(IpczTrapEventHandler handler,
+                        IpczTrapBatchEventHandler batch_handler,
+                        uint64_t context);
+
   // Attempts to merge this Router's route with the route terminated by `other`.
   // Both `other` and this Router must be terminal routers on their own separate
   // routes, and neither Router must have transmitted or retreived any parcels
@@ -178,12 +221,15 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   static Ref<Router> Deserialize(const RouterDescriptor& descriptor,
                                  NodeLink& from_node_link);
 
-  // Serializes a description of a new Router which will be used to extend this
-  // Router's route across `to_node_link` by introducing a new Router on the
-  // remote node.
-  void SerializeNewRouter(const OperationContext& context,
-                          NodeLink& to_node_link,
-                          RouterDescriptor& descriptor);
+  // Serializes descriptions of new Routers which will be used to extend each
+  // of `routers`' routes across `to_node_link` by introducing a new Router on
+  // the remote node. `descriptors` must be the same size as `routers`, and each
+  // descriptor is populated for the corresponding Router. Sublink IDs and
+  // RouterLinkStates are allocated for the whole batch at once.
+  static void SerializeNewRouters(const OperationContext& context,
+                                  NodeLink& to_node_link,
+                                  absl::Span<const Ref<Router>> routers,
+                                  absl::Span<RouterDescriptor> descriptors);
 
   // Configures this Router to begin proxying incoming parcels toward (and
   // outgoing parcels from) the Router described by `descriptor`, living on the
@@ -400,33 +446,190 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
                                   RemoteRouterLink& requestor,
                                   SublinkId bypass_target_sublink);
 
+  // First stage of SerializeNewRouters() for this Router: detaches the Router
+  // from its portal and determines which serialization path to take. Returns
+  // the Router's local peer if the optimized SerializeNewRouterWithLocalPeer()
+  // path may be attempted, in which case `initiate_proxy_bypass` is also true.
+  Ref<Router> PrepareToSerializeNewRouter(const OperationContext& context,
+                                          TrapEventDispatcher& dispatcher,
+                                          NodeLink& to_node_link,
+                                          bool& initiate_proxy_bypass);
+
   // Optimized Router serialization case when the Router's peer is local to the
   // same node and the existing (local) central link can be replaced with a new
-  // remote link, without establishing an intermediate proxy. Returns true on
-  // success, or false indicating that the caller must fall back onto the slower
-  // Router serialization path defined below.
-  bool SerializeNewRouterWithLocalPeer(const OperationContext& context,
-                                       NodeLink& to_node_link,
-                                       RouterDescriptor& descriptor,
-                                       Ref<Router> local_peer);
+  // remote link, without establishing an intermediate proxy. `new_link_state`
+  // is a preallocated RouterLinkState for the new central link, and
+  // `new_sublink` is the first of two consecutive preallocated sublink IDs.
+  // Returns true on success, or false indicating that the caller must fall back
+  // onto the slower Router serialization path defined below.
+  bool SerializeNewRouterWithLocalPeer(
+      const OperationContext& context,
+      NodeLink& to_node_link,
+      RouterDescriptor& descriptor,
+      Ref<Router> local_peer,
+      FragmentRef<RouterLinkState> new_link_state,
+      SublinkId new_sublink);
 
   // Default Router serialization case when the serializing Router must stay
   // behind as an intermediate proxy between its (remote) peer and the newly
   // established Router that will result from this serialization. As an
   // optimization, `initiate_proxy_bypass` may be true if the serializing router
   // is on the central link and was able to lock that link for bypass prior to
-  // serialization.
+  // serialization. `new_sublink` is a preallocated sublink ID.
   void SerializeNewRouterAndConfigureProxy(const OperationContext& context,
                                            NodeLink& to_node_link,
                                            RouterDescriptor& descriptor,
-                                           bool initiate_proxy_bypass);
+                                           bool initiate_proxy_bypass,
+                                           SublinkId new_sublink);
 
   std::unique_ptr<Parcel> TakeNextInboundParcel(const OperationContext& context,
                                                 TrapEventDispatcher& dispatcher)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Blocks the calling thread until an inbound parcel is available for
+  // retrieval, the inbound sequence is fully consumed, this Router's portal is
+  // closed or transferred, or `deadline` elapses. Used to implement Get() with
+  // IPCZ_GET_BLOCKING. Returns IPCZ_RESULT_OK if the caller should proceed with
+  // a normal Get(), or an error result to be returned from Get() otherwise.
+  // The caller must already be counted in `num_blocked_gets_`, which this
+  // decrements before returning.
+  IpczResult WaitForInboundParcel(absl::Time deadline)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Wakes any threads blocked in WaitForInboundParcel(). If `all` is false,
+  // only one waiter is woken. That waiter wakes another in turn if it finds a
+  // parcel available, so one signal eventually reaches as many waiters as there
+  // are parcels to retrieve.
+  void WakeBlockedGets(bool all) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Publishes the current portal status to `status_snapshot_`. Must be called
+  // before releasing `mutex_` any time `status_flags_` or the set of available
+  // inbound parcels may have changed.
+  void PublishStatus() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Indicates whether this is a terminal router with a stable outward edge and
+  // no final inbound sequence length. This is the steady state of a route in
+  // active use: there is nothing to forward, no decaying link to retire, and no
+  // closure to propagate, so receiving more inbound parcels cannot give this
+  // router any work to flush.
+  bool IsInSteadyState() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Indicates whether this is a proxy with a stable primary link on each edge
+  // and no closure pending in either direction. Such a router can forward any
+  // parcels it receives as soon as they're in sequence, and doing so can't give
+  // it any other work to flush: there are no decaying links to retire, no
+  // closure to propagate, and no new bypass opportunity.
+  //
+  // While this holds and both primary links are remote, parcels without
+  // attached objects are forwarded by the NodeLinks themselves and never reach
+  // this router as Parcel objects; see UpdateNodeLinkForwarding(). Any parcels
+  // which do reach this router are still forwarded through
+  // RouterLink::AcceptParcel().
+  bool CanCutThroughParcels() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_, outbound_mutex_);
+
+  // Indicates whether a default Flush() would be a no-op: the router is in
+  // steady state, and it has neither outbound parcels ready to transmit nor an
+  // outbound closure to propagate.
+  bool IsFlushNoOp() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_, outbound_mutex_);
+
+  // Finalizes the inbound parcel sequence at `sequence_length` following
+  // closure of the other side of the route, updating status and notifying traps
+  // as needed. Returns false if the sequence could not be finalized at that
+  // length, e.g. because it was already finalized.
+  bool FinalizeInboundSequence(const OperationContext& context,
+                               SequenceNumber sequence_length,
+                               TrapEventDispatcher& dispatcher)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Indicates whether this router could be woken only by closure of the other
+  // side of the route, so it's safe for the other side to publish its closure
+  // in shared state without notifying us. True for a terminal router on a
+  // stable central link with no traps watching for peer closure, no blocked
+  // Get() calls, and a portal still in use. Traps watching only for parcels
+  // don't prevent this, since closure can't satisfy their conditions.
+  bool CanBeIdle() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Ensures this router is no longer marked idle if it's not CanBeIdle(), or if
+  // its outward link has changed. Called on every Flush().
+  void UpdateIdleState(const OperationContext& context,
+                       TrapEventDispatcher& dispatcher)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Marks this router idle on its outward link if it isn't already and
+  // CanBeIdle(). Called at the end of every non-trivial Flush(), and from Get()
+  // and RemoveTrap() when they may leave the router newly eligible. Any stale
+  // idle state must already have been cleared by UpdateIdleState().
+  void EnterIdleState() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Ensures that this router is not marked idle, picking up any route closure
+  // the other side published while it was. This must be called before any
+  // state change which invalidates CanBeIdle(). Returns true if closure was
+  // picked up, in which case the caller should Flush() once `mutex_` is
+  // released.
+  bool WakeFromIdle(const OperationContext& context,
+                    TrapEventDispatcher& dispatcher)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Called on API entry points which can observe closure of the other side of
+  // the route. If this router is idle and the other side has published its
+  // closure in shared state, this accepts that closure just as if it had been
+  // notified of it directly. `mutex_` is acquired only if such a closure has
+  // actually been published.
+  void AcceptIdleRouteClosure() ABSL_LOCKS_EXCLUDED(mutex_, outbound_mutex_);
+
+  // Indicates whether this router is idle and the other side has published its
+  // closure to the idle link. This only reads shared link state, so it's cheap
+  // enough to check on every outbound parcel.
+  bool HasIdleRouteClosure() ABSL_EXCLUSIVE_LOCKS_REQUIRED(outbound_mutex_);
+
+  // Picks up a closure found by HasIdleRouteClosure(), finalizing the inbound
+  // sequence and flushing this router.
+  void AcceptPublishedRouteClosure()
+      ABSL_LOCKS_EXCLUDED(mutex_, outbound_mutex_);
+
+  // Refreshes `outbound_link_`, `can_cut_through_outbound_`, and
+  // `is_flush_no_op_` to reflect the current state of this router's edges and
+  // parcel queues. Must be called before releasing `outbound_mutex_` any time
+  // any of them may have changed.
+  void UpdateOutboundState()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_, outbound_mutex_);
+
+  // Called by UpdateOutboundState() to install or tear down NodeLink-level
+  // forwarding between this proxy's primary links, so that it's installed
+  // only while CanCutThroughParcels() holds and both links are remote.
+  void UpdateNodeLinkForwarding()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_, outbound_mutex_);
+
+  // Guards the inbound side of the router along with its edges, traps and
+  // status. Code which holds this may also acquire `outbound_mutex_`, but never
+  // the other way around.
   absl::Mutex mutex_;
 
+  // Guards the outbound side of the router: outbound sequence assignment and
+  // `outbound_parcels_`, along with a few fields mirrored from the inbound side
+  // so that SendOutboundParcel() never needs to acquire `mutex_`. This is
+  // always acquired after `mutex_` (if at all), and any other routers' outbound
+  // mutexes needed at the same time are acquired with it in a single
+  // MultiMutexLock.
+  absl::Mutex outbound_mutex_ ABSL_ACQUIRED_AFTER(mutex_);
+
+  // Signaled when an inbound parcel becomes available to a terminal router, or
+  // when no more inbound parcels can ever become available. Threads blocked in
+  // Get() with IPCZ_GET_BLOCKING wait on this.
+  absl::CondVar inbound_parcel_available_;
+
+  // The number of threads currently in a blocking Get(), whether already
+  // waiting on `inbound_parcel_available_` or about to. This allows the inbound
+  // parcel path to skip signaling when nobody waits, and keeps the router from
+  // going idle while anyone does.
+  size_t num_blocked_gets_ ABSL_GUARDED_BY(mutex_) = 0;
+
+  // Indicates whether this router's controlling portal has been closed or
+  // transferred to another node, meaning no Get() can succeed here anymore.
+  bool is_portal_invalidated_ ABSL_GUARDED_BY(mutex_) = false;
+
   // Indicates whether the opposite end of the route has been closed. This is
   // the source of truth for peer closure status. The status bit
   // (IPCZ_PORTAL_STATUS_PEER_CLOSED) within `status_flags_`, and the
@@ -447,6 +650,11 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   // controlling this router iff this is a terminal router.
   IpczPortalStatusFlags status_flags_ ABSL_GUARDED_BY(mutex_) = IPCZ_NO_FLAGS;
 
+  // A copy of `status_flags_` and the inbound parcel counts, published under
+  // `mutex_` but readable without it. This serves QueryStatus(),
+  // IsPeerClosed() and IsRouteDead() without contending with parcel delivery.
+  PortalStatusSnapshot status_snapshot_;
+
   // A set of traps installed via a controlling portal where applicable. These
   // traps are notified about any interesting state changes within the router.
   TrapSet traps_ ABSL_GUARDED_BY(mutex_);
@@ -474,7 +682,48 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   // Router. These parcels generally only accumulate if there is no outward link
   // present when attempting to transmit them, and they are forwarded along
   // `outward_edge_` as soon as possible.
-  ParcelQueue outbound_parcels_ ABSL_GUARDED_BY(mutex_);
+  ParcelQueue outbound_parcels_ ABSL_GUARDED_BY(outbound_mutex_);
+
+  // A copy of `outward_edge_`'s primary link, used to transmit outbound parcels
+  // directly without acquiring `mutex_`. Any change to that link is made with
+  // both `mutex_` and `outbound_mutex_` held, and this is updated at the same
+  // time.
+  Ref<RouterLink> outbound_link_ ABSL_GUARDED_BY(outbound_mutex_);
+
+  // Mirrors CanCutThroughParcels(), so that AcceptOutboundParcel() can forward
+  // outbound parcels through a stable proxy without acquiring `mutex_`. If this
+  // is true, every outbound parcel is forwarded over `outbound_link_`. This may
+  // lag behind a router becoming able to cut through until its next Flush(),
+  // but every change which makes CanCutThroughParcels() false updates it.
+  bool can_cut_through_outbound_ ABSL_GUARDED_BY(outbound_mutex_) = false;
+
+  // Mirrors IsFlushNoOp(), so that Flush() can return early for a router in
+  // steady state without acquiring either lock. This is only written with both
+  // locks held, except that queueing an outbound parcel clears it with only
+  // `outbound_mutex_` held. It may lag behind a router becoming a no-op to
+  // flush, but every change which gives the router work to flush updates it
+  // before the caller's own Flush().
+  std::atomic<bool> is_flush_no_op_{false};
+
+  // The outward and inward primary links between which this router's parcels
+  // are currently forwarded by their NodeLinks, if any. See
+  // UpdateNodeLinkForwarding().
+  Ref<RemoteRouterLink> forwarding_outward_link_
+      ABSL_GUARDED_BY(outbound_mutex_);
+  Ref<RemoteRouterLink> forwarding_inward_link_
+      ABSL_GUARDED_BY(outbound_mutex_);
+
+  // Mirrors whether `inbound_parcels_` has a final sequence length, meaning the
+  // other end of the route is gone and no more parcels may be sent.
+  bool is_inbound_sequence_final_ ABSL_GUARDED_BY(outbound_mutex_) = false;
+
+  // The outward link on which this router has marked its side idle, if any.
+  // See CanBeIdle().
+  Ref<RouterLink> idle_link_ ABSL_GUARDED_BY(mutex_);
+
+  // Mirrors whether `idle_link_` is set, so API calls on a router which isn't
+  // idle can skip checking for closure published in shared state.
+  std::atomic<bool> is_idle_{false};
 
   // The set of pending get transactions in progress on this router.
   std::unique_ptr<PendingTransactionSet> pending_gets_ ABSL_GUARDED_BY(mutex_);
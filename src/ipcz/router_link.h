@@ -8,6 +8,7 @@
 #include <cstddef>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 
@@ -114,6 +115,25 @@ class RouterLink : public RefCounted<RouterLink> {
   // Unlocks a link previously locked by one of the TryLock* methods above.
   virtual void Unlock() = 0;
 
+  // Following a successful TryLockForClosure(), attempts to publish closure of
+  // this side of the route with its final `sequence_length` in the link's
+  // shared state. Returns true if and only if the other side is idle and will
+  // discover the closure there on its own. Otherwise the caller must still
+  // notify the other side with AcceptRouteClosure().
+  virtual bool TryPublishRouteClosure(SequenceNumber sequence_length) = 0;
+
+  // Attempts to mark this side of the link as idle, meaning the other side may
+  // publish its closure with TryPublishRouteClosure() instead of notifying this
+  // side directly. Returns true if and only if successful.
+  virtual bool TryMarkSideIdle() = 0;
+
+  // Clears any idle mark previously set on this side by TryMarkSideIdle().
+  virtual void MarkSideActive() = 0;
+
+  // Returns the final sequence length of the other side of the route if it has
+  // published its closure to this link's shared state.
+  virtual std::optional<SequenceNumber> GetPublishedRouteClosure() = 0;
+
   // Asks the other side to flush its router if and only if the side marked
   // itself as waiting for both sides of the link to become stable, and both
   // sides of the link are stable. Returns true if and only if a flush was
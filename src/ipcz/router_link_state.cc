@@ -125,4 +125,37 @@ bool RouterLinkState::ResetWaitingBit(LinkSide side) {
   return true;
 }
 
+bool RouterLinkState::PublishClosure(LinkSide side,
+                                     SequenceNumber sequence_length) {
+  const Status kThisSideClosed =
+      side == LinkSide::kA ? kSideAClosed : kSideBClosed;
+  const Status kOtherSideIdle = side == LinkSide::kA ? kSideBIdle : kSideAIdle;
+  final_sequence_length.store(sequence_length.value(),
+                              std::memory_order_relaxed);
+
+  // This release is balanced by an acquire in GetFinalSequenceLengthFrom().
+  const Status previous =
+      status.fetch_or(kThisSideClosed, std::memory_order_acq_rel);
+  return (previous & kOtherSideIdle) != 0;
+}
+
+void RouterLinkState::SetSideIdle(LinkSide side, bool idle) {
+  const Status kThisSideIdle = side == LinkSide::kA ? kSideAIdle : kSideBIdle;
+  if (idle) {
+    status.fetch_or(kThisSideIdle, std::memory_order_acq_rel);
+  } else {
+    status.fetch_and(~kThisSideIdle, std::memory_order_acq_rel);
+  }
+}
+
+std::optional<SequenceNumber> RouterLinkState::GetFinalSequenceLengthFrom(
+    LinkSide side) const {
+  const Status kSideClosed = side == LinkSide::kA ? kSideAClosed : kSideBClosed;
+  if ((status.load(std::memory_order_acquire) & kSideClosed) == 0) {
+    return std::nullopt;
+  }
+  return SequenceNumber(
+      final_sequence_length.load(std::memory_order_relaxed));
+}
+
 }  // namespace ipcz
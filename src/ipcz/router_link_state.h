@@ -7,12 +7,14 @@
 
 #include <atomic>
 #include <cstdint>
+#include <optional>
 #include <type_traits>
 
 #include "ipcz/ipcz.h"
 #include "ipcz/link_side.h"
 #include "ipcz/node_name.h"
 #include "ipcz/ref_counted_fragment.h"
+#include "ipcz/sequence_number.h"
 
 namespace ipcz {
 
@@ -62,6 +64,20 @@ struct IPCZ_ALIGN(8) RouterLinkState : public RefCountedFragment {
   static constexpr Status kLockedBySideA = 1 << 4;
   static constexpr Status kLockedBySideB = 1 << 5;
 
+  // Set by side A or B, respectively, once it has locked this link to propagate
+  // closure of its side of the route and published its final sequence length
+  // in `final_sequence_length` below.
+  static constexpr Status kSideAClosed = 1 << 6;
+  static constexpr Status kSideBClosed = 1 << 7;
+
+  // Set by side A or B, respectively, while its Router has nothing which must
+  // be woken by closure of the other side: no traps, no blocked Get() calls,
+  // and no other links to propagate closure along. While this bit is set, the
+  // other side may publish its closure here without sending a message about
+  // it. The idle side picks up the closure from here the next time it's used.
+  static constexpr Status kSideAIdle = 1 << 8;
+  static constexpr Status kSideBIdle = 1 << 9;
+
   std::atomic<Status> status{kUnstable};
 
   // In a situation with three routers A-B-C and a central link between A and
@@ -71,8 +87,12 @@ struct IPCZ_ALIGN(8) RouterLinkState : public RefCountedFragment {
   // validate that C is an appropriate source of such a bypass request.
   NodeName allowed_bypass_request_source;
 
+  // The final length of the parcel sequence sent by whichever side has set its
+  // closed bit in `status`. Written before that bit is set.
+  std::atomic<uint64_t> final_sequence_length{0};
+
   // More reserved slots, padding out this structure to 64 bytes.
-  uint32_t reserved1[10] = {0};
+  uint32_t reserved1[8] = {0};
 
   bool is_locked_by(LinkSide side) const {
     Status s = status.load(std::memory_order_relaxed);
@@ -108,6 +128,18 @@ struct IPCZ_ALIGN(8) RouterLinkState : public RefCountedFragment {
   // attempt was made to TryLock() from that side, while the other side was
   // still unstable.
   bool ResetWaitingBit(LinkSide side);
+
+  // Publishes closure of the route from `side`, which must have locked the link
+  // with TryLock(), along with the final `sequence_length` of parcels sent from
+  // that side. Returns true if and only if the other side was marked idle at
+  // the time, in which case it will discover the closure here on its own.
+  bool PublishClosure(LinkSide side, SequenceNumber sequence_length);
+
+  // Sets or clears the idle bit for `side`.
+  void SetSideIdle(LinkSide side, bool idle);
+
+  // Returns the final sequence length published by `side` if it has closed.
+  std::optional<SequenceNumber> GetFinalSequenceLengthFrom(LinkSide side) const;
 };
 
 // The size of this structure is fixed at 64 bytes to ensure that it fits the
@@ -362,6 +362,43 @@ TEST_F(RemoteRouterLinkTest, NewLinkWithPendingState) {
   CloseRoutes(router_pairs);
 }
 
+TEST_F(RemoteRouterLinkTest, PublishClosureToIdleSide) {
+  nodes().ActivateTransports();
+
+  std::vector<FragmentRef<RouterLinkState>> fragments =
+      nodes().AllocateAllRouterLinkStates();
+  ASSERT_GE(fragments.size(), 2u);
+  std::vector<Router::Pair> router_pairs = CreateTestRouterPairs(2);
+  auto [a, b] = router_pairs[0];
+  auto [c, d] = router_pairs[1];
+  auto [a_link, b_link] =
+      nodes().LinkRemoteRouters(a, fragments[0], b, fragments[0]);
+  a_link->MarkSideStable();
+  b_link->MarkSideStable();
+
+  // Closure published to a side which isn't idle must still be signaled with a
+  // message, but it's visible in shared state either way. Note that `b` has no
+  // traps, so it may have marked itself idle as soon as it was linked.
+  b_link->MarkSideActive();
+  EXPECT_TRUE(a_link->TryLockForClosure());
+  EXPECT_FALSE(a_link->TryPublishRouteClosure(SequenceNumber(3)));
+  EXPECT_EQ(SequenceNumber(3), b_link->GetPublishedRouteClosure());
+  EXPECT_FALSE(a_link->GetPublishedRouteClosure());
+
+  // Closure published to an idle side needs no message.
+  auto [c_link, d_link] =
+      nodes().LinkRemoteRouters(c, fragments[1], d, fragments[1]);
+  c_link->MarkSideStable();
+  d_link->MarkSideStable();
+  EXPECT_TRUE(d_link->TryMarkSideIdle());
+  EXPECT_TRUE(c_link->TryLockForClosure());
+  EXPECT_TRUE(c_link->TryPublishRouteClosure(SequenceNumber(5)));
+  d_link->MarkSideActive();
+  EXPECT_EQ(SequenceNumber(5), d_link->GetPublishedRouteClosure());
+
+  CloseRoutes(router_pairs);
+}
+
 INSTANTIATE_TEST_SUITE_P(,
                          RouterLinkTest,
                          ::testing::Values(RouterLinkTestMode::kLocal,
@@ -0,0 +1,388 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/router.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "ipcz/ipcz.h"
+#include "ipcz/link_side.h"
+#include "ipcz/link_type.h"
+#include "ipcz/message_dispatch_pool.h"
+#include "ipcz/node.h"
+#include "ipcz/node_link.h"
+#include "ipcz/node_link_memory.h"
+#include "ipcz/operation_context.h"
+#include "ipcz/parcel.h"
+#include "ipcz/remote_router_link.h"
+#include "ipcz/router_descriptor.h"
+#include "ipcz/router_link_state.h"
+#include "ipcz/sequence_number.h"
+#include "ipcz/sublink_id.h"
+#include "reference_drivers/sync_reference_driver.h"
+#include "test/test_node_links.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+#include "util/ref_counted.h"
+
+namespace ipcz {
+namespace {
+
+using RouterTest = testing::Test;
+
+std::unique_ptr<Parcel> MakeParcel(uint64_t n) {
+  auto parcel = std::make_unique<Parcel>(SequenceNumber(n));
+  parcel->AllocateData(sizeof(n), /*allow_partial=*/false, nullptr);
+  memcpy(parcel->data_view().data(), &n, sizeof(n));
+  return parcel;
+}
+
+TEST_F(RouterTest, BlockedGetsWokenByGapFill) {
+  constexpr size_t kNumGetters = 4;
+  auto router = MakeRefCounted<Router>();
+
+  // Several threads block in Get() with a generous timeout, so that a missed
+  // wakeup shows up as a getter which only returns once its deadline expires,
+  // rather than as a hang.
+  constexpr auto kTimeout = std::chrono::seconds(5);
+  const IpczGetOptions options = {
+      .size = sizeof(options),
+      .timeout_microseconds = static_cast<uint64_t>(
+          std::chrono::microseconds(kTimeout).count())};
+  std::vector<std::thread> getters;
+  std::vector<IpczResult> results(kNumGetters, IPCZ_RESULT_UNKNOWN);
+  for (size_t i = 0; i < kNumGetters; ++i) {
+    getters.emplace_back([&, i] {
+      uint64_t value;
+      size_t num_bytes = sizeof(value);
+      results[i] = router->Get(IPCZ_GET_BLOCKING, &options, &value,
+                               &num_bytes, nullptr, nullptr, nullptr);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  // Parcels arrive out of order. Nothing is available until the first one
+  // arrives, at which point all of them become available at once.
+  const OperationContext context{OperationContext::kTransportNotification};
+  for (uint64_t n = kNumGetters - 1; n > 0; --n) {
+    EXPECT_TRUE(router->AcceptInboundParcel(context, MakeParcel(n)));
+  }
+  const auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(router->AcceptInboundParcel(context, MakeParcel(0)));
+
+  for (std::thread& getter : getters) {
+    getter.join();
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start, kTimeout / 2);
+  for (IpczResult result : results) {
+    EXPECT_EQ(IPCZ_RESULT_OK, result);
+  }
+  router->CloseRoute();
+}
+
+TEST_F(RouterTest, BlockingGetOnDispatchThread) {
+  // A blocking Get() on a dispatch thread could wait forever on a parcel which
+  // that same thread has yet to dispatch, so it's rejected outright.
+  auto router = MakeRefCounted<Router>();
+  Ref<MessageDispatchPool> pool = MessageDispatchPool::Create(1);
+  IpczResult result = IPCZ_RESULT_UNKNOWN;
+  EXPECT_TRUE(pool->Post(0, [&] {
+    result = router->Get(IPCZ_GET_BLOCKING, nullptr, nullptr, nullptr, nullptr,
+                         nullptr, nullptr);
+  }));
+  pool->ShutDown();
+  EXPECT_EQ(IPCZ_RESULT_FAILED_PRECONDITION, result);
+  router->CloseRoute();
+}
+
+void PutString(Router& router, std::string_view message) {
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            router.Put(absl::MakeSpan(
+                           reinterpret_cast<const uint8_t*>(message.data()),
+                           message.size()),
+                       {}));
+}
+
+std::string GetString(Router& router) {
+  char data[256];
+  size_t num_bytes = sizeof(data);
+  const IpczResult result = router.Get(IPCZ_NO_FLAGS, nullptr, data,
+                                       &num_bytes, nullptr, nullptr, nullptr);
+  if (result != IPCZ_RESULT_OK) {
+    return "";
+  }
+  return std::string(data, num_bytes);
+}
+
+// Builds a route from terminal router `a_` through proxy `proxy_` to terminal
+// router `c_`. The proxy lives on `node1_` and both terminal routers live on
+// `node0_`. The central link between `a_` and `proxy_` starts out locked by
+// `a_`'s side, which keeps the proxy stable by blocking its bypass until a test
+// unlocks it.
+class StableProxyTest : public testing::Test {
+ protected:
+  StableProxyTest() {
+    std::tie(link0_, link1_) = test::LinkNodes(node0_, node1_);
+    link_state_ = link0_->memory().GetInitialRouterLinkState(0);
+    a_->SetOutwardLink(
+        context_,
+        link0_->AddRemoteRouterLink(context_, SublinkId(0), link_state_,
+                                    LinkType::kCentral, LinkSide::kA, a_));
+    proxy_->SetOutwardLink(
+        context_,
+        link1_->AddRemoteRouterLink(context_, SublinkId(0), link_state_,
+                                    LinkType::kCentral, LinkSide::kB, proxy_));
+    link_state_->status = RouterLinkState::kStable;
+    EXPECT_TRUE(link_state_->TryLock(LinkSide::kA));
+
+    // Extend the route from `proxy_` to a new router on `node0_`, as if
+    // `proxy_`'s portal had been sent there.
+    RouterDescriptor descriptor = {};
+    Router::SerializeNewRouters(context_, *link1_, {proxy_},
+                                absl::MakeSpan(&descriptor, 1));
+    c_ = Router::Deserialize(descriptor, *link0_);
+    proxy_->BeginProxyingToNewRouter(context_, *link1_, descriptor);
+  }
+
+  ~StableProxyTest() override {
+    link0_->Deactivate(context_);
+    link1_->Deactivate(context_);
+    node0_->Close();
+    node1_->Close();
+  }
+
+  // Unblocks and attempts bypass of `proxy_`.
+  void UnlockCentralLink() {
+    link_state_->Unlock(LinkSide::kA);
+    proxy_->Flush(context_, Router::kForceProxyBypassAttempt);
+  }
+
+  const OperationContext context_{OperationContext::kTransportNotification};
+  const Ref<Node> node0_ = MakeRefCounted<Node>(
+      Node::Type::kBroker, reference_drivers::kSyncReferenceDriver);
+  const Ref<Node> node1_ = MakeRefCounted<Node>(
+      Node::Type::kNormal, reference_drivers::kSyncReferenceDriver);
+  Ref<NodeLink> link0_;
+  Ref<NodeLink> link1_;
+  FragmentRef<RouterLinkState> link_state_;
+  const Ref<Router> a_ = MakeRefCounted<Router>();
+  const Ref<Router> proxy_ = MakeRefCounted<Router>();
+  Ref<Router> c_;
+};
+
+TEST_F(StableProxyTest, ForwardsInBothDirections) {
+  ASSERT_TRUE(c_);
+  EXPECT_TRUE(proxy_->IsProxy());
+  EXPECT_TRUE(proxy_->CanCutThroughInboundParcels());
+  EXPECT_TRUE(proxy_->CanCutThroughOutboundParcels());
+
+  for (int i = 0; i < 8; ++i) {
+    PutString(*a_, absl::StrCat("a", i));
+    PutString(*c_, absl::StrCat("c", i));
+  }
+
+  // Every parcel was forwarded as it arrived, so the proxy holds none of them
+  // and is still able to cut through.
+  EXPECT_EQ(0u, proxy_->GetNumQueuedParcels());
+  EXPECT_TRUE(proxy_->CanCutThroughInboundParcels());
+  EXPECT_TRUE(proxy_->CanCutThroughOutboundParcels());
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(absl::StrCat("a", i), GetString(*c_));
+    EXPECT_EQ(absl::StrCat("c", i), GetString(*a_));
+  }
+
+  a_->CloseRoute();
+  c_->CloseRoute();
+}
+
+TEST_F(StableProxyTest, ForwardsAtNodeLink) {
+  ASSERT_TRUE(c_);
+
+  // Parcels with data are carried in shared memory fragments, while empty ones
+  // are inlined. Both kinds are forwarded by `link1_` without reaching
+  // `proxy_`.
+  const std::string kMessage(128, '!');
+  PutString(*a_, "");
+  PutString(*a_, kMessage);
+  PutString(*c_, "");
+  PutString(*c_, kMessage);
+  EXPECT_EQ(4u, link1_->GetNumParcelsForwarded());
+
+  // Both of the proxy's links are on `link1_`, so fragments are handed over
+  // rather than copied.
+  IpczNodeLinkStats stats = {.size = sizeof(stats)};
+  link1_->QueryStats(stats);
+  EXPECT_EQ(2u, stats.num_fragment_parcels_sent);
+  EXPECT_EQ(2u, stats.num_inlined_parcels_sent);
+
+  EXPECT_EQ("", GetString(*c_));
+  EXPECT_EQ(kMessage, GetString(*c_));
+  EXPECT_EQ("", GetString(*a_));
+  EXPECT_EQ(kMessage, GetString(*a_));
+
+  a_->CloseRoute();
+  c_->CloseRoute();
+}
+
+TEST_F(StableProxyTest, OutwardClosureMidStream) {
+  ASSERT_TRUE(c_);
+  PutString(*a_, "a0");
+  PutString(*c_, "c0");
+  PutString(*a_, "a1");
+  EXPECT_EQ("c0", GetString(*a_));
+
+  // Closure can't cross the central link while it's locked, so the proxy keeps
+  // cutting through until the lock is released.
+  a_->CloseRoute();
+  EXPECT_TRUE(proxy_->CanCutThroughInboundParcels());
+  EXPECT_TRUE(proxy_->CanCutThroughOutboundParcels());
+
+  // Once closure reaches the proxy, its inbound sequence is final and it falls
+  // back on Flush() in both directions. The outbound mirror must agree.
+  link_state_->Unlock(LinkSide::kA);
+  a_->Flush(context_);
+  EXPECT_FALSE(proxy_->CanCutThroughInboundParcels());
+  EXPECT_FALSE(proxy_->CanCutThroughOutboundParcels());
+
+  EXPECT_EQ("a0", GetString(*c_));
+  EXPECT_EQ("a1", GetString(*c_));
+  EXPECT_TRUE(c_->IsRouteDead());
+  c_->CloseRoute();
+}
+
+TEST_F(StableProxyTest, InwardClosureDuringDecay) {
+  ASSERT_TRUE(c_);
+  PutString(*c_, "c0");
+  PutString(*a_, "a0");
+  PutString(*c_, "c1");
+  EXPECT_EQ("a0", GetString(*c_));
+
+  // The closure waits for `c_` to reach the central link, which only happens
+  // once the proxy is bypassed.
+  c_->CloseRoute();
+  EXPECT_FALSE(a_->IsPeerClosed());
+  UnlockCentralLink();
+  EXPECT_FALSE(proxy_->CanCutThroughInboundParcels());
+  EXPECT_FALSE(proxy_->CanCutThroughOutboundParcels());
+
+  EXPECT_EQ("c0", GetString(*a_));
+  EXPECT_EQ("c1", GetString(*a_));
+  EXPECT_TRUE(a_->IsRouteDead());
+  a_->CloseRoute();
+}
+
+TEST_F(StableProxyTest, DecayMidStream) {
+  ASSERT_TRUE(c_);
+  PutString(*a_, "a0");
+  PutString(*c_, "c0");
+
+  // Once bypass begins, the proxy's links decay and it stops cutting through.
+  // Parcels sent before, during and after the bypass all arrive in order.
+  UnlockCentralLink();
+  EXPECT_FALSE(proxy_->CanCutThroughInboundParcels());
+  EXPECT_FALSE(proxy_->CanCutThroughOutboundParcels());
+  PutString(*a_, "a1");
+  PutString(*c_, "c1");
+  EXPECT_EQ(2u, link1_->GetNumParcelsForwarded());
+
+  EXPECT_TRUE(a_->HasLocalPeer(*c_));
+  EXPECT_EQ("a0", GetString(*c_));
+  EXPECT_EQ("a1", GetString(*c_));
+  EXPECT_EQ("c0", GetString(*a_));
+  EXPECT_EQ("c1", GetString(*a_));
+
+  a_->CloseRoute();
+  c_->CloseRoute();
+}
+
+// Like StableProxyTest, but with the proxy on a broker node between two other
+// nodes, so that each of its links is on a different NodeLink: `a_` lives on
+// `node1_` and `c_` lives on `node2_`.
+class CrossLinkProxyTest : public testing::Test {
+ protected:
+  CrossLinkProxyTest() {
+    std::tie(link01_, link10_) = test::LinkNodes(node0_, node1_);
+    std::tie(link02_, link20_) = test::LinkNodes(node0_, node2_);
+    link_state_ = link01_->memory().GetInitialRouterLinkState(0);
+    a_->SetOutwardLink(
+        context_,
+        link10_->AddRemoteRouterLink(context_, SublinkId(0), link_state_,
+                                     LinkType::kCentral, LinkSide::kA, a_));
+    proxy_->SetOutwardLink(
+        context_,
+        link01_->AddRemoteRouterLink(context_, SublinkId(0), link_state_,
+                                     LinkType::kCentral, LinkSide::kB, proxy_));
+    link_state_->status = RouterLinkState::kStable;
+    EXPECT_TRUE(link_state_->TryLock(LinkSide::kA));
+
+    RouterDescriptor descriptor = {};
+    Router::SerializeNewRouters(context_, *link02_, {proxy_},
+                                absl::MakeSpan(&descriptor, 1));
+    c_ = Router::Deserialize(descriptor, *link20_);
+    proxy_->BeginProxyingToNewRouter(context_, *link02_, descriptor);
+  }
+
+  ~CrossLinkProxyTest() override {
+    for (const Ref<NodeLink>& link : {link01_, link10_, link02_, link20_}) {
+      link->Deactivate(context_);
+    }
+    node0_->Close();
+    node1_->Close();
+    node2_->Close();
+  }
+
+  static uint64_t GetNumInlinedParcelsSent(NodeLink& link) {
+    IpczNodeLinkStats stats = {.size = sizeof(stats)};
+    link.QueryStats(stats);
+    return stats.num_inlined_parcels_sent;
+  }
+
+  const OperationContext context_{OperationContext::kTransportNotification};
+  const Ref<Node> node0_ = MakeRefCounted<Node>(
+      Node::Type::kBroker, reference_drivers::kSyncReferenceDriver);
+  const Ref<Node> node1_ = MakeRefCounted<Node>(
+      Node::Type::kNormal, reference_drivers::kSyncReferenceDriver);
+  const Ref<Node> node2_ = MakeRefCounted<Node>(
+      Node::Type::kNormal, reference_drivers::kSyncReferenceDriver);
+  Ref<NodeLink> link01_;
+  Ref<NodeLink> link10_;
+  Ref<NodeLink> link02_;
+  Ref<NodeLink> link20_;
+  FragmentRef<RouterLinkState> link_state_;
+  const Ref<Router> a_ = MakeRefCounted<Router>();
+  const Ref<Router> proxy_ = MakeRefCounted<Router>();
+  Ref<Router> c_;
+};
+
+TEST_F(CrossLinkProxyTest, CopiesFragmentsBetweenLinks) {
+  ASSERT_TRUE(c_);
+
+  // The proxy's links don't share memory, so parcel data carried in a fragment
+  // is copied into the forwarded message and the fragment is freed.
+  const std::string kLargeMessage(128, '!');
+  PutString(*a_, kLargeMessage);
+  PutString(*c_, kLargeMessage);
+  EXPECT_EQ(1u, link01_->GetNumParcelsForwarded());
+  EXPECT_EQ(1u, link02_->GetNumParcelsForwarded());
+  EXPECT_EQ(1u, GetNumInlinedParcelsSent(*link01_));
+  EXPECT_EQ(1u, GetNumInlinedParcelsSent(*link02_));
+
+  EXPECT_EQ(kLargeMessage, GetString(*c_));
+  EXPECT_EQ(kLargeMessage, GetString(*a_));
+
+  a_->CloseRoute();
+  c_->CloseRoute();
+}
+
+}  // namespace
+}  // namespace ipcz
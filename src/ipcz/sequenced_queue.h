@@ -8,6 +8,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <optional>
+#include <utility>
 #include <vector>
 
 #include "ipcz/sequence_number.h"
@@ -27,12 +28,15 @@ struct DefaultSequencedQueueTraits {
 // out-of-order and need to be reordered efficiently for consumption. The
 // implementation relies on an assumption that sequence gaps are common but tend
 // to be small and short-lived. As such, a SequencedQueue retains at least
-// enough linear storage to hold every object between the last popped
-// SequenceNumber (exclusive) and the highest queued (or anticipated)
-// SequenceNumber so far (inclusive).
+// enough storage to hold every object between the last popped SequenceNumber
+// (exclusive) and the highest queued (or anticipated) SequenceNumber so far
+// (inclusive).
 //
-// Storage may be sparsely populated at times, but as elements are consumed from
-// the queue, storage is compacted to reduce waste.
+// Storage is a circular buffer whose capacity is always a power of two. It may
+// be sparsely populated at times, but slots are reused as elements are consumed
+// from the front of the queue, so a queue whose length stays bounded never
+// needs to reallocate. In particular, pushing and popping elements in sequence
+// order are constant-time operations.
 //
 // ElementTraits may be overridden to attribute a measurable size to each stored
 // element. SequencedQueue performs additional accounting to efficiently track
@@ -48,8 +52,20 @@ class SequencedQueue {
   // this will be the SequenceNumber of the first element to be popped.
   explicit SequencedQueue(SequenceNumber initial_sequence_number)
       : base_sequence_number_(initial_sequence_number) {}
-  SequencedQueue(SequencedQueue&& other) = default;
-  SequencedQueue& operator=(SequencedQueue&& other) = default;
+  SequencedQueue(SequencedQueue&& other)
+      : slots_(std::move(other.slots_)),
+        front_(std::exchange(other.front_, 0)),
+        size_(std::exchange(other.size_, 0)),
+        is_final_length_known_(other.is_final_length_known_),
+        base_sequence_number_(other.base_sequence_number_) {}
+  SequencedQueue& operator=(SequencedQueue&& other) {
+    slots_ = std::move(other.slots_);
+    front_ = std::exchange(other.front_, 0);
+    size_ = std::exchange(other.size_, 0);
+    is_final_length_known_ = other.is_final_length_known_;
+    base_sequence_number_ = other.base_sequence_number_;
+    return *this;
+  }
   ~SequencedQueue() = default;
 
   // As a basic practical constraint, SequencedQueue won't tolerate sequence
@@ -72,8 +88,7 @@ class SequencedQueue {
     if (!is_final_length_known_) {
       return std::nullopt;
     }
-    return SequenceNumber{base_sequence_number_.value() +
-                          (entries_.size() - front_index_)};
+    return SequenceNumber{base_sequence_number_.value() + size_};
   }
 
   // Returns the number of elements currently ready for popping at the front of
@@ -83,11 +98,11 @@ class SequencedQueue {
   // method returns 2: only elements 5 and 6 are available, because element 8
   // cannot be made available until element 7 is also available.
   size_t GetNumAvailableElements() const {
-    if (entries_.empty() || !entries_[front_index_]) {
+    if (!HasNextElement()) {
       return 0;
     }
 
-    return entries_[front_index_]->num_entries_in_span;
+    return slot(0)->num_entries_in_span;
   }
 
   // Returns the total size of elements currently ready for popping at the
@@ -95,11 +110,11 @@ class SequencedQueue {
   // each element counted by `GetNumAvailableElements()`, and it is always
   // returned in constant time.
   size_t GetTotalAvailableElementSize() const {
-    if (entries_.empty() || !entries_[front_index_]) {
+    if (!HasNextElement()) {
       return 0;
     }
 
-    return entries_[front_index_]->total_span_size;
+    return slot(0)->total_span_size;
   }
 
   // Returns the total length of the contiguous sequence already pushed and/or
@@ -127,21 +142,16 @@ class SequencedQueue {
 
     // We've already pushed some entries beyond the current sequence number, and
     // the final sequence length must be at least long enough to contain them.
-    ABSL_ASSERT((entries_.empty() && front_index_ == 0) ||
-                front_index_ < entries_.size());
-    const size_t min_gap = entries_.size() - front_index_;
-
     const size_t gap = length.value() - base_sequence_number_.value();
-    if (gap < min_gap || gap > GetMaxSequenceGap()) {
+    if (gap < size_ || gap > GetMaxSequenceGap()) {
       return false;
     }
 
     is_final_length_known_ = true;
 
-    // Resize storage to exactly fit whatever remaining entries are expected
-    // after `front_index_`.
-    entries_.resize(front_index_ + gap);
-    if (entries_.empty()) {
+    // Extend storage to fit whatever remaining entries are expected.
+    Resize(gap);
+    if (size_ == 0) {
       // No longer any use for our storage capacity.
       ResetAndReleaseStorage();
     }
@@ -169,8 +179,7 @@ class SequencedQueue {
     }
 
     // Drop entries pushed anywhere beyond the forced termination point.
-    const size_t final_storage_size = front_index_ + required_storage_size;
-    entries_.resize(final_storage_size);
+    Resize(required_storage_size);
   }
 
   // Indicates whether this queue is still expecting to have more elements
@@ -186,9 +195,7 @@ class SequencedQueue {
   }
 
   // Indicates whether the next element (in sequence order) is available to pop.
-  bool HasNextElement() const {
-    return !entries_.empty() && entries_[front_index_];
-  }
+  bool HasNextElement() const { return size_ > 0 && slot(0).has_value(); }
 
   // Indicates whether this queue's sequence has been fully consumed. This means
   // the final sequence length has been set AND all elements up to that length
@@ -202,7 +209,7 @@ class SequencedQueue {
   // called only on an empty queue and only when the caller can be sure they
   // won't want to push any elements with a SequenceNumber below `n`.
   void ResetSequence(SequenceNumber n) {
-    ABSL_ASSERT(entries_.empty());
+    ABSL_ASSERT(size_ == 0);
     base_sequence_number_ = n;
     is_final_length_known_ = false;
     ResetAndReleaseStorage();
@@ -227,16 +234,9 @@ class SequencedQueue {
     }
 
     base_sequence_number_ = NextSequenceNumber(n);
-    if (entries_.empty()) {
-      // Nothing else needs to change if storage is unoccupied.
-      ABSL_ASSERT(front_index_ == 0);
-      return true;
-    }
-
-    ++front_index_;
-    if (front_index_ == entries_.size()) {
-      // We've hit the end of storage, so all elements are null.
-      ResetStorage();
+    if (size_ > 0) {
+      // The front slot is known to be empty, so it can simply be discarded.
+      AdvanceFront();
     }
     return true;
   }
@@ -259,14 +259,13 @@ class SequencedQueue {
       return false;
     }
 
-    const size_t index = front_index_ + gap;
-    if (index >= entries_.size()) {
-      entries_.resize(index + 1);
-    } else if (entries_[index]) {
+    if (gap >= size_) {
+      Resize(gap + 1);
+    } else if (slot(gap)) {
       return false;
     }
 
-    PlaceNewEntry(index, n, element);
+    PlaceNewEntry(gap, n, element);
     return true;
   }
 
@@ -278,7 +277,7 @@ class SequencedQueue {
       return false;
     }
 
-    Entry& head = *entries_[front_index_];
+    Entry& head = *slot(0);
     element = std::move(head.element);
 
     const SequenceNumber sequence_number = base_sequence_number_;
@@ -286,33 +285,27 @@ class SequencedQueue {
 
     // Make sure the next queued entry has up-to-date accounting, if present.
     const size_t element_size = ElementTraits::GetElementSize(element);
-    const size_t next_index = front_index_ + 1;
-    if (next_index < entries_.size() && entries_[next_index]) {
-      Entry& next = *entries_[next_index];
+    if (head.num_entries_in_span > 1) {
+      Entry& next = *slot(1);
       next.span_start = head.span_start;
       next.span_end = head.span_end;
       next.num_entries_in_span = head.num_entries_in_span - 1;
       next.total_span_size = head.total_span_size - element_size;
 
       // Find the tail entry for this span, derived from its stored
-      // SequenceNumber. We compute the offset in `entries_` relative to
-      // `front_index_`. Note that if the offset is 1, it's the same entry as
-      // the new head which we already updated above.
+      // SequenceNumber. We compute its offset relative to the front of the
+      // queue. Note that if the offset is 1, it's the same entry as the new
+      // head which we already updated above.
       size_t tail_offset = next.span_end.value() - sequence_number.value();
       if (tail_offset > 1) {
-        Entry& tail = *entries_[front_index_ + tail_offset];
+        Entry& tail = *slot(tail_offset);
         tail.num_entries_in_span = next.num_entries_in_span;
         tail.total_span_size = next.total_span_size;
       }
     }
 
-    entries_[front_index_].reset();
-    if (front_index_ < entries_.size() - 1) {
-      ++front_index_;
-    } else {
-      // This was the last element in storage. Now we can reuse all capacity.
-      ResetStorage();
-    }
+    slot(0).reset();
+    AdvanceFront();
     return true;
   }
 
@@ -320,76 +313,119 @@ class SequencedQueue {
   // any non-const methods here.
   T& NextElement() {
     ABSL_ASSERT(HasNextElement());
-    return entries_[front_index_]->element;
+    return slot(0)->element;
   }
 
  private:
+  struct Entry;
+
+  // The smallest non-zero capacity of `slots_`.
+  static constexpr size_t kMinCapacity = 8;
+
+  // Returns the storage slot for the entry at `offset` from the front of the
+  // queue. `offset` must be less than `size_`.
+  std::optional<Entry>& slot(size_t offset) {
+    ABSL_ASSERT(offset < size_);
+    return slots_[(front_ + offset) & (slots_.size() - 1)];
+  }
+  const std::optional<Entry>& slot(size_t offset) const {
+    ABSL_ASSERT(offset < size_);
+    return slots_[(front_ + offset) & (slots_.size() - 1)];
+  }
+
   // See detailed comments on Entry below for an explanation of this logic.
-  void PlaceNewEntry(size_t index, SequenceNumber n, T& element) {
-    ABSL_ASSERT(index < entries_.size());
-    ABSL_ASSERT(!entries_[index].has_value());
+  void PlaceNewEntry(size_t offset, SequenceNumber n, T& element) {
+    ABSL_ASSERT(offset < size_);
+    ABSL_ASSERT(!slot(offset).has_value());
 
-    Entry& entry = entries_[index].emplace();
+    Entry& entry = slot(offset).emplace();
     entry.num_entries_in_span = 1;
     entry.total_span_size = ElementTraits::GetElementSize(element);
     entry.element = std::move(element);
 
-    if (index == 0 || !entries_[index - 1]) {
-      entry.span_start = n;
-    } else {
-      Entry& left = *entries_[index - 1];
+    const bool joins_left = offset > 0 && slot(offset - 1).has_value();
+    const bool joins_right = offset < size_ - 1 && slot(offset + 1).has_value();
+    if (joins_left) {
+      Entry& left = *slot(offset - 1);
       entry.span_start = left.span_start;
       entry.num_entries_in_span += left.num_entries_in_span;
       entry.total_span_size += left.total_span_size;
+    } else {
+      entry.span_start = n;
     }
 
-    if (index == entries_.size() - 1 || !entries_[index + 1]) {
-      entry.span_end = n;
-    } else {
-      Entry& right = *entries_[index + 1];
+    if (joins_right) {
+      Entry& right = *slot(offset + 1);
       entry.span_end = right.span_end;
       entry.num_entries_in_span += right.num_entries_in_span;
       entry.total_span_size += right.total_span_size;
-    }
-
-    Entry* start;
-    if (entry.span_start <= base_sequence_number_) {
-      start = &entries_[front_index_].value();
     } else {
-      const size_t start_index = front_index_ + (entry.span_start.value() -
-                                                 base_sequence_number_.value());
-      start = &entries_[start_index].value();
+      entry.span_end = n;
     }
 
-    ABSL_ASSERT(entry.span_end >= base_sequence_number_);
-    const size_t end_index =
-        front_index_ + (entry.span_end.value() - base_sequence_number_.value());
-    ABSL_ASSERT(end_index < entries_.size());
-    Entry* end = &entries_[end_index].value();
+    // The new entry is now accurate, but if it joined an existing span on
+    // either side, the far end of the combined span must be updated too. This
+    // is skipped entirely for an entry which stands alone, the common case for
+    // elements which arrive ahead of a gap.
+    if (joins_left) {
+      // The span's recorded start may precede the front of the queue if
+      // elements have since been popped from it, in which case the span now
+      // starts at the front.
+      Entry& start = entry.span_start <= base_sequence_number_
+                         ? *slot(0)
+                         : *slot(entry.span_start.value() -
+                                 base_sequence_number_.value());
+      start.span_end = entry.span_end;
+      start.num_entries_in_span = entry.num_entries_in_span;
+      start.total_span_size = entry.total_span_size;
+    }
 
-    start->span_end = entry.span_end;
-    start->num_entries_in_span = entry.num_entries_in_span;
-    start->total_span_size = entry.total_span_size;
+    if (joins_right) {
+      Entry& end =
+          *slot(entry.span_end.value() - base_sequence_number_.value());
+      end.span_start = entry.span_start;
+      end.num_entries_in_span = entry.num_entries_in_span;
+      end.total_span_size = entry.total_span_size;
+    }
+  }
 
-    end->span_start = entry.span_start;
-    end->num_entries_in_span = entry.num_entries_in_span;
-    end->total_span_size = entry.total_span_size;
+  // Discards the front slot of the queue, which must already be empty.
+  void AdvanceFront() {
+    ABSL_ASSERT(size_ > 0 && !slot(0).has_value());
+    front_ = (front_ + 1) & (slots_.size() - 1);
+    --size_;
   }
 
-  // Wipes out any logical storage and resets `front_index_`. This does NOT
-  // shrink underlying storage capacity, in anticipation of the capacity being
-  // reused by subsequent pushes.
-  void ResetStorage() {
-    entries_.clear();
-    front_index_ = 0;
+  // Sets the number of slots spanned by the queue to `new_size`, destroying any
+  // entries beyond that point and growing storage capacity as needed.
+  void Resize(size_t new_size) {
+    for (size_t i = new_size; i < size_; ++i) {
+      slot(i).reset();
+    }
+    if (new_size > slots_.size()) {
+      // Grow to the next power of two, moving all entries to the front of the
+      // new storage.
+      size_t capacity = kMinCapacity;
+      while (capacity < new_size) {
+        capacity *= 2;
+      }
+      std::vector<std::optional<Entry>> new_slots(capacity);
+      for (size_t i = 0; i < size_; ++i) {
+        new_slots[i] = std::move(slot(i));
+      }
+      slots_.swap(new_slots);
+      front_ = 0;
+    }
+    size_ = new_size;
   }
 
-  // Wipes out any logical storage and resets `front_index_`, also releasing any
-  // underlying storage capacity. This is used to eagerly free resources when
-  // the queue will no longer accept new elements.
+  // Wipes out any logical storage and resets `front_` and `size_`, also
+  // releasing any underlying storage capacity. This is used to eagerly free
+  // resources when the queue will no longer accept new elements.
   void ResetAndReleaseStorage() {
-    ResetStorage();
-    entries_.shrink_to_fit();
+    std::vector<std::optional<Entry>>().swap(slots_);
+    front_ = 0;
+    size_ = 0;
   }
 
   struct Entry {
@@ -407,7 +443,7 @@ class SequencedQueue {
     // Conceptually we treat the active range of entries as a series of
     // contiguous spans:
     //
-    //     `entries_`: [2][ ][4][5][6][ ][8][9]
+    //     `slots_`: [2][ ][4][5][6][ ][8][9]
     //
     // For example, above we can designate three contiguous spans: element 2
     // stands alone at the front of the queue, elements 4-6 form a second span,
@@ -421,7 +457,7 @@ class SequencedQueue {
     //
     // If we pop element 2 off the queue, it then becomes:
     //
-    //     `entries_`: [ ][4][5][6][ ][8][9]
+    //     `slots_`: [ ][4][5][6][ ][8][9]
     //
     // The head of the queue is pointing at the empty slot for element 3, and
     // because no span starts in element 0 there are now 0 elements available to
@@ -429,7 +465,7 @@ class SequencedQueue {
     //
     // Finally if we then push element 3, the queue looks like this:
     //
-    //     `entries_`: [3][4][5][6][ ][8][9]
+    //     `slots_`: [3][4][5][6][ ][8][9]
     //
     // and now there are 4 elements available to pop. Element 0 begins the span
     // of elements 3, 4, 5, and 6.
@@ -486,32 +522,30 @@ class SequencedQueue {
     SequenceNumber span_end{0};
   };
 
-  // Concrete, sparse storage for each entry. This is sparse because the queue
-  // may push elements out of sequence order (e.g. elements 42 and 47 may be
-  // pushed before elements 43-46).
+  // Concrete, sparse storage for each entry, used as a circular buffer. This is
+  // sparse because the queue may push elements out of sequence order (e.g.
+  // elements 42 and 47 may be pushed before elements 43-46).
   //
-  // When the vector is non-empty, the element at `front_index_` always
-  // corresponds to the element with `base_sequence_number_` as its
-  // SequenceNumber. Elements below `front_index_` are always null.
-  //
-  // In general, this vector grows to accomodate new entries and is shrunk
-  // only once all present entries have been consumed. This avoids the need to
-  // remove elements from the front of the vector.
-  std::vector<std::optional<Entry>> entries_;
+  // The capacity of this vector is always zero or a power of two, and it only
+  // grows when the queue must span more slots than it can hold. Slots outside
+  // of the `size_` slots starting at `front_` are always null.
+  std::vector<std::optional<Entry>> slots_;
+
+  // The index into `slots_` which corresponds to the front of the queue, i.e.
+  // the slot for the element with `base_sequence_number_` as its
+  // SequenceNumber.
+  size_t front_ = 0;
 
-  // The index into `entries_` which corresponds to the front of the queue. When
-  // `entries_` is empty this is zero; otherwise it is always kept in bounds of
-  // `entries_`. Elements below this index in `entries_` are always null.
-  size_t front_index_ = 0;
+  // The number of slots spanned by the queue, starting from `front_`. This
+  // covers every slot up to the highest queued (or anticipated) element.
+  size_t size_ = 0;
 
   // If and only if this is true, the final length of this queue's sequence is
-  // known and can be determined by the size of `entries_` relative to
-  // `front_index_`.
+  // known and can be determined by `size_`.
   bool is_final_length_known_ = false;
 
   // The SequenceNumber corresponding to the front entry of this queue, which
-  // may or may not yet be occupied. If `entries_` is non-empty, storage for
-  // this entry is always at `entries_[front_index_]`.
+  // may or may not yet be occupied.
   SequenceNumber base_sequence_number_{0};
 };
 
@@ -296,5 +296,87 @@ TEST(SequencedQueueTest, Accounting) {
   EXPECT_EQ(0u, q.GetTotalAvailableElementSize());
 }
 
+TEST(SequencedQueueTest, Wraparound) {
+  // Keep a bounded number of elements outstanding across many more pushes and
+  // pops than the queue has capacity for, with some pushed out of order.
+  TestQueueWithSize q;
+  uint64_t next_to_push = 0;
+  uint64_t next_to_pop = 0;
+  std::string s;
+  for (size_t i = 0; i < 100; ++i) {
+    // Push three elements in the order N+1, N+2, N.
+    const uint64_t n = next_to_push;
+    EXPECT_TRUE(q.Push(SequenceNumber(n + 1), std::to_string(n + 1)));
+    EXPECT_TRUE(q.Push(SequenceNumber(n + 2), std::to_string(n + 2)));
+    EXPECT_EQ(0u, q.GetNumAvailableElements());
+    EXPECT_TRUE(q.Push(SequenceNumber(n), std::to_string(n)));
+    EXPECT_EQ(3u, q.GetNumAvailableElements());
+    EXPECT_EQ(std::to_string(n).size() + std::to_string(n + 1).size() +
+                  std::to_string(n + 2).size(),
+              q.GetTotalAvailableElementSize());
+    next_to_push += 3;
+
+    for (size_t j = 0; j < 3; ++j) {
+      EXPECT_TRUE(q.Pop(s));
+      EXPECT_EQ(std::to_string(next_to_pop++), s);
+    }
+    EXPECT_FALSE(q.HasNextElement());
+  }
+}
+
+TEST(SequencedQueueTest, GrowWhileWrapped) {
+  TestQueueWithSize q;
+  std::string s;
+
+  // Advance the front of the queue partway into its storage.
+  for (uint64_t n = 0; n < 5; ++n) {
+    EXPECT_TRUE(q.Push(SequenceNumber(n), std::to_string(n)));
+    EXPECT_TRUE(q.Pop(s));
+  }
+
+  // Now push enough elements, with a gap, to force storage to wrap around and
+  // then grow.
+  for (uint64_t n = 6; n < 40; ++n) {
+    EXPECT_TRUE(q.Push(SequenceNumber(n), std::to_string(n)));
+  }
+  EXPECT_EQ(0u, q.GetNumAvailableElements());
+  EXPECT_TRUE(q.Push(SequenceNumber(5), "5"));
+  EXPECT_EQ(35u, q.GetNumAvailableElements());
+
+  // Pushing an element beyond the contiguous span can still be detected as a
+  // duplicate after growth.
+  EXPECT_FALSE(q.Push(SequenceNumber(20), "20"));
+
+  for (uint64_t n = 5; n < 40; ++n) {
+    EXPECT_TRUE(q.Pop(s));
+    EXPECT_EQ(std::to_string(n), s);
+  }
+  EXPECT_FALSE(q.HasNextElement());
+}
+
+TEST(SequencedQueueTest, TerminateWhileWrapped) {
+  TestQueue q;
+  std::string s;
+  for (uint64_t n = 0; n < 6; ++n) {
+    EXPECT_TRUE(q.Push(SequenceNumber(n), std::to_string(n)));
+    EXPECT_TRUE(q.Pop(s));
+  }
+
+  // Queue elements which wrap around the end of storage, with a gap at 9.
+  EXPECT_TRUE(q.Push(SequenceNumber(6), "6"));
+  EXPECT_TRUE(q.Push(SequenceNumber(7), "7"));
+  EXPECT_TRUE(q.Push(SequenceNumber(8), "8"));
+  EXPECT_TRUE(q.Push(SequenceNumber(10), "10"));
+  q.ForceTerminateSequence();
+  EXPECT_EQ(SequenceNumber(9), *q.final_sequence_length());
+  EXPECT_FALSE(q.Push(SequenceNumber(9), "9"));
+
+  for (uint64_t n = 6; n < 9; ++n) {
+    EXPECT_TRUE(q.Pop(s));
+    EXPECT_EQ(std::to_string(n), s);
+  }
+  EXPECT_TRUE(q.IsSequenceFullyConsumed());
+}
+
 }  // namespace
 }  // namespace ipcz
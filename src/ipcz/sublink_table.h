@@ -0,0 +1,383 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_SUBLINK_TABLE_H_
+#define IPCZ_SRC_IPCZ_SUBLINK_TABLE_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "ipcz/sublink_id.h"
+#include "third_party/abseil-cpp/absl/base/macros.h"
+#include "third_party/abseil-cpp/absl/base/thread_annotations.h"
+#include "third_party/abseil-cpp/absl/container/flat_hash_map.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+
+namespace ipcz {
+
+// A table of values keyed by SublinkId, optimized for frequent lookups from
+// many threads. SublinkIds are allocated densely from zero by NodeLinkMemory
+// and never reused, so the table is directly indexed by a fixed ring of lazily
+// allocated chunks, each holding an array of atomic entry pointers for a range
+// of consecutive ids. Ids which are kChunkSize * kMaxChunks apart share a ring
+// slot. A chunk is freed once every entry in it has been removed, unless it
+// holds the newest ids, so a busy long-lived link keeps only the chunks
+// covering its live sublinks.
+//
+// Lookups never lock. Modifications are serialized by an internal mutex, and
+// entries removed from the table are reclaimed only once no lookup which may
+// have observed them is still in progress. This is tracked with a simple
+// epoch scheme: each lookup registers with the current epoch, and the epoch
+// can only advance once every lookup registered with the preceding epoch has
+// finished. An entry retired during epoch N is therefore unreachable once the
+// epoch reaches N + 2.
+//
+// An id whose ring slot is still occupied by a chunk of older live ids is
+// stored in a mutex-guarded map instead. That happens only for ids allocated
+// while some sublink has outlived roughly kChunkSize * kMaxChunks newer ones.
+// Lookups only take the mutex to consult that map while it's non-empty.
+template <typename T>
+class SublinkTable {
+ public:
+  static constexpr size_t kChunkSize = 1024;
+  static constexpr size_t kMaxChunks = 1024;
+  static constexpr uint64_t kNumDirectIds = kChunkSize * kMaxChunks;
+
+  SublinkTable() = default;
+  SublinkTable(const SublinkTable&) = delete;
+  SublinkTable& operator=(const SublinkTable&) = delete;
+
+  ~SublinkTable() {
+    for (std::atomic<Chunk*>& chunk_slot : chunks_) {
+      std::unique_ptr<Chunk> chunk(chunk_slot.load(std::memory_order_relaxed));
+      if (!chunk) {
+        continue;
+      }
+      for (std::atomic<T*>& entry : chunk->entries) {
+        delete entry.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Inserts `value` for `id`. Returns false and leaves the table unmodified if
+  // `id` already has a value.
+  bool Add(SublinkId id, T value) {
+    std::vector<Retired> reclaimed;
+    absl::MutexLock lock(&mutex_);
+    if (overflow_entries_.contains(id)) {
+      return false;
+    }
+
+    Chunk* chunk = GetOrCreateChunk(id, reclaimed);
+    if (!chunk) {
+      const bool inserted =
+          overflow_entries_.try_emplace(id, std::move(value)).second;
+      has_overflow_entries_.store(true, std::memory_order_release);
+      return inserted;
+    }
+
+    std::atomic<T*>& slot = chunk->entries[id.value() % kChunkSize];
+    if (slot.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    slot.store(new T(std::move(value)), std::memory_order_release);
+    ++chunk->num_entries;
+    return true;
+  }
+
+  // Removes the value for `id`, if any.
+  void Remove(SublinkId id) {
+    // Removed values are destroyed only after the lock is released, since they
+    // may own the last reference to objects which own this table.
+    std::vector<Retired> reclaimed;
+    std::optional<T> overflow_value;
+    {
+      absl::MutexLock lock(&mutex_);
+      auto it = overflow_entries_.find(id);
+      if (it != overflow_entries_.end()) {
+        overflow_value = std::move(it->second);
+        overflow_entries_.erase(it);
+        has_overflow_entries_.store(!overflow_entries_.empty(),
+                                    std::memory_order_relaxed);
+        return;
+      }
+
+      std::atomic<Chunk*>& chunk_slot = GetChunkSlot(id);
+      Chunk* chunk = chunk_slot.load(std::memory_order_relaxed);
+      if (!chunk || chunk->index != GetChunkIndex(id)) {
+        return;
+      }
+      std::atomic<T*>& slot = chunk->entries[id.value() % kChunkSize];
+      if (T* entry = slot.exchange(nullptr)) {
+        Retire(Retired{.entry = std::unique_ptr<T>(entry)});
+        if (--chunk->num_entries == 0 && chunk->index < newest_chunk_index_) {
+          // Ids are never reused, so an empty chunk behind the newest one is
+          // unlikely to be needed again.
+          chunk_slot.store(nullptr, std::memory_order_relaxed);
+          Retire(Retired{.chunk = std::unique_ptr<Chunk>(chunk)});
+        }
+      }
+      reclaimed = Reclaim();
+    }
+  }
+
+  // Returns a copy of the value for `id`, or null if there is none. Never
+  // blocks unless the table has overflow entries and `id` isn't found in its
+  // ring.
+  std::optional<T> Get(SublinkId id) {
+    std::optional<T> value;
+    {
+      const ReadScope scope(*this);
+      Chunk* chunk = GetChunkSlot(id).load(std::memory_order_acquire);
+      if (chunk && chunk->index == GetChunkIndex(id)) {
+        if (const T* entry = chunk->entries[id.value() % kChunkSize].load(
+                std::memory_order_acquire)) {
+          value = *entry;
+        }
+      }
+    }
+
+    if (!value && has_overflow_entries_.load(std::memory_order_acquire)) {
+      absl::MutexLock lock(&mutex_);
+      auto it = overflow_entries_.find(id);
+      if (it != overflow_entries_.end()) {
+        value = it->second;
+      }
+    }
+
+    if (has_retired_entries_.load(std::memory_order_relaxed)) {
+      TryReclaim();
+    }
+    return value;
+  }
+
+  // Returns a copy of every value in the table. Unlike Get(), this always takes
+  // the table's lock, so it's meant only for infrequent diagnostic use.
+  std::vector<T> GetAll() {
+    std::vector<T> values;
+    absl::MutexLock lock(&mutex_);
+    for (std::atomic<Chunk*>& chunk_slot : chunks_) {
+      Chunk* chunk = chunk_slot.load(std::memory_order_relaxed);
+      if (!chunk) {
+        continue;
+      }
+      for (std::atomic<T*>& slot : chunk->entries) {
+        if (const T* entry = slot.load(std::memory_order_relaxed)) {
+          values.push_back(*entry);
+        }
+      }
+    }
+    for (const auto& [id, value] : overflow_entries_) {
+      values.push_back(value);
+    }
+    return values;
+  }
+
+  // Removes every value from the table and returns them along with their ids.
+  std::vector<std::pair<SublinkId, T>> TakeAll() {
+    std::vector<std::pair<SublinkId, T>> values;
+    std::vector<Retired> reclaimed;
+    absl::MutexLock lock(&mutex_);
+    for (std::atomic<Chunk*>& chunk_slot : chunks_) {
+      Chunk* chunk = chunk_slot.load(std::memory_order_relaxed);
+      if (!chunk) {
+        continue;
+      }
+      for (size_t j = 0; j < kChunkSize; ++j) {
+        if (T* entry = chunk->entries[j].exchange(nullptr)) {
+          values.emplace_back(SublinkId(chunk->index * kChunkSize + j),
+                              *entry);
+          Retire(Retired{.entry = std::unique_ptr<T>(entry)});
+        }
+      }
+      chunk->num_entries = 0;
+    }
+    for (auto& [id, value] : overflow_entries_) {
+      values.emplace_back(id, std::move(value));
+    }
+    overflow_entries_.clear();
+    has_overflow_entries_.store(false, std::memory_order_relaxed);
+    reclaimed = Reclaim();
+    return values;
+  }
+
+  // Returns the number of chunks currently allocated by the table.
+  size_t GetNumChunks() {
+    absl::MutexLock lock(&mutex_);
+    size_t num_chunks = 0;
+    for (std::atomic<Chunk*>& chunk_slot : chunks_) {
+      if (chunk_slot.load(std::memory_order_relaxed)) {
+        ++num_chunks;
+      }
+    }
+    return num_chunks;
+  }
+
+ private:
+  struct Chunk {
+    explicit Chunk(uint64_t index) : index(index) {}
+
+    // The index of this chunk among all chunks, which is not necessarily its
+    // index within the ring. This chunk holds entries for ids in the range
+    // [index * kChunkSize, (index + 1) * kChunkSize).
+    const uint64_t index;
+
+    // The number of non-null `entries`. Guarded by the table's mutex.
+    size_t num_entries = 0;
+
+    std::array<std::atomic<T*>, kChunkSize> entries{};
+  };
+
+  // An entry or chunk removed from the table, which can be destroyed once no
+  // lookup can still reach it.
+  struct Retired {
+    uint64_t epoch = 0;
+    std::unique_ptr<T> entry;
+    std::unique_ptr<Chunk> chunk;
+  };
+
+  // Registers a lookup with the current epoch for its lifetime.
+  class ReadScope {
+   public:
+    explicit ReadScope(SublinkTable& table) : table_(table) {
+      for (;;) {
+        epoch_ = table_.epoch_.load();
+        table_.num_readers_[epoch_ & 1].fetch_add(1);
+        if (table_.epoch_.load() == epoch_) {
+          return;
+        }
+
+        // The epoch advanced before registration was visible. Retry with the
+        // new epoch, since reclamation may not have accounted for us.
+        table_.num_readers_[epoch_ & 1].fetch_sub(1);
+      }
+    }
+
+    ~ReadScope() { table_.num_readers_[epoch_ & 1].fetch_sub(1); }
+
+   private:
+    SublinkTable& table_;
+    uint64_t epoch_;
+  };
+
+  static uint64_t GetChunkIndex(SublinkId id) {
+    return id.value() / kChunkSize;
+  }
+
+  std::atomic<Chunk*>& GetChunkSlot(SublinkId id) {
+    return chunks_[GetChunkIndex(id) % kMaxChunks];
+  }
+
+  // Returns the chunk which holds the entry for `id`, creating it if needed.
+  // Returns null if the ring slot for `id` is occupied by a chunk of different
+  // ids which still has entries, in which case `id` belongs in the overflow
+  // map. An empty chunk displaced from the slot is retired.
+  Chunk* GetOrCreateChunk(SublinkId id, std::vector<Retired>& reclaimed)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    const uint64_t index = GetChunkIndex(id);
+    std::atomic<Chunk*>& chunk_slot = GetChunkSlot(id);
+    Chunk* chunk = chunk_slot.load(std::memory_order_relaxed);
+    if (chunk && chunk->index == index) {
+      return chunk;
+    }
+    if (chunk && chunk->num_entries > 0) {
+      return nullptr;
+    }
+    if (chunk) {
+      chunk_slot.store(nullptr, std::memory_order_relaxed);
+      Retire(Retired{.chunk = std::unique_ptr<Chunk>(chunk)});
+    }
+
+    if (index > newest_chunk_index_) {
+      // The previous newest chunk was kept even if empty. Now that it's been
+      // superseded, free it if nothing is left in it.
+      std::atomic<Chunk*>& newest_slot =
+          chunks_[newest_chunk_index_ % kMaxChunks];
+      Chunk* newest = newest_slot.load(std::memory_order_relaxed);
+      if (newest && newest->index == newest_chunk_index_ &&
+          newest->num_entries == 0) {
+        newest_slot.store(nullptr, std::memory_order_relaxed);
+        Retire(Retired{.chunk = std::unique_ptr<Chunk>(newest)});
+      }
+      newest_chunk_index_ = index;
+    }
+
+    chunk = new Chunk(index);
+    chunk_slot.store(chunk, std::memory_order_release);
+    reclaimed = Reclaim();
+    return chunk;
+  }
+
+  void Retire(Retired retired) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    retired.epoch = epoch_.load();
+    retired_entries_.push_back(std::move(retired));
+    has_retired_entries_.store(true, std::memory_order_relaxed);
+  }
+
+  // Advances the epoch as far as possible and returns every retired entry or
+  // chunk which is no longer reachable by any lookup. The caller must destroy
+  // these only after releasing `mutex_`.
+  std::vector<Retired> Reclaim() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    std::vector<Retired> reclaimed;
+    if (retired_entries_.empty()) {
+      return reclaimed;
+    }
+
+    // Advancing from epoch N to N + 1 requires that no lookup registered with
+    // epoch N - 1 remains, because those share a counter with epoch N + 1.
+    for (int i = 0; i < 2; ++i) {
+      const uint64_t epoch = epoch_.load();
+      if (num_readers_[(epoch + 1) & 1].load() != 0) {
+        break;
+      }
+      epoch_.store(epoch + 1);
+    }
+
+    const uint64_t epoch = epoch_.load();
+    auto it = retired_entries_.begin();
+    for (; it != retired_entries_.end() && it->epoch + 2 <= epoch; ++it) {
+      reclaimed.push_back(std::move(*it));
+    }
+    retired_entries_.erase(retired_entries_.begin(), it);
+    has_retired_entries_.store(!retired_entries_.empty(),
+                               std::memory_order_relaxed);
+    return reclaimed;
+  }
+
+  // Opportunistically reclaims retired entries from the lookup path, without
+  // ever blocking on a concurrent modification.
+  void TryReclaim() {
+    std::vector<Retired> reclaimed;
+    if (!mutex_.TryLock()) {
+      return;
+    }
+    reclaimed = Reclaim();
+    mutex_.Unlock();
+  }
+
+  std::array<std::atomic<Chunk*>, kMaxChunks> chunks_{};
+
+  std::atomic<uint64_t> epoch_{0};
+  std::array<std::atomic<size_t>, 2> num_readers_{};
+  std::atomic<bool> has_retired_entries_{false};
+  std::atomic<bool> has_overflow_entries_{false};
+
+  absl::Mutex mutex_;
+  std::vector<Retired> retired_entries_ ABSL_GUARDED_BY(mutex_);
+  absl::flat_hash_map<SublinkId, T> overflow_entries_ ABSL_GUARDED_BY(mutex_);
+
+  // The index of the newest chunk ever allocated. Since ids are allocated in
+  // increasing order, this chunk is kept even when empty.
+  uint64_t newest_chunk_index_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_SUBLINK_TABLE_H_
@@ -0,0 +1,221 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/sublink_table.h"
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipcz/sublink_id.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "util/ref_counted.h"
+
+namespace ipcz {
+namespace {
+
+using SublinkTableTest = testing::Test;
+
+class TestObject : public RefCounted<TestObject> {
+ public:
+  explicit TestObject(bool& destroyed) : destroyed_(destroyed) {}
+
+ private:
+  friend class RefCounted<TestObject>;
+
+  ~TestObject() { destroyed_ = true; }
+
+  bool& destroyed_;
+};
+
+TEST_F(SublinkTableTest, AddGetRemove) {
+  SublinkTable<std::string> table;
+  EXPECT_FALSE(table.Get(SublinkId(0)));
+
+  EXPECT_TRUE(table.Add(SublinkId(0), "zero"));
+  EXPECT_TRUE(table.Add(SublinkId(5000), "five thousand"));
+  EXPECT_FALSE(table.Add(SublinkId(0), "nope"));
+  EXPECT_EQ("zero", table.Get(SublinkId(0)));
+  EXPECT_EQ("five thousand", table.Get(SublinkId(5000)));
+  EXPECT_FALSE(table.Get(SublinkId(1)));
+
+  table.Remove(SublinkId(0));
+  EXPECT_FALSE(table.Get(SublinkId(0)));
+  EXPECT_EQ("five thousand", table.Get(SublinkId(5000)));
+
+  // Ids may be re-bound once removed.
+  EXPECT_TRUE(table.Add(SublinkId(0), "zero again"));
+  EXPECT_EQ("zero again", table.Get(SublinkId(0)));
+}
+
+TEST_F(SublinkTableTest, OverflowIds) {
+  // An id whose ring slot is still held by older live ids is stored aside.
+  using Table = SublinkTable<std::string>;
+  Table table;
+  const SublinkId kLargeId(Table::kNumDirectIds + 42);
+  EXPECT_TRUE(table.Add(SublinkId(42), "small"));
+  EXPECT_TRUE(table.Add(kLargeId, "large"));
+  EXPECT_FALSE(table.Add(kLargeId, "nope"));
+  EXPECT_EQ("small", table.Get(SublinkId(42)));
+  EXPECT_EQ("large", table.Get(kLargeId));
+  EXPECT_EQ(1u, table.GetNumChunks());
+
+  table.Remove(kLargeId);
+  EXPECT_FALSE(table.Get(kLargeId));
+  EXPECT_EQ("small", table.Get(SublinkId(42)));
+}
+
+TEST_F(SublinkTableTest, EmptyChunksAreFreed) {
+  // Ids are never reused, so a long-lived link keeps moving through new
+  // chunks. Only chunks with live entries should stay allocated, and ids well
+  // beyond a single pass over the ring must still be directly indexed.
+  using Table = SublinkTable<std::string>;
+  Table table;
+  EXPECT_TRUE(table.Add(SublinkId(0), "first"));
+  for (uint64_t id = 1; id < Table::kNumDirectIds * 3; id += 100) {
+    EXPECT_TRUE(table.Add(SublinkId(id), "value"));
+    table.Remove(SublinkId(id));
+  }
+  EXPECT_EQ(2u, table.GetNumChunks());
+  EXPECT_EQ("first", table.Get(SublinkId(0)));
+
+  table.Remove(SublinkId(0));
+  EXPECT_EQ(1u, table.GetNumChunks());
+
+  const SublinkId kLargeId(Table::kNumDirectIds * 3);
+  EXPECT_TRUE(table.Add(kLargeId, "large"));
+  EXPECT_EQ("large", table.Get(kLargeId));
+  EXPECT_EQ(1u, table.GetNumChunks());
+}
+
+TEST_F(SublinkTableTest, TakeAll) {
+  using Table = SublinkTable<std::string>;
+  Table table;
+  EXPECT_TRUE(table.Add(SublinkId(1), "one"));
+  EXPECT_TRUE(table.Add(SublinkId(2000), "two thousand"));
+  EXPECT_TRUE(table.Add(SublinkId(Table::kNumDirectIds), "large"));
+
+  std::vector<std::pair<SublinkId, std::string>> values = table.TakeAll();
+  ASSERT_EQ(3u, values.size());
+  EXPECT_EQ(SublinkId(1), values[0].first);
+  EXPECT_EQ("one", values[0].second);
+  EXPECT_EQ(SublinkId(2000), values[1].first);
+  EXPECT_EQ("two thousand", values[1].second);
+  EXPECT_EQ(SublinkId(Table::kNumDirectIds), values[2].first);
+  EXPECT_EQ("large", values[2].second);
+
+  EXPECT_FALSE(table.Get(SublinkId(1)));
+  EXPECT_FALSE(table.Get(SublinkId(2000)));
+  EXPECT_FALSE(table.Get(SublinkId(Table::kNumDirectIds)));
+}
+
+TEST_F(SublinkTableTest, GetAll) {
+  using Table = SublinkTable<std::string>;
+  Table table;
+  EXPECT_TRUE(table.GetAll().empty());
+  EXPECT_TRUE(table.Add(SublinkId(1), "one"));
+  EXPECT_TRUE(table.Add(SublinkId(2000), "two thousand"));
+  EXPECT_TRUE(table.Add(SublinkId(Table::kNumDirectIds), "large"));
+  table.Remove(SublinkId(1));
+
+  // Unlike TakeAll(), values are left in the table.
+  EXPECT_EQ((std::vector<std::string>{"two thousand", "large"}),
+            table.GetAll());
+  EXPECT_EQ("two thousand", table.Get(SublinkId(2000)));
+}
+
+TEST_F(SublinkTableTest, RemovedValuesAreReleased) {
+  // Without concurrent lookups, removed values are released immediately.
+  SublinkTable<Ref<TestObject>> table;
+  bool destroyed = false;
+  EXPECT_TRUE(table.Add(SublinkId(3), MakeRefCounted<TestObject>(destroyed)));
+  EXPECT_TRUE(table.Get(SublinkId(3)));
+  EXPECT_FALSE(destroyed);
+  table.Remove(SublinkId(3));
+  EXPECT_TRUE(destroyed);
+}
+
+TEST_F(SublinkTableTest, ConcurrentLookups) {
+  // Exercises lookups racing against insertion and removal of the same ids.
+  // Every successful lookup must observe a fully intact value.
+  constexpr size_t kNumIds = 64;
+  constexpr size_t kNumIterations = 1000;
+  constexpr size_t kNumReaders = 4;
+  SublinkTable<std::string> table;
+  std::atomic<bool> done{false};
+
+  std::vector<std::thread> readers;
+  for (size_t i = 0; i < kNumReaders; ++i) {
+    readers.emplace_back([&] {
+      while (!done.load(std::memory_order_relaxed)) {
+        for (size_t id = 0; id < kNumIds; ++id) {
+          std::optional<std::string> value = table.Get(SublinkId(id));
+          if (value) {
+            EXPECT_EQ(std::to_string(id), *value);
+          }
+        }
+      }
+    });
+  }
+
+  for (size_t i = 0; i < kNumIterations; ++i) {
+    for (size_t id = 0; id < kNumIds; ++id) {
+      EXPECT_TRUE(table.Add(SublinkId(id), std::to_string(id)));
+    }
+    for (size_t id = 0; id < kNumIds; ++id) {
+      table.Remove(SublinkId(id));
+    }
+  }
+
+  done = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+}
+
+TEST_F(SublinkTableTest, ConcurrentLookupsWithChunkTurnover) {
+  // Exercises lookups racing against chunks being freed as ids advance through
+  // the ring, including ids which collide with older chunks in it.
+  using Table = SublinkTable<std::string>;
+  constexpr uint64_t kStride = Table::kChunkSize / 2;
+  constexpr uint64_t kMaxId = Table::kNumDirectIds * 2;
+  constexpr size_t kNumReaders = 4;
+  Table table;
+  std::atomic<uint64_t> next_id{0};
+  std::atomic<bool> done{false};
+
+  std::vector<std::thread> readers;
+  for (size_t i = 0; i < kNumReaders; ++i) {
+    readers.emplace_back([&] {
+      while (!done.load(std::memory_order_relaxed)) {
+        const uint64_t id = next_id.load(std::memory_order_relaxed);
+        for (uint64_t other : {id, id - kStride, id + Table::kNumDirectIds}) {
+          std::optional<std::string> value = table.Get(SublinkId(other));
+          if (value) {
+            EXPECT_EQ(std::to_string(other), *value);
+          }
+        }
+      }
+    });
+  }
+
+  for (uint64_t id = 0; id < kMaxId; id += kStride) {
+    EXPECT_TRUE(table.Add(SublinkId(id), std::to_string(id)));
+    next_id.store(id, std::memory_order_relaxed);
+    if (id >= kStride) {
+      table.Remove(SublinkId(id - kStride));
+    }
+  }
+
+  done = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+}
+
+}  // namespace
+}  // namespace ipcz
@@ -0,0 +1,49 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_SUBPARCEL_DESCRIPTOR_H_
+#define IPCZ_SRC_IPCZ_SUBPARCEL_DESCRIPTOR_H_
+
+#include <cstdint>
+#include <type_traits>
+
+#include "ipcz/fragment_descriptor.h"
+#include "ipcz/ipcz.h"
+
+namespace ipcz {
+
+// Describes one of the parcels carried by an AcceptCoalescedParcel message,
+// which transmits a main parcel together with all of its subparcels. Entries
+// appear in subparcel index order, so the first entry always describes the
+// main parcel.
+//
+// NOTE: This is a wire structure and must remain backwards-compatible across
+// changes.
+struct IPCZ_ALIGN(8) SubparcelDescriptor {
+  // An optional shared memory fragment containing this parcel's data. If this
+  // is null, the data is instead inlined within the message's `parcel_data`
+  // array as described by `data_offset` and `data_size` below.
+  FragmentDescriptor data_fragment;
+
+  // The location of this parcel's inlined data within the message's
+  // `parcel_data` array. Only meaningful if `data_fragment` is null.
+  uint32_t data_offset;
+  uint32_t data_size;
+
+  // The number of consecutive entries in the message's `handle_types` array
+  // which belong to this parcel. Each portal among them also claims the next
+  // entry in `new_routers`, and each boxed driver object claims the next entry
+  // in `driver_objects`.
+  uint32_t num_handles;
+
+  // Reserved padding out to the next 8-byte boundary.
+  uint32_t reserved0;
+};
+
+static_assert(std::is_trivially_copyable_v<SubparcelDescriptor>,
+              "SubparcelDescriptor must be trivially copyable");
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_SUBPARCEL_DESCRIPTOR_H_
@@ -0,0 +1,332 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/transport_capture.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "ipcz/driver_transport.h"
+#include "ipcz/fragment.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "util/log.h"
+
+namespace ipcz {
+
+namespace {
+
+// Identifies a serialized capture, including a trailing format version byte.
+constexpr std::string_view kSignature = {"ipczcap\x01", 8};
+
+// The fields of a record to be serialized, without owning its data.
+struct RecordView {
+  TransportCaptureRecord::Type type;
+  uint64_t transport_id;
+  int64_t time;
+  uint32_t num_driver_objects;
+  BufferId buffer_id;
+  uint32_t offset;
+  absl::Span<const uint8_t> data;
+};
+
+void AppendVarint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+bool ReadVarint(absl::Span<const uint8_t>& in, uint64_t& value) {
+  value = 0;
+  for (size_t shift = 0; shift < 64; shift += 7) {
+    if (in.empty()) {
+      return false;
+    }
+    const uint8_t byte = in[0];
+    in.remove_prefix(1);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Appends `record` to `out`. `last_time` is the time of the previously
+// appended record, against which this record's time is encoded. Times must not
+// decrease from one record to the next.
+void AppendRecord(std::string& out, const RecordView& record,
+                  int64_t& last_time) {
+  AppendVarint(out, static_cast<uint64_t>(record.type));
+  AppendVarint(out, record.transport_id);
+  AppendVarint(out, static_cast<uint64_t>(record.time - last_time));
+  last_time = record.time;
+  if (record.type == TransportCaptureRecord::Type::kFragment) {
+    AppendVarint(out, record.buffer_id.value());
+    AppendVarint(out, record.offset);
+  } else {
+    AppendVarint(out, record.num_driver_objects);
+  }
+  AppendVarint(out, record.data.size());
+  out.append(reinterpret_cast<const char*>(record.data.data()),
+             record.data.size());
+}
+
+// While streaming to a file, records are buffered up to this size between
+// writes.
+constexpr size_t kFileBufferSize = 64 * 1024;
+
+class CaptureLog {
+ public:
+  // Begins a new capture, discarding any previous one. If `file` is non-null,
+  // the capture is streamed to it and the log takes ownership of it. If
+  // `max_bytes` is non-zero, the capture is limited to that size.
+  void Reset(std::FILE* file, size_t max_bytes) {
+    absl::MutexLock lock(&mutex_);
+    CloseFile();
+    file_ = file;
+    max_bytes_ = max_bytes;
+    num_flushed_bytes_ = 0;
+    is_full_ = false;
+    last_time_ = 0;
+    buffer_.assign(kSignature);
+  }
+
+  void Add(RecordView record) {
+    absl::MutexLock lock(&mutex_);
+    if (is_full_) {
+      return;
+    }
+
+    // Timestamps are taken under the lock so they're ordered like the records
+    // themselves, except where the wall clock itself goes backwards.
+    record.time = std::max(absl::GetCurrentTimeNanos(), last_time_);
+    const size_t previous_size = buffer_.size();
+    const int64_t previous_time = last_time_;
+    AppendRecord(buffer_, record, last_time_);
+    if (max_bytes_ && num_flushed_bytes_ + buffer_.size() > max_bytes_) {
+      // Drop this record and everything after it, rather than leave a gap.
+      buffer_.resize(previous_size);
+      last_time_ = previous_time;
+      is_full_ = true;
+      return;
+    }
+    if (file_ && buffer_.size() >= kFileBufferSize) {
+      FlushToFile();
+    }
+  }
+
+  // Ends the capture. Returns the serialized capture if it was kept in memory,
+  // or an empty string if it was streamed to a file.
+  std::string TakeCapture() {
+    absl::MutexLock lock(&mutex_);
+    if (file_) {
+      CloseFile();
+      return {};
+    }
+    std::string capture = std::move(buffer_);
+    buffer_.clear();
+    return capture;
+  }
+
+ private:
+  void FlushToFile() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    const size_t num_bytes_written =
+        std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+    num_flushed_bytes_ += num_bytes_written;
+    if (num_bytes_written < buffer_.size() || std::fflush(file_) != 0) {
+      // Nothing more can be appended after a failed write without leaving a
+      // gap in the capture, so stop recording.
+      DLOG(ERROR) << "Transport capture stopped after failing to write "
+                  << buffer_.size() << " bytes";
+      is_full_ = true;
+    }
+    buffer_.clear();
+  }
+
+  void CloseFile() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    if (!file_) {
+      return;
+    }
+    FlushToFile();
+    if (std::fclose(file_) != 0) {
+      DLOG(ERROR) << "Transport capture failed to close its file";
+    }
+    file_ = nullptr;
+  }
+
+  absl::Mutex mutex_;
+  std::FILE* file_ ABSL_GUARDED_BY(mutex_) = nullptr;
+  size_t max_bytes_ ABSL_GUARDED_BY(mutex_) = 0;
+
+  // Serialized records not yet written to `file_`, or the whole capture if
+  // there's no file.
+  std::string buffer_ ABSL_GUARDED_BY(mutex_);
+
+  // The number of bytes already written to `file_`.
+  size_t num_flushed_bytes_ ABSL_GUARDED_BY(mutex_) = 0;
+
+  // Whether a record has been dropped for exceeding `max_bytes_`, after which
+  // nothing more is recorded.
+  bool is_full_ ABSL_GUARDED_BY(mutex_) = false;
+
+  int64_t last_time_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+CaptureLog& GetCaptureLog() {
+  static auto* log = new CaptureLog();
+  return *log;
+}
+
+}  // namespace
+
+std::atomic<bool> TransportCapture::enabled_{false};
+
+// static
+bool TransportCapture::Start(size_t max_bytes) {
+  bool was_enabled = false;
+  if (!enabled_.compare_exchange_strong(was_enabled, true,
+                                        std::memory_order_relaxed)) {
+    return false;
+  }
+
+  // As in StartToFile(), anything recorded since `enabled_` was set is
+  // discarded here.
+  GetCaptureLog().Reset(nullptr, max_bytes);
+  return true;
+}
+
+// static
+bool TransportCapture::StartToFile(const char* path, size_t max_bytes) {
+  bool was_enabled = false;
+  if (!enabled_.compare_exchange_strong(was_enabled, true,
+                                        std::memory_order_relaxed)) {
+    return false;
+  }
+
+  std::FILE* file = std::fopen(path, "wb");
+  if (!file) {
+    enabled_.store(false, std::memory_order_relaxed);
+    return false;
+  }
+
+  // Anything recorded since `enabled_` was set is discarded here, so the file
+  // begins cleanly with the records which follow.
+  GetCaptureLog().Reset(file, max_bytes);
+  return true;
+}
+
+// static
+std::string TransportCapture::Stop() {
+  enabled_.store(false, std::memory_order_relaxed);
+  return GetCaptureLog().TakeCapture();
+}
+
+// static
+std::optional<std::vector<TransportCaptureRecord>> TransportCapture::Parse(
+    absl::Span<const uint8_t> capture) {
+  if (capture.size() < kSignature.size() ||
+      std::string_view(reinterpret_cast<const char*>(capture.data()),
+                       kSignature.size()) != kSignature) {
+    return std::nullopt;
+  }
+  capture.remove_prefix(kSignature.size());
+
+  std::vector<TransportCaptureRecord> records;
+  int64_t last_time = 0;
+  while (!capture.empty()) {
+    TransportCaptureRecord& record = records.emplace_back();
+    uint64_t type, time_delta, size;
+    if (!ReadVarint(capture, type) ||
+        type > static_cast<uint64_t>(TransportCaptureRecord::Type::kFragment) ||
+        !ReadVarint(capture, record.transport_id) ||
+        !ReadVarint(capture, time_delta)) {
+      return std::nullopt;
+    }
+    record.type = static_cast<TransportCaptureRecord::Type>(type);
+    last_time += static_cast<int64_t>(time_delta);
+    record.time = last_time;
+
+    if (record.type == TransportCaptureRecord::Type::kFragment) {
+      uint64_t buffer_id, offset;
+      if (!ReadVarint(capture, buffer_id) || !ReadVarint(capture, offset) ||
+          offset > UINT32_MAX) {
+        return std::nullopt;
+      }
+      record.buffer_id = BufferId(buffer_id);
+      record.offset = static_cast<uint32_t>(offset);
+    } else {
+      uint64_t num_driver_objects;
+      if (!ReadVarint(capture, num_driver_objects) ||
+          num_driver_objects > UINT32_MAX) {
+        return std::nullopt;
+      }
+      record.num_driver_objects = static_cast<uint32_t>(num_driver_objects);
+    }
+
+    if (!ReadVarint(capture, size) || size > capture.size()) {
+      return std::nullopt;
+    }
+    record.data.assign(capture.begin(), capture.begin() + size);
+    capture.remove_prefix(size);
+  }
+  return records;
+}
+
+// static
+std::string TransportCapture::Serialize(
+    absl::Span<const TransportCaptureRecord> records) {
+  std::string capture(kSignature);
+  int64_t last_time = 0;
+  for (const TransportCaptureRecord& record : records) {
+    AppendRecord(capture,
+                 {
+                     .type = record.type,
+                     .transport_id = record.transport_id,
+                     .time = std::max(record.time, last_time),
+                     .num_driver_objects = record.num_driver_objects,
+                     .buffer_id = record.buffer_id,
+                     .offset = record.offset,
+                     .data = record.data,
+                 },
+                 last_time);
+  }
+  return capture;
+}
+
+// static
+void TransportCapture::RecordMessageImpl(TransportCaptureRecord::Type type,
+                                         const DriverTransport& transport,
+                                         absl::Span<const uint8_t> data,
+                                         size_t num_driver_objects) {
+  GetCaptureLog().Add({
+      .type = type,
+      .transport_id = transport.id(),
+      .num_driver_objects = static_cast<uint32_t>(num_driver_objects),
+      .data = data,
+  });
+}
+
+// static
+void TransportCapture::RecordFragmentImpl(const DriverTransport& transport,
+                                          const Fragment& fragment) {
+  if (fragment.is_null() || !fragment.is_addressable()) {
+    return;
+  }
+  GetCaptureLog().Add({
+      .type = TransportCaptureRecord::Type::kFragment,
+      .transport_id = transport.id(),
+      .buffer_id = fragment.buffer_id(),
+      .offset = fragment.offset(),
+      .data = fragment.bytes(),
+  });
+}
+
+}  // namespace ipcz
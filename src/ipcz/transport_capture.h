@@ -0,0 +1,140 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_TRANSPORT_CAPTURE_H_
+#define IPCZ_SRC_IPCZ_TRANSPORT_CAPTURE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "ipcz/buffer_id.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz {
+
+class DriverTransport;
+struct Fragment;
+
+// A single event recorded by TransportCapture.
+struct TransportCaptureRecord {
+  enum class Type : uint8_t {
+    // A message was transmitted through the transport.
+    kTransmit = 0,
+
+    // A message was received from the transport.
+    kReceive = 1,
+
+    // Immediately before a message referencing it was transmitted, a shared
+    // memory fragment held this data.
+    kFragment = 2,
+  };
+
+  Type type = Type::kTransmit;
+
+  // Identifies the DriverTransport involved. See DriverTransport::id().
+  uint64_t transport_id = 0;
+
+  // Wall clock time of the event, in nanoseconds since the Unix epoch.
+  int64_t time = 0;
+
+  // For kTransmit and kReceive, the number of driver objects which accompanied
+  // the message. Their contents are not captured.
+  uint32_t num_driver_objects = 0;
+
+  // For kFragment, the location of the fragment within the link's memory.
+  BufferId buffer_id = kInvalidBufferId;
+  uint32_t offset = 0;
+
+  // The message data, or the fragment's contents.
+  std::vector<uint8_t> data;
+};
+
+// Records the raw traffic on every DriverTransport in the process, for offline
+// analysis and replay (see TransportReplayer). Every message transmitted or
+// received is captured, along with the contents of any shared memory fragment
+// holding parcel data at the time it's passed by reference in a transmitted
+// message. Capture is off by default. While it's off, DriverTransport and
+// RemoteRouterLink neither copy message data nor read fragment contents, so
+// no capture lock or allocation is involved in transmitting anything.
+//
+// Embedders enable capture with IpczCreateNodeOptions.transport_capture_file,
+// which streams the capture to a file. A capture may instead be kept in
+// memory, e.g. by tests. Either way it's bounded: once the next record would
+// take the capture beyond its size limit, capture stops recording, so a
+// capture is always a well-formed prefix of the traffic.
+//
+// A capture serializes to a compact binary format: an 8-byte signature
+// followed by records of LEB128-encoded fields, with timestamps delta-encoded
+// against the previous record.
+class TransportCapture {
+ public:
+  // The default size limit of a capture kept in memory.
+  static constexpr size_t kDefaultMaxInMemoryBytes = 64 * 1024 * 1024;
+
+  static bool IsEnabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  // Discards anything previously captured and begins capturing in memory, up
+  // to `max_bytes` of serialized capture. Returns false, without starting, if
+  // capture is already in progress.
+  static bool Start(size_t max_bytes = kDefaultMaxInMemoryBytes);
+
+  // Discards anything previously captured and begins streaming a capture to a
+  // new file at `path`, replacing any existing file. Only a small buffer is
+  // held in memory between writes. If `max_bytes` is non-zero, the file is
+  // limited to that size. If a write to the file fails, capture stops
+  // recording, leaving whatever was written before the failure. Returns false,
+  // without starting, if capture is already in progress or the file can't be
+  // created.
+  static bool StartToFile(const char* path, size_t max_bytes);
+
+  // Stops capturing. If capture was started by Start(), returns everything
+  // captured since, serialized. If it was started by StartToFile(), flushes
+  // and closes the file and returns an empty string.
+  static std::string Stop();
+
+  // Parses a serialized capture. Returns null if `capture` is malformed.
+  static std::optional<std::vector<TransportCaptureRecord>> Parse(
+      absl::Span<const uint8_t> capture);
+
+  // Serializes `records` in the same format returned by Stop().
+  static std::string Serialize(
+      absl::Span<const TransportCaptureRecord> records);
+
+  // Captures a message transmitted or received by `transport`.
+  static void RecordMessage(TransportCaptureRecord::Type type,
+                            const DriverTransport& transport,
+                            absl::Span<const uint8_t> data,
+                            size_t num_driver_objects) {
+    if (IsEnabled()) {
+      RecordMessageImpl(type, transport, data, num_driver_objects);
+    }
+  }
+
+  // Captures the current contents of `fragment`, which is about to be passed
+  // by reference in a message transmitted by `transport`.
+  static void RecordFragment(const DriverTransport& transport,
+                             const Fragment& fragment) {
+    if (IsEnabled()) {
+      RecordFragmentImpl(transport, fragment);
+    }
+  }
+
+ private:
+  static void RecordMessageImpl(TransportCaptureRecord::Type type,
+                                const DriverTransport& transport,
+                                absl::Span<const uint8_t> data,
+                                size_t num_driver_objects);
+  static void RecordFragmentImpl(const DriverTransport& transport,
+                                 const Fragment& fragment);
+
+  static std::atomic<bool> enabled_;
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_TRANSPORT_CAPTURE_H_
@@ -0,0 +1,288 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/transport_capture.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ipcz/link_side.h"
+#include "ipcz/link_type.h"
+#include "ipcz/node.h"
+#include "ipcz/node_link.h"
+#include "ipcz/node_link_memory.h"
+#include "ipcz/operation_context.h"
+#include "ipcz/remote_router_link.h"
+#include "ipcz/router.h"
+#include "ipcz/sublink_id.h"
+#include "ipcz/transport_replayer.h"
+#include "reference_drivers/sync_reference_driver.h"
+#include "test/test_node_links.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+#include "util/ref_counted.h"
+
+namespace ipcz {
+namespace {
+
+const IpczDriver& kDriver = reference_drivers::kSyncReferenceDriver;
+
+size_t CountRecords(absl::Span<const TransportCaptureRecord> records,
+                    TransportCaptureRecord::Type type, uint64_t transport_id) {
+  size_t count = 0;
+  for (const TransportCaptureRecord& record : records) {
+    if (record.type == type && record.transport_id == transport_id) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+absl::Span<const uint8_t> AsBytes(const std::string& data) {
+  return absl::MakeSpan(reinterpret_cast<const uint8_t*>(data.data()),
+                        data.size());
+}
+
+class TransportCaptureTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    // Only one capture may be in progress per process, and the test runner may
+    // already be capturing to a file.
+    if (TransportCapture::IsEnabled()) {
+      GTEST_SKIP() << "Transport capture is already in progress";
+    }
+  }
+
+  // Sends `messages` from one portal to another over a NodeLink between two
+  // new nodes created with `node_options`, and closes the nodes afterward.
+  // `on_sent` is invoked once all messages are sent, before any teardown.
+  void SendMessages(const IpczCreateNodeOptions* node_options,
+                    const std::vector<std::string>& messages,
+                    uint64_t& sender_transport_id,
+                    uint64_t& receiver_transport_id,
+                    std::function<void()> on_sent = nullptr) {
+    Ref<Node> node0 =
+        MakeRefCounted<Node>(Node::Type::kBroker, kDriver, node_options);
+    Ref<Node> node1 =
+        MakeRefCounted<Node>(Node::Type::kNormal, kDriver, node_options);
+
+    const OperationContext context{OperationContext::kTransportNotification};
+    auto [link0, link1] = test::LinkNodes(node0, node1);
+    sender_transport_id = link0->transport()->id();
+    receiver_transport_id = link1->transport()->id();
+    auto router0 = MakeRefCounted<Router>();
+    auto router1 = MakeRefCounted<Router>();
+    FragmentRef<RouterLinkState> link_state =
+        link0->memory().GetInitialRouterLinkState(0);
+    router0->SetOutwardLink(
+        context,
+        link0->AddRemoteRouterLink(context, SublinkId(0), link_state,
+                                   LinkType::kCentral, LinkSide::kA, router0));
+    router1->SetOutwardLink(
+        context,
+        link1->AddRemoteRouterLink(context, SublinkId(0), link_state,
+                                   LinkType::kCentral, LinkSide::kB, router1));
+    link_state->status = RouterLinkState::kStable;
+
+    for (const std::string& message : messages) {
+      EXPECT_EQ(IPCZ_RESULT_OK, router0->Put(AsBytes(message), {}));
+    }
+    if (on_sent) {
+      on_sent();
+    }
+
+    router0->CloseRoute();
+    router1->CloseRoute();
+    link0->Deactivate(context);
+    link1->Deactivate(context);
+    node1->Close();
+    node0->Close();
+  }
+
+  // Captures in memory the traffic of a NodeLink over which `messages` are
+  // sent from one portal to another.
+  std::vector<TransportCaptureRecord> CaptureMessages(
+      const std::vector<std::string>& messages,
+      uint64_t& sender_transport_id,
+      uint64_t& receiver_transport_id,
+      size_t max_bytes = TransportCapture::kDefaultMaxInMemoryBytes) {
+    EXPECT_TRUE(TransportCapture::Start(max_bytes));
+    std::string capture;
+    SendMessages(/*node_options=*/nullptr, messages, sender_transport_id,
+                 receiver_transport_id,
+                 [&] { capture = TransportCapture::Stop(); });
+
+    std::optional<std::vector<TransportCaptureRecord>> records =
+        TransportCapture::Parse(AsBytes(capture));
+    EXPECT_TRUE(records.has_value());
+    return records.value_or(std::vector<TransportCaptureRecord>());
+  }
+};
+
+TEST_F(TransportCaptureTest, DisabledByDefault) {
+  EXPECT_FALSE(TransportCapture::IsEnabled());
+
+  // Nothing recorded before capture started is returned.
+  EXPECT_TRUE(TransportCapture::Start());
+  EXPECT_TRUE(TransportCapture::IsEnabled());
+
+  // A second capture can't start while one is in progress.
+  EXPECT_FALSE(TransportCapture::Start());
+  const std::string capture = TransportCapture::Stop();
+  EXPECT_FALSE(TransportCapture::IsEnabled());
+  std::optional<std::vector<TransportCaptureRecord>> records =
+      TransportCapture::Parse(AsBytes(capture));
+  ASSERT_TRUE(records.has_value());
+  EXPECT_TRUE(records->empty());
+}
+
+TEST_F(TransportCaptureTest, SerializeAndParse) {
+  std::vector<TransportCaptureRecord> records(3);
+  records[0].type = TransportCaptureRecord::Type::kFragment;
+  records[0].transport_id = 7;
+  records[0].time = 1000;
+  records[0].buffer_id = BufferId(3);
+  records[0].offset = 4096;
+  records[0].data = {1, 2, 3, 4};
+  records[1].type = TransportCaptureRecord::Type::kTransmit;
+  records[1].transport_id = 7;
+  records[1].time = 1500;
+  records[1].num_driver_objects = 2;
+  records[1].data.resize(300, 0xab);
+  records[2].type = TransportCaptureRecord::Type::kReceive;
+  records[2].transport_id = uint64_t{1} << 40;
+  records[2].time = 1500;
+
+  const std::string capture = TransportCapture::Serialize(records);
+  std::optional<std::vector<TransportCaptureRecord>> parsed =
+      TransportCapture::Parse(AsBytes(capture));
+  ASSERT_TRUE(parsed.has_value());
+  ASSERT_EQ(records.size(), parsed->size());
+  for (size_t i = 0; i < records.size(); ++i) {
+    EXPECT_EQ(records[i].type, (*parsed)[i].type);
+    EXPECT_EQ(records[i].transport_id, (*parsed)[i].transport_id);
+    EXPECT_EQ(records[i].time, (*parsed)[i].time);
+    EXPECT_EQ(records[i].num_driver_objects, (*parsed)[i].num_driver_objects);
+    EXPECT_EQ(records[i].buffer_id, (*parsed)[i].buffer_id);
+    EXPECT_EQ(records[i].offset, (*parsed)[i].offset);
+    EXPECT_EQ(records[i].data, (*parsed)[i].data);
+  }
+
+  // Truncated captures and captures without the signature are rejected.
+  EXPECT_FALSE(
+      TransportCapture::Parse(AsBytes(capture.substr(0, capture.size() - 1)))
+          .has_value());
+  EXPECT_FALSE(TransportCapture::Parse(AsBytes(capture.substr(1))).has_value());
+  EXPECT_FALSE(TransportCapture::Parse({}).has_value());
+}
+
+TEST_F(TransportCaptureTest, CaptureLinkTraffic) {
+  const std::vector<std::string> messages = {"hello", "world",
+                                             std::string(2000, '!')};
+  uint64_t sender_id, receiver_id;
+  const std::vector<TransportCaptureRecord> records =
+      CaptureMessages(messages, sender_id, receiver_id);
+  EXPECT_NE(sender_id, receiver_id);
+
+  // Every parcel is transmitted by one transport and received by the other.
+  const size_t num_transmitted = CountRecords(
+      records, TransportCaptureRecord::Type::kTransmit, sender_id);
+  EXPECT_GE(num_transmitted, messages.size());
+  EXPECT_EQ(num_transmitted,
+            CountRecords(records, TransportCaptureRecord::Type::kReceive,
+                         receiver_id));
+  EXPECT_EQ(0u, CountRecords(records, TransportCaptureRecord::Type::kTransmit,
+                             receiver_id));
+}
+
+TEST_F(TransportCaptureTest, InMemoryCaptureIsBounded) {
+  // Enough room for the short messages, but not for the fragment holding the
+  // long one.
+  constexpr size_t kMaxBytes = 1024;
+  const std::vector<std::string> messages = {"hello", "world",
+                                             std::string(2000, '!')};
+  uint64_t sender_id, receiver_id;
+  const std::vector<TransportCaptureRecord> records =
+      CaptureMessages(messages, sender_id, receiver_id, kMaxBytes);
+  EXPECT_LE(TransportCapture::Serialize(records).size(), kMaxBytes);
+
+  // Nothing is recorded once the limit is hit, so the capture ends with the
+  // short messages.
+  EXPECT_GE(CountRecords(records, TransportCaptureRecord::Type::kTransmit,
+                         sender_id),
+            2u);
+  for (const TransportCaptureRecord& record : records) {
+    EXPECT_LT(record.data.size(), messages[2].size());
+  }
+}
+
+TEST_F(TransportCaptureTest, CaptureToFileFromNodeOptions) {
+  const std::string path = testing::TempDir() + "ipcz_transport_capture";
+  const IpczCreateNodeOptions options = {
+      .size = sizeof(options),
+      .transport_capture_file = path.c_str(),
+  };
+
+  // The first node starts capturing and the second, finding capture already in
+  // progress, leaves it alone. Closing the first node stops the capture.
+  uint64_t sender_id, receiver_id;
+  SendMessages(&options, {"hello", "world"}, sender_id, receiver_id,
+               [] { EXPECT_TRUE(TransportCapture::IsEnabled()); });
+  EXPECT_FALSE(TransportCapture::IsEnabled());
+
+  std::ifstream file(path, std::ios::binary);
+  const std::string capture((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+  std::remove(path.c_str());
+  std::optional<std::vector<TransportCaptureRecord>> records =
+      TransportCapture::Parse(AsBytes(capture));
+  ASSERT_TRUE(records.has_value());
+  EXPECT_GE(CountRecords(*records, TransportCaptureRecord::Type::kTransmit,
+                         sender_id),
+            2u);
+  EXPECT_EQ(CountRecords(*records, TransportCaptureRecord::Type::kTransmit,
+                         sender_id),
+            CountRecords(*records, TransportCaptureRecord::Type::kReceive,
+                         receiver_id));
+}
+
+TEST_F(TransportCaptureTest, Replay) {
+  const std::vector<std::string> messages = {"hello", "world",
+                                             std::string(2000, '!')};
+  uint64_t sender_id, receiver_id;
+  const std::vector<TransportCaptureRecord> records =
+      CaptureMessages(messages, sender_id, receiver_id);
+
+  // Replaying the sender's traffic delivers every parcel again, even those
+  // whose data was passed through shared memory.
+  std::vector<std::string> replayed;
+  const TransportReplayer::Result result = TransportReplayer::Replay(
+      kDriver, records,
+      {.transport_id = sender_id,
+       .parcel_handler = [&](absl::Span<const uint8_t> data) {
+         replayed.emplace_back(data.begin(), data.end());
+       }});
+  EXPECT_EQ(messages.size(), result.num_parcels_received);
+  EXPECT_EQ(messages, replayed);
+  EXPECT_GT(result.num_fragments_restored, 0u);
+  EXPECT_EQ(0u, result.num_messages_rejected);
+  EXPECT_EQ(0u, result.num_messages_skipped);
+  EXPECT_EQ(0u, result.num_fragments_dropped);
+
+  // Replaying a transport which doesn't appear in the capture does nothing.
+  const TransportReplayer::Result empty_result =
+      TransportReplayer::Replay(kDriver, records, {.transport_id = 0});
+  EXPECT_EQ(0u, empty_result.num_messages_replayed);
+  EXPECT_EQ(0u, empty_result.num_parcels_received);
+}
+
+}  // namespace
+}  // namespace ipcz
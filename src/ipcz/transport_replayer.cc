@@ -0,0 +1,191 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/transport_replayer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "ipcz/api_object.h"
+#include "ipcz/driver_memory.h"
+#include "ipcz/driver_object.h"
+#include "ipcz/driver_transport.h"
+#include "ipcz/fragment.h"
+#include "ipcz/fragment_descriptor.h"
+#include "ipcz/link_side.h"
+#include "ipcz/link_type.h"
+#include "ipcz/node.h"
+#include "ipcz/node_link.h"
+#include "ipcz/node_link_memory.h"
+#include "ipcz/operation_context.h"
+#include "ipcz/remote_router_link.h"
+#include "ipcz/router.h"
+#include "ipcz/sublink_id.h"
+#include "third_party/abseil-cpp/absl/base/macros.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "util/ref_counted.h"
+
+namespace ipcz {
+
+namespace {
+
+// Stands in for the remote end of the replaying NodeLink, discarding anything
+// transmitted to it.
+class StubPeer : public DriverTransport::Listener {
+ public:
+  // DriverTransport::Listener:
+  bool OnTransportMessage(const DriverTransport::RawMessage& message,
+                          const DriverTransport& transport) override {
+    // Driver objects sent to the stub are owned by it, and must be closed.
+    for (IpczDriverHandle handle : message.handles) {
+      DriverObject(*transport.driver_object().driver(), handle).reset();
+    }
+    return true;
+  }
+  void OnTransportError() override {}
+
+ private:
+  ~StubPeer() override = default;
+};
+
+// Retrieves and discards every parcel available from `router`, passing each
+// one's data to `handler` if set. Returns the number of parcels retrieved.
+size_t DrainParcels(Router& router,
+                    const TransportReplayer::ParcelHandler& handler) {
+  std::vector<uint8_t> data;
+  std::vector<IpczHandle> handles;
+  size_t num_parcels = 0;
+  for (;;) {
+    size_t num_bytes = data.size();
+    size_t num_handles = handles.size();
+    const IpczResult result =
+        router.Get(IPCZ_NO_FLAGS, nullptr, data.data(), &num_bytes,
+                   handles.data(), &num_handles, nullptr);
+    if (result == IPCZ_RESULT_RESOURCE_EXHAUSTED) {
+      data.resize(std::max(num_bytes, data.size()));
+      handles.resize(std::max(num_handles, handles.size()));
+      continue;
+    }
+    if (result != IPCZ_RESULT_OK) {
+      return num_parcels;
+    }
+
+    if (handler) {
+      handler(absl::MakeSpan(data.data(), num_bytes));
+    }
+    for (size_t i = 0; i < num_handles; ++i) {
+      if (Ref<APIObject> object = APIObject::TakeFromHandle(handles[i])) {
+        object->Close();
+      }
+    }
+    ++num_parcels;
+  }
+}
+
+}  // namespace
+
+// static
+TransportReplayer::Result TransportReplayer::Replay(
+    const IpczDriver& driver,
+    absl::Span<const TransportCaptureRecord> records,
+    const Options& options) {
+  Ref<Node> node = MakeRefCounted<Node>(Node::Type::kNormal, driver);
+
+  IpczDriverHandle handle, peer_handle;
+  IpczResult result = driver.CreateTransports(
+      IPCZ_INVALID_DRIVER_HANDLE, IPCZ_INVALID_DRIVER_HANDLE, IPCZ_NO_FLAGS,
+      nullptr, &handle, &peer_handle);
+  ABSL_ASSERT(result == IPCZ_RESULT_OK);
+  auto transport =
+      MakeRefCounted<DriverTransport>(DriverObject(driver, handle));
+  auto peer =
+      MakeRefCounted<DriverTransport>(DriverObject(driver, peer_handle));
+  peer->set_listener(MakeRefCounted<StubPeer>());
+  peer->Activate();
+
+  DriverMemoryWithMapping buffer = NodeLinkMemory::AllocateMemory(driver);
+  ABSL_ASSERT(buffer.mapping.is_valid());
+  const NodeName remote_name = node->GenerateRandomName();
+  Ref<NodeLink> link = NodeLink::CreateInactive(
+      node, LinkSide::kB, node->GenerateRandomName(), remote_name,
+      Node::Type::kNormal, 0, transport,
+      NodeLinkMemory::Create(node, std::move(buffer.mapping)));
+  node->AddConnection(remote_name, {.link = link});
+  link->Activate();
+
+  const OperationContext context{OperationContext::kTransportNotification};
+  std::vector<Ref<Router>> routers;
+  const size_t num_portals = std::min(options.num_initial_portals,
+                                      NodeLinkMemory::kMaxInitialPortals);
+  for (size_t i = 0; i < num_portals; ++i) {
+    auto router = MakeRefCounted<Router>();
+    router->SetOutwardLink(
+        context, link->AddRemoteRouterLink(
+                     context, SublinkId(i),
+                     link->memory().GetInitialRouterLinkState(i),
+                     LinkType::kCentral, LinkSide::kB, router));
+    routers.push_back(std::move(router));
+  }
+
+  Result replay_result;
+  const absl::Time start_time = absl::Now();
+  std::optional<int64_t> first_record_time;
+  for (const TransportCaptureRecord& record : records) {
+    if (record.transport_id != options.transport_id ||
+        record.type == TransportCaptureRecord::Type::kReceive) {
+      continue;
+    }
+
+    if (options.preserve_timing) {
+      if (!first_record_time) {
+        first_record_time = record.time;
+      }
+      absl::SleepFor(start_time +
+                     absl::Nanoseconds(record.time - *first_record_time) -
+                     absl::Now());
+    }
+
+    if (record.type == TransportCaptureRecord::Type::kFragment) {
+      const Fragment fragment = link->memory().GetFragment(FragmentDescriptor(
+          record.buffer_id, record.offset,
+          static_cast<uint32_t>(record.data.size())));
+      if (fragment.is_addressable()) {
+        memcpy(fragment.mutable_bytes().data(), record.data.data(),
+               record.data.size());
+        ++replay_result.num_fragments_restored;
+      } else {
+        ++replay_result.num_fragments_dropped;
+      }
+      continue;
+    }
+
+    if (record.num_driver_objects > 0) {
+      ++replay_result.num_messages_skipped;
+      continue;
+    }
+
+    if (transport->Notify({.data = record.data})) {
+      ++replay_result.num_messages_replayed;
+    } else {
+      ++replay_result.num_messages_rejected;
+    }
+    for (const Ref<Router>& router : routers) {
+      replay_result.num_parcels_received +=
+          DrainParcels(*router, options.parcel_handler);
+    }
+  }
+  replay_result.elapsed = absl::Now() - start_time;
+
+  for (const Ref<Router>& router : routers) {
+    router->CloseRoute();
+  }
+  node->Close();
+  peer->Deactivate();
+  return replay_result;
+}
+
+}  // namespace ipcz
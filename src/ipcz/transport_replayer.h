@@ -0,0 +1,90 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_TRANSPORT_REPLAYER_H_
+#define IPCZ_SRC_IPCZ_TRANSPORT_REPLAYER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "ipcz/ipcz.h"
+#include "ipcz/transport_capture.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz {
+
+// Feeds the messages transmitted over one captured transport into a fresh
+// NodeLink, as if that NodeLink were the transport's remote end. This allows
+// the handling of real traffic to be profiled without the processes which
+// produced it. Anything the NodeLink transmits in response goes to a stub peer
+// which discards it.
+//
+// Replay is necessarily approximate. Captured fragment contents are restored
+// into the replaying link's memory before the messages which reference them,
+// but only within buffers the replaying link has itself; any other state the
+// original nodes kept in shared memory starts out fresh. Messages which carried
+// driver objects are skipped, since the objects themselves aren't captured, and
+// messages which refer to other nodes (e.g. introductions) fail as they would
+// for any unknown node.
+class TransportReplayer {
+ public:
+  // Receives the data of each parcel retrieved from an initial portal during
+  // replay.
+  using ParcelHandler = std::function<void(absl::Span<const uint8_t> data)>;
+
+  struct Options {
+    // Identifies the transport whose transmitted messages are to be replayed.
+    // See TransportCaptureRecord::transport_id.
+    uint64_t transport_id = 0;
+
+    // If true, messages are replayed at the same relative times they were
+    // captured. Otherwise they're replayed as fast as possible.
+    bool preserve_timing = false;
+
+    // The number of portals bound to the replaying link before replay begins,
+    // standing in for the initial portals of the captured connection. Parcels
+    // arriving for these portals are retrieved and discarded as they arrive.
+    size_t num_initial_portals = 1;
+
+    // If set, invoked with the data of each parcel retrieved from an initial
+    // portal, in order of retrieval, before the parcel is discarded.
+    ParcelHandler parcel_handler;
+  };
+
+  struct Result {
+    // Messages accepted by the replaying NodeLink.
+    size_t num_messages_replayed = 0;
+
+    // Messages rejected by the replaying NodeLink, e.g. because they were part
+    // of the handshake which preceded the captured NodeLink, or because they
+    // referred to state which replay could not reproduce.
+    size_t num_messages_rejected = 0;
+
+    // Messages not replayed because they carried driver objects.
+    size_t num_messages_skipped = 0;
+
+    // Captured fragments which were or weren't restored into the replaying
+    // link's memory.
+    size_t num_fragments_restored = 0;
+    size_t num_fragments_dropped = 0;
+
+    // Parcels retrieved from the initial portals.
+    size_t num_parcels_received = 0;
+
+    // Time spent replaying, excluding setup and teardown.
+    absl::Duration elapsed;
+  };
+
+  // Replays `records` according to `options`, using `driver` for the
+  // replaying link's transport and memory.
+  static Result Replay(const IpczDriver& driver,
+                       absl::Span<const TransportCaptureRecord> records,
+                       const Options& options);
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_TRANSPORT_REPLAYER_H_
@@ -4,23 +4,120 @@
 
 #include "ipcz/trap_event_dispatcher.h"
 
+#include <utility>
+
+#include "third_party/abseil-cpp/absl/base/macros.h"
+
 namespace ipcz {
 
+PersistentTrapEvent::PersistentTrapEvent() = default;
+
+PersistentTrapEvent::~PersistentTrapEvent() = default;
+
+bool PersistentTrapEvent::Fire(IpczTrapConditionFlags flags,
+                               const IpczPortalStatus& status) {
+  absl::MutexLock lock(&mutex_);
+  ABSL_ASSERT(!is_removed_);
+  flags_ |= flags;
+  status_ = status;
+  if (is_dispatch_pending_) {
+    return false;
+  }
+  is_dispatch_pending_ = true;
+  return true;
+}
+
+bool PersistentTrapEvent::Remove() {
+  absl::MutexLock lock(&mutex_);
+  is_removed_ = true;
+
+  // Forced trap removal implies the portal has been invalidated by closure or
+  // transfer, or the application is no longer interested in the trap. In any
+  // case, any undispatched conditions and status are meaningless.
+  flags_ = IPCZ_TRAP_REMOVED;
+  status_ = {.size = sizeof(status_)};
+  if (is_dispatch_pending_) {
+    return false;
+  }
+  is_dispatch_pending_ = true;
+  return true;
+}
+
+bool PersistentTrapEvent::TakeForDispatch(IpczTrapConditionFlags& flags,
+                                          IpczPortalStatus& status) {
+  absl::MutexLock lock(&mutex_);
+  if (flags_ == IPCZ_NO_FLAGS) {
+    is_dispatch_pending_ = false;
+    return false;
+  }
+
+  flags = std::exchange(flags_, IPCZ_NO_FLAGS);
+  status = status_;
+  return true;
+}
+
 TrapEventDispatcher::TrapEventDispatcher() = default;
 
+TrapEventDispatcher::TrapEventDispatcher(const OperationContext& context)
+    : outer_dispatcher_(context.trap_event_dispatcher()) {}
+
 TrapEventDispatcher::~TrapEventDispatcher() {
   DispatchAll();
 }
 
 void TrapEventDispatcher::DeferEvent(IpczTrapEventHandler handler,
+                                     IpczTrapBatchEventHandler batch_handler,
                                      uintptr_t context,
                                      IpczTrapConditionFlags flags,
                                      const IpczPortalStatus& status) {
-  events_.emplace_back(handler, context, flags, status);
+  if (outer_dispatcher_) {
+    outer_dispatcher_->DeferEvent(handler, batch_handler, context, flags,
+                                  status);
+    return;
+  }
+  events_.emplace_back(handler, batch_handler, context, flags, status);
+}
+
+void TrapEventDispatcher::DeferPersistentEvent(
+    IpczTrapEventHandler handler,
+    IpczTrapBatchEventHandler batch_handler,
+    uintptr_t context,
+    IpczTrapConditionFlags flags,
+    Ref<PersistentTrapEvent> event) {
+  if (outer_dispatcher_) {
+    outer_dispatcher_->DeferPersistentEvent(handler, batch_handler, context,
+                                            flags, std::move(event));
+    return;
+  }
+  events_.emplace_back(handler, batch_handler, context, flags,
+                       std::move(event));
 }
 
 void TrapEventDispatcher::DispatchAll() {
-  for (const Event& event : events_) {
+  for (size_t i = 0; i < events_.size(); ++i) {
+    const Event& event = events_[i];
+    if (event.batch_handler) {
+      if (!event.batched) {
+        DispatchBatch(i);
+      }
+      continue;
+    }
+
+    if (event.persistent_event) {
+      IpczTrapConditionFlags flags;
+      IpczPortalStatus status;
+      while (event.persistent_event->TakeForDispatch(flags, status)) {
+        const IpczTrapEvent trap_event = {
+            .size = sizeof(trap_event),
+            .context = event.context,
+            .condition_flags = flags | event.flags,
+            .status = &status,
+        };
+        event.handler(&trap_event);
+      }
+      continue;
+    }
+
     const IpczTrapEvent trap_event = {
         .size = sizeof(trap_event),
         .context = event.context,
@@ -31,13 +128,81 @@ void TrapEventDispatcher::DispatchAll() {
   }
 }
 
+void TrapEventDispatcher::DispatchBatch(size_t index) {
+  const IpczTrapBatchEventHandler batch_handler = events_[index].batch_handler;
+  absl::InlinedVector<const Event*, 8> batch;
+  for (size_t i = index; i < events_.size(); ++i) {
+    Event& event = events_[i];
+    if (event.batch_handler == batch_handler) {
+      event.batched = true;
+      batch.push_back(&event);
+    }
+  }
+
+  // Persistent events may accumulate new state while the batch handler runs.
+  // Those are collected into a follow-up batch, and so on until no persistent
+  // event in the batch has anything left to dispatch.
+  absl::InlinedVector<IpczPortalStatus, 8> statuses;
+  absl::InlinedVector<IpczTrapEvent, 8> trap_events;
+  absl::InlinedVector<const Event*, 8> next_batch;
+  while (!batch.empty()) {
+    statuses.clear();
+    trap_events.clear();
+    next_batch.clear();
+    statuses.reserve(batch.size());
+    for (const Event* event : batch) {
+      IpczTrapConditionFlags flags = event->flags;
+      if (event->persistent_event) {
+        IpczTrapConditionFlags persistent_flags;
+        IpczPortalStatus& status = statuses.emplace_back();
+        if (!event->persistent_event->TakeForDispatch(persistent_flags,
+                                                      status)) {
+          statuses.pop_back();
+          continue;
+        }
+        flags |= persistent_flags;
+        next_batch.push_back(event);
+      } else {
+        statuses.push_back(event->status);
+      }
+      trap_events.push_back({
+          .size = sizeof(IpczTrapEvent),
+          .context = event->context,
+          .condition_flags = flags,
+          .status = &statuses.back(),
+      });
+    }
+    if (!trap_events.empty()) {
+      batch_handler(trap_events.data(), trap_events.size());
+    }
+    batch.swap(next_batch);
+  }
+}
+
 TrapEventDispatcher::Event::Event() = default;
 
 TrapEventDispatcher::Event::Event(IpczTrapEventHandler handler,
+                                  IpczTrapBatchEventHandler batch_handler,
                                   uintptr_t context,
                                   IpczTrapConditionFlags flags,
                                   IpczPortalStatus status)
-    : handler(handler), context(context), flags(flags), status(status) {}
+    : handler(handler),
+      batch_handler(batch_handler),
+      context(context),
+      flags(flags),
+      status(status) {}
+
+TrapEventDispatcher::Event::Event(IpczTrapEventHandler handler,
+                                  IpczTrapBatchEventHandler batch_handler,
+                                  uintptr_t context,
+                                  IpczTrapConditionFlags flags,
+                                  Ref<PersistentTrapEvent> persistent_event)
+    : handler(handler),
+      batch_handler(batch_handler),
+      context(context),
+      flags(flags),
+      status({.size = sizeof(status)}),
+      persistent_event(std::move(persistent_event)) {}
 
 TrapEventDispatcher::Event::Event(const Event&) = default;
 
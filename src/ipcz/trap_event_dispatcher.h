@@ -8,32 +8,95 @@
 #include <cstdint>
 
 #include "ipcz/ipcz.h"
+#include "ipcz/operation_context.h"
+#include "third_party/abseil-cpp/absl/base/thread_annotations.h"
 #include "third_party/abseil-cpp/absl/container/inlined_vector.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
 #include "util/ref_counted.h"
 
 namespace ipcz {
 
+// Event state shared between a persistent trap and any TrapEventDispatcher
+// which has a dispatch of that trap's events pending. This is used to coalesce
+// repeated firings of a persistent trap into a single handler invocation, and
+// to ensure that a persistent trap's handler is never invoked concurrently with
+// itself.
+class PersistentTrapEvent : public RefCounted<PersistentTrapEvent> {
+ public:
+  PersistentTrapEvent();
+
+  // Merges `flags` and `status` into this event. Returns true if the caller
+  // must defer a new dispatch of this event, or false if a dispatch is already
+  // pending or in progress and will pick up the merged state.
+  bool Fire(IpczTrapConditionFlags flags, const IpczPortalStatus& status);
+
+  // Discards any merged conditions and replaces them with IPCZ_TRAP_REMOVED.
+  // No further calls to Fire() may be made after this. Returns true if the
+  // caller must defer a new dispatch of this event, as with Fire().
+  bool Remove();
+
+  // Takes the currently merged condition flags and status for dispatch. If
+  // there are none, this returns false and marks the event as no longer
+  // pending, so that the next Fire() will elicit a new dispatch.
+  bool TakeForDispatch(IpczTrapConditionFlags& flags, IpczPortalStatus& status);
+
+ private:
+  friend class RefCounted<PersistentTrapEvent>;
+
+  ~PersistentTrapEvent();
+
+  absl::Mutex mutex_;
+  bool is_dispatch_pending_ ABSL_GUARDED_BY(mutex_) = false;
+  bool is_removed_ ABSL_GUARDED_BY(mutex_) = false;
+  IpczTrapConditionFlags flags_ ABSL_GUARDED_BY(mutex_) = IPCZ_NO_FLAGS;
+  IpczPortalStatus status_ ABSL_GUARDED_BY(mutex_) = {.size = sizeof(status_)};
+};
+
 // Accumulates IpczTrapEvent dispatches to specific handlers. Handler invocation
 // is deferred until DispatchAll() is called or the TrapEventDispatcher is
 // destroyed. This allows event dispatches to be accumulated while e.g. Node and
 // Router locks are held, and dispatched later, once such locks are released.
 //
+// Events for traps with a batch handler are grouped by that handler, so each
+// batch handler is invoked once with every event accumulated for it. For
+// maximum batching, an OperationContext may carry a TrapEventDispatcher which
+// accumulates events for the whole operation. See OperationContext.
+//
 // This object is not thread-safe but is generally constructed on the stack and
 // passed into whatever might want to accumulate events for dispatch.
 class TrapEventDispatcher {
  public:
   TrapEventDispatcher();
+
+  // Constructs a TrapEventDispatcher which forwards all of its events to the
+  // TrapEventDispatcher of `context`, if it has one. Otherwise this behaves
+  // like a default-constructed TrapEventDispatcher.
+  explicit TrapEventDispatcher(const OperationContext& context);
+
   TrapEventDispatcher(const TrapEventDispatcher&) = delete;
   TrapEventDispatcher& operator=(const TrapEventDispatcher&) = delete;
   ~TrapEventDispatcher();
 
   // Schedules a new event for dispatch by this object as soon as DispatchAll()
-  // is explicitly called or the TrapEventDispatcher is destroyed.
+  // is explicitly called or the TrapEventDispatcher is destroyed. If
+  // `batch_handler` is non-null, it's used instead of `handler`.
   void DeferEvent(IpczTrapEventHandler handler,
+                  IpczTrapBatchEventHandler batch_handler,
                   uintptr_t context,
                   IpczTrapConditionFlags flags,
                   const IpczPortalStatus& status);
 
+  // Schedules dispatch of a persistent trap's coalesced `event`. This must only
+  // be called when PersistentTrapEvent::Fire() or Remove() returns true. The
+  // handler is invoked repeatedly with the event's merged state until no more
+  // state is merged into it. `flags` is combined with the flags of each
+  // invocation and should convey only IPCZ_TRAP_WITHIN_API_CALL if applicable.
+  void DeferPersistentEvent(IpczTrapEventHandler handler,
+                            IpczTrapBatchEventHandler batch_handler,
+                            uintptr_t context,
+                            IpczTrapConditionFlags flags,
+                            Ref<PersistentTrapEvent> event);
+
   // Dispatches any events deferred by DeferEvent() above.
   void DispatchAll();
 
@@ -42,23 +105,44 @@ class TrapEventDispatcher {
   struct Event {
     Event();
     Event(IpczTrapEventHandler handler,
+          IpczTrapBatchEventHandler batch_handler,
           uintptr_t context,
           IpczTrapConditionFlags flags,
           IpczPortalStatus status);
+    Event(IpczTrapEventHandler handler,
+          IpczTrapBatchEventHandler batch_handler,
+          uintptr_t context,
+          IpczTrapConditionFlags flags,
+          Ref<PersistentTrapEvent> persistent_event);
     Event(const Event&);
     Event& operator=(const Event&);
     ~Event();
 
     IpczTrapEventHandler handler;
+    IpczTrapBatchEventHandler batch_handler;
     uintptr_t context;
     IpczTrapConditionFlags flags;
     IpczPortalStatus status;
+
+    // Non-null only for events deferred by DeferPersistentEvent(). In that
+    // case `status` is unused and the dispatched state is taken from here.
+    Ref<PersistentTrapEvent> persistent_event;
+
+    // Set once a batched event has been dispatched as part of a batch.
+    bool batched = false;
   };
 
+  // Dispatches the event at `events_[index]` along with every subsequent event
+  // which shares its batch handler, in a single batch handler invocation.
+  void DispatchBatch(size_t index);
+
   // Space for four events should avoid heap allocations in the vast majority of
   // cases where we accumulate events for imminent dispatch.
   using DeferredEventQueue = absl::InlinedVector<Event, 4>;
   DeferredEventQueue events_;
+
+  // If non-null, all events deferred on this object are forwarded here.
+  TrapEventDispatcher* const outer_dispatcher_ = nullptr;
 };
 
 }  // namespace ipcz
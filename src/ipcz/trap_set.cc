@@ -15,25 +15,44 @@
 
 namespace ipcz {
 
+namespace {
+
+// Conditions which persistent traps observe only on transitions from an
+// unsatisfied to a satisfied state.
+constexpr IpczTrapConditionFlags kLevelTriggeredConditions =
+    IPCZ_TRAP_PEER_CLOSED | IPCZ_TRAP_DEAD | IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS |
+    IPCZ_TRAP_ABOVE_MIN_LOCAL_BYTES;
+
+}  // namespace
+
 TrapSet::TrapSet() = default;
 
 TrapSet::~TrapSet() {
   ABSL_ASSERT(empty());
 }
 
+bool TrapSet::IsWatchingPeerClosure() const {
+  return std::any_of(traps_.begin(), traps_.end(), [](const Trap& trap) {
+    return (trap.conditions.flags & (IPCZ_TRAP_PEER_CLOSED | IPCZ_TRAP_DEAD)) !=
+           0;
+  });
+}
+
 IpczResult TrapSet::Add(const IpczTrapConditions& conditions,
                         IpczTrapEventHandler handler,
+                        IpczTrapBatchEventHandler batch_handler,
                         uintptr_t context,
+                        IpczTrapFlags flags,
                         IpczPortalStatusFlags status_flags,
                         ParcelQueue& inbound_parcel_queue,
                         IpczTrapConditionFlags* satisfied_condition_flags,
                         IpczPortalStatus* status) {
-  IpczTrapConditionFlags flags = GetSatisfiedConditionsForUpdate(
+  IpczTrapConditionFlags satisfied_flags = GetSatisfiedConditionsForUpdate(
       conditions, status_flags, inbound_parcel_queue,
       UpdateReason::kInstallTrap);
-  if (flags != 0) {
+  if (satisfied_flags != 0) {
     if (satisfied_condition_flags) {
-      *satisfied_condition_flags = flags;
+      *satisfied_condition_flags = satisfied_flags;
     }
     if (status) {
       // The `size` field is updated to reflect how many bytes are actually
@@ -49,7 +68,12 @@ IpczResult TrapSet::Add(const IpczTrapConditions& conditions,
     return IPCZ_RESULT_FAILED_PRECONDITION;
   }
 
-  traps_.emplace_back(conditions, handler, context);
+  Ref<PersistentTrapEvent> persistent_event;
+  if (flags & IPCZ_TRAP_FLAG_PERSISTENT) {
+    persistent_event = MakeRefCounted<PersistentTrapEvent>();
+  }
+  traps_.emplace_back(conditions, handler, batch_handler, context,
+                      std::move(persistent_event));
   return IPCZ_RESULT_OK;
 }
 
@@ -77,6 +101,37 @@ void TrapSet::NotifyPeerClosed(const OperationContext& context,
                      UpdateReason::kPeerClosed, dispatcher);
 }
 
+bool TrapSet::Remove(const OperationContext& context,
+                     IpczTrapEventHandler handler,
+                     IpczTrapBatchEventHandler batch_handler,
+                     uintptr_t trap_context,
+                     TrapEventDispatcher& dispatcher) {
+  IpczTrapConditionFlags flags = IPCZ_TRAP_REMOVED;
+  if (context.is_api_call()) {
+    flags |= IPCZ_TRAP_WITHIN_API_CALL;
+  }
+
+  const IpczPortalStatus status{
+      .size = sizeof(status),
+      .flags = IPCZ_NO_FLAGS,
+      .num_local_parcels = 0,
+      .num_local_bytes = 0,
+  };
+  bool removed_any = false;
+  for (auto it = traps_.begin(); it != traps_.end();) {
+    if (it->handler != handler || it->batch_handler != batch_handler ||
+        it->context != trap_context) {
+      ++it;
+      continue;
+    }
+
+    DeferEventForTrap(*it, flags, status, dispatcher);
+    it = traps_.erase(it);
+    removed_any = true;
+  }
+  return removed_any;
+}
+
 void TrapSet::RemoveAll(const OperationContext& context,
                         TrapEventDispatcher& dispatcher) {
   IpczTrapConditionFlags flags = IPCZ_TRAP_REMOVED;
@@ -93,7 +148,7 @@ void TrapSet::RemoveAll(const OperationContext& context,
       .num_local_bytes = 0,
   };
   for (const Trap& trap : traps_) {
-    dispatcher.DeferEvent(trap.handler, trap.context, flags, status);
+    DeferEventForTrap(trap, flags, status, dispatcher);
   }
   traps_.clear();
 }
@@ -135,9 +190,16 @@ void TrapSet::UpdatePortalStatus(const OperationContext& context,
                                  UpdateReason reason,
                                  TrapEventDispatcher& dispatcher) {
   for (auto it = traps_.begin(); it != traps_.end();) {
-    const Trap& trap = *it;
+    Trap& trap = *it;
     IpczTrapConditionFlags flags = GetSatisfiedConditionsForUpdate(
         trap.conditions, status_flags, inbound_parcel_queue, reason);
+    if (trap.persistent_event) {
+      // Persistent traps only fire on edges, so filter out any level-triggered
+      // conditions which were already satisfied on the last update.
+      const IpczTrapConditionFlags levels = flags & kLevelTriggeredConditions;
+      flags &= ~trap.satisfied_levels;
+      trap.satisfied_levels = levels;
+    }
     if (!flags) {
       ++it;
       continue;
@@ -153,15 +215,57 @@ void TrapSet::UpdatePortalStatus(const OperationContext& context,
         .num_local_parcels = inbound_parcel_queue.GetNumAvailableElements(),
         .num_local_bytes = inbound_parcel_queue.GetTotalAvailableElementSize(),
     };
-    dispatcher.DeferEvent(trap.handler, trap.context, flags, status);
-    it = traps_.erase(it);
+    DeferEventForTrap(trap, flags, status, dispatcher);
+    if (trap.persistent_event) {
+      ++it;
+    } else {
+      it = traps_.erase(it);
+    }
+  }
+}
+
+void TrapSet::DeferEventForTrap(const Trap& trap,
+                                IpczTrapConditionFlags flags,
+                                const IpczPortalStatus& status,
+                                TrapEventDispatcher& dispatcher) {
+  if (!trap.persistent_event) {
+    dispatcher.DeferEvent(trap.handler, trap.batch_handler, trap.context,
+                          flags, status);
+    return;
+  }
+
+  // IPCZ_TRAP_WITHIN_API_CALL describes the stack on which an event is
+  // dispatched, so it's not merged into the coalesced event state. It's instead
+  // attached to the deferred dispatch, which always runs on this stack.
+  const IpczTrapConditionFlags api_call_flag =
+      flags & IPCZ_TRAP_WITHIN_API_CALL;
+  const IpczTrapConditionFlags condition_flags =
+      flags & ~IPCZ_TRAP_WITHIN_API_CALL;
+  const bool needs_dispatch =
+      (condition_flags & IPCZ_TRAP_REMOVED)
+          ? trap.persistent_event->Remove()
+          : trap.persistent_event->Fire(condition_flags, status);
+  if (needs_dispatch) {
+    dispatcher.DeferPersistentEvent(trap.handler, trap.batch_handler,
+                                    trap.context, api_call_flag,
+                                    trap.persistent_event);
   }
 }
 
 TrapSet::Trap::Trap(IpczTrapConditions conditions,
                     IpczTrapEventHandler handler,
-                    uintptr_t context)
-    : conditions(conditions), handler(handler), context(context) {}
+                    IpczTrapBatchEventHandler batch_handler,
+                    uintptr_t context,
+                    Ref<PersistentTrapEvent> persistent_event)
+    : conditions(conditions),
+      handler(handler),
+      batch_handler(batch_handler),
+      context(context),
+      persistent_event(std::move(persistent_event)) {}
+
+TrapSet::Trap::Trap(Trap&&) = default;
+
+TrapSet::Trap& TrapSet::Trap::operator=(Trap&&) = default;
 
 TrapSet::Trap::~Trap() = default;
 
@@ -10,12 +10,12 @@
 #include "ipcz/ipcz.h"
 #include "ipcz/operation_context.h"
 #include "ipcz/parcel_queue.h"
+#include "ipcz/trap_event_dispatcher.h"
 #include "third_party/abseil-cpp/absl/container/inlined_vector.h"
+#include "util/ref_counted.h"
 
 namespace ipcz {
 
-class TrapEventDispatcher;
-
 // A set of traps installed on a portal.
 class TrapSet {
  public:
@@ -28,46 +28,67 @@ class TrapSet {
 
   bool empty() const { return traps_.empty(); }
 
+  // Indicates whether any trap in the set watches for closure of the portal's
+  // peer, i.e. for IPCZ_TRAP_PEER_CLOSED or IPCZ_TRAP_DEAD.
+  bool IsWatchingPeerClosure() const;
+
   // Attempts to install a new trap in the set. This effectively implements
   // the ipcz Trap() API. `status_flags`, `num_local_parcels`, and
   // `num_local_bytes` convey the current status of the portal. If `conditions`
   // are already met, returns IPCZ_RESULT_FAILED_PRECONDITION and populates
-  // `satisfied_condition_flags` and/or `status` if non-null.
+  // `satisfied_condition_flags` and/or `status` if non-null. If `flags`
+  // includes IPCZ_TRAP_FLAG_PERSISTENT, the trap remains in the set after it
+  // fires and its events are coalesced. If `batch_handler` is non-null, it's
+  // invoked for the trap's events in place of `handler`.
   IpczResult Add(const IpczTrapConditions& conditions,
                  IpczTrapEventHandler handler,
+                 IpczTrapBatchEventHandler batch_handler,
                  uintptr_t context,
+                 IpczTrapFlags flags,
                  IpczPortalStatusFlags status_flags,
                  ParcelQueue& inbound_parcel_queue,
                  IpczTrapConditionFlags* satisfied_condition_flags,
                  IpczPortalStatus* status);
 
   // Notifies the TrapSet that a new local parcel has arrived on its portal.
-  // Any trap interested in this is removed from the set, and its event handler
-  // invocation is appended to `dispatcher`. `status_flags`, `num_local_parcels`
-  // and `num_local_bytes` convey the new status of the portal.
+  // Any trap interested in this has its event handler invocation appended to
+  // `dispatcher`, and is removed from the set unless it's persistent.
+  // `status_flags` and `inbound_parcel_queue` convey the new status of the
+  // portal.
   void NotifyNewLocalParcel(const OperationContext& context,
                             IpczPortalStatusFlags status_flags,
                             ParcelQueue& inbound_parcel_queue,
                             TrapEventDispatcher& dispatcher);
 
   // Notifies the TrapSet that a local parcel has been consumed from its portal.
-  // Any trap interested in this is removed from the set, and its event handler
-  // invocation is appended to `dispatcher`. `status_flags`, `num_local_parcels`
-  // and `num_local_bytes` convey the new status of the portal.
+  // Any trap interested in this has its event handler invocation appended to
+  // `dispatcher`, and is removed from the set unless it's persistent.
+  // `status_flags` and `inbound_parcel_queue` convey the new status of the
+  // portal.
   void NotifyLocalParcelConsumed(const OperationContext& context,
                                  IpczPortalStatusFlags status_flags,
                                  ParcelQueue& inbound_parcel_queue,
                                  TrapEventDispatcher& dispatcher);
 
   // Notifies the TrapSet that its portal's peer has been closed. Any trap
-  // interested in this is removed from the set, and its event handler
-  // invocation is appended to `dispatcher`. `status_flags` conveys the new
-  // status of the portal.
+  // interested in this has its event handler invocation appended to
+  // `dispatcher`, and is removed from the set unless it's persistent.
+  // `status_flags` conveys the new status of the portal.
   void NotifyPeerClosed(const OperationContext& context,
                         IpczPortalStatusFlags status_flags,
                         ParcelQueue& inbound_parcel_queue,
                         TrapEventDispatcher& dispatcher);
 
+  // Removes every trap installed with the given `handler`, `batch_handler`,
+  // and `context`. Each removed trap appends an IPCZ_TRAP_REMOVED event to
+  // `dispatcher`. Returns true if any trap was removed, or false if no such
+  // trap was found.
+  bool Remove(const OperationContext& context,
+              IpczTrapEventHandler handler,
+              IpczTrapBatchEventHandler batch_handler,
+              uintptr_t trap_context,
+              TrapEventDispatcher& dispatcher);
+
   // Immediately removes all traps from the set. Every trap present appends an
   // IPCZ_TRAP_REMOVED event to `dispatcher` before removal.
   void RemoveAll(const OperationContext& context,
@@ -77,14 +98,34 @@ class TrapSet {
   struct Trap {
     Trap(IpczTrapConditions conditions,
          IpczTrapEventHandler handler,
-         uintptr_t context);
+         IpczTrapBatchEventHandler batch_handler,
+         uintptr_t context,
+         Ref<PersistentTrapEvent> persistent_event);
+    Trap(Trap&&);
+    Trap& operator=(Trap&&);
     ~Trap();
 
     IpczTrapConditions conditions;
     IpczTrapEventHandler handler;
+    IpczTrapBatchEventHandler batch_handler;
     uintptr_t context;
+
+    // Non-null if and only if this is a persistent trap.
+    Ref<PersistentTrapEvent> persistent_event;
+
+    // For persistent traps only, the level-triggered conditions which were
+    // satisfied as of the most recent update. These conditions do not fire
+    // again until they are first observed to be unsatisfied.
+    IpczTrapConditionFlags satisfied_levels = IPCZ_NO_FLAGS;
   };
 
+  // Appends an event for `trap` to `dispatcher`, given the condition `flags`
+  // which triggered it and the current portal `status`.
+  void DeferEventForTrap(const Trap& trap,
+                         IpczTrapConditionFlags flags,
+                         const IpczPortalStatus& status,
+                         TrapEventDispatcher& dispatcher);
+
   // The reason for each status update when something happens that might
   // interest a trap.
   enum class UpdateReason {
@@ -0,0 +1,127 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "ipcz/ipcz.h"
+#include "ipcz/node_messages.h"
+#include "test/multinode_test.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace ipcz {
+namespace {
+
+using NodeStatsTestNode = test::TestNode;
+using NodeStatsTest = test::MultinodeTest<NodeStatsTestNode>;
+
+constexpr std::string_view kMessage = "hello";
+
+MULTINODE_TEST_NODE(NodeStatsTestNode, EchoClient) {
+  IpczHandle b = ConnectToBroker();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, WaitToGetString(b)));
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED));
+  Close(b);
+}
+
+MULTINODE_TEST(NodeStatsTest, LinkTraffic) {
+  IpczHandle c = SpawnTestNode<EchoClient>();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, kMessage));
+  EXPECT_EQ(kMessage, WaitToGetString(c));
+
+  // With no room for link stats, only the number of links is reported.
+  IpczNodeStats stats = {.size = sizeof(stats)};
+  size_t num_link_stats = 0;
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            ipcz().QueryNodeStats(node(), IPCZ_NO_FLAGS, nullptr, &stats,
+                                  nullptr, &num_link_stats));
+  EXPECT_EQ(1u, stats.num_links);
+  EXPECT_EQ(1u, num_link_stats);
+
+  IpczNodeLinkStats link_stats = {.size = sizeof(link_stats)};
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryNodeStats(node(), IPCZ_NO_FLAGS, nullptr, &stats,
+                                  &link_stats, &num_link_stats));
+  EXPECT_EQ(1u, num_link_stats);
+  EXPECT_EQ(sizeof(link_stats), link_stats.size);
+
+  // The portal to the client is the only router bound to the link, and it
+  // isn't proxying for anyone.
+  EXPECT_EQ(1u, stats.num_routers);
+  EXPECT_EQ(0u, stats.num_proxies);
+
+  // Our parcel went out and the client's echo came back, each in at least one
+  // AcceptParcel message.
+  EXPECT_LE(1u, link_stats.messages[msg::AcceptParcel::kId].num_sent);
+  EXPECT_LE(1u, link_stats.messages[msg::AcceptParcel::kId].num_received);
+  EXPECT_LE(kMessage.size(),
+            link_stats.messages[msg::AcceptParcel::kId].num_bytes_sent);
+  EXPECT_LE(1u, link_stats.num_inlined_parcels_sent +
+                    link_stats.num_fragment_parcels_sent);
+  EXPECT_EQ(0u, link_stats.num_messages_relayed);
+
+  uint64_t num_messages_sent = 0;
+  uint64_t num_messages_received = 0;
+  for (const IpczMessageStats& message_stats : link_stats.messages) {
+    num_messages_sent += message_stats.num_sent;
+    num_messages_received += message_stats.num_received;
+  }
+  EXPECT_EQ(num_messages_sent, link_stats.num_messages_sent);
+  EXPECT_EQ(num_messages_received, link_stats.num_messages_received);
+
+  // Every link has a primary buffer with at least one block size.
+  EXPECT_LT(0u, link_stats.shared_memory_size);
+  EXPECT_LT(0u, link_stats.num_block_sizes);
+  for (size_t i = 1; i < link_stats.num_block_sizes; ++i) {
+    EXPECT_LT(link_stats.blocks[i - 1].block_size,
+              link_stats.blocks[i].block_size);
+  }
+
+  Close(c);
+}
+
+MULTINODE_TEST(NodeStatsTest, LargerLinkStats) {
+  // Simulates a caller built against a newer version of ipcz, whose
+  // IpczNodeLinkStats has grown. Trailing fields must be left intact.
+  struct NewerLinkStats {
+    IpczNodeLinkStats stats;
+    uint64_t new_field;
+  };
+
+  IpczHandle c1 = SpawnTestNode<EchoClient>();
+  IpczHandle c2 = SpawnTestNode<EchoClient>();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c1, kMessage));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c2, kMessage));
+  EXPECT_EQ(kMessage, WaitToGetString(c1));
+  EXPECT_EQ(kMessage, WaitToGetString(c2));
+
+  NewerLinkStats link_stats[2];
+  for (NewerLinkStats& element : link_stats) {
+    element.stats.size = sizeof(element);
+    element.new_field = 42;
+  }
+  IpczNodeStats stats = {.size = sizeof(stats)};
+  size_t num_link_stats = 2;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryNodeStats(node(), IPCZ_NO_FLAGS, nullptr, &stats,
+                                  &link_stats[0].stats, &num_link_stats));
+  EXPECT_EQ(2u, stats.num_links);
+  EXPECT_EQ(2u, num_link_stats);
+  for (const NewerLinkStats& element : link_stats) {
+    EXPECT_EQ(sizeof(element), element.stats.size);
+    EXPECT_EQ(42u, element.new_field);
+    EXPECT_LE(1u, element.stats.num_messages_sent);
+  }
+  EXPECT_FALSE(link_stats[0].stats.remote_node_name_high ==
+                   link_stats[1].stats.remote_node_name_high &&
+               link_stats[0].stats.remote_node_name_low ==
+                   link_stats[1].stats.remote_node_name_low);
+
+  CloseAll({c1, c2});
+}
+
+}  // namespace
+}  // namespace ipcz
@@ -0,0 +1,134 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#include "ipcz/ipcz.h"
+#include "reference_drivers/sync_reference_driver.h"
+#include "test/allocation_counter.h"
+#include "test/test.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+#if defined(IPCZ_COUNT_ALLOCATIONS)
+
+namespace ipcz {
+namespace {
+
+using ParcelAllocationTest = test::Test;
+
+const IpczDriver& kDriver = reference_drivers::kSyncReferenceDriver;
+
+using test::ScopedAllocationCounter;
+
+TEST_F(ParcelAllocationTest, SteadyStatePutAndGet) {
+  IpczHandle node = CreateNode(kDriver);
+  auto [a, b] = OpenPortals(node);
+
+  constexpr uint8_t kMessage[] = {1, 2, 3, 4, 5, 6, 7, 8};
+  uint8_t buffer[sizeof(kMessage)];
+  auto put_and_get = [&, a = a, b = b] {
+    EXPECT_EQ(IPCZ_RESULT_OK, ipcz().Put(a, kMessage, sizeof(kMessage),
+                                         nullptr, 0, IPCZ_NO_FLAGS, nullptr));
+    size_t num_bytes = sizeof(buffer);
+    EXPECT_EQ(IPCZ_RESULT_OK, ipcz().Get(b, IPCZ_NO_FLAGS, nullptr, buffer,
+                                         &num_bytes, nullptr, nullptr,
+                                         nullptr));
+  };
+
+  // Warm up any lazily allocated state and caches.
+  for (size_t i = 0; i < 8; ++i) {
+    put_and_get();
+  }
+
+  ScopedAllocationCounter counter;
+  for (size_t i = 0; i < 100; ++i) {
+    put_and_get();
+  }
+  EXPECT_EQ(0u, counter.count());
+
+  CloseAll({a, b, node});
+}
+
+TEST_F(ParcelAllocationTest, SteadyStateGetParcel) {
+  IpczHandle node = CreateNode(kDriver);
+  auto [a, b] = OpenPortals(node);
+
+  constexpr uint8_t kMessage[] = {1, 2, 3, 4};
+  auto put_and_get_parcel = [&, a = a, b = b] {
+    EXPECT_EQ(IPCZ_RESULT_OK, ipcz().Put(a, kMessage, sizeof(kMessage),
+                                         nullptr, 0, IPCZ_NO_FLAGS, nullptr));
+    IpczHandle parcel;
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().Get(b, IPCZ_GET_PARTIAL, nullptr, nullptr, nullptr,
+                         nullptr, nullptr, &parcel));
+    EXPECT_EQ(IPCZ_RESULT_OK, ipcz().Close(parcel, IPCZ_NO_FLAGS, nullptr));
+  };
+
+  for (size_t i = 0; i < 8; ++i) {
+    put_and_get_parcel();
+  }
+
+  ScopedAllocationCounter counter;
+  for (size_t i = 0; i < 100; ++i) {
+    put_and_get_parcel();
+  }
+  EXPECT_EQ(0u, counter.count());
+
+  CloseAll({a, b, node});
+}
+
+TEST_F(ParcelAllocationTest, SteadyStateCrossThreadPutAndGet) {
+  // Parcels are allocated by one thread and freed by another, as when a
+  // transport thread receives parcels which the application then retrieves.
+  // Their storage must still be recycled for the allocating thread.
+  IpczHandle node = CreateNode(kDriver);
+  auto [a, b] = OpenPortals(node);
+
+  constexpr uint8_t kMessage[] = {1, 2, 3, 4, 5, 6, 7, 8};
+  constexpr size_t kNumWarmupParcels = 8;
+  constexpr size_t kNumParcels = kNumWarmupParcels + 100;
+  std::atomic<size_t> num_parcels_received{0};
+  std::thread receiver([&, b = b] {
+    uint8_t buffer[sizeof(kMessage)];
+    for (size_t i = 0; i < kNumParcels; ++i) {
+      size_t num_bytes = sizeof(buffer);
+      EXPECT_EQ(IPCZ_RESULT_OK, ipcz().Get(b, IPCZ_GET_BLOCKING, nullptr,
+                                           buffer, &num_bytes, nullptr, nullptr,
+                                           nullptr));
+      num_parcels_received.store(i + 1, std::memory_order_release);
+    }
+  });
+
+  auto put_and_wait = [&, a = a](size_t i) {
+    EXPECT_EQ(IPCZ_RESULT_OK, ipcz().Put(a, kMessage, sizeof(kMessage),
+                                         nullptr, 0, IPCZ_NO_FLAGS, nullptr));
+    while (num_parcels_received.load(std::memory_order_acquire) <= i) {
+      std::this_thread::yield();
+    }
+  };
+
+  size_t i = 0;
+  for (; i < kNumWarmupParcels; ++i) {
+    put_and_wait(i);
+  }
+
+  {
+    ScopedAllocationCounter counter;
+    for (; i < kNumParcels; ++i) {
+      put_and_wait(i);
+    }
+    EXPECT_EQ(0u, counter.count());
+  }
+
+  receiver.join();
+  CloseAll({a, b, node});
+}
+
+}  // namespace
+}  // namespace ipcz
+
+#endif  // defined(IPCZ_COUNT_ALLOCATIONS)
@@ -0,0 +1,557 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "reference_drivers/simulation_driver.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "ipcz/ipcz.h"
+#include "reference_drivers/object.h"
+#include "reference_drivers/single_process_reference_driver_base.h"
+#include "third_party/abseil-cpp/absl/base/macros.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+#include "util/ref_counted.h"
+
+namespace ipcz::reference_drivers {
+
+namespace {
+
+// The random number generator behind kSimulationDriver's GenerateRandomBytes(),
+// reseeded by each new Simulation so that node names and other random values
+// are reproducible.
+class RandomSource {
+ public:
+  void Seed(uint64_t seed) {
+    absl::MutexLock lock(&mutex_);
+    engine_.seed(seed);
+  }
+
+  void Fill(absl::Span<uint8_t> destination) {
+    absl::MutexLock lock(&mutex_);
+    while (!destination.empty()) {
+      const uint64_t value = engine_();
+      const size_t n = std::min(sizeof(value), destination.size());
+      memcpy(destination.data(), &value, n);
+      destination.remove_prefix(n);
+    }
+  }
+
+ private:
+  absl::Mutex mutex_;
+  std::mt19937_64 engine_ ABSL_GUARDED_BY(mutex_);
+};
+
+RandomSource& GetRandomSource() {
+  static auto* source = new RandomSource();
+  return *source;
+}
+
+// A transport notification in flight. Any driver objects attached to a message
+// which is never delivered are closed along with it.
+class Message {
+ public:
+  Message() = default;
+  Message(absl::Span<const uint8_t> data,
+          absl::Span<const IpczDriverHandle> handles)
+      : data_(data.begin(), data.end()),
+        handles_(handles.begin(), handles.end()) {}
+  explicit Message(IpczTransportActivityFlags flags) : flags_(flags) {}
+  Message(Message&&) = default;
+  Message& operator=(Message&&) = default;
+  ~Message() {
+    for (IpczDriverHandle handle : handles_) {
+      Object::TakeFromHandle(handle)->Close();
+    }
+  }
+
+  size_t size() const { return data_.size(); }
+  bool is_data() const { return flags_ == IPCZ_NO_FLAGS; }
+
+  IpczResult Notify(IpczHandle transport,
+                    IpczTransportActivityHandler handler) {
+    std::vector<IpczDriverHandle> handles = std::move(handles_);
+    return handler(transport, data_.data(), data_.size(), handles.data(),
+                   handles.size(), flags_, nullptr);
+  }
+
+ private:
+  std::vector<uint8_t> data_;
+  std::vector<IpczDriverHandle> handles_;
+  IpczTransportActivityFlags flags_ = IPCZ_NO_FLAGS;
+};
+
+// The driver transport implementation for the simulation driver. Like the
+// async reference driver's transports, each SimulatedTransport holds a direct
+// reference to its peer; but rather than posting transmissions to a thread,
+// it schedules them on the Simulation's virtual clock.
+class SimulatedTransport
+    : public ObjectImpl<SimulatedTransport, Object::kTransport> {
+ public:
+  SimulatedTransport(Ref<Simulation::Scheduler> scheduler,
+                     const SimulatedLinkParameters& params)
+      : scheduler_(std::move(scheduler)), params_(params) {}
+
+  using Pair = std::pair<Ref<SimulatedTransport>, Ref<SimulatedTransport>>;
+  static Pair CreatePair(Ref<Simulation::Scheduler> scheduler,
+                         const SimulatedLinkParameters& params0,
+                         const SimulatedLinkParameters& params1) {
+    Pair pair{MakeRefCounted<SimulatedTransport>(scheduler, params0),
+              MakeRefCounted<SimulatedTransport>(scheduler, params1)};
+    std::tie(pair.second->peer_, pair.first->peer_) = pair;
+    return pair;
+  }
+
+  const Ref<Simulation::Scheduler>& scheduler() const { return scheduler_; }
+
+  void Activate(IpczHandle transport, IpczTransportActivityHandler handler);
+  void Deactivate();
+  void Transmit(absl::Span<const uint8_t> data,
+                absl::Span<const IpczDriverHandle> handles);
+
+  // Called by the Scheduler when `message` arrives at this transport.
+  void Deliver(Message message);
+
+  // Object:
+  IpczResult Close() override;
+
+ private:
+  ~SimulatedTransport() override = default;
+
+  // Schedules `message` to arrive at `peer` according to `params_`.
+  void SendToPeer(Ref<SimulatedTransport> peer, Message message);
+
+  const Ref<Simulation::Scheduler> scheduler_;
+  const SimulatedLinkParameters params_;
+
+  absl::Mutex mutex_;
+  Ref<SimulatedTransport> peer_ ABSL_GUARDED_BY(mutex_);
+  IpczHandle transport_ ABSL_GUARDED_BY(mutex_) = IPCZ_INVALID_HANDLE;
+  IpczTransportActivityHandler handler_ ABSL_GUARDED_BY(mutex_) = nullptr;
+  bool deactivated_ ABSL_GUARDED_BY(mutex_) = false;
+  bool closed_ ABSL_GUARDED_BY(mutex_) = false;
+
+  // Whether a notification is in progress, and whether deactivation was
+  // requested during it. The DEACTIVATED notification must not be issued until
+  // any in-progress notification returns.
+  bool in_notification_ ABSL_GUARDED_BY(mutex_) = false;
+  bool deactivate_after_notification_ ABSL_GUARDED_BY(mutex_) = false;
+
+  // Messages which arrived before activation.
+  std::vector<Message> pending_messages_ ABSL_GUARDED_BY(mutex_);
+
+  // Virtual times, in nanoseconds, at which the outgoing direction will have
+  // finished transmitting everything sent so far, and at which the most
+  // recently sent message will arrive.
+  int64_t busy_until_ ABSL_GUARDED_BY(mutex_) = 0;
+  int64_t last_arrival_time_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace
+
+// Orders every message in flight within a Simulation by virtual arrival time,
+// breaking ties by the order in which messages were sent.
+class Simulation::Scheduler : public RefCounted<Scheduler> {
+ public:
+  explicit Scheduler(const Options& options)
+      : default_link_parameters_(options.default_link_parameters),
+        jitter_engine_(options.seed) {}
+
+  const SimulatedLinkParameters& default_link_parameters() const {
+    return default_link_parameters_;
+  }
+
+  int64_t now() const {
+    absl::MutexLock lock(&mutex_);
+    return now_;
+  }
+
+  Stats stats() const {
+    absl::MutexLock lock(&mutex_);
+    return stats_;
+  }
+
+  // Returns a random delay in the range [0, max_jitter].
+  int64_t GenerateJitter(int64_t max_jitter) {
+    absl::MutexLock lock(&mutex_);
+    return static_cast<int64_t>(jitter_engine_() %
+                                (static_cast<uint64_t>(max_jitter) + 1));
+  }
+
+  void Post(int64_t time, Ref<SimulatedTransport> target, Message message) {
+    absl::MutexLock lock(&mutex_);
+    if (shut_down_) {
+      return;
+    }
+    events_.push_back({
+        .time = std::max(time, now_),
+        .sequence_number = next_sequence_number_++,
+        .target = std::move(target),
+        .message = std::move(message),
+    });
+    std::push_heap(events_.begin(), events_.end(), &Event::IsLater);
+    stats_.max_pending_events =
+        std::max(stats_.max_pending_events, events_.size());
+  }
+
+  void RecordDelivery(size_t num_bytes) {
+    absl::MutexLock lock(&mutex_);
+    ++stats_.num_messages_delivered;
+    stats_.num_bytes_delivered += num_bytes;
+  }
+
+  bool Step() {
+    Event event;
+    {
+      absl::MutexLock lock(&mutex_);
+      ABSL_ASSERT(!stepping_);
+      if (events_.empty()) {
+        return false;
+      }
+      std::pop_heap(events_.begin(), events_.end(), &Event::IsLater);
+      event = std::move(events_.back());
+      events_.pop_back();
+      now_ = event.time;
+      stepping_ = true;
+    }
+
+    event.target->Deliver(std::move(event.message));
+
+    absl::MutexLock lock(&mutex_);
+    stepping_ = false;
+    return true;
+  }
+
+  void RunFor(int64_t duration) {
+    int64_t end_time;
+    {
+      absl::MutexLock lock(&mutex_);
+      end_time = now_ + duration;
+    }
+    for (;;) {
+      {
+        absl::MutexLock lock(&mutex_);
+        if (events_.empty() || events_.front().time > end_time) {
+          now_ = std::max(now_, end_time);
+          return;
+        }
+      }
+      Step();
+    }
+  }
+
+  void Shutdown() {
+    std::vector<Event> events;
+    {
+      absl::MutexLock lock(&mutex_);
+      shut_down_ = true;
+      events.swap(events_);
+    }
+
+    // Destroying these may close transports carried by their messages, which
+    // may in turn attempt to post more events. Those are discarded.
+    events.clear();
+  }
+
+ private:
+  friend class RefCounted<Scheduler>;
+
+  struct Event {
+    int64_t time;
+    uint64_t sequence_number;
+    Ref<SimulatedTransport> target;
+    Message message;
+
+    static bool IsLater(const Event& a, const Event& b) {
+      return std::tie(a.time, a.sequence_number) >
+             std::tie(b.time, b.sequence_number);
+    }
+  };
+
+  ~Scheduler() = default;
+
+  const SimulatedLinkParameters default_link_parameters_;
+
+  mutable absl::Mutex mutex_;
+  int64_t now_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint64_t next_sequence_number_ ABSL_GUARDED_BY(mutex_) = 0;
+  bool stepping_ ABSL_GUARDED_BY(mutex_) = false;
+  bool shut_down_ ABSL_GUARDED_BY(mutex_) = false;
+  std::mt19937_64 jitter_engine_ ABSL_GUARDED_BY(mutex_);
+  Stats stats_ ABSL_GUARDED_BY(mutex_);
+
+  // A min-heap on (time, sequence_number).
+  std::vector<Event> events_ ABSL_GUARDED_BY(mutex_);
+};
+
+namespace {
+
+void SimulatedTransport::Activate(IpczHandle transport,
+                                  IpczTransportActivityHandler handler) {
+  std::vector<Message> pending_messages;
+  {
+    absl::MutexLock lock(&mutex_);
+    ABSL_ASSERT(!handler_ && !deactivated_);
+    transport_ = transport;
+    handler_ = handler;
+    pending_messages.swap(pending_messages_);
+  }
+
+  // Anything which arrived before activation is redelivered as soon as the
+  // Simulation next steps, in its original order.
+  const int64_t now = scheduler_->now();
+  for (Message& message : pending_messages) {
+    scheduler_->Post(now, WrapRefCounted(this), std::move(message));
+  }
+}
+
+void SimulatedTransport::Deactivate() {
+  IpczHandle transport;
+  IpczTransportActivityHandler handler;
+  {
+    absl::MutexLock lock(&mutex_);
+    ABSL_ASSERT(handler_);
+    transport = transport_;
+    handler = handler_;
+    handler_ = nullptr;
+    deactivated_ = true;
+    if (in_notification_) {
+      deactivate_after_notification_ = true;
+      return;
+    }
+  }
+  Message(IPCZ_TRANSPORT_ACTIVITY_DEACTIVATED).Notify(transport, handler);
+}
+
+void SimulatedTransport::Transmit(absl::Span<const uint8_t> data,
+                                  absl::Span<const IpczDriverHandle> handles) {
+  Message message(data, handles);
+  Ref<SimulatedTransport> peer;
+  {
+    absl::MutexLock lock(&mutex_);
+    peer = peer_;
+  }
+  if (peer) {
+    SendToPeer(std::move(peer), std::move(message));
+  }
+}
+
+void SimulatedTransport::Deliver(Message message) {
+  IpczHandle transport;
+  IpczTransportActivityHandler handler;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (closed_ || deactivated_) {
+      return;
+    }
+    if (!handler_) {
+      pending_messages_.push_back(std::move(message));
+      return;
+    }
+    transport = transport_;
+    handler = handler_;
+    in_notification_ = true;
+  }
+
+  if (message.is_data()) {
+    scheduler_->RecordDelivery(message.size());
+  }
+  const IpczResult result = message.Notify(transport, handler);
+
+  bool deactivate;
+  {
+    absl::MutexLock lock(&mutex_);
+    in_notification_ = false;
+    deactivate = deactivate_after_notification_;
+    deactivate_after_notification_ = false;
+  }
+
+  if (!deactivate && result != IPCZ_RESULT_OK &&
+      result != IPCZ_RESULT_UNIMPLEMENTED) {
+    Message(IPCZ_TRANSPORT_ACTIVITY_ERROR).Notify(transport, handler);
+  }
+  if (deactivate) {
+    Message(IPCZ_TRANSPORT_ACTIVITY_DEACTIVATED).Notify(transport, handler);
+  }
+}
+
+IpczResult SimulatedTransport::Close() {
+  Ref<SimulatedTransport> peer;
+  std::vector<Message> pending_messages;
+  {
+    absl::MutexLock lock(&mutex_);
+    closed_ = true;
+    peer = std::move(peer_);
+    pending_messages.swap(pending_messages_);
+  }
+
+  // Like any other transmission, closure reaches the peer only after
+  // everything transmitted before it.
+  if (peer) {
+    SendToPeer(std::move(peer), Message(IPCZ_TRANSPORT_ACTIVITY_ERROR));
+  }
+  return IPCZ_RESULT_OK;
+}
+
+void SimulatedTransport::SendToPeer(Ref<SimulatedTransport> peer,
+                                    Message message) {
+  const int64_t now = scheduler_->now();
+  const int64_t jitter =
+      params_.jitter > absl::ZeroDuration()
+          ? scheduler_->GenerateJitter(absl::ToInt64Nanoseconds(params_.jitter))
+          : 0;
+  const int64_t transmission_time =
+      params_.bytes_per_second
+          ? static_cast<int64_t>(message.size() * uint64_t{1000000000} /
+                                 params_.bytes_per_second)
+          : 0;
+
+  int64_t arrival_time;
+  {
+    absl::MutexLock lock(&mutex_);
+    busy_until_ = std::max(now, busy_until_) + transmission_time;
+    arrival_time =
+        busy_until_ + absl::ToInt64Nanoseconds(params_.latency) + jitter;
+    if (!params_.allow_reordering) {
+      arrival_time = std::max(arrival_time, last_arrival_time_);
+    }
+    last_arrival_time_ = std::max(arrival_time, last_arrival_time_);
+  }
+  scheduler_->Post(arrival_time, std::move(peer), std::move(message));
+}
+
+IpczResult IPCZ_API CreateTransports(IpczDriverHandle transport0,
+                                     IpczDriverHandle transport1,
+                                     uint32_t,
+                                     const void*,
+                                     IpczDriverHandle* new_transport0,
+                                     IpczDriverHandle* new_transport1) {
+  auto* target0 = SimulatedTransport::FromHandle(transport0);
+  if (!target0) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  const Ref<Simulation::Scheduler>& scheduler = target0->scheduler();
+  const SimulatedLinkParameters& params = scheduler->default_link_parameters();
+  auto [first, second] =
+      SimulatedTransport::CreatePair(scheduler, params, params);
+  *new_transport0 = Object::ReleaseAsHandle(std::move(first));
+  *new_transport1 = Object::ReleaseAsHandle(std::move(second));
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult IPCZ_API ActivateTransport(IpczDriverHandle transport,
+                                      IpczHandle listener,
+                                      IpczTransportActivityHandler handler,
+                                      uint32_t,
+                                      const void*) {
+  SimulatedTransport::FromHandle(transport)->Activate(listener, handler);
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult IPCZ_API DeactivateTransport(IpczDriverHandle transport,
+                                        uint32_t,
+                                        const void*) {
+  SimulatedTransport::FromHandle(transport)->Deactivate();
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult IPCZ_API Transmit(IpczDriverHandle transport,
+                             const void* data,
+                             size_t num_bytes,
+                             const IpczDriverHandle* handles,
+                             size_t num_handles,
+                             uint32_t,
+                             const void*) {
+  SimulatedTransport::FromHandle(transport)->Transmit(
+      {static_cast<const uint8_t*>(data), num_bytes}, {handles, num_handles});
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult IPCZ_API GenerateRandomBytes(size_t num_bytes,
+                                        uint32_t,
+                                        const void*,
+                                        void* buffer) {
+  GetRandomSource().Fill(
+      absl::MakeSpan(static_cast<uint8_t*>(buffer), num_bytes));
+  return IPCZ_RESULT_OK;
+}
+
+}  // namespace
+
+Simulation::Simulation() : Simulation(Options()) {}
+
+Simulation::Simulation(const Options& options)
+    : scheduler_(MakeRefCounted<Scheduler>(options)) {
+  GetRandomSource().Seed(options.seed);
+}
+
+Simulation::~Simulation() {
+  scheduler_->Shutdown();
+}
+
+absl::Duration Simulation::Now() const {
+  return absl::Nanoseconds(scheduler_->now());
+}
+
+Simulation::Stats Simulation::GetStats() const {
+  return scheduler_->stats();
+}
+
+std::pair<IpczDriverHandle, IpczDriverHandle> Simulation::CreateTransports(
+    const SimulatedLinkParameters& params0,
+    const SimulatedLinkParameters& params1) {
+  auto [first, second] =
+      SimulatedTransport::CreatePair(scheduler_, params0, params1);
+  return {Object::ReleaseAsHandle(std::move(first)),
+          Object::ReleaseAsHandle(std::move(second))};
+}
+
+std::pair<IpczDriverHandle, IpczDriverHandle> Simulation::CreateTransports() {
+  return CreateTransports(scheduler_->default_link_parameters());
+}
+
+bool Simulation::Step() {
+  return scheduler_->Step();
+}
+
+size_t Simulation::RunUntilIdle() {
+  size_t num_events = 0;
+  while (Step()) {
+    ++num_events;
+  }
+  return num_events;
+}
+
+void Simulation::RunFor(absl::Duration duration) {
+  scheduler_->RunFor(absl::ToInt64Nanoseconds(duration));
+}
+
+// Note that this driver inherits most of its implementation from the baseline
+// single-process driver. Only transport operation and random number generation
+// are overridden here.
+const IpczDriver kSimulationDriver = {
+    sizeof(kSimulationDriver),
+    kSingleProcessReferenceDriverBase.Close,
+    kSingleProcessReferenceDriverBase.Serialize,
+    kSingleProcessReferenceDriverBase.Deserialize,
+    CreateTransports,
+    ActivateTransport,
+    DeactivateTransport,
+    Transmit,
+    kSingleProcessReferenceDriverBase.ReportBadTransportActivity,
+    kSingleProcessReferenceDriverBase.AllocateSharedMemory,
+    kSingleProcessReferenceDriverBase.GetSharedMemoryInfo,
+    kSingleProcessReferenceDriverBase.DuplicateSharedMemory,
+    kSingleProcessReferenceDriverBase.MapSharedMemory,
+    GenerateRandomBytes,
+};
+
+}  // namespace ipcz::reference_drivers
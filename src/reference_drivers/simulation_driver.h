@@ -0,0 +1,125 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_REFERENCE_DRIVERS_SIMULATION_DRIVER_H_
+#define IPCZ_SRC_REFERENCE_DRIVERS_SIMULATION_DRIVER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "ipcz/ipcz.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+#include "util/ref_counted.h"
+
+namespace ipcz::reference_drivers {
+
+// A single-process driver whose transports deliver messages on a virtual clock
+// owned by a Simulation (see below). Nothing is delivered until the Simulation
+// is stepped, at which point messages arrive in order of their simulated
+// arrival times, as determined by the latency and throughput of the transport
+// they were transmitted on. Shared memory and all other driver objects behave
+// as they do for the sync and async reference drivers.
+//
+// Transports must be created by Simulation::CreateTransports(). Transports
+// created by ipcz itself (e.g. when introducing two nodes) join the same
+// Simulation as the transports they were created from.
+extern const IpczDriver kSimulationDriver;
+
+// Characteristics of one direction of a simulated transport.
+struct SimulatedLinkParameters {
+  // The time it takes a message to arrive once it's been fully transmitted.
+  absl::Duration latency = absl::Microseconds(10);
+
+  // The rate at which message data can be transmitted. Messages transmitted
+  // while an earlier message is still being transmitted queue behind it. If
+  // zero, transmission is instantaneous.
+  uint64_t bytes_per_second = 0;
+
+  // If non-zero, a random delay of up to this duration is added to the latency
+  // of each message.
+  absl::Duration jitter = absl::ZeroDuration();
+
+  // Whether jitter may cause messages to arrive in a different order than they
+  // were transmitted. If false, a message delayed by jitter also delays any
+  // messages behind it.
+  bool allow_reordering = false;
+};
+
+// Owns the virtual clock and event queue for a set of simulated transports.
+// A Simulation and every transport in it must be used from a single thread,
+// and only the thread stepping the Simulation receives transport
+// notifications. Given the same sequence of calls, a Simulation delivers the
+// same messages at the same virtual times every time, and ipcz nodes using
+// kSimulationDriver generate the same names and other random values.
+//
+// Only one Simulation should exist at a time, since kSimulationDriver's
+// random number generator is shared by the whole process.
+class Simulation {
+ public:
+  struct Options {
+    // Seeds jitter and kSimulationDriver's random number generator.
+    uint64_t seed = 0;
+
+    // Parameters for both directions of transports created by ipcz, and by
+    // CreateTransports() when no parameters are given.
+    SimulatedLinkParameters default_link_parameters;
+  };
+
+  struct Stats {
+    // Messages delivered to an active transport, and their total size.
+    size_t num_messages_delivered = 0;
+    uint64_t num_bytes_delivered = 0;
+
+    // The largest number of events ever pending at once.
+    size_t max_pending_events = 0;
+  };
+
+  class Scheduler;
+
+  Simulation();
+  explicit Simulation(const Options& options);
+  Simulation(const Simulation&) = delete;
+  Simulation& operator=(const Simulation&) = delete;
+
+  // Any events still pending are discarded, along with any driver objects
+  // they carried. Transports may outlive the Simulation, but once it's gone
+  // they no longer deliver anything.
+  ~Simulation();
+
+  // Virtual time elapsed since the Simulation was created.
+  absl::Duration Now() const;
+
+  Stats GetStats() const;
+
+  // Creates a new pair of connected transports. `params0` governs messages
+  // transmitted from the first transport to the second, and `params1` governs
+  // the reverse direction.
+  std::pair<IpczDriverHandle, IpczDriverHandle> CreateTransports(
+      const SimulatedLinkParameters& params0,
+      const SimulatedLinkParameters& params1);
+  std::pair<IpczDriverHandle, IpczDriverHandle> CreateTransports(
+      const SimulatedLinkParameters& params) {
+    return CreateTransports(params, params);
+  }
+  std::pair<IpczDriverHandle, IpczDriverHandle> CreateTransports();
+
+  // Advances the clock to the next pending event and delivers it, returning
+  // false if there was nothing pending.
+  bool Step();
+
+  // Steps until nothing is pending, returning the number of events delivered.
+  size_t RunUntilIdle();
+
+  // Delivers every event due within `duration` of Now(), then advances the
+  // clock by `duration`.
+  void RunFor(absl::Duration duration);
+
+ private:
+  const Ref<Scheduler> scheduler_;
+};
+
+}  // namespace ipcz::reference_drivers
+
+#endif  // IPCZ_SRC_REFERENCE_DRIVERS_SIMULATION_DRIVER_H_
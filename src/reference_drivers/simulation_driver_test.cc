@@ -0,0 +1,328 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "reference_drivers/simulation_driver.h"
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ipcz/api_object.h"
+#include "ipcz/ipcz.h"
+#include "test/test.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+
+namespace ipcz::reference_drivers {
+namespace {
+
+const IpczDriver& kDriver = kSimulationDriver;
+
+// Records every notification received by a simulated transport, along with the
+// virtual time at which it was received.
+class TransportReceiver
+    : public APIObjectImpl<TransportReceiver, APIObject::kTransportListener> {
+ public:
+  struct Notification {
+    absl::Duration time;
+    IpczTransportActivityFlags flags;
+    std::string data;
+  };
+
+  explicit TransportReceiver(const Simulation& simulation)
+      : simulation_(simulation) {}
+  ~TransportReceiver() override = default;
+
+  IpczHandle handle() const { return reinterpret_cast<IpczHandle>(this); }
+  const std::vector<Notification>& notifications() const {
+    return notifications_;
+  }
+
+  void Activate(IpczDriverHandle transport) {
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              kDriver.ActivateTransport(transport, handle(),
+                                        &TransportReceiver::Receive,
+                                        IPCZ_NO_FLAGS, nullptr));
+  }
+
+  static IpczResult Receive(IpczHandle transport,
+                            const void* data,
+                            size_t num_bytes,
+                            const IpczDriverHandle* driver_handles,
+                            size_t num_driver_handles,
+                            IpczTransportActivityFlags flags,
+                            const void* options) {
+    TransportReceiver& receiver = *TransportReceiver::FromHandle(transport);
+    receiver.notifications_.push_back({
+        .time = receiver.simulation_.Now(),
+        .flags = flags,
+        .data = std::string(static_cast<const char*>(data), num_bytes),
+    });
+    return IPCZ_RESULT_OK;
+  }
+
+  // APIObject:
+  IpczResult Close() override { return IPCZ_RESULT_INVALID_ARGUMENT; }
+
+ private:
+  const Simulation& simulation_;
+  std::vector<Notification> notifications_;
+};
+
+void Transmit(IpczDriverHandle transport, std::string_view message) {
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            kDriver.Transmit(transport, message.data(), message.size(),
+                             nullptr, 0, IPCZ_NO_FLAGS, nullptr));
+}
+
+void CloseTransports(std::pair<IpczDriverHandle, IpczDriverHandle> transports) {
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            kDriver.Close(transports.first, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            kDriver.Close(transports.second, IPCZ_NO_FLAGS, nullptr));
+}
+
+TEST(SimulationDriverTest, Latency) {
+  Simulation simulation;
+  auto transports =
+      simulation.CreateTransports({.latency = absl::Milliseconds(5)});
+  TransportReceiver receiver(simulation);
+  receiver.Activate(transports.second);
+
+  // Nothing arrives until the simulation is stepped, and then only once the
+  // message's latency has elapsed on the virtual clock.
+  Transmit(transports.first, "hello");
+  EXPECT_TRUE(receiver.notifications().empty());
+  simulation.RunFor(absl::Milliseconds(4));
+  EXPECT_TRUE(receiver.notifications().empty());
+  EXPECT_TRUE(simulation.Step());
+  ASSERT_EQ(1u, receiver.notifications().size());
+  EXPECT_EQ("hello", receiver.notifications()[0].data);
+  EXPECT_EQ(absl::Milliseconds(5), receiver.notifications()[0].time);
+  EXPECT_EQ(absl::Milliseconds(5), simulation.Now());
+  EXPECT_FALSE(simulation.Step());
+
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            kDriver.DeactivateTransport(transports.second, IPCZ_NO_FLAGS,
+                                        nullptr));
+  CloseTransports(transports);
+}
+
+TEST(SimulationDriverTest, Throughput) {
+  Simulation simulation;
+  auto transports = simulation.CreateTransports(
+      {.latency = absl::Milliseconds(1), .bytes_per_second = 1000},
+      {.latency = absl::ZeroDuration()});
+  TransportReceiver receiver(simulation);
+  receiver.Activate(transports.second);
+
+  // Each 100-byte message takes 100 ms to transmit, and the second is queued
+  // behind the first.
+  Transmit(transports.first, std::string(100, 'a'));
+  Transmit(transports.first, std::string(100, 'b'));
+  EXPECT_EQ(2u, simulation.RunUntilIdle());
+  ASSERT_EQ(2u, receiver.notifications().size());
+  EXPECT_EQ(absl::Milliseconds(101), receiver.notifications()[0].time);
+  EXPECT_EQ(absl::Milliseconds(201), receiver.notifications()[1].time);
+
+  const Simulation::Stats stats = simulation.GetStats();
+  EXPECT_EQ(2u, stats.num_messages_delivered);
+  EXPECT_EQ(200u, stats.num_bytes_delivered);
+  EXPECT_EQ(2u, stats.max_pending_events);
+
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            kDriver.DeactivateTransport(transports.second, IPCZ_NO_FLAGS,
+                                        nullptr));
+  CloseTransports(transports);
+}
+
+std::vector<std::string> ReceiveWithJitter(bool allow_reordering,
+                                           uint64_t seed) {
+  Simulation simulation({.seed = seed});
+  auto transports = simulation.CreateTransports(
+      {.latency = absl::Microseconds(10),
+       .jitter = absl::Milliseconds(10),
+       .allow_reordering = allow_reordering});
+  TransportReceiver receiver(simulation);
+  receiver.Activate(transports.second);
+  for (int i = 0; i < 20; ++i) {
+    Transmit(transports.first, std::to_string(i));
+  }
+  simulation.RunUntilIdle();
+
+  std::vector<std::string> messages;
+  absl::Duration last_time;
+  for (const auto& notification : receiver.notifications()) {
+    EXPECT_GE(notification.time, last_time);
+    last_time = notification.time;
+    messages.push_back(notification.data);
+  }
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            kDriver.DeactivateTransport(transports.second, IPCZ_NO_FLAGS,
+                                        nullptr));
+  CloseTransports(transports);
+  return messages;
+}
+
+TEST(SimulationDriverTest, Jitter) {
+  std::vector<std::string> in_order;
+  for (int i = 0; i < 20; ++i) {
+    in_order.push_back(std::to_string(i));
+  }
+
+  // Without reordering, jitter only affects timing.
+  EXPECT_EQ(in_order, ReceiveWithJitter(/*allow_reordering=*/false, 1));
+
+  // With reordering, the arrival order depends only on the seed.
+  const std::vector<std::string> reordered =
+      ReceiveWithJitter(/*allow_reordering=*/true, 1);
+  EXPECT_NE(in_order, reordered);
+  EXPECT_EQ(reordered, ReceiveWithJitter(/*allow_reordering=*/true, 1));
+}
+
+TEST(SimulationDriverTest, TransmitBeforeActive) {
+  Simulation simulation;
+  auto transports = simulation.CreateTransports();
+  Transmit(transports.first, "hello");
+  simulation.RunUntilIdle();
+
+  // A message which arrived before activation is delivered at the next step
+  // after activation.
+  TransportReceiver receiver(simulation);
+  receiver.Activate(transports.second);
+  EXPECT_TRUE(receiver.notifications().empty());
+  EXPECT_EQ(1u, simulation.RunUntilIdle());
+  ASSERT_EQ(1u, receiver.notifications().size());
+  EXPECT_EQ("hello", receiver.notifications()[0].data);
+
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            kDriver.DeactivateTransport(transports.second, IPCZ_NO_FLAGS,
+                                        nullptr));
+  CloseTransports(transports);
+}
+
+TEST(SimulationDriverTest, CloseAndDeactivate) {
+  Simulation simulation;
+  auto transports =
+      simulation.CreateTransports({.latency = absl::Milliseconds(1)});
+  TransportReceiver receiver(simulation);
+  receiver.Activate(transports.second);
+
+  // Closure of one transport reaches its peer after everything transmitted
+  // before it.
+  Transmit(transports.first, "hello");
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            kDriver.Close(transports.first, IPCZ_NO_FLAGS, nullptr));
+  simulation.RunUntilIdle();
+  ASSERT_EQ(2u, receiver.notifications().size());
+  EXPECT_EQ("hello", receiver.notifications()[0].data);
+  EXPECT_EQ(IPCZ_TRANSPORT_ACTIVITY_ERROR, receiver.notifications()[1].flags);
+
+  // Deactivation is acknowledged immediately.
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            kDriver.DeactivateTransport(transports.second, IPCZ_NO_FLAGS,
+                                        nullptr));
+  ASSERT_EQ(3u, receiver.notifications().size());
+  EXPECT_EQ(IPCZ_TRANSPORT_ACTIVITY_DEACTIVATED,
+            receiver.notifications()[2].flags);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            kDriver.Close(transports.second, IPCZ_NO_FLAGS, nullptr));
+}
+
+class SimulationDriverClusterTest : public test::Test {
+ protected:
+  struct ClusterResult {
+    absl::Duration time;
+    Simulation::Stats stats;
+  };
+
+  // Connects `num_nodes` non-broker nodes to a broker, then sends a portal
+  // from each node to the next through the broker, so that every pair of
+  // neighbors is eventually introduced and talks directly.
+  ClusterResult RunCluster(size_t num_nodes, uint64_t seed) {
+    Simulation simulation(
+        {.seed = seed,
+         .default_link_parameters = {.latency = absl::Microseconds(50),
+                                     .bytes_per_second = 1000000000,
+                                     .jitter = absl::Microseconds(20)}});
+    IpczHandle broker = CreateNode(kDriver, IPCZ_CREATE_NODE_AS_BROKER);
+    std::vector<IpczHandle> nodes(num_nodes);
+    std::vector<IpczHandle> broker_portals(num_nodes);
+    std::vector<IpczHandle> portals(num_nodes);
+    for (size_t i = 0; i < num_nodes; ++i) {
+      nodes[i] = CreateNode(kDriver);
+      auto [broker_transport, transport] = simulation.CreateTransports();
+      EXPECT_EQ(IPCZ_RESULT_OK,
+                ipcz().ConnectNode(broker, broker_transport, 1, IPCZ_NO_FLAGS,
+                                   nullptr, &broker_portals[i]));
+      EXPECT_EQ(IPCZ_RESULT_OK,
+                ipcz().ConnectNode(nodes[i], transport, 1,
+                                   IPCZ_CONNECT_NODE_TO_BROKER, nullptr,
+                                   &portals[i]));
+    }
+    simulation.RunUntilIdle();
+
+    std::vector<IpczHandle> local_ends(num_nodes);
+    for (size_t i = 0; i < num_nodes; ++i) {
+      auto [local, remote] = OpenPortals(nodes[i]);
+      local_ends[i] = local;
+      EXPECT_EQ(IPCZ_RESULT_OK, Put(portals[i], "", {&remote, 1}));
+    }
+    simulation.RunUntilIdle();
+
+    for (size_t i = 0; i < num_nodes; ++i) {
+      IpczHandle portal;
+      EXPECT_EQ(IPCZ_RESULT_OK, Get(broker_portals[i], nullptr, {&portal, 1}));
+      EXPECT_EQ(IPCZ_RESULT_OK,
+                Put(broker_portals[(i + 1) % num_nodes], "", {&portal, 1}));
+    }
+    simulation.RunUntilIdle();
+
+    std::vector<IpczHandle> remote_ends(num_nodes);
+    for (size_t i = 0; i < num_nodes; ++i) {
+      EXPECT_EQ(IPCZ_RESULT_OK, Get(portals[i], nullptr, {&remote_ends[i], 1}));
+      EXPECT_EQ(IPCZ_RESULT_OK, Put(remote_ends[i], "hello"));
+    }
+    simulation.RunUntilIdle();
+
+    for (size_t i = 0; i < num_nodes; ++i) {
+      std::string message;
+      EXPECT_EQ(IPCZ_RESULT_OK, Get(local_ends[i], &message));
+      EXPECT_EQ("hello", message);
+    }
+
+    const ClusterResult result = {
+        .time = simulation.Now(),
+        .stats = simulation.GetStats(),
+    };
+    CloseAll(local_ends);
+    CloseAll(remote_ends);
+    CloseAll(portals);
+    CloseAll(broker_portals);
+    CloseAll(nodes);
+    Close(broker);
+    simulation.RunUntilIdle();
+    return result;
+  }
+};
+
+TEST_F(SimulationDriverClusterTest, Deterministic) {
+  constexpr size_t kNumNodes = 100;
+  const ClusterResult result = RunCluster(kNumNodes, 42);
+  EXPECT_GT(result.time, absl::ZeroDuration());
+  EXPECT_GT(result.stats.num_messages_delivered, kNumNodes * 4);
+
+  // The same cluster with the same seed behaves identically.
+  const ClusterResult repeat = RunCluster(kNumNodes, 42);
+  EXPECT_EQ(result.time, repeat.time);
+  EXPECT_EQ(result.stats.num_messages_delivered,
+            repeat.stats.num_messages_delivered);
+  EXPECT_EQ(result.stats.num_bytes_delivered,
+            repeat.stats.num_bytes_delivered);
+  EXPECT_EQ(result.stats.max_pending_events, repeat.stats.max_pending_events);
+}
+
+}  // namespace
+}  // namespace ipcz::reference_drivers
@@ -2,20 +2,65 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <string_view>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 #include "build/build_config.h"
 #include "ipcz/ipcz.h"
+#include "ipcz/node_messages.h"
 #include "test/multinode_test.h"
 #include "testing/gtest/include/gtest/gtest.h"
 #include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "third_party/abseil-cpp/absl/synchronization/notification.h"
 
 namespace ipcz {
 namespace {
 
-using RemotePortalTestNode = test::TestNode;
+class RemotePortalTestNode : public test::TestNode {
+ public:
+  // Returns the number of RouteClosed messages this node has sent so far.
+  uint64_t GetNumRouteClosedMessagesSent() {
+    IpczNodeStats stats = {.size = sizeof(stats)};
+    size_t num_link_stats = 0;
+    ipcz().QueryNodeStats(node(), IPCZ_NO_FLAGS, nullptr, &stats, nullptr,
+                          &num_link_stats);
+    std::vector<IpczNodeLinkStats> link_stats(num_link_stats);
+    for (IpczNodeLinkStats& link : link_stats) {
+      link.size = sizeof(link);
+    }
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().QueryNodeStats(node(), IPCZ_NO_FLAGS, nullptr, &stats,
+                                    link_stats.data(), &num_link_stats));
+    uint64_t num_sent = 0;
+    for (const IpczNodeLinkStats& link : link_stats) {
+      num_sent += link.messages[msg::RouteClosed::kId].num_sent;
+    }
+    return num_sent;
+  }
+
+  // Returns the number of routers on this node bound to any of its links.
+  size_t GetNumRouters() {
+    IpczNodeStats stats = {.size = sizeof(stats)};
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().QueryNodeStats(node(), IPCZ_NO_FLAGS, nullptr, &stats,
+                                    nullptr, nullptr));
+    return stats.num_routers;
+  }
+
+  // Makes `portal` idle once it's on a direct remote link. A portal with no
+  // trap watching for peer closure goes idle once it's found empty.
+  void MakeIdle(IpczHandle portal) {
+    WaitForDirectRemoteLink(portal);
+    EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE, Get(portal));
+  }
+};
+
 using RemotePortalTest = test::MultinodeTest<RemotePortalTestNode>;
 
 static constexpr std::string_view kTestMessage1 = "hello world";
@@ -214,6 +259,45 @@ MULTINODE_TEST(RemotePortalTest, HugeNumberOfPortals) {
   CloseAll({c1, c2, q, p});
 }
 
+constexpr size_t kNumPortalsPerParcel = 64;
+
+MULTINODE_TEST_NODE(RemotePortalTestNode, ManyPortalsInOneParcelClient) {
+  IpczHandle b = ConnectToBroker();
+  std::vector<IpczHandle> portals(kNumPortalsPerParcel);
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, absl::MakeSpan(portals)));
+  for (size_t i = 0; i < kNumPortalsPerParcel; ++i) {
+    std::string message;
+    EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(portals[i], &message));
+    EXPECT_EQ(absl::StrCat(absl::Dec(i)), message);
+    EXPECT_EQ(IPCZ_RESULT_OK, Put(portals[i], message));
+  }
+  CloseAll(portals);
+  Close(b);
+}
+
+MULTINODE_TEST(RemotePortalTest, ManyPortalsInOneParcel) {
+  // Sends one end of many local portal pairs within a single parcel, so that
+  // every transferred router is serialized as part of one batch.
+  IpczHandle c = SpawnTestNode<ManyPortalsInOneParcelClient>();
+  std::vector<IpczHandle> ours(kNumPortalsPerParcel);
+  std::vector<IpczHandle> theirs(kNumPortalsPerParcel);
+  for (size_t i = 0; i < kNumPortalsPerParcel; ++i) {
+    std::tie(ours[i], theirs[i]) = OpenPortals();
+  }
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "", absl::MakeSpan(theirs)));
+
+  for (size_t i = 0; i < kNumPortalsPerParcel; ++i) {
+    const std::string expected_message = absl::StrCat(absl::Dec(i));
+    EXPECT_EQ(IPCZ_RESULT_OK, Put(ours[i], expected_message));
+    std::string message;
+    EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(ours[i], &message));
+    EXPECT_EQ(expected_message, message);
+  }
+
+  CloseAll(ours);
+  Close(c);
+}
+
 constexpr size_t kRouteExpansionStressTestNumIterations = 100;
 
 MULTINODE_TEST_NODE(RemotePortalTestNode, RoutingStressTestClient) {
@@ -355,6 +439,182 @@ MULTINODE_TEST(RemotePortalTest, ClosurePropagation) {
   CloseAll({c1, c2});
 }
 
+MULTINODE_TEST_NODE(RemotePortalTestNode, ClosureOfIdlePeerClient) {
+  IpczHandle b = ConnectToBroker();
+  IpczHandle p;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, {&p, 1}));
+  WaitForDirectRemoteLink(p);
+  EXPECT_EQ("close", WaitToGetString(b));
+
+  // Report how many RouteClosed messages were sent to close `p`. The broker's
+  // portal is idle, so there should be none.
+  const uint64_t num_route_closed_before = GetNumRouteClosedMessagesSent();
+  Close(p);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            Put(b, absl::StrCat(GetNumRouteClosedMessagesSent() -
+                                num_route_closed_before)));
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED));
+  Close(b);
+}
+
+MULTINODE_TEST(RemotePortalTest, ClosureOfIdlePeer) {
+  // A portal with no traps installed may learn of its peer's closure only
+  // through shared link state rather than a message. Verify that closure is
+  // still observed by simply polling the portal.
+  IpczHandle c = SpawnTestNode<ClosureOfIdlePeerClient>();
+  auto [q, p] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "", {&p, 1}));
+  MakeIdle(q);
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "close"));
+
+  // Once the client has closed its portal, closure is already published in
+  // shared state, and it was never sent as a message.
+  EXPECT_EQ("0", WaitToGetString(c));
+  IpczPortalStatus status = {.size = sizeof(status)};
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryPortalStatus(q, IPCZ_NO_FLAGS, nullptr, &status));
+  EXPECT_TRUE(status.flags & IPCZ_PORTAL_STATUS_PEER_CLOSED);
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND,
+            ipcz().Get(q, IPCZ_NO_FLAGS, nullptr, nullptr, nullptr, nullptr,
+                       nullptr, nullptr));
+  CloseAll({q, c});
+}
+
+MULTINODE_TEST(RemotePortalTest, PutToIdleClosedPeer) {
+  // Put() on an idle portal checks shared link state for its peer's closure
+  // before sending anything, and fails once it's found there.
+  IpczHandle c = SpawnTestNode<ClosureOfIdlePeerClient>();
+  auto [q, p] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "", {&p, 1}));
+  MakeIdle(q);
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "close"));
+
+  EXPECT_EQ("0", WaitToGetString(c));
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND, Put(q, "x"));
+
+  IpczPortalStatus status = {.size = sizeof(status)};
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryPortalStatus(q, IPCZ_NO_FLAGS, nullptr, &status));
+  EXPECT_TRUE(status.flags & IPCZ_PORTAL_STATUS_PEER_CLOSED);
+  CloseAll({q, c});
+}
+
+MULTINODE_TEST(RemotePortalTest, BlockingGetOnIdleClosedPeer) {
+  // A blocking Get() wakes an idle portal, and any closure its peer published
+  // in shared state beforehand must be fully accepted, including dropping the
+  // portal's dead link to its peer.
+  IpczHandle c = SpawnTestNode<ClosureOfIdlePeerClient>();
+  auto [q, p] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "", {&p, 1}));
+  MakeIdle(q);
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "close"));
+  EXPECT_EQ("0", WaitToGetString(c));
+
+  const size_t num_routers_before = GetNumRouters();
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND,
+            ipcz().Get(q, IPCZ_GET_BLOCKING, nullptr, nullptr, nullptr,
+                       nullptr, nullptr, nullptr));
+  EXPECT_EQ(num_routers_before - 1, GetNumRouters());
+  CloseAll({q, c});
+}
+
+constexpr size_t kNumTrappedPortals = 32;
+
+MULTINODE_TEST_NODE(RemotePortalTestNode, ClosureOfTrappedPeersClient) {
+  IpczHandle b = ConnectToBroker();
+  std::vector<IpczHandle> portals(kNumTrappedPortals);
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, absl::MakeSpan(portals)));
+  for (IpczHandle portal : portals) {
+    WaitForDirectRemoteLink(portal);
+  }
+  EXPECT_EQ("close", WaitToGetString(b));
+
+  // Report how many RouteClosed messages were sent to close every portal.
+  const uint64_t num_route_closed_before = GetNumRouteClosedMessagesSent();
+  CloseAll(portals);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            Put(b, absl::StrCat(GetNumRouteClosedMessagesSent() -
+                                num_route_closed_before)));
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED));
+  Close(b);
+}
+
+MULTINODE_TEST(RemotePortalTest, ClosureOfTrappedIdlePeers) {
+  // Every portal has a trap installed throughout, watching only for a batch of
+  // parcels to arrive. Closure can't satisfy such a trap, so each portal still
+  // goes idle and its peer's closure is only published in shared state.
+  IpczHandle c = SpawnTestNode<ClosureOfTrappedPeersClient>();
+  std::vector<IpczHandle> qs(kNumTrappedPortals);
+  std::vector<IpczHandle> ps(kNumTrappedPortals);
+  std::atomic<size_t> num_traps_removed{0};
+  for (size_t i = 0; i < kNumTrappedPortals; ++i) {
+    std::tie(qs[i], ps[i]) = OpenPortals();
+    const IpczTrapConditions conditions = {
+        .size = sizeof(conditions),
+        .flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS,
+        .min_local_parcels = 1,
+    };
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              Trap(qs[i], conditions, [&](const IpczTrapEvent& event) {
+                EXPECT_EQ(IPCZ_TRAP_REMOVED,
+                          event.condition_flags & ~IPCZ_TRAP_WITHIN_API_CALL);
+                ++num_traps_removed;
+              }));
+  }
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "", absl::MakeSpan(ps)));
+
+  for (IpczHandle q : qs) {
+    WaitForDirectRemoteLink(q);
+    EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE, Get(q));
+  }
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "close"));
+
+  EXPECT_EQ("0", WaitToGetString(c));
+  for (IpczHandle q : qs) {
+    IpczPortalStatus status = {.size = sizeof(status)};
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().QueryPortalStatus(q, IPCZ_NO_FLAGS, nullptr, &status));
+    EXPECT_TRUE(status.flags & IPCZ_PORTAL_STATUS_PEER_CLOSED);
+  }
+  CloseAll(qs);
+  EXPECT_EQ(kNumTrappedPortals, num_traps_removed.load());
+  Close(c);
+}
+
+MULTINODE_TEST(RemotePortalTest, ClosureOfPeersWatchedForClosure) {
+  // A portal with a trap watching for peer closure is never idle, so its
+  // peer's closure must still arrive as a message to fire the trap.
+  IpczHandle c = SpawnTestNode<ClosureOfTrappedPeersClient>();
+  std::vector<IpczHandle> qs(kNumTrappedPortals);
+  std::vector<IpczHandle> ps(kNumTrappedPortals);
+  for (size_t i = 0; i < kNumTrappedPortals; ++i) {
+    std::tie(qs[i], ps[i]) = OpenPortals();
+  }
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "", absl::MakeSpan(ps)));
+
+  std::vector<absl::Notification> closures(kNumTrappedPortals);
+  for (size_t i = 0; i < kNumTrappedPortals; ++i) {
+    WaitForDirectRemoteLink(qs[i]);
+    EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE, Get(qs[i]));
+    const IpczTrapConditions conditions = {
+        .size = sizeof(conditions),
+        .flags = IPCZ_TRAP_PEER_CLOSED,
+    };
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              Trap(qs[i], conditions, [&closures, i](const IpczTrapEvent&) {
+                closures[i].Notify();
+              }));
+  }
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "close"));
+
+  EXPECT_EQ(absl::StrCat(kNumTrappedPortals), WaitToGetString(c));
+  for (absl::Notification& closure : closures) {
+    closure.WaitForNotification();
+  }
+  CloseAll(qs);
+  Close(c);
+}
+
 MULTINODE_TEST_NODE(RemotePortalTestNode, DisconnectThroughProxyClient1) {
   IpczHandle b = ConnectToBroker();
 
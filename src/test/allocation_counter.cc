@@ -0,0 +1,127 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "test/allocation_counter.h"
+
+#if defined(IPCZ_COUNT_ALLOCATIONS)
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "third_party/abseil-cpp/absl/base/macros.h"
+
+namespace {
+
+// Counts of heap allocations made on the current thread while a
+// ScopedAllocationCounter exists on it.
+thread_local bool count_allocations = false;
+thread_local size_t num_allocations = 0;
+
+// Net bytes allocated by every thread while a ScopedHeapTracker exists.
+std::atomic<bool> track_heap_bytes{false};
+std::atomic<int64_t> heap_bytes{0};
+
+// Each allocation is prefixed with its size and whether it was tracked, so
+// that tracked bytes can be subtracted when freed. The header size keeps
+// allocations aligned as malloc() would.
+struct AllocationHeader {
+  size_t size;
+  bool tracked;
+};
+constexpr size_t kHeaderSize = alignof(std::max_align_t);
+static_assert(sizeof(AllocationHeader) <= kHeaderSize);
+
+void* CountedAllocate(size_t size) {
+  if (count_allocations) {
+    ++num_allocations;
+  }
+  void* ptr = malloc(kHeaderSize + size);
+  if (!ptr) {
+    abort();
+  }
+  auto& header = *static_cast<AllocationHeader*>(ptr);
+  header.size = size;
+  header.tracked = track_heap_bytes.load(std::memory_order_relaxed);
+  if (header.tracked) {
+    heap_bytes.fetch_add(static_cast<int64_t>(size),
+                         std::memory_order_relaxed);
+  }
+  return static_cast<uint8_t*>(ptr) + kHeaderSize;
+}
+
+void CountedFree(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+  void* header_ptr = static_cast<uint8_t*>(ptr) - kHeaderSize;
+  const auto& header = *static_cast<AllocationHeader*>(header_ptr);
+  if (header.tracked) {
+    heap_bytes.fetch_sub(static_cast<int64_t>(header.size),
+                         std::memory_order_relaxed);
+  }
+  free(header_ptr);
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  return CountedAllocate(size);
+}
+
+void* operator new[](size_t size) {
+  return CountedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  CountedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  CountedFree(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  CountedFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  CountedFree(ptr);
+}
+
+namespace ipcz::test {
+
+ScopedAllocationCounter::ScopedAllocationCounter() {
+  num_allocations = 0;
+  count_allocations = true;
+}
+
+ScopedAllocationCounter::~ScopedAllocationCounter() {
+  count_allocations = false;
+}
+
+size_t ScopedAllocationCounter::count() const {
+  return num_allocations;
+}
+
+ScopedHeapTracker::ScopedHeapTracker()
+    : initial_bytes_(heap_bytes.load(std::memory_order_relaxed)) {
+  const bool was_tracking =
+      track_heap_bytes.exchange(true, std::memory_order_relaxed);
+  ABSL_ASSERT(!was_tracking);
+}
+
+ScopedHeapTracker::~ScopedHeapTracker() {
+  track_heap_bytes.store(false, std::memory_order_relaxed);
+}
+
+int64_t ScopedHeapTracker::GetNetBytes() const {
+  return heap_bytes.load(std::memory_order_relaxed) - initial_bytes_;
+}
+
+}  // namespace ipcz::test
+
+#endif  // defined(IPCZ_COUNT_ALLOCATIONS)
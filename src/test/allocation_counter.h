@@ -0,0 +1,58 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_TEST_ALLOCATION_COUNTER_H_
+#define IPCZ_SRC_TEST_ALLOCATION_COUNTER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Heap usage is counted by replacing the global allocation functions, which is
+// only feasible in standalone builds without sanitizers or an allocator shim of
+// their own. Elsewhere IPCZ_COUNT_ALLOCATIONS is undefined and the counters
+// below are unavailable.
+#if defined(IPCZ_STANDALONE) && !defined(ADDRESS_SANITIZER) && \
+    !defined(MEMORY_SANITIZER) && !defined(THREAD_SANITIZER)
+#define IPCZ_COUNT_ALLOCATIONS 1
+#endif
+
+#if defined(IPCZ_COUNT_ALLOCATIONS)
+
+namespace ipcz::test {
+
+// Counts heap allocations made on the current thread for its lifetime.
+// Allocations made by other threads are not counted.
+class ScopedAllocationCounter {
+ public:
+  ScopedAllocationCounter();
+  ScopedAllocationCounter(const ScopedAllocationCounter&) = delete;
+  ScopedAllocationCounter& operator=(const ScopedAllocationCounter&) = delete;
+  ~ScopedAllocationCounter();
+
+  size_t count() const;
+};
+
+// Tracks the net number of heap bytes allocated by every thread in the process
+// for its lifetime. Bytes allocated while the tracker exists are subtracted
+// once freed, even if that happens after the tracker is gone. Only one tracker
+// may exist at a time.
+class ScopedHeapTracker {
+ public:
+  ScopedHeapTracker();
+  ScopedHeapTracker(const ScopedHeapTracker&) = delete;
+  ScopedHeapTracker& operator=(const ScopedHeapTracker&) = delete;
+  ~ScopedHeapTracker();
+
+  // Bytes allocated and not yet freed since this tracker was created.
+  int64_t GetNetBytes() const;
+
+ private:
+  const int64_t initial_bytes_;
+};
+
+}  // namespace ipcz::test
+
+#endif  // defined(IPCZ_COUNT_ALLOCATIONS)
+
+#endif  // IPCZ_SRC_TEST_ALLOCATION_COUNTER_H_
@@ -157,6 +157,7 @@ class AsyncTestDriver : public InProcessTestDriverBase {
     kForceBrokering,
     kDelegateAllocation,
     kForceBrokeringAndDelegateAllocation,
+    kParallelDispatch,
   };
   AsyncTestDriver(const char* name, Mode mode) : name_(name), mode_(mode) {}
 
@@ -194,6 +195,17 @@ class AsyncTestDriver : public InProcessTestDriverBase {
     return IPCZ_NO_FLAGS;
   }
 
+  const IpczCreateNodeOptions* GetCreateNodeOptions() const override {
+    static constexpr IpczCreateNodeOptions kParallelDispatchOptions = {
+        .size = sizeof(kParallelDispatchOptions),
+        .num_dispatch_threads = 4,
+    };
+    if (mode_ == kParallelDispatch) {
+      return &kParallelDispatchOptions;
+    }
+    return nullptr;
+  }
+
  private:
   const char* const name_;
   const Mode mode_;
@@ -212,6 +224,10 @@ TestDriverRegistration<AsyncTestDriver>
     kRegisterAsyncDriverWithDelegatedAllocAndForcedBrokering{
         internal::kAsyncDelegatedAllocAndForcedBrokeringTestDriverName,
         AsyncTestDriver::kForceBrokeringAndDelegateAllocation};
+TestDriverRegistration<AsyncTestDriver>
+    kRegisterAsyncDriverWithParallelDispatch{
+        internal::kAsyncParallelDispatchTestDriverName,
+        AsyncTestDriver::kParallelDispatch};
 
 #if BUILDFLAG(ENABLE_IPCZ_MULTIPROCESS_TESTS)
 // Controls a node running within an isolated child process.
@@ -301,6 +317,7 @@ const char kAsyncDelegatedAllocTestDriverName[] = "AsyncDelegatedAlloc";
 const char kAsyncForcedBrokeringTestDriverName[] = "AsyncForcedBrokering";
 const char kAsyncDelegatedAllocAndForcedBrokeringTestDriverName[] =
     "AsyncDelegatedAllocAndForcedBrokering";
+const char kAsyncParallelDispatchTestDriverName[] = "AsyncParallelDispatch";
 const char kMultiprocessTestDriverName[] = "Multiprocess";
 
 }  // namespace internal
@@ -333,7 +350,8 @@ void TestNode::Initialize(TestDriver* test_driver) {
       GetDetails().is_broker ? IPCZ_CREATE_NODE_AS_BROKER : IPCZ_NO_FLAGS;
   ABSL_ASSERT(node_ == IPCZ_INVALID_HANDLE);
   const IpczResult result =
-      ipcz().CreateNode(&test_driver_->GetIpczDriver(), flags, nullptr, &node_);
+      ipcz().CreateNode(&test_driver_->GetIpczDriver(), flags,
+                        test_driver_->GetCreateNodeOptions(), &node_);
   ABSL_ASSERT(result == IPCZ_RESULT_OK);
 }
 
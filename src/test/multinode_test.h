@@ -42,6 +42,7 @@ extern const char kAsyncTestDriverName[];
 extern const char kAsyncDelegatedAllocTestDriverName[];
 extern const char kAsyncForcedBrokeringTestDriverName[];
 extern const char kAsyncDelegatedAllocAndForcedBrokeringTestDriverName[];
+extern const char kAsyncParallelDispatchTestDriverName[];
 extern const char kMultiprocessTestDriverName[];
 
 }  // namespace internal
@@ -288,6 +289,12 @@ class TestDriver {
   // called to retrieve the driver transport which the test node should use to
   // connect to the broker.
   virtual IpczDriverHandle GetClientTestNodeTransport() = 0;
+
+  // Returns options to be provided to CreateNode() for every test node, or
+  // null to use the defaults.
+  virtual const IpczCreateNodeOptions* GetCreateNodeOptions() const {
+    return nullptr;
+  }
 };
 
 // Registers a TestDriver globally so that all MULTINODE_TEST() invocations are
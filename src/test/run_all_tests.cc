@@ -2,6 +2,10 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <cstdlib>
+
+#include "ipcz/parcel_trace.h"
+#include "ipcz/transport_capture.h"
 #include "standalone/base/logging.h"
 #include "standalone/base/stack_trace.h"
 #include "test/multinode_test.h"
@@ -29,5 +33,29 @@ int main(int argc, char** argv) {
   }
 #endif
 
-  return RUN_ALL_TESTS();
+  // Standalone builds have no tracing service to collect parcel traces, so if
+  // requested they're written to a file once all tests have run. The file can
+  // be loaded by Perfetto or chrome://tracing.
+  const char* parcel_trace_file = std::getenv("IPCZ_PARCEL_TRACE_FILE");
+  if (parcel_trace_file) {
+    ipcz::ParcelTracer::StartToFile(parcel_trace_file, /*max_slices=*/0);
+  }
+
+  // Transport captures are streamed to a file as tests run, and can be
+  // inspected and replayed with the ipcz_replay tool.
+  const char* transport_capture_file =
+      std::getenv("IPCZ_TRANSPORT_CAPTURE_FILE");
+  if (transport_capture_file) {
+    ipcz::TransportCapture::StartToFile(transport_capture_file,
+                                        /*max_bytes=*/0);
+  }
+
+  const int result = RUN_ALL_TESTS();
+  if (parcel_trace_file) {
+    ipcz::ParcelTracer::Stop();
+  }
+  if (transport_capture_file) {
+    ipcz::TransportCapture::Stop();
+  }
+  return result;
 }
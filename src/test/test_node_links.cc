@@ -0,0 +1,59 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "test/test_node_links.h"
+
+#include <utility>
+
+#include "ipcz/driver_memory.h"
+#include "ipcz/driver_object.h"
+#include "ipcz/driver_transport.h"
+#include "ipcz/link_side.h"
+#include "ipcz/node_link_memory.h"
+#include "ipcz/node_name.h"
+#include "reference_drivers/sync_reference_driver.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/base/macros.h"
+
+namespace ipcz::test {
+
+std::pair<Ref<NodeLink>, Ref<NodeLink>> LinkNodes(Ref<Node> broker,
+                                                  Ref<Node> non_broker,
+                                                  uint32_t protocol_version,
+                                                  bool add_connections) {
+  const IpczDriver& driver = reference_drivers::kSyncReferenceDriver;
+  IpczDriverHandle handle0, handle1;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            driver.CreateTransports(IPCZ_INVALID_DRIVER_HANDLE,
+                                    IPCZ_INVALID_DRIVER_HANDLE, IPCZ_NO_FLAGS,
+                                    nullptr, &handle0, &handle1));
+
+  auto transport0 =
+      MakeRefCounted<DriverTransport>(DriverObject(driver, handle0));
+  auto transport1 =
+      MakeRefCounted<DriverTransport>(DriverObject(driver, handle1));
+
+  DriverMemoryWithMapping buffer = NodeLinkMemory::AllocateMemory(driver);
+  ABSL_ASSERT(buffer.mapping.is_valid());
+
+  const NodeName non_broker_name = broker->GenerateRandomName();
+  auto link0 = NodeLink::CreateInactive(
+      broker, LinkSide::kA, broker->GetAssignedName(), non_broker_name,
+      Node::Type::kNormal, protocol_version, transport0,
+      NodeLinkMemory::Create(broker, std::move(buffer.mapping)));
+  auto link1 = NodeLink::CreateInactive(
+      non_broker, LinkSide::kB, non_broker_name, broker->GetAssignedName(),
+      Node::Type::kNormal, protocol_version, transport1,
+      NodeLinkMemory::Create(non_broker, buffer.memory.Map()));
+  if (add_connections) {
+    broker->AddConnection(non_broker_name, {.link = link0});
+    non_broker->AddConnection(broker->GetAssignedName(),
+                              {.link = link1, .broker = link1});
+  }
+  link0->Activate();
+  link1->Activate();
+  return {link0, link1};
+}
+
+}  // namespace ipcz::test
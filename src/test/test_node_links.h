@@ -0,0 +1,36 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_TEST_TEST_NODE_LINKS_H_
+#define IPCZ_SRC_TEST_TEST_NODE_LINKS_H_
+
+#include <cstdint>
+#include <utility>
+
+#include "ipcz/node.h"
+#include "ipcz/node_link.h"
+#include "ipcz/node_messages.h"
+#include "util/ref_counted.h"
+
+namespace ipcz::test {
+
+// Creates and activates a pair of NodeLinks connecting `broker` to
+// `non_broker`, over a transport pair from the synchronous reference driver
+// and sharing a newly allocated primary buffer. Both nodes must also use the
+// synchronous reference driver. The broker's link is returned first.
+//
+// `protocol_version` is the remote protocol version advertised to each side.
+// If `add_connections` is true, each node also registers its link as a
+// connection to the other before activation, with the broker's link serving as
+// the non-broker's broker link; this lets node-level lookups by name find the
+// links.
+std::pair<Ref<NodeLink>, Ref<NodeLink>> LinkNodes(
+    Ref<Node> broker,
+    Ref<Node> non_broker,
+    uint32_t protocol_version = msg::kProtocolVersion,
+    bool add_connections = false);
+
+}  // namespace ipcz::test
+
+#endif  // IPCZ_SRC_TEST_TEST_NODE_LINKS_H_
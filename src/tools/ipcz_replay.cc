@@ -0,0 +1,205 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// ipcz_replay summarizes and replays captures of ipcz transport traffic, as
+// recorded by TransportCapture. Given only a capture file, it lists each
+// captured transport along with the shape of its traffic. Given a transport ID
+// as well, it replays that transport's transmitted messages into a fresh
+// NodeLink (see TransportReplayer) and reports how long that took, which makes
+// it suitable for running under a profiler.
+//
+// Usage: ipcz_replay <capture file> [--transport=ID] [--repeat=N]
+//                    [--portals=N] [--preserve_timing]
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ipcz/message.h"
+#include "ipcz/transport_capture.h"
+#include "ipcz/transport_replayer.h"
+#include "reference_drivers/sync_reference_driver.h"
+#include "third_party/abseil-cpp/absl/strings/numbers.h"
+#include "third_party/abseil-cpp/absl/strings/str_format.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz::tools {
+namespace {
+
+constexpr std::string_view kTransportFlag = "--transport=";
+constexpr std::string_view kRepeatFlag = "--repeat=";
+constexpr std::string_view kPortalsFlag = "--portals=";
+constexpr std::string_view kPreserveTimingFlag = "--preserve_timing";
+
+constexpr std::string_view kUsage =
+    "Usage: ipcz_replay <capture file> [--transport=ID] [--repeat=N]\n"
+    "                   [--portals=N] [--preserve_timing]\n";
+
+// Parses `arg` as `flag` followed by an unsigned integer.
+template <typename T>
+bool ParseFlag(std::string_view arg, std::string_view flag, T& value) {
+  return arg.substr(0, flag.size()) == flag &&
+         absl::SimpleAtoi(std::string(arg.substr(flag.size())), &value);
+}
+
+// The shape of the traffic in one direction on a transport.
+struct TrafficSummary {
+  size_t num_messages = 0;
+  size_t num_bytes = 0;
+  size_t max_message_size = 0;
+  int64_t first_time = 0;
+  int64_t last_time = 0;
+
+  // The largest number of messages seen within any one millisecond.
+  size_t peak_messages_per_ms = 0;
+  int64_t current_ms = -1;
+  size_t num_messages_in_current_ms = 0;
+
+  // Message counts keyed by message ID.
+  std::map<uint8_t, size_t> message_mix;
+
+  void Add(const TransportCaptureRecord& record) {
+    if (!num_messages) {
+      first_time = record.time;
+    }
+    last_time = record.time;
+    ++num_messages;
+    num_bytes += record.data.size();
+    max_message_size = std::max(max_message_size, record.data.size());
+    if (record.data.size() >= sizeof(internal::MessageHeaderV0)) {
+      const auto& header = *reinterpret_cast<const internal::MessageHeaderV0*>(
+          record.data.data());
+      ++message_mix[header.message_id];
+    }
+
+    const int64_t ms = record.time / 1000000;
+    if (ms != current_ms) {
+      current_ms = ms;
+      num_messages_in_current_ms = 0;
+    }
+    peak_messages_per_ms =
+        std::max(peak_messages_per_ms, ++num_messages_in_current_ms);
+  }
+
+  void Print(std::string_view direction) const {
+    if (!num_messages) {
+      absl::PrintF("  %s: none\n", direction);
+      return;
+    }
+    absl::PrintF(
+        "  %s: %d messages, %d bytes (max %d) over %s, peak %d/ms\n",
+        direction, num_messages, num_bytes, max_message_size,
+        absl::FormatDuration(absl::Nanoseconds(last_time - first_time)),
+        peak_messages_per_ms);
+    absl::PrintF("    by message ID:");
+    for (const auto& [id, count] : message_mix) {
+      absl::PrintF(" %d:%d", id, count);
+    }
+    absl::PrintF("\n");
+  }
+};
+
+struct TransportSummary {
+  TrafficSummary transmitted;
+  TrafficSummary received;
+  size_t num_fragments = 0;
+  size_t num_fragment_bytes = 0;
+};
+
+void PrintSummary(absl::Span<const TransportCaptureRecord> records) {
+  std::map<uint64_t, TransportSummary> transports;
+  for (const TransportCaptureRecord& record : records) {
+    TransportSummary& summary = transports[record.transport_id];
+    switch (record.type) {
+      case TransportCaptureRecord::Type::kTransmit:
+        summary.transmitted.Add(record);
+        break;
+      case TransportCaptureRecord::Type::kReceive:
+        summary.received.Add(record);
+        break;
+      case TransportCaptureRecord::Type::kFragment:
+        ++summary.num_fragments;
+        summary.num_fragment_bytes += record.data.size();
+        break;
+    }
+  }
+
+  absl::PrintF("%d records on %d transports\n\n", records.size(),
+               transports.size());
+  for (const auto& [id, summary] : transports) {
+    absl::PrintF("transport %d\n", id);
+    summary.transmitted.Print("transmitted");
+    summary.received.Print("received");
+    absl::PrintF("  fragments: %d, %d bytes\n\n", summary.num_fragments,
+                 summary.num_fragment_bytes);
+  }
+}
+
+int Run(absl::Span<char*> args) {
+  if (args.empty()) {
+    absl::FPrintF(stderr, "%s", kUsage);
+    return 1;
+  }
+
+  std::optional<uint64_t> transport_id;
+  size_t repeat = 1;
+  TransportReplayer::Options options;
+  for (std::string_view arg : args.subspan(1)) {
+    uint64_t id;
+    if (ParseFlag(arg, kTransportFlag, id)) {
+      transport_id = id;
+    } else if (ParseFlag(arg, kRepeatFlag, repeat)) {
+    } else if (ParseFlag(arg, kPortalsFlag, options.num_initial_portals)) {
+    } else if (arg == kPreserveTimingFlag) {
+      options.preserve_timing = true;
+    } else {
+      absl::FPrintF(stderr, "%s", kUsage);
+      return 1;
+    }
+  }
+
+  std::ifstream file(args[0], std::ios::binary);
+  const std::vector<uint8_t> capture{std::istreambuf_iterator<char>(file),
+                                     std::istreambuf_iterator<char>()};
+  const std::optional<std::vector<TransportCaptureRecord>> records =
+      TransportCapture::Parse(capture);
+  if (!records) {
+    absl::FPrintF(stderr, "%s is not a valid transport capture\n", args[0]);
+    return 1;
+  }
+
+  if (!transport_id) {
+    PrintSummary(*records);
+    return 0;
+  }
+
+  options.transport_id = *transport_id;
+  for (size_t i = 0; i < repeat; ++i) {
+    const TransportReplayer::Result result = TransportReplayer::Replay(
+        reference_drivers::kSyncReferenceDriver, *records, options);
+    absl::PrintF(
+        "replay %d: %d messages replayed, %d rejected, %d skipped; "
+        "%d fragments restored, %d dropped; %d parcels received in %s\n",
+        i, result.num_messages_replayed, result.num_messages_rejected,
+        result.num_messages_skipped, result.num_fragments_restored,
+        result.num_fragments_dropped, result.num_parcels_received,
+        absl::FormatDuration(result.elapsed));
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace ipcz::tools
+
+int main(int argc, char** argv) {
+  return ipcz::tools::Run(absl::MakeSpan(argv + 1, argc - 1));
+}
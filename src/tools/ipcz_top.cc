@@ -0,0 +1,377 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// ipcz_top finds the stats pages published by ipcz nodes running in any
+// process on the system (see IpczCreateNodeOptions.stats_publish_interval_ms)
+// and periodically renders their contents, much like top(1). It needs no
+// cooperation from the processes it observes, but it does need permission to
+// open their file descriptors through /proc, so it generally must run as the
+// same user or with elevated privileges.
+//
+// Pages are found by scanning every process's open file descriptors for memfd
+// regions of exactly NodeStatsPage::kSize bytes which begin with the page's
+// magic number. This works with nodes using the Linux multiprocess reference
+// driver, which allocates all shared memory as memfd regions.
+//
+// Usage: ipcz_top [--interval_ms=N] [--once]
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ipcz/node_name.h"
+#include "ipcz/node_stats_page.h"
+#include "third_party/abseil-cpp/absl/strings/numbers.h"
+#include "third_party/abseil-cpp/absl/strings/str_cat.h"
+#include "third_party/abseil-cpp/absl/strings/str_format.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz::tools {
+namespace {
+
+constexpr std::string_view kMemfdPrefix = "/memfd:";
+constexpr std::string_view kIntervalFlag = "--interval_ms=";
+constexpr std::string_view kOnceFlag = "--once";
+
+// A read-only mapping of a NodeStatsPage published by another process.
+class MappedPage {
+ public:
+  // Maps the page in the file at `path` if it is one. Returns null otherwise.
+  static std::unique_ptr<MappedPage> Open(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return nullptr;
+    }
+
+    void* address = mmap(nullptr, NodeStatsPage::kSize, PROT_READ, MAP_SHARED,
+                         fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+      return nullptr;
+    }
+
+    const NodeStatsPage* page = NodeStatsPage::FromMemory(
+        {static_cast<const uint8_t*>(address), NodeStatsPage::kSize});
+    if (!page) {
+      munmap(address, NodeStatsPage::kSize);
+      return nullptr;
+    }
+    return std::unique_ptr<MappedPage>(new MappedPage(address, *page));
+  }
+
+  MappedPage(const MappedPage&) = delete;
+  MappedPage& operator=(const MappedPage&) = delete;
+  ~MappedPage() { munmap(address_, NodeStatsPage::kSize); }
+
+  const NodeStatsPage& page() const { return page_; }
+
+ private:
+  MappedPage(void* address, const NodeStatsPage& page)
+      : address_(address), page_(page) {}
+
+  void* const address_;
+  const NodeStatsPage& page_;
+};
+
+// A consistent snapshot read from a page.
+struct Sample {
+  NodeStatsPage::NodeEntry node;
+  std::vector<NodeStatsPage::LinkEntry> links;
+
+  const NodeStatsPage::LinkEntry* FindLink(const NodeName& name) const {
+    for (const NodeStatsPage::LinkEntry& link : links) {
+      if (NodeName(link.remote_node_name_high, link.remote_node_name_low) ==
+          name) {
+        return &link;
+      }
+    }
+    return nullptr;
+  }
+};
+
+// A page published by one node, along with its two most recent distinct
+// samples so that rates can be computed.
+struct ObservedNode {
+  pid_t pid;
+  std::unique_ptr<MappedPage> mapping;
+  std::optional<Sample> current;
+  std::optional<Sample> previous;
+
+  NodeName name() const {
+    return NodeName(current->node.node_name_high,
+                    current->node.node_name_low);
+  }
+
+  void Update() {
+    Sample sample;
+    if (!mapping->page().Read(sample.node, sample.links)) {
+      return;
+    }
+    if (current && current->node.publish_time == sample.node.publish_time) {
+      return;
+    }
+    previous = std::move(current);
+    current = std::move(sample);
+  }
+};
+
+// Pages are identified by their memfd's device and inode numbers, since the
+// same page may be found through more than one file descriptor.
+using PageKey = std::pair<dev_t, ino_t>;
+using ObservedNodeMap = std::map<PageKey, ObservedNode>;
+
+std::optional<pid_t> ParsePid(std::string_view name) {
+  int pid;
+  if (name.empty() || !std::isdigit(name[0]) ||
+      !absl::SimpleAtoi(std::string(name), &pid)) {
+    return std::nullopt;
+  }
+  return pid;
+}
+
+// Calls `fn` with the full path of each entry in the directory at `path`.
+template <typename Fn>
+void ForEachDirectoryEntry(const std::string& path, Fn fn) {
+  DIR* dir = opendir(path.c_str());
+  if (!dir) {
+    return;
+  }
+  while (dirent* entry = readdir(dir)) {
+    const std::string_view name = entry->d_name;
+    if (name != "." && name != "..") {
+      fn(name, absl::StrCat(path, "/", std::string(name)));
+    }
+  }
+  closedir(dir);
+}
+
+// Brings `nodes` up to date with the pages currently open in any process,
+// mapping new ones and forgetting any which are no longer open anywhere.
+void ScanForPages(ObservedNodeMap& nodes) {
+  ObservedNodeMap found;
+  ForEachDirectoryEntry("/proc", [&](std::string_view name,
+                                     const std::string& process_path) {
+    const std::optional<pid_t> pid = ParsePid(name);
+    if (!pid) {
+      return;
+    }
+    ForEachDirectoryEntry(
+        absl::StrCat(process_path, "/fd"),
+        [&](std::string_view, const std::string& fd_path) {
+          char target[256];
+          const ssize_t length =
+              readlink(fd_path.c_str(), target, sizeof(target));
+          if (length <= 0 ||
+              std::string_view(target, length).substr(
+                  0, kMemfdPrefix.size()) != kMemfdPrefix) {
+            return;
+          }
+
+          struct stat info;
+          if (stat(fd_path.c_str(), &info) != 0 ||
+              static_cast<size_t>(info.st_size) != NodeStatsPage::kSize) {
+            return;
+          }
+
+          const PageKey key(info.st_dev, info.st_ino);
+          if (found.count(key)) {
+            return;
+          }
+          auto it = nodes.find(key);
+          if (it != nodes.end()) {
+            found.insert(nodes.extract(it));
+            return;
+          }
+          std::unique_ptr<MappedPage> mapping = MappedPage::Open(fd_path);
+          if (mapping) {
+            found[key] = {.pid = *pid, .mapping = std::move(mapping)};
+          }
+        });
+  });
+  nodes = std::move(found);
+}
+
+// Returns the per-second rate of change of a counter between two samples
+// `elapsed` apart.
+double GetRate(uint64_t current, uint64_t previous, absl::Duration elapsed) {
+  return static_cast<double>(current - previous) /
+         absl::ToDoubleSeconds(elapsed);
+}
+
+std::string FormatName(const NodeName& name) {
+  // The full 32 hex digits are more than anyone wants to read in a table, and
+  // the first several are just as random as the rest.
+  return name.ToString().substr(0, 12);
+}
+
+// Returns the occupancy of a link's shared memory blocks as a percentage, if
+// both ends of the link are observed.
+std::string FormatBlockOccupancy(const NodeName& local_name,
+                                 const NodeStatsPage::LinkEntry& link,
+                                 const ObservedNodeMap& nodes) {
+  const NodeName remote_name(link.remote_node_name_high,
+                             link.remote_node_name_low);
+  for (const auto& [key, node] : nodes) {
+    if (!node.current || node.name() != remote_name) {
+      continue;
+    }
+    const NodeStatsPage::LinkEntry* remote_link =
+        node.current->FindLink(local_name);
+    if (!remote_link || !link.block_capacity) {
+      break;
+    }
+    const uint64_t num_bytes_allocated =
+        link.num_block_bytes_allocated + remote_link->num_block_bytes_allocated;
+    const uint64_t num_bytes_freed =
+        link.num_block_bytes_freed + remote_link->num_block_bytes_freed;
+    const uint64_t num_bytes_in_use = num_bytes_allocated - num_bytes_freed;
+    return absl::StrFormat("%.1f%%", 100.0 * num_bytes_in_use /
+                                         link.block_capacity);
+  }
+  return "-";
+}
+
+void Render(const ObservedNodeMap& nodes, absl::Duration interval) {
+  const absl::Time now = absl::Now();
+  absl::PrintF("ipcz_top - %d nodes, refreshing every %dms\n\n", nodes.size(),
+               absl::ToInt64Milliseconds(interval));
+  for (const auto& [key, node] : nodes) {
+    if (!node.current) {
+      absl::PrintF("PID %-8d (no consistent snapshot)\n\n", node.pid);
+      continue;
+    }
+
+    const Sample& current = *node.current;
+    const absl::Duration age =
+        now - absl::FromUnixNanos(current.node.publish_time);
+    const bool is_stale =
+        age > 3 * absl::Milliseconds(current.node.publish_interval_ms) +
+                  absl::Seconds(1);
+    absl::PrintF(
+        "PID %-8d NODE %s  LINKS %d  ROUTERS %d  PROXIES %d%s\n", node.pid,
+        FormatName(node.name()), current.node.num_links,
+        current.node.num_routers, current.node.num_proxies,
+        is_stale ? absl::StrCat("  (stale for ", absl::FormatDuration(age), ")")
+                 : "");
+    if (current.links.empty()) {
+      absl::PrintF("\n");
+      continue;
+    }
+
+    absl::PrintF("  %-12s %10s %10s %10s %10s %8s %8s %7s %7s %7s %7s\n",
+                 "REMOTE", "MSG/S OUT", "MSG/S IN", "KB/S OUT", "KB/S IN",
+                 "RELAY/S", "SHM KB", "BLOCKS", "QUEUED", "PENDING",
+                 "PARTIAL");
+    for (const NodeStatsPage::LinkEntry& link : current.links) {
+      const NodeName remote_name(link.remote_node_name_high,
+                                 link.remote_node_name_low);
+      const NodeStatsPage::LinkEntry* previous_link =
+          node.previous ? node.previous->FindLink(remote_name) : nullptr;
+      std::string rates[5];
+      if (previous_link) {
+        const absl::Duration elapsed =
+            absl::Nanoseconds(current.node.publish_time -
+                              node.previous->node.publish_time);
+        rates[0] = absl::StrFormat(
+            "%.1f", GetRate(link.num_messages_sent,
+                            previous_link->num_messages_sent, elapsed));
+        rates[1] = absl::StrFormat(
+            "%.1f", GetRate(link.num_messages_received,
+                            previous_link->num_messages_received, elapsed));
+        rates[2] = absl::StrFormat(
+            "%.1f", GetRate(link.num_bytes_sent, previous_link->num_bytes_sent,
+                            elapsed) /
+                        1024);
+        rates[3] = absl::StrFormat(
+            "%.1f", GetRate(link.num_bytes_received,
+                            previous_link->num_bytes_received, elapsed) /
+                        1024);
+        rates[4] = absl::StrFormat(
+            "%.1f", GetRate(link.num_messages_relayed,
+                            previous_link->num_messages_relayed, elapsed));
+      } else {
+        for (std::string& rate : rates) {
+          rate = "-";
+        }
+      }
+      absl::PrintF("  %-12s %10s %10s %10s %10s %8s %8d %7s %7d %7d %7d\n",
+                   FormatName(remote_name), rates[0], rates[1], rates[2],
+                   rates[3], rates[4], link.shared_memory_size / 1024,
+                   FormatBlockOccupancy(node.name(), link, nodes),
+                   link.num_queued_parcels, link.num_pending_capacity_requests,
+                   link.num_partial_parcels);
+    }
+    if (current.node.num_links > current.links.size()) {
+      absl::PrintF("  ... and %d more links\n",
+                   current.node.num_links - current.links.size());
+    }
+    absl::PrintF("\n");
+  }
+}
+
+int Run(absl::Span<char*> args) {
+  absl::Duration interval = absl::Seconds(1);
+  bool once = false;
+  for (std::string_view arg : args) {
+    int interval_ms;
+    if (arg.substr(0, kIntervalFlag.size()) == kIntervalFlag &&
+        absl::SimpleAtoi(std::string(arg.substr(kIntervalFlag.size())),
+                         &interval_ms) &&
+        interval_ms > 0) {
+      interval = absl::Milliseconds(interval_ms);
+    } else if (arg == kOnceFlag) {
+      once = true;
+    } else {
+      absl::FPrintF(stderr, "Usage: ipcz_top [--interval_ms=N] [--once]\n");
+      return 1;
+    }
+  }
+
+  ObservedNodeMap nodes;
+  for (;;) {
+    ScanForPages(nodes);
+    for (auto& [key, node] : nodes) {
+      node.Update();
+    }
+
+    if (once) {
+      // Take a second sample so that rates can be shown.
+      absl::SleepFor(interval);
+      for (auto& [key, node] : nodes) {
+        node.Update();
+      }
+      Render(nodes, interval);
+      return 0;
+    }
+
+    // Clear the terminal and redraw from the top.
+    absl::PrintF("\x1b[H\x1b[2J");
+    Render(nodes, interval);
+    fflush(stdout);
+    absl::SleepFor(interval);
+  }
+}
+
+}  // namespace
+}  // namespace ipcz::tools
+
+int main(int argc, char** argv) {
+  return ipcz::tools::Run(absl::MakeSpan(argv + 1, argc - 1));
+}
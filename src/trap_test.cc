@@ -4,6 +4,7 @@
 
 #include <tuple>
 #include <utility>
+#include <vector>
 
 #include "ipcz/ipcz.h"
 #include "reference_drivers/sync_reference_driver.h"
@@ -22,7 +23,68 @@ class TrapTest : public test::Test {
     return TestBase::OpenPortals(node_);
   }
 
+  // Installs a persistent trap which invokes `handler` for every event. Unlike
+  // with Trap(), the caller retains ownership of `handler`, which must outlive
+  // the trap.
+  IpczResult TrapPersistent(IpczHandle portal,
+                            const IpczTrapConditions& conditions,
+                            TrapEventHandler& handler) {
+    return ipcz().Trap(portal, &conditions, &HandlePersistentEvent,
+                       reinterpret_cast<uintptr_t>(&handler),
+                       IPCZ_TRAP_FLAG_PERSISTENT, nullptr, nullptr, nullptr);
+  }
+
+  IpczResult RemovePersistentTrap(IpczHandle portal,
+                                  TrapEventHandler& handler) {
+    return ipcz().Trap(portal, nullptr, &HandlePersistentEvent,
+                       reinterpret_cast<uintptr_t>(&handler),
+                       IPCZ_TRAP_FLAG_REMOVE, nullptr, nullptr, nullptr);
+  }
+
+  // Every batch of events delivered to a batched trap, as lists of condition
+  // flags.
+  using BatchLog = std::vector<std::vector<IpczTrapConditionFlags>>;
+
+  // Installs a trap whose events are delivered in batches and logged to `log`.
+  // All traps sharing a `log` share a batch handler.
+  IpczResult TrapBatched(IpczHandle portal,
+                         const IpczTrapConditions& conditions,
+                         BatchLog& log,
+                         IpczTrapFlags flags = IPCZ_NO_FLAGS) {
+    const IpczTrapOptions options = {
+        .size = sizeof(options),
+        .batch_handler = &HandleEventBatch,
+    };
+    return ipcz().Trap(portal, &conditions, nullptr,
+                       reinterpret_cast<uintptr_t>(&log), flags, &options,
+                       nullptr, nullptr);
+  }
+
+  IpczResult RemoveBatchedTraps(IpczHandle portal, BatchLog& log) {
+    const IpczTrapOptions options = {
+        .size = sizeof(options),
+        .batch_handler = &HandleEventBatch,
+    };
+    return ipcz().Trap(portal, nullptr, nullptr,
+                       reinterpret_cast<uintptr_t>(&log),
+                       IPCZ_TRAP_FLAG_REMOVE, &options, nullptr, nullptr);
+  }
+
  private:
+  static void HandlePersistentEvent(const IpczTrapEvent* event) {
+    (*reinterpret_cast<TrapEventHandler*>(event->context))(*event);
+  }
+
+  static void HandleEventBatch(const IpczTrapEvent* events, size_t num_events) {
+    ASSERT_GT(num_events, 0u);
+    BatchLog& log = *reinterpret_cast<BatchLog*>(events[0].context);
+    std::vector<IpczTrapConditionFlags>& batch = log.emplace_back();
+    for (size_t i = 0; i < num_events; ++i) {
+      EXPECT_EQ(events[0].context, events[i].context);
+      batch.push_back(events[i].condition_flags);
+    }
+  }
+
   const IpczHandle node_{CreateNode(reference_drivers::kSyncReferenceDriver)};
 };
 
@@ -306,5 +368,221 @@ TEST_F(TrapTest, MultipleTraps) {
   Close(b);
 }
 
+TEST_F(TrapTest, PersistentNewLocalParcel) {
+  auto [a, b] = OpenPortals();
+
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_NEW_LOCAL_PARCEL,
+  };
+  size_t num_events = 0;
+  bool removed = false;
+  TrapEventHandler handler = [&](const IpczTrapEvent& e) {
+    if (e.condition_flags & IPCZ_TRAP_REMOVED) {
+      removed = true;
+      return;
+    }
+    EXPECT_EQ(IPCZ_TRAP_NEW_LOCAL_PARCEL | IPCZ_TRAP_WITHIN_API_CALL,
+              e.condition_flags);
+    ++num_events;
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK, TrapPersistent(b, conditions, handler));
+
+  // The trap stays installed and fires once for every new parcel.
+  Put(a, "one");
+  EXPECT_EQ(1u, num_events);
+  Put(a, "two");
+  EXPECT_EQ(2u, num_events);
+  Put(a, "three");
+  EXPECT_EQ(3u, num_events);
+
+  EXPECT_FALSE(removed);
+  EXPECT_EQ(IPCZ_RESULT_OK, RemovePersistentTrap(b, handler));
+  EXPECT_TRUE(removed);
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND, RemovePersistentTrap(b, handler));
+
+  Put(a, "four");
+  EXPECT_EQ(3u, num_events);
+
+  CloseAll({a, b});
+}
+
+TEST_F(TrapTest, PersistentLevelConditionsAreEdgeTriggered) {
+  auto [a, b] = OpenPortals();
+
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS,
+      .min_local_parcels = 0,
+  };
+  size_t num_events = 0;
+  TrapEventHandler handler = [&](const IpczTrapEvent& e) {
+    if (e.condition_flags & IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS) {
+      ++num_events;
+    }
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK, TrapPersistent(b, conditions, handler));
+
+  // The condition only fires when it goes from unsatisfied to satisfied.
+  Put(a, "one");
+  EXPECT_EQ(1u, num_events);
+  Put(a, "two");
+  EXPECT_EQ(1u, num_events);
+
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  EXPECT_EQ(1u, num_events);
+
+  Put(a, "three");
+  EXPECT_EQ(2u, num_events);
+
+  EXPECT_EQ(IPCZ_RESULT_OK, RemovePersistentTrap(b, handler));
+  CloseAll({a, b});
+}
+
+TEST_F(TrapTest, PersistentEventsCoalesce) {
+  auto [a, b] = OpenPortals();
+
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_NEW_LOCAL_PARCEL,
+  };
+
+  // The handler elicits more parcels on its own portal while it's running. With
+  // the synchronous driver these arrive within the handler's own stack frame,
+  // but they must not re-enter the handler. Instead they're coalesced into a
+  // single follow-up invocation once the handler returns.
+  size_t num_events = 0;
+  bool in_handler = false;
+  TrapEventHandler handler = [&](const IpczTrapEvent& e) {
+    if (e.condition_flags & IPCZ_TRAP_REMOVED) {
+      return;
+    }
+    EXPECT_FALSE(in_handler);
+    in_handler = true;
+    if (++num_events == 1) {
+      Put(a, "two");
+      Put(a, "three");
+      Put(a, "four");
+    }
+    in_handler = false;
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK, TrapPersistent(b, conditions, handler));
+
+  Put(a, "one");
+  EXPECT_EQ(2u, num_events);
+
+  IpczPortalStatus status = {.size = sizeof(status)};
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryPortalStatus(b, IPCZ_NO_FLAGS, nullptr, &status));
+  EXPECT_EQ(4u, status.num_local_parcels);
+
+  EXPECT_EQ(IPCZ_RESULT_OK, RemovePersistentTrap(b, handler));
+  CloseAll({a, b});
+}
+
+TEST_F(TrapTest, PersistentRemoveOnClose) {
+  auto [a, b] = OpenPortals();
+
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_NEW_LOCAL_PARCEL | IPCZ_TRAP_PEER_CLOSED,
+  };
+  size_t num_parcel_events = 0;
+  bool peer_closed = false;
+  bool removed = false;
+  TrapEventHandler handler = [&](const IpczTrapEvent& e) {
+    if (e.condition_flags & IPCZ_TRAP_NEW_LOCAL_PARCEL) {
+      ++num_parcel_events;
+    }
+    if (e.condition_flags & IPCZ_TRAP_PEER_CLOSED) {
+      peer_closed = true;
+    }
+    if (e.condition_flags & IPCZ_TRAP_REMOVED) {
+      EXPECT_EQ(IPCZ_TRAP_REMOVED | IPCZ_TRAP_WITHIN_API_CALL,
+                e.condition_flags);
+      removed = true;
+    }
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK, TrapPersistent(b, conditions, handler));
+
+  Put(a, "hello");
+  Close(a);
+  EXPECT_EQ(1u, num_parcel_events);
+  EXPECT_TRUE(peer_closed);
+  EXPECT_FALSE(removed);
+
+  Close(b);
+  EXPECT_TRUE(removed);
+}
+
+TEST_F(TrapTest, BatchedEventsFromOneOperation) {
+  auto [a, b] = OpenPortals();
+
+  // Two traps sharing a batch handler are triggered by the same parcel. Their
+  // events are delivered together in a single batch.
+  BatchLog log;
+  IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_NEW_LOCAL_PARCEL,
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK, TrapBatched(b, conditions, log));
+  conditions.flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS;
+  EXPECT_EQ(IPCZ_RESULT_OK, TrapBatched(b, conditions, log));
+
+  Put(a, "hello");
+  ASSERT_EQ(1u, log.size());
+  EXPECT_EQ((std::vector<IpczTrapConditionFlags>{
+                IPCZ_TRAP_NEW_LOCAL_PARCEL | IPCZ_TRAP_WITHIN_API_CALL,
+                IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS | IPCZ_TRAP_WITHIN_API_CALL,
+            }),
+            log[0]);
+
+  // Both traps were removed when they fired.
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND, RemoveBatchedTraps(b, log));
+  CloseAll({a, b});
+}
+
+TEST_F(TrapTest, BatchedRemoval) {
+  auto [a, b] = OpenPortals();
+
+  BatchLog log;
+  IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_NEW_LOCAL_PARCEL,
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK, TrapBatched(b, conditions, log));
+  conditions.flags = IPCZ_TRAP_PEER_CLOSED;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            TrapBatched(b, conditions, log, IPCZ_TRAP_FLAG_PERSISTENT));
+
+  // Explicit removal delivers every removal event in one batch.
+  EXPECT_EQ(IPCZ_RESULT_OK, RemoveBatchedTraps(b, log));
+  ASSERT_EQ(1u, log.size());
+  EXPECT_EQ((std::vector<IpczTrapConditionFlags>{
+                IPCZ_TRAP_REMOVED | IPCZ_TRAP_WITHIN_API_CALL,
+                IPCZ_TRAP_REMOVED | IPCZ_TRAP_WITHIN_API_CALL,
+            }),
+            log[0]);
+
+  // Traps installed with a batch handler are not matched by an individual
+  // handler.
+  IpczTrapConditions removal_conditions = {.size = sizeof(conditions)};
+  EXPECT_EQ(IPCZ_RESULT_OK, TrapBatched(b, conditions, log));
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND,
+            ipcz().Trap(b, &removal_conditions, [](const IpczTrapEvent*) {},
+                        reinterpret_cast<uintptr_t>(&log),
+                        IPCZ_TRAP_FLAG_REMOVE, nullptr, nullptr, nullptr));
+
+  Close(b);
+  ASSERT_EQ(2u, log.size());
+  EXPECT_EQ((std::vector<IpczTrapConditionFlags>{
+                IPCZ_TRAP_REMOVED | IPCZ_TRAP_WITHIN_API_CALL,
+            }),
+            log[1]);
+  Close(a);
+}
+
 }  // namespace
 }  // namespace ipcz
@@ -0,0 +1,200 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_UTIL_THREAD_LOCAL_FREE_LIST_H_
+#define IPCZ_SRC_UTIL_THREAD_LOCAL_FREE_LIST_H_
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#include "third_party/abseil-cpp/absl/base/thread_annotations.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+
+namespace ipcz {
+
+// A per-thread cache of storage for objects of type T, used to recycle the
+// storage of frequently allocated and freed objects without a trip through the
+// heap. A class opts in by defining its own operator new and operator delete in
+// terms of Allocate() and Free().
+//
+// Storage is always returned to the cache of the thread which allocated it.
+// Storage freed on that thread goes directly into its cache, which holds at
+// most `kMaxCachedObjects` blocks; any excess is returned to the heap. Storage
+// freed on any other thread is pushed onto a lock-free stack belonging to the
+// allocating thread, which that thread reclaims into its cache once the cache
+// runs dry. This way a thread which only allocates (e.g. one receiving parcels
+// from a transport) still reuses storage freed by the threads consuming them.
+template <typename T, size_t kMaxCachedObjects = 64>
+class ThreadLocalFreeList {
+ public:
+  static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                "Over-aligned types are not supported");
+
+  // Returns storage for an object of `size` bytes.
+  static void* Allocate(size_t size) {
+    if (size != sizeof(T)) {
+      return ::operator new(size);
+    }
+
+    Cache* cache = GetCache();
+    if (cache) {
+      if (!cache->head) {
+        cache->ReclaimRemoteFrees();
+      }
+      if (Block* block = cache->head) {
+        cache->head = block->next;
+        --cache->size;
+        return block + 1;
+      }
+    }
+
+    Block* block = static_cast<Block*>(::operator new(kBlockSize));
+    block->owner = cache ? cache->owner : nullptr;
+    return block + 1;
+  }
+
+  // Releases storage previously returned by Allocate(), for an object of
+  // `size` bytes.
+  static void Free(void* ptr, size_t size) {
+    if (size != sizeof(T)) {
+      ::operator delete(ptr);
+      return;
+    }
+
+    Block* block = static_cast<Block*>(ptr) - 1;
+    Owner* owner = block->owner;
+    Cache* cache = GetCache();
+    if (cache && owner == cache->owner) {
+      if (cache->size < kMaxCachedObjects) {
+        block->next = cache->head;
+        cache->head = block;
+        ++cache->size;
+        return;
+      }
+    } else if (owner) {
+      owner->PushRemoteFree(block);
+      return;
+    }
+    ::operator delete(block);
+  }
+
+ private:
+  struct Owner;
+
+  // Header preceding the storage for each object. Aligned so that the object
+  // which follows it is aligned as well as anything from the heap.
+  struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Block {
+    // The thread whose cache this storage returns to, or null if it was
+    // allocated by a thread without a cache and returns to the heap.
+    Owner* owner;
+
+    // The next free block in a cache or remote stack, while this one is free.
+    Block* next;
+  };
+
+  static constexpr size_t kBlockSize = sizeof(Block) + sizeof(T);
+
+  // Identifies the thread which allocated a Block. Owners are never destroyed,
+  // because other threads may free blocks to them at any time. Instead the
+  // Owner of an exiting thread is orphaned and later adopted by a new thread,
+  // so there are never more Owners than the peak number of threads which used
+  // this free list at once.
+  struct Owner {
+    void PushRemoteFree(Block* block) {
+      block->next = remote_frees.load(std::memory_order_relaxed);
+      while (!remote_frees.compare_exchange_weak(block->next, block,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+      }
+    }
+
+    // Only ever taken as a whole, so the stack isn't subject to ABA problems.
+    Block* TakeRemoteFrees() {
+      if (!remote_frees.load(std::memory_order_relaxed)) {
+        return nullptr;
+      }
+      return remote_frees.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    std::atomic<Block*> remote_frees{nullptr};
+    Owner* next_orphan = nullptr;
+  };
+
+  struct Orphans {
+    absl::Mutex mutex;
+    Owner* head ABSL_GUARDED_BY(mutex) = nullptr;
+  };
+
+  static Orphans& GetOrphans() {
+    static Orphans* orphans = new Orphans();
+    return *orphans;
+  }
+
+  struct Cache {
+    explicit Cache(bool& is_torn_down) : is_torn_down(is_torn_down) {
+      Orphans& orphans = GetOrphans();
+      absl::MutexLock lock(&orphans.mutex);
+      if (orphans.head) {
+        owner = std::exchange(orphans.head, orphans.head->next_orphan);
+      } else {
+        owner = new Owner();
+      }
+    }
+
+    ~Cache() {
+      while (head) {
+        ::operator delete(std::exchange(head, head->next));
+      }
+
+      // Blocks still in use elsewhere are returned to whichever thread adopts
+      // `owner` next.
+      is_torn_down = true;
+      Orphans& orphans = GetOrphans();
+      absl::MutexLock lock(&orphans.mutex);
+      owner->next_orphan = orphans.head;
+      orphans.head = owner;
+    }
+
+    // Moves storage freed by other threads into this cache, up to its limit.
+    void ReclaimRemoteFrees() {
+      Block* block = owner->TakeRemoteFrees();
+      while (block) {
+        Block* next = block->next;
+        if (size < kMaxCachedObjects) {
+          block->next = head;
+          head = block;
+          ++size;
+        } else {
+          ::operator delete(block);
+        }
+        block = next;
+      }
+    }
+
+    bool& is_torn_down;
+    Owner* owner;
+    Block* head = nullptr;
+    size_t size = 0;
+  };
+
+  // Returns the calling thread's cache, or null if the thread is exiting and
+  // its cache has already been destroyed. In that case new storage comes
+  // directly from the heap and is returned there when freed.
+  static Cache* GetCache() {
+    // Trivially destructible, so this remains valid even after `cache` below
+    // is destroyed during thread exit.
+    thread_local bool is_torn_down = false;
+    if (is_torn_down) {
+      return nullptr;
+    }
+    thread_local Cache cache(is_torn_down);
+    return &cache;
+  }
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_UTIL_THREAD_LOCAL_FREE_LIST_H_